@@ -279,6 +279,30 @@ bool parse_kv_override(const char * data, std::vector<llama_model_kv_override> &
     return true;
 }
 
+bool parse_cpu_list(const std::string & value, std::vector<int32_t> & cpus) {
+    for (const auto & range : string_split(value, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        const size_t dash = range.find('-');
+        try {
+            const int32_t first = std::stoi(range.substr(0, dash));
+            const int32_t last  = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            if (first < 0 || last < first) {
+                fprintf(stderr, "%s: invalid CPU range '%s'\n", __func__, range.c_str());
+                return false;
+            }
+            for (int32_t cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::exception &) {
+            fprintf(stderr, "%s: invalid CPU range '%s'\n", __func__, range.c_str());
+            return false;
+        }
+    }
+    return !cpus.empty();
+}
+
 bool gpt_params_find_arg(int argc, char ** argv, const std::string & arg, gpt_params & params, int & i, bool & invalid_param) {
     llama_sampling_params & sparams = params.sparams;
 
@@ -1066,6 +1090,17 @@ bool gpt_params_find_arg(int argc, char ** argv, const std::string & arg, gpt_pa
         else { invalid_param = true; }
         return true;
     }
+    if (arg == "--cpu-affinity") {
+        if (++i >= argc) {
+            invalid_param = true;
+            return true;
+        }
+        params.cpu_affinity.clear();
+        if (!parse_cpu_list(argv[i], params.cpu_affinity)) {
+            invalid_param = true;
+        }
+        return true;
+    }
     if (arg == "--verbose-prompt") {
         params.verbose_prompt = true;
         return true;
@@ -1142,6 +1177,10 @@ bool gpt_params_find_arg(int argc, char ** argv, const std::string & arg, gpt_pa
         params.check_tensors = true;
         return true;
     }
+    if (arg == "--repack") {
+        params.repack = true;
+        return true;
+    }
     if (arg == "--ppl-output-type") {
         if (++i >= argc) {
             invalid_param = true;
@@ -1532,6 +1571,8 @@ void gpt_print_usage(int /*argc*/, char ** argv, const gpt_params & params) {
     printf("                          - numactl: use the CPU map provided by numactl\n");
     printf("                        if run without this previously, it is recommended to drop the system page cache before using this\n");
     printf("                        see https://github.com/ggerganov/llama.cpp/issues/1437\n");
+    printf("  --cpu-affinity LIST   pin the compute threads to these CPUs, e.g. 0-15,32-47 (thread i runs on the i-th CPU)\n");
+    printf("                        list the CPUs of each NUMA node together to keep the weights node-local\n");
     if (llama_supports_gpu_offload()) {
         printf("  -ngl N, --n-gpu-layers N\n");
         printf("                        number of layers to store in VRAM\n");
@@ -1593,6 +1634,7 @@ void gpt_print_usage(int /*argc*/, char ** argv, const gpt_params & params) {
     printf("  -ptc N, --print-token-count N\n");
     printf("                        print token count every N tokens (default: %d)\n", params.n_print);
     printf("  --check-tensors       check model tensor data for invalid values\n");
+    printf("  --repack              repack Q4_0/Q8_0 weights of CPU layers for faster matrix multiplication (disables mmap of those weights)\n");
     printf("\n");
 #ifndef LOG_DISABLE_LOGS
     log_print_usage();
@@ -1826,6 +1868,7 @@ struct llama_model_params llama_model_params_from_gpt_params(const gpt_params &
     mparams.use_mmap        = params.use_mmap;
     mparams.use_mlock       = params.use_mlock;
     mparams.check_tensors   = params.check_tensors;
+    mparams.repack          = params.repack;
     if (params.kv_overrides.empty()) {
         mparams.kv_overrides = NULL;
     } else {
@@ -2276,6 +2319,10 @@ std::tuple<struct llama_model *, struct llama_context *> llama_init_from_gpt_par
         return std::make_tuple(nullptr, nullptr);
     }
 
+    if (!params.cpu_affinity.empty()) {
+        llama_set_cpu_affinity(lctx, params.cpu_affinity.data(), params.cpu_affinity.size());
+    }
+
     if (!params.control_vectors.empty()) {
         if (params.control_vector_layer_start <= 0) params.control_vector_layer_start = 1;
         if (params.control_vector_layer_end   <= 0) params.control_vector_layer_end   = llama_n_layer(model);
@@ -87,6 +87,7 @@ struct gpt_params {
     void * cb_eval_user_data                 = nullptr;
 
     ggml_numa_strategy numa = GGML_NUMA_STRATEGY_DISABLED;
+    std::vector<int32_t> cpu_affinity; // CPUs to pin the compute threads to, thread i runs on cpu_affinity[i % n]
 
     enum llama_rope_scaling_type rope_scaling_type = LLAMA_ROPE_SCALING_TYPE_UNSPECIFIED;
     enum llama_pooling_type      pooling_type      = LLAMA_POOLING_TYPE_UNSPECIFIED; // pooling type for embeddings
@@ -165,6 +166,7 @@ struct gpt_params {
     bool no_kv_offload     = false; // disable KV offloading
     bool warmup            = true;  // warmup run
     bool check_tensors     = false; // validate tensor data
+    bool repack            = false; // repack CPU weights with interleaved rows
 
     std::string cache_type_k = "f16"; // KV cache data type for the K
     std::string cache_type_v = "f16"; // KV cache data type for the V
@@ -178,6 +180,9 @@ void gpt_params_handle_model_default(gpt_params & params);
 
 bool parse_kv_override(const char * data, std::vector<llama_model_kv_override> & overrides);
 
+// parses a CPU list such as "0-7,16-23" into the list of CPU ids
+bool parse_cpu_list(const std::string & value, std::vector<int32_t> & cpus);
+
 bool gpt_params_parse_ex(int argc, char ** argv, gpt_params & params);
 
 bool gpt_params_parse(int argc, char ** argv, gpt_params & params);
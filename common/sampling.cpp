@@ -1,16 +1,26 @@
 #define LLAMA_API_INTERNAL
 #include "sampling.h"
+#include <algorithm>
+#include <cmath>
 #include <random>
 
-struct llama_sampling_context * llama_sampling_init(const struct llama_sampling_params & params) {
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static struct llama_sampling_context * llama_sampling_init_impl(
+        const struct llama_sampling_params & params,
+        const grammar_parser::parse_state * parsed_grammar) {
     struct llama_sampling_context * result = new llama_sampling_context();
 
     result->params  = params;
     result->grammar = nullptr;
 
-    // if there is a grammar, parse it
+    // if there is a grammar, parse it unless the caller already did
     if (!params.grammar.empty()) {
-        result->parsed_grammar = grammar_parser::parse(params.grammar.c_str());
+        result->parsed_grammar = parsed_grammar ? *parsed_grammar : grammar_parser::parse(params.grammar.c_str());
 
         // will be empty (default) if there are parse errors
         if (result->parsed_grammar.rules.empty()) {
@@ -40,6 +50,16 @@ struct llama_sampling_context * llama_sampling_init(const struct llama_sampling_
     return result;
 }
 
+struct llama_sampling_context * llama_sampling_init(const struct llama_sampling_params & params) {
+    return llama_sampling_init_impl(params, nullptr);
+}
+
+struct llama_sampling_context * llama_sampling_init(
+        const struct llama_sampling_params & params,
+        const grammar_parser::parse_state & parsed_grammar) {
+    return llama_sampling_init_impl(params, &parsed_grammar);
+}
+
 void llama_sampling_free(struct llama_sampling_context * ctx) {
     if (ctx->grammar != NULL) {
         llama_grammar_free(ctx->grammar);
@@ -171,6 +191,16 @@ static void sampler_queue(
     }
 }
 
+static llama_token_data_array llama_sampling_prepare_impl(
+                  struct llama_sampling_context * ctx_sampling,
+                  struct llama_context * ctx_main,
+                  struct llama_context * ctx_cfg,
+                  const int idx,
+                  bool apply_grammar,
+                  std::vector<float> * original_logits,
+                  int32_t n_top,
+                  float min_p);
+
 static llama_token llama_sampling_sample_impl(
                   struct llama_sampling_context * ctx_sampling,
                   struct llama_context * ctx_main,
@@ -184,11 +214,40 @@ static llama_token llama_sampling_sample_impl(
     const float   mirostat_tau    = params.mirostat_tau;
     const float   mirostat_eta    = params.mirostat_eta;
 
-    std::vector<float> original_logits;
-    auto cur_p = llama_sampling_prepare(ctx_sampling, ctx_main, ctx_cfg, idx, !is_resampling, &original_logits);
-    if (!is_resampling) {
-        GGML_ASSERT(!original_logits.empty());
+    // the logits only need to be restored when the grammar rejects the sampled token
+    std::vector<float> * original_logits = ctx_sampling->grammar != NULL && !is_resampling ? &ctx_sampling->logits_orig : nullptr;
+
+    // when the first step of the sampling chain only keeps the best candidates, do not materialize the full vocabulary
+    int32_t n_top = 0;
+    float   min_p = 0.0f;
+    if (ctx_sampling->grammar == NULL && mirostat == 0) {
+        const int32_t min_keep = std::max(1, params.min_keep);
+
+        const bool no_penalties = params.penalty_repeat == 1.0f && params.penalty_freq == 0.0f && params.penalty_present == 0.0f;
+
+        if (temp == 0.0 && params.n_probs == 0) {
+            n_top = 1;
+        } else if (temp > 0.0 && !params.samplers_sequence.empty()) {
+            switch (params.samplers_sequence[0]) {
+                case llama_sampler_type::TOP_K:
+                    if (params.top_k > 0) {
+                        n_top = std::max(params.top_k, min_keep);
+                    }
+                    break;
+                case llama_sampler_type::MIN_P:
+                    // penalties can lower the max logit, which moves the min-p threshold
+                    if (params.min_p > 0.0f && no_penalties) {
+                        n_top = min_keep;
+                        min_p = params.min_p;
+                    }
+                    break;
+                default: break;
+            }
+        }
     }
+
+    auto cur_p = llama_sampling_prepare_impl(ctx_sampling, ctx_main, ctx_cfg, idx, !is_resampling, original_logits, n_top, min_p);
+
     llama_token id = 0;
     // Get a pointer to the logits
     float * logits = llama_get_logits_ith(ctx_main, idx);
@@ -247,7 +306,7 @@ static llama_token llama_sampling_sample_impl(
             LOG("Resampling because token %d: '%s' does not meet grammar rules\n", id, llama_token_to_piece(ctx_main, id).c_str());
 
             // Restore logits from the copy
-            std::copy(original_logits.begin(), original_logits.end(), logits);
+            std::copy(original_logits->begin(), original_logits->end(), logits);
 
             return llama_sampling_sample_impl(ctx_sampling, ctx_main, ctx_cfg, idx, true);  // Pass true for is_resampling
         }
@@ -262,7 +321,9 @@ static llama_token_data_array llama_sampling_prepare_impl(
                   struct llama_context * ctx_cfg,
                   const int idx,
                   bool apply_grammar,
-                  std::vector<float> * original_logits) {
+                  std::vector<float> * original_logits,
+                  int32_t n_top,
+                  float min_p) {
     const llama_sampling_params & params = ctx_sampling->params;
 
     const int n_vocab = llama_n_vocab(llama_get_model(ctx_main));
@@ -282,7 +343,7 @@ static llama_token_data_array llama_sampling_prepare_impl(
 
     if (apply_grammar && original_logits != NULL) {
         // Only make a copy of the original logits if we are not applying grammar checks, not sure if I actually have to do this.
-        *original_logits = {logits, logits + llama_n_vocab(llama_get_model(ctx_main))};
+        original_logits->assign(logits, logits + n_vocab);
     }
 
     // apply params.logit_bias map
@@ -295,22 +356,28 @@ static llama_token_data_array llama_sampling_prepare_impl(
         llama_sample_apply_guidance(ctx_main, logits, logits_guidance, params.cfg_scale);
     }
 
-    cur.clear();
+    const auto& penalty_tokens = params.use_penalty_prompt_tokens ? params.penalty_prompt_tokens : prev;
+    const int penalty_tokens_used_size = std::min((int)penalty_tokens.size(), penalty_last_n);
+    const llama_token * penalty_tokens_used = penalty_tokens.data() + penalty_tokens.size() - penalty_tokens_used_size;
+
+    if (n_top > 0 || min_p > 0.0f) {
+        llama_sampling_top_candidates_penalized(logits, n_vocab, n_top, min_p, penalty_tokens_used, penalty_tokens_used_size, cur);
+    } else {
+        cur.clear();
 
-    for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
-        cur.emplace_back(llama_token_data{token_id, logits[token_id], 0.0f});
+        for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
+            cur.emplace_back(llama_token_data{token_id, logits[token_id], 0.0f});
+        }
     }
 
     llama_token_data_array cur_p = { cur.data(), cur.size(), false };
 
     // apply penalties
-    const auto& penalty_tokens = params.use_penalty_prompt_tokens ? params.penalty_prompt_tokens : prev;
-    const int penalty_tokens_used_size = std::min((int)penalty_tokens.size(), penalty_last_n);
     if (penalty_tokens_used_size) {
         const float nl_logit = logits[llama_token_nl(llama_get_model(ctx_main))];
 
         llama_sample_repetition_penalties(ctx_main, &cur_p,
-                penalty_tokens.data() + penalty_tokens.size() - penalty_tokens_used_size,
+                penalty_tokens_used,
                 penalty_tokens_used_size, penalty_repeat, penalty_freq, penalty_present);
 
         if (!penalize_nl) {
@@ -347,7 +414,96 @@ llama_token_data_array llama_sampling_prepare(
                   const int idx,
                   bool apply_grammar,
                   std::vector<float> * original_logits) {
-    return llama_sampling_prepare_impl(ctx_sampling,ctx_main, ctx_cfg, idx, apply_grammar, original_logits);
+    return llama_sampling_prepare_impl(ctx_sampling,ctx_main, ctx_cfg, idx, apply_grammar, original_logits, 0, 0.0f);
+}
+
+static float llama_sampling_max_logit(const float * logits, int n) {
+    float max_logit = -INFINITY;
+
+    int i = 0;
+#if defined(__AVX__)
+    __m256 vmax = _mm256_set1_ps(-INFINITY);
+    for (; i + 8 <= n; i += 8) {
+        vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(logits + i));
+    }
+    float tmp[8];
+    _mm256_storeu_ps(tmp, vmax);
+    max_logit = *std::max_element(tmp, tmp + 8);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float32x4_t vmax = vdupq_n_f32(-INFINITY);
+    for (; i + 4 <= n; i += 4) {
+        vmax = vmaxq_f32(vmax, vld1q_f32(logits + i));
+    }
+    max_logit = vmaxvq_f32(vmax);
+#endif
+    for (; i < n; ++i) {
+        max_logit = std::max(max_logit, logits[i]);
+    }
+
+    return max_logit;
+}
+
+float llama_sampling_top_candidates(
+        const float * logits,
+        int n_vocab,
+        int k,
+        float min_p,
+        std::vector<llama_token_data> & cur) {
+    k = std::min(k, n_vocab);
+
+    const float max_logit = llama_sampling_max_logit(logits, n_vocab);
+
+    // start from the min-p cutoff, or from a window below the max that usually holds the top-k of a real distribution
+    float delta     = min_p > 0.0f ? -logf(min_p) : 8.0f;
+    float threshold = max_logit - delta;
+
+    while (true) {
+        if (delta > 1e4f || !std::isfinite(threshold)) {
+            threshold = -INFINITY;
+        }
+
+        cur.clear();
+        for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
+            if (logits[token_id] >= threshold) {
+                cur.emplace_back(llama_token_data{token_id, logits[token_id], 0.0f});
+            }
+        }
+
+        if ((int) cur.size() >= k || threshold == -INFINITY) {
+            break;
+        }
+
+        delta     = std::max(2.0f*delta, 1.0f);
+        threshold = max_logit - delta;
+    }
+
+    return threshold;
+}
+
+void llama_sampling_top_candidates_penalized(
+        const float * logits,
+        int n_vocab,
+        int k,
+        float min_p,
+        const llama_token * penalty_tokens,
+        int n_penalty_tokens,
+        std::vector<llama_token_data> & cur) {
+    // penalized tokens can move across the threshold, so keep enough slack for them and always include them
+    const float threshold = llama_sampling_top_candidates(logits, n_vocab, k + n_penalty_tokens, min_p, cur);
+
+    const size_t n_cur = cur.size();
+    for (int i = 0; i < n_penalty_tokens; ++i) {
+        const llama_token token_id = penalty_tokens[i];
+        if (logits[token_id] >= threshold) {
+            continue;
+        }
+        const bool found = std::any_of(cur.begin() + n_cur, cur.end(), [token_id](const llama_token_data & td) {
+            return td.id == token_id;
+        });
+        if (!found) {
+            cur.emplace_back(llama_token_data{token_id, logits[token_id], 0.0f});
+        }
+    }
 }
 
 void llama_sampling_accept(
@@ -82,6 +82,9 @@ struct llama_sampling_context {
     std::vector<llama_token>      prev;
     std::vector<llama_token_data> cur;
 
+    // copy of the logits, kept across calls so grammar resampling does not allocate per token
+    std::vector<float>            logits_orig;
+
     std::mt19937 rng;
 };
 
@@ -90,6 +93,12 @@ struct llama_sampling_context {
 // Create a new sampling context instance.
 struct llama_sampling_context * llama_sampling_init(const struct llama_sampling_params & params);
 
+// Create a new sampling context instance from a grammar that was already parsed from params.grammar,
+// e.g. one kept in a cache, skipping the parse.
+struct llama_sampling_context * llama_sampling_init(
+        const struct llama_sampling_params & params,
+        const grammar_parser::parse_state & parsed_grammar);
+
 void llama_sampling_free(struct llama_sampling_context * ctx);
 
 // Reset the sampler context
@@ -147,6 +156,28 @@ llama_token_data_array llama_sampling_prepare(
         bool apply_grammar = true,
         std::vector<float> * original_logits = nullptr);
 
+// Fill `cur` with only the candidates that can survive a leading top-k / min-p step, so the full vocabulary
+// does not have to be materialized and sorted. Keeps every token with logit >= max_logit + log(min_p)
+// (when min_p > 0) and lowers the threshold until at least k tokens pass.
+// returns the logit threshold that was used
+float llama_sampling_top_candidates(
+        const float * logits,
+        int n_vocab,
+        int k,
+        float min_p,
+        std::vector<llama_token_data> & cur);
+
+// llama_sampling_top_candidates for a chain that applies repetition penalties first: the penalized tokens can move
+// across the threshold, so k is raised by their number and each of them is always included
+void llama_sampling_top_candidates_penalized(
+        const float * logits,
+        int n_vocab,
+        int k,
+        float min_p,
+        const llama_token * penalty_tokens,
+        int n_penalty_tokens,
+        std::vector<llama_token_data> & cur);
+
 void llama_sampling_accept(
         struct llama_sampling_context * ctx_sampling,
         struct llama_context * ctx_main,
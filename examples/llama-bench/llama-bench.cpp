@@ -178,7 +178,10 @@ struct cmd_params {
     std::vector<std::vector<float>> tensor_split;
     std::vector<bool> use_mmap;
     std::vector<bool> embeddings;
+    ggml_numa_strategy numa;
+    std::vector<int32_t> cpu_affinity;
     int reps;
+    bool thread_times;
     bool verbose;
     output_formats output_format;
 };
@@ -200,7 +203,10 @@ static const cmd_params cmd_params_defaults = {
     /* tensor_split  */ {std::vector<float>(llama_max_devices(), 0.0f)},
     /* use_mmap      */ {true},
     /* embeddings    */ {false},
+    /* numa          */ GGML_NUMA_STRATEGY_DISABLED,
+    /* cpu_affinity  */ {},
     /* reps          */ 5,
+    /* thread_times  */ false,
     /* verbose       */ false,
     /* output_format */ MARKDOWN
 };
@@ -226,6 +232,9 @@ static void print_usage(int /* argc */, char ** argv) {
     printf("  -mmp, --mmap <0|1>                  (default: %s)\n", join(cmd_params_defaults.use_mmap, ",").c_str());
     printf("  -embd, --embeddings <0|1>           (default: %s)\n", join(cmd_params_defaults.embeddings, ",").c_str());
     printf("  -ts, --tensor-split <ts0/ts1/..>    (default: 0)\n");
+    printf("  --numa <distribute|isolate|numactl> (default: disabled)\n");
+    printf("  -C, --cpu-affinity <cpu list>       pin the compute threads, e.g. 0-15,32-47 (default: none)\n");
+    printf("  -tt, --thread-times <0|1>           print the compute time of each CPU thread (default: %s)\n", cmd_params_defaults.thread_times ? "1" : "0");
     printf("  -r, --repetitions <n>               (default: %d)\n", cmd_params_defaults.reps);
     printf("  -o, --output <csv|json|md|sql>      (default: %s)\n", output_format_str(cmd_params_defaults.output_format));
     printf("  -v, --verbose                       (default: %s)\n", cmd_params_defaults.verbose ? "1" : "0");
@@ -270,6 +279,8 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
     params.verbose = cmd_params_defaults.verbose;
     params.output_format = cmd_params_defaults.output_format;
     params.reps = cmd_params_defaults.reps;
+    params.numa = cmd_params_defaults.numa;
+    params.thread_times = cmd_params_defaults.thread_times;
 
     for (int i = 1; i < argc; i++) {
         arg = argv[i];
@@ -439,6 +450,32 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
                 }
                 params.tensor_split.push_back(tensor_split);
             }
+        } else if (arg == "--numa") {
+            if (++i >= argc) {
+                invalid_param = true;
+                break;
+            }
+            std::string value(argv[i]);
+            /**/ if (value == "distribute") { params.numa = GGML_NUMA_STRATEGY_DISTRIBUTE; }
+            else if (value == "isolate")    { params.numa = GGML_NUMA_STRATEGY_ISOLATE; }
+            else if (value == "numactl")    { params.numa = GGML_NUMA_STRATEGY_NUMACTL; }
+            else { invalid_param = true; break; }
+        } else if (arg == "-C" || arg == "--cpu-affinity") {
+            if (++i >= argc) {
+                invalid_param = true;
+                break;
+            }
+            params.cpu_affinity.clear();
+            if (!parse_cpu_list(argv[i], params.cpu_affinity)) {
+                invalid_param = true;
+                break;
+            }
+        } else if (arg == "-tt" || arg == "--thread-times") {
+            if (++i >= argc) {
+                invalid_param = true;
+                break;
+            }
+            params.thread_times = std::stoi(argv[i]) != 0;
         } else if (arg == "-r" || arg == "--repetitions") {
             if (++i >= argc) {
                 invalid_param = true;
@@ -1192,6 +1229,23 @@ static void llama_null_log_callback(enum ggml_log_level level, const char * text
     (void) user_data;
 }
 
+// the busy time of each CPU thread shows stragglers and uneven placement between NUMA nodes
+static void print_thread_times(llama_context * ctx, const test & t) {
+    std::vector<int64_t> t_busy_us(t.n_threads);
+    const int n = llama_get_thread_timings(ctx, t_busy_us.data(), t_busy_us.size());
+    if (n == 0) {
+        return;
+    }
+
+    const int64_t t_max_us = *std::max_element(t_busy_us.begin(), t_busy_us.begin() + n);
+
+    fprintf(stderr, "thread times for %s %s %d:\n", t.model_type.c_str(), t.n_prompt > 0 ? "pp" : "tg", t.n_prompt > 0 ? t.n_prompt : t.n_gen);
+    for (int i = 0; i < n; i++) {
+        fprintf(stderr, "  thread %3d: %10.2f ms (%5.1f%% of slowest)\n",
+                i, t_busy_us[i] / 1e3, t_max_us > 0 ? 100.0 * t_busy_us[i] / t_max_us : 0.0);
+    }
+}
+
 int main(int argc, char ** argv) {
     // try to set locale for unicode characters in markdown
     setlocale(LC_CTYPE, ".UTF-8");
@@ -1215,6 +1269,7 @@ int main(int argc, char ** argv) {
         llama_log_set(llama_null_log_callback, NULL);
     }
     llama_backend_init();
+    llama_numa_init(params.numa);
 
     // initialize printer
     std::unique_ptr<printer> p;
@@ -1265,6 +1320,10 @@ int main(int argc, char ** argv) {
             return 1;
         }
 
+        if (!params.cpu_affinity.empty()) {
+            llama_set_cpu_affinity(ctx, params.cpu_affinity.data(), params.cpu_affinity.size());
+        }
+
         test t(inst, lmodel, ctx);
 
         llama_kv_cache_clear(ctx);
@@ -1278,6 +1337,11 @@ int main(int argc, char ** argv) {
             test_gen(ctx, 1, 0, t.n_threads);
         }
 
+        // only report the thread times of the repetitions
+        if (params.thread_times) {
+            llama_reset_timings(ctx);
+        }
+
         for (int i = 0; i < params.reps; i++) {
             llama_kv_cache_clear(ctx);
 
@@ -1295,6 +1359,10 @@ int main(int argc, char ** argv) {
 
         p->print_test(t);
 
+        if (params.thread_times) {
+            print_thread_times(ctx, t);
+        }
+
         llama_print_timings(ctx);
 
         llama_free(ctx);
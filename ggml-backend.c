@@ -725,11 +725,128 @@ ggml_backend_buffer_type_t ggml_backend_cpu_hbm_buffer_type(void) {
 }
 #endif
 
+// buffer type REPACK
+// quantized matrices are stored with the rows of each group of 4 interleaved, so that mul_mat can compute 4 rows per
+// pass over src1 (see ggml_get_interleaved_type); tensors are converted on set_tensor/get_tensor
+// the buffer is not a host buffer: other buffers cannot memcpy from it, they have to go through get_tensor
+
+GGML_CALL static const char * ggml_backend_cpu_repack_buffer_type_get_name(ggml_backend_buffer_type_t buft) {
+    return "CPU_REPACK";
+
+    GGML_UNUSED(buft);
+}
+
+GGML_CALL static const char * ggml_backend_cpu_repack_buffer_get_name(ggml_backend_buffer_t buf) {
+    return "CPU_REPACK";
+
+    GGML_UNUSED(buf);
+}
+
+GGML_CALL static void ggml_backend_cpu_repack_buffer_init_tensor(ggml_backend_buffer_t buffer, struct ggml_tensor * tensor) {
+    if (tensor->view_src == NULL && tensor->ne[2] == 1 && tensor->ne[3] == 1 && ggml_is_contiguous(tensor)) {
+        tensor->type = ggml_get_interleaved_type(tensor->type, tensor->ne[0], tensor->ne[1]);
+    }
+
+    GGML_UNUSED(buffer);
+}
+
+GGML_CALL static void ggml_backend_cpu_repack_buffer_set_tensor(ggml_backend_buffer_t buffer, struct ggml_tensor * tensor, const void * data, size_t offset, size_t size) {
+    if (!ggml_is_interleaved(tensor->type)) {
+        memcpy((char *)tensor->data + offset, data, size);
+        return;
+    }
+
+    GGML_ASSERT(offset == 0 && size == ggml_nbytes(tensor) && "interleaved tensors must be set in one piece");
+
+    ggml_repack_rows(tensor->type, tensor->data, data, ggml_nrows(tensor), tensor->ne[0]);
+
+    GGML_UNUSED(buffer);
+}
+
+GGML_CALL static void ggml_backend_cpu_repack_buffer_get_tensor(ggml_backend_buffer_t buffer, const struct ggml_tensor * tensor, void * data, size_t offset, size_t size) {
+    if (!ggml_is_interleaved(tensor->type)) {
+        memcpy(data, (const char *)tensor->data + offset, size);
+        return;
+    }
+
+    if (offset == 0 && size == ggml_nbytes(tensor)) {
+        ggml_unpack_rows(tensor->type, data, tensor->data, ggml_nrows(tensor), tensor->ne[0]);
+        return;
+    }
+
+    void * tmp = malloc(ggml_nbytes(tensor));
+    GGML_ASSERT(tmp != NULL);
+    ggml_unpack_rows(tensor->type, tmp, tensor->data, ggml_nrows(tensor), tensor->ne[0]);
+    memcpy(data, (const char *)tmp + offset, size);
+    free(tmp);
+
+    GGML_UNUSED(buffer);
+}
+
+GGML_CALL static bool ggml_backend_cpu_repack_buffer_cpy_tensor(ggml_backend_buffer_t buffer, const struct ggml_tensor * src, struct ggml_tensor * dst) {
+    if (!ggml_backend_buffer_is_host(src->buffer)) {
+        return false;
+    }
+
+    if (src->type == dst->type) {
+        memcpy(dst->data, src->data, ggml_nbytes(src));
+    } else if (ggml_is_interleaved(dst->type)) {
+        ggml_repack_rows(dst->type, dst->data, src->data, ggml_nrows(dst), dst->ne[0]);
+    } else {
+        return false;
+    }
+    return true;
+
+    GGML_UNUSED(buffer);
+}
+
+GGML_CALL static ggml_backend_buffer_t ggml_backend_cpu_repack_buffer_type_alloc_buffer(ggml_backend_buffer_type_t buft, size_t size) {
+    ggml_backend_buffer_t buffer = ggml_backend_buft_alloc_buffer(ggml_backend_cpu_buffer_type(), size);
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    buffer->buft = buft;
+    buffer->iface.get_name    = ggml_backend_cpu_repack_buffer_get_name;
+    buffer->iface.init_tensor = ggml_backend_cpu_repack_buffer_init_tensor;
+    buffer->iface.set_tensor  = ggml_backend_cpu_repack_buffer_set_tensor;
+    buffer->iface.get_tensor  = ggml_backend_cpu_repack_buffer_get_tensor;
+    buffer->iface.cpy_tensor  = ggml_backend_cpu_repack_buffer_cpy_tensor;
+
+    return buffer;
+}
+
+GGML_CALL ggml_backend_buffer_type_t ggml_backend_cpu_repack_buffer_type(void) {
+    static struct ggml_backend_buffer_type ggml_backend_cpu_buffer_type_repack = {
+        /* .iface    = */ {
+            /* .get_name         = */ ggml_backend_cpu_repack_buffer_type_get_name,
+            /* .alloc_buffer     = */ ggml_backend_cpu_repack_buffer_type_alloc_buffer,
+            /* .get_alignment    = */ ggml_backend_cpu_buffer_type_get_alignment,
+            /* .get_max_size     = */ NULL, // defaults to SIZE_MAX
+            /* .get_alloc_size   = */ NULL, // defaults to ggml_nbytes
+            /* .supports_backend = */ ggml_backend_cpu_buffer_type_supports_backend,
+            /* .is_host          = */ NULL, // the data is not in the ggml layout, it must be accessed with set/get_tensor
+        },
+        /* .context  = */ NULL,
+    };
+
+    return &ggml_backend_cpu_buffer_type_repack;
+}
+
 struct ggml_backend_cpu_context {
     int n_threads;
     void * work_data;
     size_t work_size;
 
+    // worker threads are kept alive for the lifetime of the backend
+    struct ggml_compute_threadpool * threadpool;
+
+    // CPUs the worker threads are pinned to, applied when the thread pool is (re)created
+    int32_t * cpus;
+    int       n_cpus;
+
+    bool static_chunking;
+
     ggml_abort_callback abort_callback;
     void *              abort_callback_data;
 };
@@ -742,6 +859,8 @@ GGML_CALL static const char * ggml_backend_cpu_name(ggml_backend_t backend) {
 
 GGML_CALL static void ggml_backend_cpu_free(ggml_backend_t backend) {
     struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
+    ggml_threadpool_free(cpu_ctx->threadpool);
+    free(cpu_ctx->cpus);
     free(cpu_ctx->work_data);
     free(cpu_ctx);
     free(backend);
@@ -758,6 +877,23 @@ struct ggml_backend_plan_cpu {
     struct ggml_cgraph cgraph;
 };
 
+// returns a thread pool with at least n_threads threads, or NULL if no worker threads are needed
+static struct ggml_compute_threadpool * ggml_backend_cpu_get_threadpool(struct ggml_backend_cpu_context * cpu_ctx, int n_threads) {
+    if (n_threads <= 1) {
+        return NULL;
+    }
+
+    if (cpu_ctx->threadpool == NULL || ggml_threadpool_get_n_threads(cpu_ctx->threadpool) < n_threads) {
+        ggml_threadpool_free(cpu_ctx->threadpool);
+        cpu_ctx->threadpool = ggml_threadpool_new(n_threads);
+        if (cpu_ctx->n_cpus > 0) {
+            ggml_threadpool_set_affinity(cpu_ctx->threadpool, cpu_ctx->cpus, cpu_ctx->n_cpus);
+        }
+    }
+
+    return cpu_ctx->threadpool;
+}
+
 GGML_CALL static ggml_backend_graph_plan_t ggml_backend_cpu_graph_plan_create(ggml_backend_t backend, const struct ggml_cgraph * cgraph) {
     struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
 
@@ -774,6 +910,7 @@ GGML_CALL static ggml_backend_graph_plan_t ggml_backend_cpu_graph_plan_create(gg
         }
     }
 
+    cpu_plan->cplan.static_chunking     = cpu_ctx->static_chunking;
     cpu_plan->cplan.abort_callback      = cpu_ctx->abort_callback;
     cpu_plan->cplan.abort_callback_data = cpu_ctx->abort_callback_data;
 
@@ -790,11 +927,13 @@ GGML_CALL static void ggml_backend_cpu_graph_plan_free(ggml_backend_t backend, g
 }
 
 GGML_CALL static enum ggml_status ggml_backend_cpu_graph_plan_compute(ggml_backend_t backend, ggml_backend_graph_plan_t plan) {
+    struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
     struct ggml_backend_plan_cpu * cpu_plan = (struct ggml_backend_plan_cpu *)plan;
 
-    return ggml_graph_compute(&cpu_plan->cgraph, &cpu_plan->cplan);
+    // the pool may have been recreated with more threads since the plan was created
+    cpu_plan->cplan.threadpool = ggml_backend_cpu_get_threadpool(cpu_ctx, cpu_plan->cplan.n_threads);
 
-    GGML_UNUSED(backend);
+    return ggml_graph_compute(&cpu_plan->cgraph, &cpu_plan->cplan);
 }
 
 GGML_CALL static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t backend, struct ggml_cgraph * cgraph) {
@@ -813,6 +952,8 @@ GGML_CALL static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t
     }
     cplan.work_data = cpu_ctx->work_data;
 
+    cplan.threadpool          = ggml_backend_cpu_get_threadpool(cpu_ctx, cplan.n_threads);
+    cplan.static_chunking     = cpu_ctx->static_chunking;
     cplan.abort_callback      = cpu_ctx->abort_callback;
     cplan.abort_callback_data = cpu_ctx->abort_callback_data;
 
@@ -827,6 +968,11 @@ GGML_CALL static bool ggml_backend_cpu_supports_op(ggml_backend_t backend, const
                 op->type != GGML_TYPE_IQ2_XS  &&
                 op->type != GGML_TYPE_IQ1_S   &&
                 op->type != GGML_TYPE_IQ1_M; // missing type_traits.from_float
+        case GGML_OP_SET_ROWS:
+            if (op->nb[0] != ggml_type_size(op->type)) {
+                return op->type == GGML_TYPE_F32 || op->type == GGML_TYPE_F16;
+            }
+            return op->type == GGML_TYPE_F32 || ggml_internal_get_type_traits(op->type).from_float != NULL;
         case GGML_OP_MUL_MAT:
             return op->src[1]->type == GGML_TYPE_F32 || op->src[1]->type == ggml_internal_get_type_traits(op->src[0]->type).vec_dot_type;
         default:
@@ -871,6 +1017,10 @@ ggml_backend_t ggml_backend_cpu_init(void) {
     ctx->n_threads           = GGML_DEFAULT_N_THREADS;
     ctx->work_data           = NULL;
     ctx->work_size           = 0;
+    ctx->threadpool          = NULL;
+    ctx->cpus                = NULL;
+    ctx->n_cpus              = 0;
+    ctx->static_chunking     = false;
     ctx->abort_callback      = NULL;
     ctx->abort_callback_data = NULL;
 
@@ -899,6 +1049,53 @@ void ggml_backend_cpu_set_n_threads(ggml_backend_t backend_cpu, int n_threads) {
     ctx->n_threads = n_threads;
 }
 
+void ggml_backend_cpu_set_affinity(ggml_backend_t backend_cpu, const int32_t * cpus, int n_cpus) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+
+    free(ctx->cpus);
+    ctx->cpus   = NULL;
+    ctx->n_cpus = 0;
+
+    if (n_cpus > 0) {
+        ctx->cpus = malloc(sizeof(int32_t)*n_cpus);
+        memcpy(ctx->cpus, cpus, sizeof(int32_t)*n_cpus);
+        ctx->n_cpus = n_cpus;
+    }
+
+    if (ctx->threadpool) {
+        ggml_threadpool_set_affinity(ctx->threadpool, ctx->cpus, ctx->n_cpus);
+    }
+}
+
+void ggml_backend_cpu_set_static_chunking(ggml_backend_t backend_cpu, bool static_chunking) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+    ctx->static_chunking = static_chunking;
+}
+
+int ggml_backend_cpu_get_thread_times(ggml_backend_t backend_cpu, int64_t * t_busy_us, int n_max) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+    if (ctx->threadpool == NULL) {
+        return 0;
+    }
+
+    return ggml_threadpool_get_thread_times(ctx->threadpool, t_busy_us, n_max);
+}
+
+void ggml_backend_cpu_reset_thread_times(ggml_backend_t backend_cpu) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+    if (ctx->threadpool) {
+        ggml_threadpool_reset_thread_times(ctx->threadpool);
+    }
+}
+
 void ggml_backend_cpu_set_abort_callback(ggml_backend_t backend_cpu, ggml_abort_callback abort_callback, void * abort_callback_data) {
     GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
 
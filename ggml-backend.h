@@ -102,6 +102,14 @@ extern "C" {
     GGML_API           void ggml_backend_cpu_set_n_threads     (ggml_backend_t backend_cpu, int n_threads);
     GGML_API           void ggml_backend_cpu_set_abort_callback(ggml_backend_t backend_cpu, ggml_abort_callback abort_callback, void * abort_callback_data);
 
+    // pin the compute threads: thread i runs on cpus[i % n_cpus], n_cpus = 0 restores the default placement
+    GGML_API           void ggml_backend_cpu_set_affinity       (ggml_backend_t backend_cpu, const int32_t * cpus, int n_cpus);
+    // give every thread a fixed share of each op instead of letting idle threads take chunks from a shared counter
+    GGML_API           void ggml_backend_cpu_set_static_chunking(ggml_backend_t backend_cpu, bool static_chunking);
+    // per-thread compute time in microseconds, returns the number of threads written to t_busy_us
+    GGML_API           int  ggml_backend_cpu_get_thread_times   (ggml_backend_t backend_cpu, int64_t * t_busy_us, int n_max);
+    GGML_API           void ggml_backend_cpu_reset_thread_times (ggml_backend_t backend_cpu);
+
     // Create a backend buffer from an existing pointer
     GGML_API GGML_CALL ggml_backend_buffer_t ggml_backend_cpu_buffer_from_ptr(void * ptr, size_t size);
 
@@ -111,6 +119,10 @@ extern "C" {
     GGML_API ggml_backend_buffer_type_t ggml_backend_cpu_hbm_buffer_type(void);
 #endif
 
+    // host buffer type that stores Q4_0/Q8_0 matrices with interleaved rows for faster CPU mul_mat
+    // the tensor type is changed to the interleaved type when the tensor is allocated, data is converted on set/get
+    GGML_API GGML_CALL ggml_backend_buffer_type_t ggml_backend_cpu_repack_buffer_type(void);
+
     //
     // Backend registry
     //
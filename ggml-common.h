@@ -190,6 +190,19 @@ typedef struct {
 } block_q8_0;
 static_assert(sizeof(block_q8_0) == sizeof(ggml_half) + QK8_0, "wrong q8_0 block size/padding");
 
+// Q4_0 and Q8_0 with the blocks of 4 consecutive rows interleaved (CPU only)
+typedef struct {
+    ggml_half d[4];        // deltas of the 4 rows
+    uint8_t qs[2*QK4_0];   // nibbles of the 4 rows, 16 bytes each
+} block_q4_0x4;
+static_assert(sizeof(block_q4_0x4) == 4*sizeof(block_q4_0), "wrong q4_0x4 block size/padding");
+
+typedef struct {
+    ggml_half d[4];        // deltas of the 4 rows
+    int8_t  qs[4*QK8_0];   // quants of the 4 rows, 32 bytes each
+} block_q8_0x4;
+static_assert(sizeof(block_q8_0x4) == 4*sizeof(block_q8_0), "wrong q8_0x4 block size/padding");
+
 #define QK8_1 32
 typedef struct {
     union {
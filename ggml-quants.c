@@ -12384,6 +12384,270 @@ void quantize_row_iq2_s(const float * restrict x, void * restrict vy, int64_t k)
     quantize_row_iq2_s_reference(x, y, k);
 }
 
+//===================================== interleaved layouts ============================================
+
+void repack_q4_0_x4(const block_q4_0 * restrict x, block_q4_0x4 * restrict y, int64_t nrows, int64_t n_per_row) {
+    assert(nrows % 4 == 0);
+    assert(n_per_row % QK4_0 == 0);
+    const int64_t nb = n_per_row / QK4_0;
+
+    for (int64_t ig = 0; ig < nrows/4; ++ig) {
+        const block_q4_0 * restrict xg = x + 4*ig*nb;
+        for (int64_t ib = 0; ib < nb; ++ib) {
+            for (int r = 0; r < 4; ++r) {
+                y->d[r] = xg[r*nb + ib].d;
+                memcpy(y->qs + r*QK4_0/2, xg[r*nb + ib].qs, QK4_0/2);
+            }
+            ++y;
+        }
+    }
+}
+
+void unpack_q4_0_x4(const block_q4_0x4 * restrict x, block_q4_0 * restrict y, int64_t nrows, int64_t n_per_row) {
+    assert(nrows % 4 == 0);
+    assert(n_per_row % QK4_0 == 0);
+    const int64_t nb = n_per_row / QK4_0;
+
+    for (int64_t ig = 0; ig < nrows/4; ++ig) {
+        block_q4_0 * restrict yg = y + 4*ig*nb;
+        for (int64_t ib = 0; ib < nb; ++ib) {
+            for (int r = 0; r < 4; ++r) {
+                yg[r*nb + ib].d = x->d[r];
+                memcpy(yg[r*nb + ib].qs, x->qs + r*QK4_0/2, QK4_0/2);
+            }
+            ++x;
+        }
+    }
+}
+
+void repack_q8_0_x4(const block_q8_0 * restrict x, block_q8_0x4 * restrict y, int64_t nrows, int64_t n_per_row) {
+    assert(nrows % 4 == 0);
+    assert(n_per_row % QK8_0 == 0);
+    const int64_t nb = n_per_row / QK8_0;
+
+    for (int64_t ig = 0; ig < nrows/4; ++ig) {
+        const block_q8_0 * restrict xg = x + 4*ig*nb;
+        for (int64_t ib = 0; ib < nb; ++ib) {
+            for (int r = 0; r < 4; ++r) {
+                y->d[r] = xg[r*nb + ib].d;
+                memcpy(y->qs + r*QK8_0, xg[r*nb + ib].qs, QK8_0);
+            }
+            ++y;
+        }
+    }
+}
+
+void unpack_q8_0_x4(const block_q8_0x4 * restrict x, block_q8_0 * restrict y, int64_t nrows, int64_t n_per_row) {
+    assert(nrows % 4 == 0);
+    assert(n_per_row % QK8_0 == 0);
+    const int64_t nb = n_per_row / QK8_0;
+
+    for (int64_t ig = 0; ig < nrows/4; ++ig) {
+        block_q8_0 * restrict yg = y + 4*ig*nb;
+        for (int64_t ib = 0; ib < nb; ++ib) {
+            for (int r = 0; r < 4; ++r) {
+                yg[r*nb + ib].d = x->d[r];
+                memcpy(yg[r*nb + ib].qs, x->qs + r*QK8_0, QK8_0);
+            }
+            ++x;
+        }
+    }
+}
+
+#if defined(__AVX2__)
+// 4 interleaved rows of x times nc <= 4 columns of y
+// the nibbles of rows 0,1 and 2,3 share a register, so both halves of each product belong to the same column
+// and the 8 int32 sums hold 4 partial sums of 2 rows, which are only reduced once at the end of the rows
+static inline void ggml_gemm_q4_0_x4_q8_0_avx2(int nb, float * restrict s, size_t bs, const block_q4_0x4 * restrict x, const char * restrict vy, size_t by, const int nc) {
+    const __m256i m4    = _mm256_set1_epi8(0xF);
+    const __m256i eight = _mm256_set1_epi8(8);
+    const __m256i ones  = _mm256_set1_epi16(1);
+    const __m256i idx01 = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+    const __m256i idx23 = _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3);
+
+    __m256 acc[4][2];
+    for (int j = 0; j < nc; ++j) {
+        acc[j][0] = _mm256_setzero_ps();
+        acc[j][1] = _mm256_setzero_ps();
+    }
+
+    for (int ib = 0; ib < nb; ++ib) {
+        const __m256i q01 = _mm256_loadu_si256((const __m256i *)(x[ib].qs +  0));
+        const __m256i q23 = _mm256_loadu_si256((const __m256i *)(x[ib].qs + 32));
+
+        const __m256i lo01 = _mm256_and_si256(q01, m4);
+        const __m256i hi01 = _mm256_and_si256(_mm256_srli_epi16(q01, 4), m4);
+        const __m256i lo23 = _mm256_and_si256(q23, m4);
+        const __m256i hi23 = _mm256_and_si256(_mm256_srli_epi16(q23, 4), m4);
+
+        const __m256 dx = _mm256_castps128_ps256(_mm_setr_ps(GGML_FP16_TO_FP32(x[ib].d[0]), GGML_FP16_TO_FP32(x[ib].d[1]),
+                                                             GGML_FP16_TO_FP32(x[ib].d[2]), GGML_FP16_TO_FP32(x[ib].d[3])));
+        const __m256 dx01 = _mm256_permutevar8x32_ps(dx, idx01);
+        const __m256 dx23 = _mm256_permutevar8x32_ps(dx, idx23);
+
+        for (int j = 0; j < nc; ++j) {
+            const block_q8_0 * restrict y = (const block_q8_0 *)(vy + j*by) + ib;
+
+            const __m256i yl = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(y->qs +  0)));
+            const __m256i yh = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(y->qs + 16)));
+
+            // the quants are stored with an offset of 8: q*y - 8*y
+            const __m256i off = _mm256_add_epi16(_mm256_maddubs_epi16(eight, yl), _mm256_maddubs_epi16(eight, yh));
+
+            const __m256i p01 = _mm256_madd_epi16(_mm256_sub_epi16(_mm256_add_epi16(_mm256_maddubs_epi16(lo01, yl),
+                                                                                    _mm256_maddubs_epi16(hi01, yh)), off), ones);
+            const __m256i p23 = _mm256_madd_epi16(_mm256_sub_epi16(_mm256_add_epi16(_mm256_maddubs_epi16(lo23, yl),
+                                                                                    _mm256_maddubs_epi16(hi23, yh)), off), ones);
+
+            const __m256 dy = _mm256_set1_ps(GGML_FP16_TO_FP32(y->d));
+
+            acc[j][0] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(p01), _mm256_mul_ps(dx01, dy), acc[j][0]);
+            acc[j][1] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(p23), _mm256_mul_ps(dx23, dy), acc[j][1]);
+        }
+    }
+
+    for (int j = 0; j < nc; ++j) {
+        // [r0 r0 r0 r0 | r1 r1 r1 r1], [r2 r2 r2 r2 | r3 r3 r3 r3] -> [r0 r1 r2 r3]
+        __m256 t = _mm256_hadd_ps(acc[j][0], acc[j][1]);
+        t = _mm256_hadd_ps(t, t);
+        _mm_storeu_ps(s + j*bs, _mm_unpacklo_ps(_mm256_castps256_ps128(t), _mm256_extractf128_ps(t, 1)));
+    }
+}
+
+// the signed quants of Q8_0 use the sign trick of ggml_vec_dot_q8_0_q8_0, one register per row
+static inline void ggml_gemm_q8_0_x4_q8_0_avx2(int nb, float * restrict s, size_t bs, const block_q8_0x4 * restrict x, const char * restrict vy, size_t by, const int nc) {
+    const __m256i ones = _mm256_set1_epi16(1);
+
+    __m256 acc[4];
+    for (int j = 0; j < nc; ++j) {
+        acc[j] = _mm256_setzero_ps();
+    }
+
+    for (int ib = 0; ib < nb; ++ib) {
+        __m256i q[4];
+        __m256i aq[4];
+        for (int r = 0; r < 4; ++r) {
+            q[r]  = _mm256_loadu_si256((const __m256i *)(x[ib].qs + r*QK8_0));
+            aq[r] = _mm256_sign_epi8(q[r], q[r]);
+        }
+
+        const __m128 dx4 = _mm_setr_ps(GGML_FP16_TO_FP32(x[ib].d[0]), GGML_FP16_TO_FP32(x[ib].d[1]),
+                                       GGML_FP16_TO_FP32(x[ib].d[2]), GGML_FP16_TO_FP32(x[ib].d[3]));
+        const __m256 dx = _mm256_insertf128_ps(_mm256_castps128_ps256(dx4), dx4, 1);
+
+        for (int j = 0; j < nc; ++j) {
+            const block_q8_0 * restrict y = (const block_q8_0 *)(vy + j*by) + ib;
+            const __m256i qy = _mm256_loadu_si256((const __m256i *)y->qs);
+
+            __m256i p[4];
+            for (int r = 0; r < 4; ++r) {
+                p[r] = _mm256_madd_epi16(_mm256_maddubs_epi16(aq[r], _mm256_sign_epi8(qy, q[r])), ones);
+            }
+
+            // -> [r0 r1 r2 r3 | r0 r1 r2 r3]
+            const __m256i p0123 = _mm256_hadd_epi32(_mm256_hadd_epi32(p[0], p[1]), _mm256_hadd_epi32(p[2], p[3]));
+
+            acc[j] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(p0123), _mm256_mul_ps(dx, _mm256_set1_ps(GGML_FP16_TO_FP32(y->d))), acc[j]);
+        }
+    }
+
+    for (int j = 0; j < nc; ++j) {
+        _mm_storeu_ps(s + j*bs, _mm_add_ps(_mm256_castps256_ps128(acc[j]), _mm256_extractf128_ps(acc[j], 1)));
+    }
+}
+#endif
+
+void ggml_gemm_q4_0_x4_q8_0(int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by, int nrc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+    UNUSED(bx);
+
+    const block_q4_0x4 * restrict x = vx;
+
+    int j = 0;
+
+#if defined(__AVX2__)
+    for (; j + 4 <= nrc; j += 4) {
+        ggml_gemm_q4_0_x4_q8_0_avx2(nb, s + j*bs, bs, x, (const char *) vy + j*by, by, 4);
+    }
+    for (; j < nrc; ++j) {
+        ggml_gemm_q4_0_x4_q8_0_avx2(nb, s + j*bs, bs, x, (const char *) vy + j*by, by, 1);
+    }
+#endif
+
+    for (; j < nrc; ++j) {
+        const block_q8_0 * restrict y = (const block_q8_0 *)((const char *) vy + j*by);
+
+        float sumf[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+        for (int ib = 0; ib < nb; ++ib) {
+            for (int r = 0; r < 4; ++r) {
+                const uint8_t * restrict qs = x[ib].qs + r*qk/2;
+
+                int sumi = 0;
+                for (int l = 0; l < qk/2; ++l) {
+                    const int v0 = (qs[l] & 0x0F) - 8;
+                    const int v1 = (qs[l] >>   4) - 8;
+
+                    sumi += (v0 * y[ib].qs[l]) + (v1 * y[ib].qs[l + qk/2]);
+                }
+
+                sumf[r] += sumi*GGML_FP16_TO_FP32(x[ib].d[r])*GGML_FP16_TO_FP32(y[ib].d);
+            }
+        }
+
+        for (int r = 0; r < 4; ++r) {
+            s[j*bs + r] = sumf[r];
+        }
+    }
+}
+
+void ggml_gemm_q8_0_x4_q8_0(int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by, int nrc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+    UNUSED(bx);
+
+    const block_q8_0x4 * restrict x = vx;
+
+    int j = 0;
+
+#if defined(__AVX2__)
+    for (; j + 4 <= nrc; j += 4) {
+        ggml_gemm_q8_0_x4_q8_0_avx2(nb, s + j*bs, bs, x, (const char *) vy + j*by, by, 4);
+    }
+    for (; j < nrc; ++j) {
+        ggml_gemm_q8_0_x4_q8_0_avx2(nb, s + j*bs, bs, x, (const char *) vy + j*by, by, 1);
+    }
+#endif
+
+    for (; j < nrc; ++j) {
+        const block_q8_0 * restrict y = (const block_q8_0 *)((const char *) vy + j*by);
+
+        float sumf[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+        for (int ib = 0; ib < nb; ++ib) {
+            for (int r = 0; r < 4; ++r) {
+                const int8_t * restrict qs = x[ib].qs + r*qk;
+
+                int sumi = 0;
+                for (int l = 0; l < qk; ++l) {
+                    sumi += qs[l]*y[ib].qs[l];
+                }
+
+                sumf[r] += sumi*GGML_FP16_TO_FP32(x[ib].d[r])*GGML_FP16_TO_FP32(y[ib].d);
+            }
+        }
+
+        for (int r = 0; r < 4; ++r) {
+            s[j*bs + r] = sumf[r];
+        }
+    }
+}
+
 static bool validate_float(float f, size_t i) {
     if (isinf(f)) {
         fprintf(stderr, "ggml_validate_row_data: found inf value at block %zu\n", i);
@@ -12652,6 +12916,28 @@ bool ggml_validate_row_data(enum ggml_type type, const void * data, size_t nbyte
             {
                 VALIDATE_ROW_DATA_D_F16_IMPL(block_iq4_nl, data, nb);
             } break;
+        case GGML_TYPE_Q4_0_X4:
+            {
+                const block_q4_0x4 * q = (const block_q4_0x4 *) data;
+                for (size_t i = 0; i < nb/4; ++i) {
+                    for (int r = 0; r < 4; ++r) {
+                        if (!validate_fp16(q[i].d[r], 4*i + r)) {
+                            return false;
+                        }
+                    }
+                }
+            } break;
+        case GGML_TYPE_Q8_0_X4:
+            {
+                const block_q8_0x4 * q = (const block_q8_0x4 *) data;
+                for (size_t i = 0; i < nb/4; ++i) {
+                    for (int r = 0; r < 4; ++r) {
+                        if (!validate_fp16(q[i].d[r], 4*i + r)) {
+                            return false;
+                        }
+                    }
+                }
+            } break;
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
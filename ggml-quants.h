@@ -122,6 +122,16 @@ size_t quantize_q5_0(const float * GGML_RESTRICT src, void * GGML_RESTRICT dst,
 size_t quantize_q5_1(const float * GGML_RESTRICT src, void * GGML_RESTRICT dst, int64_t nrows, int64_t n_per_row, const float * imatrix);
 size_t quantize_q8_0(const float * GGML_RESTRICT src, void * GGML_RESTRICT dst, int64_t nrows, int64_t n_per_row, const float * imatrix);
 
+// Interleaved layouts, 4 rows at a time
+void repack_q4_0_x4(const block_q4_0   * GGML_RESTRICT x, block_q4_0x4 * GGML_RESTRICT y, int64_t nrows, int64_t n_per_row);
+void unpack_q4_0_x4(const block_q4_0x4 * GGML_RESTRICT x, block_q4_0   * GGML_RESTRICT y, int64_t nrows, int64_t n_per_row);
+void repack_q8_0_x4(const block_q8_0   * GGML_RESTRICT x, block_q8_0x4 * GGML_RESTRICT y, int64_t nrows, int64_t n_per_row);
+void unpack_q8_0_x4(const block_q8_0x4 * GGML_RESTRICT x, block_q8_0   * GGML_RESTRICT y, int64_t nrows, int64_t n_per_row);
+
+// 4 interleaved rows of x times nrc columns of y (by bytes apart), s[j*bs + i] = x_i . y_j
+void ggml_gemm_q4_0_x4_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, size_t bx, const void * GGML_RESTRICT vy, size_t by, int nrc);
+void ggml_gemm_q8_0_x4_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, size_t bx, const void * GGML_RESTRICT vy, size_t by, int nrc);
+
 void iq2xs_init_impl(enum ggml_type type);
 void iq2xs_free_impl(enum ggml_type type);
 void iq3xs_init_impl(int grid_size);
@@ -97,6 +97,51 @@ static int sched_yield (void) {
     Sleep (0);
     return 0;
 }
+
+typedef SRWLOCK            pthread_mutex_t;
+typedef CONDITION_VARIABLE pthread_cond_t;
+
+static int pthread_mutex_init(pthread_mutex_t * mutex, void * unused) {
+    (void) unused;
+    InitializeSRWLock(mutex);
+    return 0;
+}
+
+static int pthread_mutex_destroy(pthread_mutex_t * mutex) {
+    (void) mutex;
+    return 0;
+}
+
+static int pthread_mutex_lock(pthread_mutex_t * mutex) {
+    AcquireSRWLockExclusive(mutex);
+    return 0;
+}
+
+static int pthread_mutex_unlock(pthread_mutex_t * mutex) {
+    ReleaseSRWLockExclusive(mutex);
+    return 0;
+}
+
+static int pthread_cond_init(pthread_cond_t * cond, void * unused) {
+    (void) unused;
+    InitializeConditionVariable(cond);
+    return 0;
+}
+
+static int pthread_cond_destroy(pthread_cond_t * cond) {
+    (void) cond;
+    return 0;
+}
+
+static int pthread_cond_wait(pthread_cond_t * cond, pthread_mutex_t * mutex) {
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+    return 0;
+}
+
+static int pthread_cond_broadcast(pthread_cond_t * cond) {
+    WakeAllConditionVariable(cond);
+    return 0;
+}
 #else
 #include <pthread.h>
 #include <stdatomic.h>
@@ -845,7 +890,33 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .type_size                = sizeof(block_q8_K),
         .is_quantized             = true,
         .from_float               = quantize_row_q8_K,
-    }
+    },
+    // the interleaved types keep the row size of their base type, vec_dot computes `nrows` rows at once
+    // against nrc columns of src1, see ggml_compute_forward_mul_mat_interleaved
+    [GGML_TYPE_Q4_0_X4] = {
+        .type_name                = "q4_0_x4",
+        .blck_size                = QK4_0,
+        .type_size                = sizeof(block_q4_0),
+        .is_quantized             = true,
+        .to_float                 = NULL,
+        .from_float               = NULL,
+        .from_float_reference     = NULL,
+        .vec_dot                  = ggml_gemm_q4_0_x4_q8_0,
+        .vec_dot_type             = GGML_TYPE_Q8_0,
+        .nrows                    = 4,
+    },
+    [GGML_TYPE_Q8_0_X4] = {
+        .type_name                = "q8_0_x4",
+        .blck_size                = QK8_0,
+        .type_size                = sizeof(block_q8_0),
+        .is_quantized             = true,
+        .to_float                 = NULL,
+        .from_float               = NULL,
+        .from_float_reference     = NULL,
+        .vec_dot                  = ggml_gemm_q8_0_x4_q8_0,
+        .vec_dot_type             = GGML_TYPE_Q8_0,
+        .nrows                    = 4,
+    },
 };
 
 // For internal test use
@@ -2038,6 +2109,7 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "TRANSPOSE",
     "GET_ROWS",
     "GET_ROWS_BACK",
+    "SET_ROWS",
     "DIAG",
     "DIAG_MASK_INF",
     "DIAG_MASK_ZERO",
@@ -2087,7 +2159,7 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "CROSS_ENTROPY_LOSS_BACK",
 };
 
-static_assert(GGML_OP_COUNT == 77, "GGML_OP_COUNT != 77");
+static_assert(GGML_OP_COUNT == 78, "GGML_OP_COUNT != 78");
 
 static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "none",
@@ -2129,6 +2201,7 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "transpose(x)",
     "get_rows(x)",
     "get_rows_back(x)",
+    "set_rows(x)",
     "diag(x)",
     "diag_mask_inf(x)",
     "diag_mask_zero(x)",
@@ -2178,7 +2251,7 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "cross_entropy_loss_back(x,y)",
 };
 
-static_assert(GGML_OP_COUNT == 77, "GGML_OP_COUNT != 77");
+static_assert(GGML_OP_COUNT == 78, "GGML_OP_COUNT != 78");
 
 static_assert(GGML_OP_POOL_COUNT == 2, "GGML_OP_POOL_COUNT != 2");
 
@@ -5348,6 +5421,33 @@ struct ggml_tensor * ggml_get_rows_back(
     return result;
 }
 
+// ggml_set_rows
+
+struct ggml_tensor * ggml_set_rows(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c) {
+    GGML_ASSERT(ggml_is_matrix(a) && ggml_is_vector(b) && b->type == GGML_TYPE_I32);
+    GGML_ASSERT(ggml_is_matrix(c) && c->type == GGML_TYPE_F32);
+    GGML_ASSERT(a->ne[0] == c->ne[0] && b->ne[0] == c->ne[1]);
+    GGML_ASSERT(c->nb[0] == sizeof(float));
+    GGML_ASSERT(a->nb[0] == ggml_type_size(a->type) || a->type == GGML_TYPE_F32 || a->type == GGML_TYPE_F16);
+
+    if (a->grad || c->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+    }
+
+    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
+
+    result->op     = GGML_OP_SET_ROWS;
+    result->grad   = NULL;
+    result->src[0] = c;
+    result->src[1] = b;
+
+    return result;
+}
+
 // ggml_diag
 
 struct ggml_tensor * ggml_diag(
@@ -10151,6 +10251,52 @@ static void ggml_compute_forward_silu(
             } break;
     }
 }
+
+// ggml_compute_forward_swiglu
+
+// silu of the gate and the mul by the up projection that follows it, in one pass over the rows
+// the activated gate is still written to silu, for any other user of it
+static void ggml_compute_forward_swiglu_f32(
+        const struct ggml_compute_params * params,
+        struct ggml_tensor * silu,
+        struct ggml_tensor * dst) {
+
+    const struct ggml_tensor * gate = silu->src[0];
+    const struct ggml_tensor * up   = dst->src[0] == silu ? dst->src[1] : dst->src[0];
+
+    GGML_ASSERT(ggml_is_contiguous(gate) && ggml_is_contiguous(silu) && ggml_is_contiguous(up) && ggml_is_contiguous(dst));
+    GGML_ASSERT(ggml_are_same_shape(gate, silu) && ggml_are_same_shape(up, silu) && ggml_are_same_shape(dst, silu));
+
+    if (params->type == GGML_TASK_TYPE_INIT || params->type == GGML_TASK_TYPE_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int nc = gate->ne[0];
+    const int nr = ggml_nrows(gate);
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    for (int i1 = ir0; i1 < ir1; i1++) {
+              float * s = (float *) ((char *) silu->data + i1*silu->nb[1]);
+        const float * u = (float *) ((char *)   up->data + i1*  up->nb[1]);
+              float * d = (float *) ((char *)  dst->data + i1* dst->nb[1]);
+
+        ggml_vec_silu_f32(nc, s, (float *) ((char *) gate->data + i1*gate->nb[1]));
+#ifdef GGML_USE_ACCELERATE
+        vDSP_vmul(s, 1, u, 1, d, 1, nc);
+#else
+        ggml_vec_mul_f32(nc, d, s, u);
+#endif
+    }
+}
 // ggml_compute_forward_leaky_relu
 
 static void ggml_compute_forward_leaky_relu_f32(
@@ -10433,6 +10579,24 @@ static void ggml_compute_forward_norm(
 
 // ggml_compute_forward_group_rms_norm
 
+static void ggml_rms_norm_row_f32(const int64_t n, float * y, const float * x, const float eps) {
+    ggml_float sum = 0.0;
+    for (int64_t i = 0; i < n; i++) {
+        sum += (ggml_float)(x[i] * x[i]);
+    }
+
+    const float mean = sum/n;
+
+    memcpy(y, x, n * sizeof(float));
+    // for (int i = 0; i < n; i++) {
+    //     y[i] = x[i];
+    // }
+
+    const float scale = 1.0f/sqrtf(mean + eps);
+
+    ggml_vec_scale_f32(n, y, scale);
+}
+
 static void ggml_compute_forward_rms_norm_f32(
         const struct ggml_compute_params * params,
         struct ggml_tensor * dst) {
@@ -10462,24 +10626,9 @@ static void ggml_compute_forward_rms_norm_f32(
         for (int64_t i02 = 0; i02 < ne02; i02++) {
             for (int64_t i01 = ith; i01 < ne01; i01 += nth) {
                 const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+                      float * y = (float *) ((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3);
 
-                ggml_float sum = 0.0;
-                for (int64_t i00 = 0; i00 < ne00; i00++) {
-                    sum += (ggml_float)(x[i00] * x[i00]);
-                }
-
-                const float mean = sum/ne00;
-
-                float * y = (float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
-
-                memcpy(y, x, ne00 * sizeof(float));
-                // for (int i00 = 0; i00 < ne00; i00++) {
-                //     y[i00] = x[i00];
-                // }
-
-                const float scale = 1.0f/sqrtf(mean + eps);
-
-                ggml_vec_scale_f32(ne00, y, scale);
+                ggml_rms_norm_row_f32(ne00, y, x, eps);
             }
         }
     }
@@ -10503,6 +10652,65 @@ static void ggml_compute_forward_rms_norm(
     }
 }
 
+// ggml_compute_forward_rms_norm_mul
+
+// rms_norm and the mul by its weight that follows it, in one pass over the rows
+// the normalized rows are still written to norm, for any other user of them
+static void ggml_compute_forward_rms_norm_mul_f32(
+        const struct ggml_compute_params * params,
+        struct ggml_tensor * norm,
+        struct ggml_tensor * dst) {
+
+    const struct ggml_tensor * src0 = norm->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+
+    GGML_ASSERT(ggml_are_same_shape(src0, norm) && ggml_are_same_shape(norm, dst));
+    GGML_ASSERT(ggml_can_repeat(src1, dst));
+
+    if (params->type == GGML_TASK_TYPE_INIT || params->type == GGML_TASK_TYPE_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    GGML_ASSERT(nb00 == sizeof(float));
+    GGML_ASSERT(nb10 == sizeof(float));
+    GGML_ASSERT( nb0 == sizeof(float));
+    GGML_ASSERT(norm->nb[0] == sizeof(float));
+
+    float eps;
+    memcpy(&eps, norm->op_params, sizeof(float));
+
+    GGML_ASSERT(eps > 0.0f);
+
+    const int64_t nr0 = ne00/ne10;
+
+    for (int64_t i03 = 0; i03 < ne03; i03++) {
+        for (int64_t i02 = 0; i02 < ne02; i02++) {
+            for (int64_t i01 = ith; i01 < ne01; i01 += nth) {
+                const float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+                      float * y = (float *) ((char *) norm->data + i01*norm->nb[1] + i02*norm->nb[2] + i03*norm->nb[3]);
+
+                ggml_rms_norm_row_f32(ne00, y, x, eps);
+
+                const float * w = (float *) ((char *) src1->data + (i01 % ne11)*nb11 + (i02 % ne12)*nb12 + (i03 % ne13)*nb13);
+                      float * d = (float *) ((char *)  dst->data + i01*nb1 + i02*nb2 + i03*nb3);
+
+                for (int64_t r = 0; r < nr0; ++r) {
+#ifdef GGML_USE_ACCELERATE
+                    vDSP_vmul(y + r*ne10, 1, w, 1, d + r*ne10, 1, ne10);
+#else
+                    ggml_vec_mul_f32(ne10, d + r*ne10, y + r*ne10, w);
+#endif
+                }
+            }
+        }
+    }
+}
+
 static void ggml_compute_forward_rms_norm_back_f32(
         const struct ggml_compute_params * params,
         struct ggml_tensor * dst) {
@@ -10797,8 +11005,10 @@ static bool ggml_compute_forward_mul_mat_use_blas(struct ggml_tensor * dst) {
 
     // NOTE: with GGML_OP_MUL_MAT_ID we don't want to go through the BLAS branch because it will dequantize (to_float)
     //       all the experts for each batch element and the processing would become incredibly slow
+    // NOTE: the interleaved types have no to_float, their own kernel already computes 4 rows at a time
     // TODO: find the optimal values for these
     if (dst->op != GGML_OP_MUL_MAT_ID &&
+        !ggml_is_interleaved(src0->type) &&
         ggml_is_contiguous(src0) &&
         ggml_is_contiguous(src1) &&
       //src0->type == GGML_TYPE_F32 &&
@@ -10813,6 +11023,135 @@ static bool ggml_compute_forward_mul_mat_use_blas(struct ggml_tensor * dst) {
 }
 #endif
 
+// dynamic work distribution between the threads computing a node, see ggml_compute_state_shared
+static bool ggml_compute_dynamic_chunks(const struct ggml_compute_params * params);
+static int  ggml_compute_next_chunk    (const struct ggml_compute_params * params);
+
+// reuse of the src1 converted by an earlier mul_mat of the graph, see ggml_compute_state_shared
+static bool ggml_compute_mul_mat_src1_cached(const struct ggml_compute_params * params, const struct ggml_tensor * dst, enum ggml_type vec_dot_type);
+static void ggml_compute_mul_mat_src1_clear (const struct ggml_compute_params * params);
+
+// split nr rows between the threads so that the threads of each NUMA node share one contiguous band of rows
+// the band of a node only depends on the share of threads placed on it, so the weight pages first-touched
+// by a node stay on that node even when the number of threads changes between calls
+static void ggml_numa_split_rows(const struct ggml_compute_params * params, int64_t nr, int64_t * ir0, int64_t * ir1) {
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int32_t * thread_node = params->thread_node;
+    const int32_t   node        = thread_node[ith];
+
+    int n_before = 0; // threads on nodes with a lower index
+    int n_node   = 0; // threads on this node
+    int i_node   = 0; // index of this thread among them
+
+    for (int i = 0; i < nth; ++i) {
+        if (thread_node[i] < node) {
+            n_before++;
+        } else if (thread_node[i] == node) {
+            if (i < ith) {
+                i_node++;
+            }
+            n_node++;
+        }
+    }
+
+    const int64_t band0 = nr*n_before/nth;
+    const int64_t band1 = nr*(n_before + n_node)/nth;
+    const int64_t dr    = (band1 - band0 + n_node - 1)/n_node;
+
+    *ir0 = MIN(band0 + dr*i_node, band1);
+    *ir1 = MIN(*ir0 + dr, band1);
+}
+
+// src0 rows are interleaved in groups of 4 (see ggml_repack_rows), the kernel computes a 4 x nc tile per call
+static void ggml_compute_forward_mul_mat_interleaved(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst,
+        const void * wdata,
+        size_t row_size) {
+
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const enum ggml_type type = src0->type;
+
+    ggml_vec_dot_t const vec_dot      = type_traits[type].vec_dot;
+    enum ggml_type const vec_dot_type = type_traits[type].vec_dot_type;
+    const int64_t        nrows        = type_traits[type].nrows;
+
+    GGML_ASSERT(ne01 % nrows == 0);
+
+    const bool src1_cont = ggml_is_contiguous(src1);
+    const bool src1_conv = src1_cont || src1->type != vec_dot_type;
+
+    const int64_t r2 = ne12/ne02;
+    const int64_t r3 = ne13/ne03;
+
+    const int64_t nr0 = ne01/nrows;    // src0 row groups
+    const int64_t nr1 = ne1*ne12*ne13; // src1 rows
+
+    const int64_t chunk_size = 16;
+
+    int64_t nchunk0 = (nr0 + chunk_size - 1)/chunk_size;
+    int64_t nchunk1 = (nr1 + chunk_size - 1)/chunk_size;
+
+    if (!ggml_compute_dynamic_chunks(params) || nchunk0*nchunk1 < nth*4) {
+        nchunk0 = nr0 > nr1 ? nth : 1;
+        nchunk1 = nr0 > nr1 ? 1 : nth;
+    }
+
+    const int64_t nchunk = nchunk0*nchunk1;
+
+    const int64_t dr0 = (nr0 + nchunk0 - 1)/nchunk0;
+    const int64_t dr1 = (nr1 + nchunk1 - 1)/nchunk1;
+
+    const size_t src1_col_stride = src1_conv ? row_size : nb11;
+
+    for (int64_t current_chunk = ith; current_chunk < nchunk; ) {
+        const int64_t ir0_start = dr0*(current_chunk % nchunk0);
+        const int64_t ir0_end   = MIN(ir0_start + dr0, nr0);
+
+        const int64_t ir1_start = dr1*(current_chunk / nchunk0);
+        const int64_t ir1_end   = MIN(ir1_start + dr1, nr1);
+
+        // process runs of src1 columns that share the same (i12, i13) plane
+        for (int64_t ir1 = ir1_start; ir1 < ir1_end; ) {
+            const int64_t i13 = (ir1/(ne12*ne1));
+            const int64_t i12 = (ir1 - i13*ne12*ne1)/ne1;
+            const int64_t i11 = (ir1 - i13*ne12*ne1 - i12*ne1);
+
+            const int64_t nc = MIN(ir1_end - ir1, ne1 - i11);
+
+            const char * src0_plane = (const char *) src0->data + (i12/r2)*nb02 + (i13/r3)*nb03;
+
+            const char * src1_col = (const char *) wdata +
+                (src1_conv
+                 ? (i11      + i12*ne11 + i13*ne12*ne11)*row_size
+                 : (i11*nb11 + i12*nb12 + i13*nb13));
+
+            float * dst_col = (float *) ((char *) dst->data + (i11*nb1 + i12*nb2 + i13*nb3));
+
+            for (int64_t ir0 = ir0_start; ir0 < ir0_end; ++ir0) {
+                vec_dot(ne00, dst_col + ir0*nrows, nb1/nb0, src0_plane + ir0*nrows*nb01, 0, src1_col, src1_col_stride, nc);
+            }
+
+            ir1 += nc;
+        }
+
+        if (nth >= nchunk) {
+            break;
+        }
+
+        current_chunk = ggml_compute_next_chunk(params);
+    }
+}
+
 static void ggml_compute_forward_mul_mat(
         const struct ggml_compute_params * params,
               struct ggml_tensor * dst) {
@@ -10862,6 +11201,7 @@ static void ggml_compute_forward_mul_mat(
 #if defined(GGML_USE_CLBLAST)
     if (ggml_cl_can_mul_mat(src0, src1, dst)) {
         if (params->ith == 0 && params->type == GGML_TASK_TYPE_COMPUTE) {
+            ggml_compute_mul_mat_src1_clear(params);
             ggml_cl_mul_mat(src0, src1, dst, params->wdata, params->wsize);
         }
         return;
@@ -10877,6 +11217,9 @@ static void ggml_compute_forward_mul_mat(
         if (params->type == GGML_TASK_TYPE_INIT) {
             if (type != GGML_TYPE_F32) {
                 assert(params->wsize >= desired_wsize);
+                if (ith == 0) {
+                    ggml_compute_mul_mat_src1_clear(params);
+                }
                 // parallelize by src0 rows
                 for (int64_t i13 = 0; i13 < ne13; i13++) {
                     for (int64_t i12 = 0; i12 < ne12; i12++) {
@@ -10962,6 +11305,11 @@ UseGgmlGemm1:;
             return;
         }
         if (src1->type != vec_dot_type) {
+            // a sibling mul_mat (e.g. Q/K/V, gate/up) already converted the same activation
+            if (ggml_compute_mul_mat_src1_cached(params, dst, vec_dot_type)) {
+                return;
+            }
+
             char * wdata = params->wdata;
             const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
@@ -11010,35 +11358,37 @@ UseGgmlGemm1:;
 UseGgmlGemm2:;
 #endif
 
+    if (ggml_is_interleaved(type)) {
+        ggml_compute_forward_mul_mat_interleaved(params, dst, wdata, row_size);
+        return;
+    }
+
     const int64_t nr0 = ne01;          // src0 rows
     const int64_t nr1 = ne1*ne12*ne13; // src1 rows
 
     //printf("nr0 = %lld, nr1 = %lld\n", nr0, nr1);
 
-    // distribute the thread work across the inner or outer loop based on which one is larger
-
-    const int64_t nth0 = nr0 > nr1 ? nth : 1; // parallelize by src0 rows
-    const int64_t nth1 = nr0 > nr1 ? 1 : nth; // parallelize by src1 rows
-
-    const int64_t ith0 = ith % nth0;
-    const int64_t ith1 = ith / nth0;
-
-    const int64_t dr0 = (nr0 + nth0 - 1)/nth0;
-    const int64_t dr1 = (nr1 + nth1 - 1)/nth1;
+    // the output is split into chunks that the threads take from a shared counter, so that threads that
+    // finish early take over work instead of waiting for a straggler at the barrier
+    // each thread starts with the chunk of its own index
+    const int64_t chunk_size = (nr0 == 1 || nr1 == 1) ? 64 : 16;
 
-    const int64_t ir010 = dr0*ith0;
-    const int64_t ir011 = MIN(ir010 + dr0, nr0);
+    int64_t nchunk0 = (nr0 + chunk_size - 1)/chunk_size;
+    int64_t nchunk1 = (nr1 + chunk_size - 1)/chunk_size;
 
-    const int64_t ir110 = dr1*ith1;
-    const int64_t ir111 = MIN(ir110 + dr1, nr1);
+    // too few chunks to balance anything, the NUMA placement relies on a fixed row split, or static
+    // scheduling was requested: distribute the thread work across the inner or outer loop based on
+    // which one is larger, one chunk per thread
+    const bool numa_split = params->thread_node && nr0 > nr1;
+    if (!ggml_compute_dynamic_chunks(params) || nchunk0*nchunk1 < nth*4 || numa_split) {
+        nchunk0 = nr0 > nr1 ? nth : 1; // parallelize by src0 rows
+        nchunk1 = nr0 > nr1 ? 1 : nth; // parallelize by src1 rows
+    }
 
-    //printf("ir010 = %6lld, ir011 = %6lld, ir110 = %6lld, ir111 = %6lld\n", ir010, ir011, ir110, ir111);
+    const int64_t nchunk = nchunk0*nchunk1;
 
-    // threads with no work simply yield (not sure if it helps)
-    if (ir010 >= ir011 || ir110 >= ir111) {
-        sched_yield();
-        return;
-    }
+    const int64_t dr0 = (nr0 + nchunk0 - 1)/nchunk0;
+    const int64_t dr1 = (nr1 + nchunk1 - 1)/nchunk1;
 
     assert(ne12 % ne02 == 0);
     assert(ne13 % ne03 == 0);
@@ -11061,46 +11411,70 @@ UseGgmlGemm2:;
     // 16 * 2, accounting for mmla kernels
     float tmp[32];
 
-    for (int64_t iir1 = ir110; iir1 < ir111; iir1 += blck_1) {
-        for (int64_t iir0 = ir010; iir0 < ir011; iir0 += blck_0) {
-            for (int64_t ir1 = iir1; ir1 < iir1 + blck_1 && ir1 < ir111; ir1 += nrc) {
-                const int64_t i13 = (ir1/(ne12*ne1));
-                const int64_t i12 = (ir1 - i13*ne12*ne1)/ne1;
-                const int64_t i11 = (ir1 - i13*ne12*ne1 - i12*ne1);
+    for (int64_t current_chunk = ith; current_chunk < nchunk; ) {
+        const int64_t ith0 = current_chunk % nchunk0;
+        const int64_t ith1 = current_chunk / nchunk0;
 
-                // broadcast src0 into src1
-                const int64_t i03 = i13/r3;
-                const int64_t i02 = i12/r2;
+        int64_t ir010 = dr0*ith0;
+        int64_t ir011 = MIN(ir010 + dr0, nr0);
+
+        const int64_t ir110 = dr1*ith1;
+        const int64_t ir111 = MIN(ir110 + dr1, nr1);
 
-                const int64_t i1 = i11;
-                const int64_t i2 = i12;
-                const int64_t i3 = i13;
+        // keep the src0 rows of each NUMA node together
+        if (numa_split) {
+            ggml_numa_split_rows(params, nr0, &ir010, &ir011);
+        }
 
-                const char * src0_row = (const char *) src0->data + (0 + i02*nb02 + i03*nb03);
+        //printf("ir010 = %6lld, ir011 = %6lld, ir110 = %6lld, ir111 = %6lld\n", ir010, ir011, ir110, ir111);
 
-                // desc: when src1 is not a contiguous memory block we have to calculate the offset using the strides
-                //       if it is, then we have either copied the data to params->wdata and made it contiguous or we are using
-                //       the original src1 data pointer, so we should index using the indices directly
-                // TODO: this is a bit of a hack, we should probably have a better way to handle this
-                const char * src1_col = (const char *) wdata +
-                    (src1_cont || src1->type != vec_dot_type
-                     ? (i11      + i12*ne11 + i13*ne12*ne11)*row_size
-                     : (i11*nb11 + i12*nb12 + i13*nb13));
-                float * dst_col = (float *) ((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3));
+        for (int64_t iir1 = ir110; iir1 < ir111; iir1 += blck_1) {
+            for (int64_t iir0 = ir010; iir0 < ir011; iir0 += blck_0) {
+                for (int64_t ir1 = iir1; ir1 < iir1 + blck_1 && ir1 < ir111; ir1 += nrc) {
+                    const int64_t i13 = (ir1/(ne12*ne1));
+                    const int64_t i12 = (ir1 - i13*ne12*ne1)/ne1;
+                    const int64_t i11 = (ir1 - i13*ne12*ne1 - i12*ne1);
 
-                //for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir011; ++ir0) {
-                //    vec_dot(ne00, &dst_col[ir0], src0_row + ir0*nb01, src1_col);
-                //}
+                    // broadcast src0 into src1
+                    const int64_t i03 = i13/r3;
+                    const int64_t i02 = i12/r2;
 
-                for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir011; ir0 += nrc) {
-                    vec_dot(ne00, &tmp[ir0 - iir0], (nrc>1 ? 16 : 0), src0_row + ir0*nb01, (nrc>1 ? nb01 : 0), src1_col, (nrc>1 ? src1_col_stride : 0), nrc);
-                }
+                    const int64_t i1 = i11;
+                    const int64_t i2 = i12;
+                    const int64_t i3 = i13;
+
+                    const char * src0_row = (const char *) src0->data + (0 + i02*nb02 + i03*nb03);
+
+                    // desc: when src1 is not a contiguous memory block we have to calculate the offset using the strides
+                    //       if it is, then we have either copied the data to params->wdata and made it contiguous or we are using
+                    //       the original src1 data pointer, so we should index using the indices directly
+                    // TODO: this is a bit of a hack, we should probably have a better way to handle this
+                    const char * src1_col = (const char *) wdata +
+                        (src1_cont || src1->type != vec_dot_type
+                         ? (i11      + i12*ne11 + i13*ne12*ne11)*row_size
+                         : (i11*nb11 + i12*nb12 + i13*nb13));
+                    float * dst_col = (float *) ((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3));
 
-                for (int cn = 0; cn < nrc; ++cn) {
-                    memcpy(&dst_col[iir0 + cn*nb1/nb0], tmp + (cn*16), (MIN(iir0 + blck_0, ir011) - iir0)*sizeof(float));
+                    //for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir011; ++ir0) {
+                    //    vec_dot(ne00, &dst_col[ir0], src0_row + ir0*nb01, src1_col);
+                    //}
+
+                    for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir011; ir0 += nrc) {
+                        vec_dot(ne00, &tmp[ir0 - iir0], (nrc>1 ? 16 : 0), src0_row + ir0*nb01, (nrc>1 ? nb01 : 0), src1_col, (nrc>1 ? src1_col_stride : 0), nrc);
+                    }
+
+                    for (int cn = 0; cn < nrc; ++cn) {
+                        memcpy(&dst_col[iir0 + cn*nb1/nb0], tmp + (cn*16), (MIN(iir0 + blck_0, ir011) - iir0)*sizeof(float));
+                    }
                 }
             }
         }
+
+        if (nth >= nchunk) {
+            break;
+        }
+
+        current_chunk = ggml_compute_next_chunk(params);
     }
 }
 
@@ -11198,6 +11572,13 @@ static void ggml_compute_forward_mul_mat_id(
         return;
     }
 
+    // with dynamic scheduling the chunks of all experts are numbered consecutively and idle threads take the
+    // next one from a shared counter, so an expert with many rows does not leave the other threads waiting
+    const bool dynamic = ggml_compute_dynamic_chunks(params);
+
+    int64_t current_chunk = ith; // next chunk for this thread, counted over all experts
+    int64_t chunk_offs    = 0;   // first chunk of the current expert
+
     // compute each matrix multiplication in sequence
     for (int cur_a = 0; cur_a < n_as; ++cur_a) {
         const int64_t cne1 = matrix_row_counts[cur_a];
@@ -11214,73 +11595,91 @@ static void ggml_compute_forward_mul_mat_id(
         const int64_t nr0 = ne01; // src0 rows
         const int64_t nr1 = cne1; // src1 rows
 
-        // distribute the thread work across the inner or outer loop based on which one is larger
+        int64_t nchunk0;
+        int64_t nchunk1;
 
-        const int64_t nth0 = nr0 > nr1 ? nth : 1; // parallelize by src0 rows
-        const int64_t nth1 = nr0 > nr1 ? 1 : nth; // parallelize by src1 rows
+        if (dynamic) {
+            const int64_t chunk_size = (nr0 == 1 || nr1 == 1) ? 64 : 16;
 
-        const int64_t ith0 = ith % nth0;
-        const int64_t ith1 = ith / nth0;
+            nchunk0 = (nr0 + chunk_size - 1)/chunk_size;
+            nchunk1 = (nr1 + chunk_size - 1)/chunk_size;
+        } else {
+            // distribute the thread work across the inner or outer loop based on which one is larger
+            nchunk0 = nr0 > nr1 ? nth : 1; // parallelize by src0 rows
+            nchunk1 = nr0 > nr1 ? 1 : nth; // parallelize by src1 rows
+        }
 
-        const int64_t dr0 = (nr0 + nth0 - 1)/nth0;
-        const int64_t dr1 = (nr1 + nth1 - 1)/nth1;
+        const int64_t nchunk = nchunk0*nchunk1;
 
-        const int64_t ir010 = dr0*ith0;
-        const int64_t ir011 = MIN(ir010 + dr0, nr0);
+        const int64_t dr0 = (nr0 + nchunk0 - 1)/nchunk0;
+        const int64_t dr1 = (nr1 + nchunk1 - 1)/nchunk1;
 
-        const int64_t ir110 = dr1*ith1;
-        const int64_t ir111 = MIN(ir110 + dr1, nr1);
+        int64_t chunk = dynamic ? current_chunk - chunk_offs : ith;
 
-        // threads with no work simply yield (not sure if it helps)
-        //if (ir010 >= ir011 || ir110 >= ir111) {
-        //    sched_yield();
-        //    continue;
-        //}
+        while (chunk < nchunk) {
+            const int64_t ith0 = chunk % nchunk0;
+            const int64_t ith1 = chunk / nchunk0;
 
-        // block-tiling attempt
-        const int64_t blck_0 = 16;
-        const int64_t blck_1 = 16;
+            const int64_t ir010 = dr0*ith0;
+            const int64_t ir011 = MIN(ir010 + dr0, nr0);
 
-        // attempt to reduce false-sharing (does not seem to make a difference)
-        float tmp[16];
+            const int64_t ir110 = dr1*ith1;
+            const int64_t ir111 = MIN(ir110 + dr1, nr1);
 
-        for (int64_t iir1 = ir110; iir1 < ir111; iir1 += blck_1) {
-            for (int64_t iir0 = ir010; iir0 < ir011; iir0 += blck_0) {
-                for (int64_t ir1 = iir1; ir1 < iir1 + blck_1 && ir1 < ir111; ++ir1) {
-                    const int64_t _i12 = ir1; // logical row index for this expert
+            // block-tiling attempt
+            const int64_t blck_0 = 16;
+            const int64_t blck_1 = 16;
 
-                    struct mmid_row_mapping row_mapping = MMID_MATRIX_ROW(cur_a, _i12);
-                    const int id       = row_mapping.i1; // selected expert index
+            // attempt to reduce false-sharing (does not seem to make a difference)
+            float tmp[16];
 
-                    const int64_t  i11 = id % ne11;
-                    const int64_t  i12 = row_mapping.i2; // row index in src1
+            for (int64_t iir1 = ir110; iir1 < ir111; iir1 += blck_1) {
+                for (int64_t iir0 = ir010; iir0 < ir011; iir0 += blck_0) {
+                    for (int64_t ir1 = iir1; ir1 < iir1 + blck_1 && ir1 < ir111; ++ir1) {
+                        const int64_t _i12 = ir1; // logical row index for this expert
 
-                    const int64_t  i1 = id;  // selected expert index
-                    const int64_t  i2 = i12; // row
+                        struct mmid_row_mapping row_mapping = MMID_MATRIX_ROW(cur_a, _i12);
+                        const int id       = row_mapping.i1; // selected expert index
 
-                    // desc: when src1 is not a contiguous memory block we have to calculate the offset using the strides
-                    //       if it is, then we have either copied the data to params->wdata and made it contiguous or we are using
-                    //       the original src1 data pointer, so we should index using the indices directly
-                    // TODO: this is a bit of a hack, we should probably have a better way to handle this
-                    const char * src1_col = (const char *) wdata +
-                        (src1_cont || src1->type != vec_dot_type
-                        ? (i11      + i12*ne11)*row_size
-                        : (i11*nb11 + i12*nb12));
+                        const int64_t  i11 = id % ne11;
+                        const int64_t  i12 = row_mapping.i2; // row index in src1
 
-                    float * dst_col = (float *) ((char *) dst->data + (i1*nb1 + i2*nb2));
+                        const int64_t  i1 = id;  // selected expert index
+                        const int64_t  i2 = i12; // row
 
-                    //for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir011; ++ir0) {
-                    //    vec_dot(ne00, &dst_col[ir0], src0_row + ir0*nb01, src1_col);
-                    //}
+                        // desc: when src1 is not a contiguous memory block we have to calculate the offset using the strides
+                        //       if it is, then we have either copied the data to params->wdata and made it contiguous or we are using
+                        //       the original src1 data pointer, so we should index using the indices directly
+                        // TODO: this is a bit of a hack, we should probably have a better way to handle this
+                        const char * src1_col = (const char *) wdata +
+                            (src1_cont || src1->type != vec_dot_type
+                            ? (i11      + i12*ne11)*row_size
+                            : (i11*nb11 + i12*nb12));
 
-                    for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir011; ++ir0) {
-                        vec_dot(ne00, &tmp[ir0 - iir0], 0, src0_cur + ir0*nb01, 0, src1_col, 0, 1);
-                    }
+                        float * dst_col = (float *) ((char *) dst->data + (i1*nb1 + i2*nb2));
+
+                        //for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir011; ++ir0) {
+                        //    vec_dot(ne00, &dst_col[ir0], src0_row + ir0*nb01, src1_col);
+                        //}
+
+                        for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir011; ++ir0) {
+                            vec_dot(ne00, &tmp[ir0 - iir0], 0, src0_cur + ir0*nb01, 0, src1_col, 0, 1);
+                        }
 
-                    memcpy(&dst_col[iir0], tmp, (MIN(iir0 + blck_0, ir011) - iir0)*sizeof(float));
+                        memcpy(&dst_col[iir0], tmp, (MIN(iir0 + blck_0, ir011) - iir0)*sizeof(float));
+                    }
                 }
             }
+
+            if (!dynamic) {
+                break;
+            }
+
+            current_chunk = ggml_compute_next_chunk(params);
+            chunk = current_chunk - chunk_offs;
         }
+
+        chunk_offs += nchunk;
     }
 
 #undef MMID_MATRIX_ROW
@@ -12194,6 +12593,68 @@ static void ggml_compute_forward_get_rows_back(
     //}
 }
 
+// ggml_compute_forward_set_rows
+
+static void ggml_compute_forward_set_rows(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst) {
+
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+
+    if (params->type == GGML_TASK_TYPE_INIT || params->type == GGML_TASK_TYPE_FINALIZE) {
+        return;
+    }
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const int64_t nc = ne00;
+    const int64_t nr = ne01;
+
+    const enum ggml_type type = dst->type;
+    ggml_from_float_t const from_float = type_traits[type].from_float;
+
+    GGML_ASSERT(ne0 == nc);
+    GGML_ASSERT(ne10 == nr);
+    GGML_ASSERT(type == GGML_TYPE_F32 || from_float);
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    // rows per thread
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t i = ir0; i < ir1; ++i) {
+        const int64_t i1 = *(int32_t *) ((char *) src1->data + i*nb10);
+
+        GGML_ASSERT(i1 >= 0 && i1 < ne1);
+
+        const float * x = (const float *) ((char *) src0->data + i*nb01);
+              char  * y = (char *)         dst->data + i1*nb1;
+
+        if (nb0 != ggml_type_size(type)) {
+            // strided row, e.g. a cell of the transposed V cache
+            if (type == GGML_TYPE_F32) {
+                for (int64_t j = 0; j < nc; ++j) {
+                    *(float *) (y + j*nb0) = x[j];
+                }
+            } else {
+                for (int64_t j = 0; j < nc; ++j) {
+                    *(ggml_fp16_t *) (y + j*nb0) = GGML_FP32_TO_FP16(x[j]);
+                }
+            }
+        } else if (type == GGML_TYPE_F32) {
+            memcpy(y, x, nc*sizeof(float));
+        } else {
+            from_float(x, y, nc);
+        }
+    }
+}
+
 // ggml_compute_forward_diag
 
 static void ggml_compute_forward_diag_f32(
@@ -12391,12 +12852,11 @@ static void ggml_compute_forward_soft_max_f32(
     const int nc = src0->ne[0];
     const int nr = ggml_nrows(src0);
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+    // with dynamic scheduling the rows are split into more chunks than threads and idle threads take the next one
+    const int nchunk = ggml_compute_dynamic_chunks(params) ? MIN(nr, 4*nth) : nth;
 
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // rows per chunk
+    const int dr = (nr + nchunk - 1)/nchunk;
 
     float * wp = (float *) params->wdata + (nc + CACHE_LINE_SIZE_F32) * ith;
 
@@ -12406,81 +12866,93 @@ static void ggml_compute_forward_soft_max_f32(
 
     const bool use_f16 = (src1 && src1->type == GGML_TYPE_F16) || (src2 && src2->type == GGML_TYPE_F16);
 
-    for (int i1 = ir0; i1 < ir1; i1++) {
-        float * sp = (float *)((char *) src0->data + i1*src0->nb[1]);
-        float * dp = (float *)((char *)  dst->data +  i1*dst->nb[1]);
-
-        // broadcast the mask across rows
-        ggml_fp16_t * mp_f16 = src1 ? (ggml_fp16_t *)((char *) src1->data) + (i1%ne01)*ne00 : NULL;
-        float       * mp_f32 = src1 ? (float       *)((char *) src1->data) + (i1%ne01)*ne00 : NULL;
-
-        ggml_vec_cpy_f32  (nc, wp, sp);
-        ggml_vec_scale_f32(nc, wp, scale);
-        if (mp_f32) {
-            if (use_f16) {
-                for (int i = 0; i < nc; ++i) {
-                    wp[i] += GGML_FP16_TO_FP32(mp_f16[i]);
-                }
-            } else {
-                for (int i = 0; i < nc; ++i) {
-                    wp[i] += mp_f32[i];
+    for (int chunk = ith; chunk < nchunk; ) {
+        // row range for this chunk
+        const int ir0 = dr*chunk;
+        const int ir1 = MIN(ir0 + dr, nr);
+
+        for (int i1 = ir0; i1 < ir1; i1++) {
+            float * sp = (float *)((char *) src0->data + i1*src0->nb[1]);
+            float * dp = (float *)((char *)  dst->data +  i1*dst->nb[1]);
+
+            // broadcast the mask across rows
+            ggml_fp16_t * mp_f16 = src1 ? (ggml_fp16_t *)((char *) src1->data) + (i1%ne01)*ne00 : NULL;
+            float       * mp_f32 = src1 ? (float       *)((char *) src1->data) + (i1%ne01)*ne00 : NULL;
+
+            ggml_vec_cpy_f32  (nc, wp, sp);
+            ggml_vec_scale_f32(nc, wp, scale);
+            if (mp_f32) {
+                if (use_f16) {
+                    for (int i = 0; i < nc; ++i) {
+                        wp[i] += GGML_FP16_TO_FP32(mp_f16[i]);
+                    }
+                } else {
+                    for (int i = 0; i < nc; ++i) {
+                        wp[i] += mp_f32[i];
+                    }
                 }
             }
-        }
 
-        // ALiBi bias
-        if (max_bias > 0.0f) {
-            const uint32_t h  = (i1/ne01)%ne02; // head
-            const float slope = h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1);
+            // ALiBi bias
+            if (max_bias > 0.0f) {
+                const uint32_t h  = (i1/ne01)%ne02; // head
+                const float slope = h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1);
 
-            if (use_f16) {
-                for (int i = 0; i < nc; ++i) {
-                    wp[i] += slope*GGML_FP16_TO_FP32(pos_f16[i]);
-                }
-            } else {
-                for (int i = 0; i < nc; ++i) {
-                    wp[i] += slope*pos_f32[i];
+                if (use_f16) {
+                    for (int i = 0; i < nc; ++i) {
+                        wp[i] += slope*GGML_FP16_TO_FP32(pos_f16[i]);
+                    }
+                } else {
+                    for (int i = 0; i < nc; ++i) {
+                        wp[i] += slope*pos_f32[i];
+                    }
                 }
             }
-        }
 
 #ifndef NDEBUG
-        for (int i = 0; i < nc; ++i) {
-            //printf("p[%d] = %f\n", i, p[i]);
-            assert(!isnan(wp[i]));
-        }
+            for (int i = 0; i < nc; ++i) {
+                //printf("p[%d] = %f\n", i, p[i]);
+                assert(!isnan(wp[i]));
+            }
 #endif
 
-        float max = -INFINITY;
-        ggml_vec_max_f32(nc, &max, wp);
+            float max = -INFINITY;
+            ggml_vec_max_f32(nc, &max, wp);
 
-        ggml_float sum = 0.0;
+            ggml_float sum = 0.0;
 
-        uint16_t scvt;
-        for (int i = 0; i < nc; i++) {
-            if (wp[i] == -INFINITY) {
-                dp[i] = 0.0f;
-            } else {
-                // const float val = (wp[i] == -INFINITY) ? 0.0 : exp(wp[i] - max);
-                ggml_fp16_t s = GGML_FP32_TO_FP16(wp[i] - max);
-                memcpy(&scvt, &s, sizeof(scvt));
-                const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt]);
-                sum += (ggml_float)val;
-                dp[i] = val;
+            uint16_t scvt;
+            for (int i = 0; i < nc; i++) {
+                if (wp[i] == -INFINITY) {
+                    dp[i] = 0.0f;
+                } else {
+                    // const float val = (wp[i] == -INFINITY) ? 0.0 : exp(wp[i] - max);
+                    ggml_fp16_t s = GGML_FP32_TO_FP16(wp[i] - max);
+                    memcpy(&scvt, &s, sizeof(scvt));
+                    const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt]);
+                    sum += (ggml_float)val;
+                    dp[i] = val;
+                }
             }
-        }
 
-        assert(sum > 0.0);
+            assert(sum > 0.0);
 
-        sum = 1.0/sum;
-        ggml_vec_scale_f32(nc, dp, sum);
+            sum = 1.0/sum;
+            ggml_vec_scale_f32(nc, dp, sum);
 
 #ifndef NDEBUG
-        for (int i = 0; i < nc; ++i) {
-            assert(!isnan(dp[i]));
-            assert(!isinf(dp[i]));
-        }
+            for (int i = 0; i < nc; ++i) {
+                assert(!isnan(dp[i]));
+                assert(!isinf(dp[i]));
+            }
 #endif
+        }
+
+        if (nth >= nchunk) {
+            break;
+        }
+
+        chunk = ggml_compute_next_chunk(params);
     }
 }
 
@@ -12760,6 +13232,8 @@ static void ggml_compute_forward_alibi(
         case GGML_TYPE_IQ3_S:
         case GGML_TYPE_IQ2_S:
         case GGML_TYPE_Q8_K:
+        case GGML_TYPE_Q4_0_X4:
+        case GGML_TYPE_Q8_0_X4:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -12849,6 +13323,8 @@ static void ggml_compute_forward_clamp(
         case GGML_TYPE_IQ3_S:
         case GGML_TYPE_IQ2_S:
         case GGML_TYPE_Q8_K:
+        case GGML_TYPE_Q4_0_X4:
+        case GGML_TYPE_Q8_0_X4:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -12919,6 +13395,26 @@ GGML_CALL void ggml_rope_yarn_corr_dims(
     dims[1] = MIN(n_dims - 1, end);
 }
 
+// rotates the pairs of one contiguous row in normal mode, with sin/cos from ggml_rope_cache_init
+static void ggml_rope_row_f32(
+        const int64_t ne0, float * dst, const float * src, const float * cache,
+        const int64_t p, const float xpos_base, const bool xpos_down) {
+    for (int64_t i0 = 0; i0 < ne0; i0 += 2) {
+        const float cos_theta = cache[i0 + 0];
+        const float sin_theta = cache[i0 + 1];
+
+        // zeta scaling for xPos only:
+        float zeta = xpos_base != 0.0f ? powf((i0 + 0.4f * ne0) / (1.4f * ne0), p / xpos_base) : 1.0f;
+        if (xpos_down) zeta = 1.0f / zeta;
+
+        const float x0 = src[i0 + 0];
+        const float x1 = src[i0 + 1];
+
+        dst[i0 + 0] = x0*cos_theta*zeta - x1*sin_theta*zeta;
+        dst[i0 + 1] = x0*sin_theta*zeta + x1*cos_theta*zeta;
+    }
+}
+
 static void ggml_compute_forward_rope_f32(
         const struct ggml_compute_params * params,
         struct ggml_tensor * dst,
@@ -13033,23 +13529,10 @@ static void ggml_compute_forward_rope_f32(
                         dst_data[n_dims/2*3] = x2*sin_block_theta + x3*cos_block_theta;
                     }
                 } else if (!is_neox) {
-                    for (int64_t i0 = 0; i0 < ne0; i0 += 2) {
-                        const float cos_theta = cache[i0 + 0];
-                        const float sin_theta = cache[i0 + 1];
-
-                        // zeta scaling for xPos only:
-                        float zeta = xpos_base != 0.0f ? powf((i0 + 0.4f * ne0) / (1.4f * ne0), p / xpos_base) : 1.0f;
-                        if (xpos_down) zeta = 1.0f / zeta;
-
-                        const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + i0*nb00);
-                              float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + i0*nb0);
-
-                        const float x0 = src[0];
-                        const float x1 = src[1];
+                    const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01);
+                          float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1);
 
-                        dst_data[0] = x0*cos_theta*zeta - x1*sin_theta*zeta;
-                        dst_data[1] = x0*sin_theta*zeta + x1*cos_theta*zeta;
-                    }
+                    ggml_rope_row_f32(ne0, dst_data, src, cache, p, xpos_base, xpos_down);
                 } else {
                     // TODO: this might be wrong for ne0 != n_dims - need double check
                     //       it seems we have to rope just the first n_dims elements and do nothing with the rest
@@ -13286,6 +13769,96 @@ static void ggml_compute_forward_rope(
     }
 }
 
+// ggml_compute_forward_rope_pair
+
+// the normal mode ropes of two tensors at the same positions (Q and K of an attention layer), with the
+// sin/cos cache of each position computed once for the heads of both
+static void ggml_compute_forward_rope_pair_f32(
+        const struct ggml_compute_params * params,
+        struct ggml_tensor * dst_q,
+        struct ggml_tensor * dst_k) {
+
+    if (params->type == GGML_TASK_TYPE_INIT || params->type == GGML_TASK_TYPE_FINALIZE) {
+        return;
+    }
+
+    float freq_base, freq_scale, ext_factor, attn_factor, beta_fast, beta_slow;
+
+    const int n_dims     = ((int32_t *) dst_q->op_params)[1];
+    const int n_orig_ctx = ((int32_t *) dst_q->op_params)[4];
+
+    memcpy(&freq_base,   (int32_t *) dst_q->op_params +  5, sizeof(float));
+    memcpy(&freq_scale,  (int32_t *) dst_q->op_params +  6, sizeof(float));
+    memcpy(&ext_factor,  (int32_t *) dst_q->op_params +  7, sizeof(float));
+    memcpy(&attn_factor, (int32_t *) dst_q->op_params +  8, sizeof(float));
+    memcpy(&beta_fast,   (int32_t *) dst_q->op_params +  9, sizeof(float));
+    memcpy(&beta_slow,   (int32_t *) dst_q->op_params + 10, sizeof(float));
+
+    // these two only relevant for xPos RoPE:
+    float xpos_base;
+    bool  xpos_down;
+
+    memcpy(&xpos_base,   (int32_t *) dst_q->op_params + 11, sizeof(float));
+    memcpy(&xpos_down,   (int32_t *) dst_q->op_params + 12, sizeof(bool));
+
+    const int64_t ne0 = dst_q->ne[0];
+    const int64_t ne2 = dst_q->ne[2];
+    const int64_t ne3 = dst_q->ne[3];
+
+    GGML_ASSERT(dst_k->ne[0] == ne0 && dst_k->ne[2] == ne2 && dst_k->ne[3] == ne3);
+    GGML_ASSERT(dst_q->src[0]->nb[0] == sizeof(float) && dst_k->src[0]->nb[0] == sizeof(float));
+    GGML_ASSERT(n_dims <= ne0);
+    GGML_ASSERT(n_dims % 2 == 0);
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    // the rows of each position are the heads of Q followed by the heads of K
+    const int64_t ne1q = dst_q->ne[1];
+    const int64_t ne1  = ne1q + dst_k->ne[1];
+
+    const int nr = ne1*ne2*ne3;
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    const float theta_scale = powf(freq_base, -2.0f/n_dims);
+    float corr_dims[2];
+    ggml_rope_yarn_corr_dims(n_dims, n_orig_ctx, freq_base, beta_fast, beta_slow, corr_dims);
+
+    const int32_t * pos = (const int32_t *) dst_q->src[1]->data;
+
+    float * cache = (float *) params->wdata + (ne0 + CACHE_LINE_SIZE_F32)*ith;
+
+    for (int64_t i3 = 0; i3 < ne3; i3++) {
+        for (int64_t i2 = 0; i2 < ne2; i2++) {
+            const int64_t ir = (i3*ne2 + i2)*ne1;
+            if (ir + ne1 <= ir0 || ir >= ir1) {
+                continue;
+            }
+
+            const int64_t p = pos[i2];
+
+            ggml_rope_cache_init(p, freq_scale, corr_dims, ne0, ext_factor, attn_factor, cache, 1.0f, theta_scale);
+
+            for (int64_t i1 = MAX(ir0 - ir, 0); i1 < MIN(ir1 - ir, ne1); i1++) {
+                const struct ggml_tensor * dst  = i1 < ne1q ? dst_q : dst_k;
+                const struct ggml_tensor * src0 = dst->src[0];
+                const int64_t              i1t  = i1 < ne1q ? i1 : i1 - ne1q;
+
+                const float * src = (float *) ((char *) src0->data + i3*src0->nb[3] + i2*src0->nb[2] + i1t*src0->nb[1]);
+                      float * dst_data = (float *) ((char *) dst->data + i3*dst->nb[3] + i2*dst->nb[2] + i1t*dst->nb[1]);
+
+                ggml_rope_row_f32(ne0, dst_data, src, cache, p, xpos_base, xpos_down);
+            }
+        }
+    }
+}
+
 // ggml_compute_forward_rope_back
 
 static void ggml_compute_forward_rope_back(
@@ -14741,8 +15314,8 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     GGML_ASSERT(ne2 == N);
 
     GGML_ASSERT(nbq0 == sizeof(float));
-    GGML_ASSERT(nbk0 == sizeof(ggml_fp16_t));
-    GGML_ASSERT(nbv0 == sizeof(ggml_fp16_t));
+    GGML_ASSERT(nbk0 == ggml_type_size(k->type));
+    GGML_ASSERT(nbv0 == ggml_type_size(v->type));
 
     GGML_ASSERT(neq0 == D);
     GGML_ASSERT(nek0 == D);
@@ -14777,107 +15350,148 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     // total rows in q
     const int nr = neq1*neq2*neq3;
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+    // with dynamic scheduling the rows are split into more chunks than threads and idle threads take the next one
+    const int nchunk = ggml_compute_dynamic_chunks(params) ? MIN(nr, 4*nth) : nth;
 
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    // rows per chunk
+    const int dr = (nr + nchunk - 1)/nchunk;
 
     float scale = 1.0f;
     memcpy(&scale, (float *) dst->op_params + 0, sizeof(float));
 
-    // loop over n_batch and n_head
-    for (int ir = ir0; ir < ir1; ++ir) {
-        // q indices
-        const int iq3 = ir/(neq2*neq1);
-        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
-        const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
-
-        float S = 0.0f;
-        float M = -INFINITY;
+    // K and V can be quantized: Q is converted once per row to the vec_dot type of K, and the rows of a quantized V
+    // are dequantized one at a time into a D-sized scratch buffer that stays in L1
+    enum ggml_type    const k_vec_dot_type = type_traits[k->type].vec_dot_type;
+    ggml_from_float_t const q_to_vec_dot   = type_traits[k_vec_dot_type].from_float;
+    ggml_vec_dot_t    const kq_vec_dot     = type_traits[k->type].vec_dot;
+    ggml_to_float_t   const v_to_float     = type_traits[v->type].to_float;
 
-        float       * V32 = (float       *) params->wdata + ith*(2*D + CACHE_LINE_SIZE_F32);
-        ggml_fp16_t * Q16 = (ggml_fp16_t *) (V32); // reuse memory
-        ggml_fp16_t * V16 = (ggml_fp16_t *) (V32 + D);
+    GGML_ASSERT(q_to_vec_dot && kq_vec_dot && "unsupported K type for flash attention");
+    GGML_ASSERT(v_to_float && "unsupported V type for flash attention");
+    GGML_ASSERT(ggml_row_size(k_vec_dot_type, D) <= D*sizeof(float));
 
-        memset(V16, 0, D*sizeof(ggml_fp16_t));
+    for (int chunk = ith; chunk < nchunk; ) {
+        // row range for this chunk
+        const int ir0 = dr*chunk;
+        const int ir1 = MIN(ir0 + dr, nr);
 
-        const ggml_fp16_t * mp = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1]) : NULL;
+        // loop over n_batch and n_head
+        for (int ir = ir0; ir < ir1; ++ir) {
+            // q indices
+            const int iq3 = ir/(neq2*neq1);
+            const int iq2 = (ir - iq3*neq2*neq1)/neq1;
+            const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
 
-        // k indices
-        const int ik3 = iq3 / rk3;
-        const int ik2 = iq2 / rk2;
+            float S = 0.0f;
+            float M = -INFINITY;
 
-        // v indices
-        const int iv3 = iq3 / rv3;
-        const int iv2 = iq2 / rv2;
+            float       * VKQ32 = (float       *) params->wdata + ith*(3*D + CACHE_LINE_SIZE_F32); // accumulator
+            float       * V32   =                 (VKQ32 + 1*D); // dequantized V row
+            ggml_fp16_t * VKQ16 = (ggml_fp16_t *) (VKQ32 + 1*D); // F16 accumulator for F16 V (reuses V32)
+            void        * Q_q   =                 (VKQ32 + 2*D); // Q in the vec_dot type of K
 
-        // online softmax / attention
-        // loop over n_kv and n_head_kv
-        // ref: https://arxiv.org/pdf/2112.05682.pdf
-        for (int64_t ic = 0; ic < nek1; ++ic) {
-            const float mv = mp ? GGML_FP16_TO_FP32(mp[ic]) : 0.0f;
-            if (mv == -INFINITY) {
-                continue;
+            if (v->type == GGML_TYPE_F16) {
+                memset(VKQ16, 0, D*sizeof(ggml_fp16_t));
+            } else {
+                memset(VKQ32, 0, D*sizeof(float));
             }
 
-            float s;
+            const ggml_fp16_t * mp = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1]) : NULL;
 
-            // convert Q to F16 in V32
-            {
-                const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
+            // k indices
+            const int ik3 = iq3 / rk3;
+            const int ik2 = iq2 / rk2;
 
-                for (int64_t d = 0; d < D; ++d) {
-                    Q16[d] = GGML_FP32_TO_FP16(pq[d]);
+            // v indices
+            const int iv3 = iq3 / rv3;
+            const int iv2 = iq2 / rv2;
+
+            const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
+            q_to_vec_dot(pq, Q_q, D);
+
+            // online softmax / attention
+            // loop over n_kv and n_head_kv
+            // ref: https://arxiv.org/pdf/2112.05682.pdf
+            for (int64_t ic = 0; ic < nek1; ++ic) {
+                const float mv = mp ? GGML_FP16_TO_FP32(mp[ic]) : 0.0f;
+                if (mv == -INFINITY) {
+                    continue;
                 }
-            }
 
-            ggml_vec_dot_f16(D,
-                    &s, 0,
-                    (ggml_fp16_t *) ((char *) k->data + ( ic*nbk1 + ik2*nbk2 + ik3*nbk3)), 0,
-                    Q16, 0, 1);
+                float s; // KQ value
 
-            s = s*scale + mv;
+                const char * k_data = (const char *) k->data + ( ic*nbk1 + ik2*nbk2 + ik3*nbk3);
+                kq_vec_dot(D, &s, 0, k_data, 0, Q_q, 0, 1);
 
-            const float Mold = M;
+                s = s*scale + mv;
 
-            float ms = 1.0f;
-            float vs = 1.0f;
+                const float Mold = M;
 
-            if (s > M) {
-                M = s;
-                ms = expf(Mold - M);
+                float ms = 1.0f;
+                float vs = 1.0f;
 
-                // V = V*expf(Mold - M)
-                ggml_vec_scale_f16(D, V16, ms);
-            } else {
-                vs = expf(s - M);
+                const char * v_data = ((const char *) v->data + (ic*nbv1 + iv2*nbv2 + iv3*nbv3));
+
+                if (v->type == GGML_TYPE_F16) {
+                    if (s > M) {
+                        M = s;
+                        ms = expf(Mold - M);
+
+                        // V = V*expf(Mold - M)
+                        ggml_vec_scale_f16(D, VKQ16, ms);
+                    } else {
+                        vs = expf(s - M);
+                    }
+
+                    // V += v*expf(s - M)
+                    ggml_vec_mad_f16(D, VKQ16, (const ggml_fp16_t *) v_data, vs);
+                } else {
+                    if (s > M) {
+                        M = s;
+                        ms = expf(Mold - M);
+
+                        // V = V*expf(Mold - M)
+                        ggml_vec_scale_f32(D, VKQ32, ms);
+                    } else {
+                        vs = expf(s - M);
+                    }
+
+                    v_to_float(v_data, V32, D);
+
+                    // V += v*expf(s - M)
+                    ggml_vec_mad_f32(D, VKQ32, V32, vs);
+                }
+
+                S = S*ms + vs;
+            }
+
+            if (v->type == GGML_TYPE_F16) {
+                for (int64_t d = 0; d < D; ++d) {
+                    VKQ32[d] = GGML_FP16_TO_FP32(VKQ16[d]);
+                }
             }
 
-            const ggml_fp16_t * v16 = (const ggml_fp16_t *) ((char *) v->data + (ic*nbv1 + iv2*nbv2 + iv3*nbv3));
+            // V /= S
+            const float S_inv = 1.0f/S;
+            ggml_vec_scale_f32(D, VKQ32, S_inv);
 
-            // V += v*expf(s - M)
-            ggml_vec_mad_f16(D, V16, v16, vs);
+            // dst indices
+            const int i1 = iq1;
+            const int i2 = iq2;
+            const int i3 = iq3;
 
-            S = S*ms + vs;
-        }
+            // original
+            //memcpy((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3), V, nev0*sizeof(float));
 
-        // V /= S
-        for (int64_t d = 0; d < D; ++d) {
-            V32[d] = GGML_FP16_TO_FP32(V16[d])/S;
+            // permute(0, 2, 1, 3)
+            memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ32, nb1);
         }
 
-        // dst indices
-        const int i1 = iq1;
-        const int i2 = iq2;
-        const int i3 = iq3;
-
-        // original
-        //memcpy((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3), V, nev0*sizeof(float));
+        if (nth >= nchunk) {
+            break;
+        }
 
-        // permute(0, 2, 1, 3)
-        memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, V32, nb1);
+        chunk = ggml_compute_next_chunk(params);
     }
 }
 
@@ -16622,6 +17236,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_get_rows_back(params, tensor);
             } break;
+        case GGML_OP_SET_ROWS:
+            {
+                ggml_compute_forward_set_rows(params, tensor);
+            } break;
         case GGML_OP_DIAG:
             {
                 ggml_compute_forward_diag(params, tensor);
@@ -17549,6 +18167,10 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
             {
                 GGML_ASSERT(false); // TODO: not implemented
             } break;
+        case GGML_OP_SET_ROWS:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
         case GGML_OP_DIAG:
             {
                 GGML_ASSERT(false); // TODO: not implemented
@@ -18300,6 +18922,20 @@ static void set_numa_thread_affinity(int thread_n) { UNUSED(thread_n);  }
 static void clear_numa_thread_affinity(void) {}
 #endif
 
+// nodes computed as one kernel, see ggml_graph_fuse
+enum ggml_fusion_op {
+    GGML_FUSION_NONE = 0,
+    GGML_FUSION_DEFERRED,     // computed by a later node of the graph
+    GGML_FUSION_RMS_NORM_MUL, // mul(rms_norm(x), w)
+    GGML_FUSION_SWIGLU,       // mul(silu(gate), up)
+    GGML_FUSION_ROPE_PAIR,    // the ropes of Q and K
+};
+
+struct ggml_fusion {
+    uint8_t op;   // enum ggml_fusion_op
+    uint8_t prev; // distance back to the node computed with this one
+};
+
 struct ggml_compute_state_shared {
     const struct ggml_cgraph * cgraph;
     const struct ggml_cplan  * cplan;
@@ -18309,35 +18945,496 @@ struct ggml_compute_state_shared {
 
     const int n_threads;
 
+    // NUMA node of each thread, NULL when the placement is not node-aware
+    const int32_t * thread_node;
+
     // synchronization primitives
     atomic_int n_active;  // num active threads
     atomic_int node_n;    // active graph node
     atomic_int node_task; // active graph node task phase
 
+    // next chunk of the current node to be picked up, chunks [0, n_tasks) are taken by the thread with the same index
+    atomic_int current_chunk;
+
+    // src1 and vec_dot_type of the activation currently converted in the mul_mat area of the work buffer,
+    // and the graph index of the mul_mat that converted it
+    const struct ggml_tensor * mul_mat_src1;
+    enum ggml_type            mul_mat_vec_dot_type;
+    int                       mul_mat_node_n;
+
+    // per node of cgraph, NULL when every node is computed on its own
+    const struct ggml_fusion * fusion;
+
     ggml_abort_callback abort_callback; // abort ggml_graph_compute when true
     void * abort_callback_data;
 };
 
-struct ggml_compute_state {
-    ggml_thread_t thrd;
-    int ith;
-    struct ggml_compute_state_shared * shared;
-    enum ggml_status ec;
-};
+static bool ggml_compute_dynamic_chunks(const struct ggml_compute_params * params) {
+    return params->shared != NULL && !params->shared->cplan->static_chunking;
+}
 
-static void ggml_graph_compute_perf_stats_node(struct ggml_tensor * node, const struct ggml_compute_state_shared * st) {
-    int64_t cycles_cur  = ggml_perf_cycles()  - st->perf_node_start_cycles;
-    int64_t time_us_cur = ggml_perf_time_us() - st->perf_node_start_time_us;
+// returns the index of the next chunk of work of the current node
+static int ggml_compute_next_chunk(const struct ggml_compute_params * params) {
+    return atomic_fetch_add(&params->shared->current_chunk, 1);
+}
 
-    node->perf_runs++;
-    node->perf_cycles  += cycles_cur;
-    node->perf_time_us += time_us_cur;
+// ops that only describe a tensor in the memory of another one, without computing anything
+static bool ggml_is_view_op(enum ggml_op op) {
+    return op == GGML_OP_VIEW || op == GGML_OP_RESHAPE || op == GGML_OP_PERMUTE || op == GGML_OP_TRANSPOSE;
 }
 
-static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads, int n_cur_threads) {
-    int n_tasks = 0;
+static bool ggml_tensors_overlap(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    const char * a0 = (const char *) a->data;
+    const char * b0 = (const char *) b->data;
 
-    if (ggml_is_empty(node)) {
+    return a0 != NULL && b0 != NULL && a0 < b0 + ggml_nbytes(b) && b0 < a0 + ggml_nbytes(a);
+}
+
+// true when src1 of dst is already in the mul_mat area as vec_dot_type, converted by an earlier mul_mat of the graph
+// with no node since then writing to src1, otherwise dst becomes the mul_mat whose conversion later ones can reuse
+// only called by thread 0 during INIT, and the nodes run in order, so the scan is linear in the graph size overall
+static bool ggml_compute_mul_mat_src1_cached(const struct ggml_compute_params * params, const struct ggml_tensor * dst, enum ggml_type vec_dot_type) {
+    struct ggml_compute_state_shared * shared = params->shared;
+    if (shared == NULL || shared->cplan->mul_mat_size == 0) {
+        return false;
+    }
+
+    const struct ggml_cgraph * cgraph = shared->cgraph;
+    const struct ggml_tensor * src1   = dst->src[1];
+
+    const int prev = shared->mul_mat_node_n;
+
+    int node_n = MAX(prev, 0);
+    while (node_n < cgraph->n_nodes && cgraph->nodes[node_n] != dst) {
+        node_n++;
+    }
+    if (node_n == cgraph->n_nodes) {
+        // not a node of this graph
+        ggml_compute_mul_mat_src1_clear(params);
+        return false;
+    }
+
+    bool cached = prev >= 0 && shared->mul_mat_src1 == src1 && shared->mul_mat_vec_dot_type == vec_dot_type;
+    for (int i = prev + 1; cached && i < node_n; i++) {
+        const struct ggml_tensor * node = cgraph->nodes[i];
+        if (!ggml_is_view_op(node->op) && ggml_tensors_overlap(node, src1)) {
+            cached = false;
+        }
+    }
+
+    shared->mul_mat_src1         = src1;
+    shared->mul_mat_vec_dot_type = vec_dot_type;
+    shared->mul_mat_node_n       = node_n;
+
+    return cached;
+}
+
+// the mul_mat area was used for something else
+static void ggml_compute_mul_mat_src1_clear(const struct ggml_compute_params * params) {
+    if (params->shared != NULL) {
+        params->shared->mul_mat_src1 = NULL;
+    }
+}
+
+//
+// fusion of ops into one kernel
+//
+// a fused group is computed at the position of its last node, and the earlier node of the group is skipped
+// at its own position, so the group costs one pass over the rows and one barrier instead of two of each
+// the earlier node is still fully written, but moving it later is only valid when the nodes in between
+// neither read it nor overwrite its inputs: ggml-alloc reuses the memory of tensors after their last use
+//
+
+// how far back the earlier node of a group may be
+#define GGML_FUSION_WINDOW 8
+
+static bool ggml_tensors_alias(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    return a->data == b->data && ggml_are_same_shape(a, b) &&
+        a->nb[0] == b->nb[0] && a->nb[1] == b->nb[1] && a->nb[2] == b->nb[2] && a->nb[3] == b->nb[3];
+}
+
+// index of node among the nodes just before node_n, -1 when it is not there
+static int ggml_fusion_find_prev(const struct ggml_cgraph * cgraph, int node_n, const struct ggml_tensor * node) {
+    for (int i = node_n - 1; i >= 0 && i >= node_n - GGML_FUSION_WINDOW; i--) {
+        if (cgraph->nodes[i] == node) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// whether node prev can be computed at the position of node_n instead of its own
+// with in_place, node_n may write to the memory of an input of prev when it is exactly that input, as an
+// element-wise op computed row by row after prev does
+static bool ggml_fusion_can_defer(const struct ggml_cgraph * cgraph, int prev, int node_n, bool in_place) {
+    const struct ggml_tensor * deferred = cgraph->nodes[prev];
+
+    for (int i = prev + 1; i <= node_n; i++) {
+        const struct ggml_tensor * node = cgraph->nodes[i];
+        if (ggml_is_view_op(node->op)) {
+            continue;
+        }
+
+        for (int j = 0; j < GGML_MAX_SRC; j++) {
+            const struct ggml_tensor * src = node->src[j];
+            // only the last node of the group reads the deferred one, which it does after computing it
+            if (src != NULL && (i < node_n || src != deferred) && ggml_tensors_overlap(src, deferred)) {
+                return false;
+            }
+        }
+
+        for (int j = 0; j < GGML_MAX_SRC; j++) {
+            const struct ggml_tensor * src = deferred->src[j];
+            if (src == NULL || !ggml_tensors_overlap(node, src)) {
+                continue;
+            }
+            if (i < node_n || !in_place || !ggml_tensors_alias(node, src)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool ggml_fusion_is_f32(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    return a->type == GGML_TYPE_F32 && b->type == GGML_TYPE_F32;
+}
+
+// mul(rms_norm(x), w), the weight of the norm applied right after it
+static int ggml_fusion_rms_norm_mul(const struct ggml_cgraph * cgraph, int node_n) {
+    const struct ggml_tensor * node = cgraph->nodes[node_n];
+    const struct ggml_tensor * norm = node->src[0];
+    const struct ggml_tensor * w    = node->src[1];
+
+    if (norm->op != GGML_OP_RMS_NORM || !ggml_fusion_is_f32(norm->src[0], norm) || !ggml_fusion_is_f32(w, node)) {
+        return -1;
+    }
+    if (!ggml_are_same_shape(norm, node) || !ggml_can_repeat(w, node) ||
+        norm->src[0]->nb[0] != sizeof(float) || norm->nb[0] != sizeof(float) ||
+        w->nb[0] != sizeof(float) || node->nb[0] != sizeof(float)) {
+        return -1;
+    }
+
+    const int prev = ggml_fusion_find_prev(cgraph, node_n, norm);
+    if (prev < 0 || !ggml_fusion_can_defer(cgraph, prev, node_n, true)) {
+        return -1;
+    }
+    return prev;
+}
+
+// mul(silu(gate), up) of a gated feed-forward
+static int ggml_fusion_swiglu(const struct ggml_cgraph * cgraph, int node_n) {
+    const struct ggml_tensor * node = cgraph->nodes[node_n];
+
+    for (int j = 0; j < 2; j++) {
+        const struct ggml_tensor * silu = node->src[j];
+        const struct ggml_tensor * up   = node->src[1 - j];
+
+        if (silu->op != GGML_OP_UNARY || ggml_get_unary_op(silu) != GGML_UNARY_OP_SILU) {
+            continue;
+        }
+        if (!ggml_fusion_is_f32(silu->src[0], silu) || !ggml_fusion_is_f32(up, node) ||
+            !ggml_are_same_shape(silu, up) || !ggml_are_same_shape(silu, node) ||
+            !ggml_is_contiguous(silu->src[0]) || !ggml_is_contiguous(silu) ||
+            !ggml_is_contiguous(up) || !ggml_is_contiguous(node)) {
+            return -1;
+        }
+
+        const int prev = ggml_fusion_find_prev(cgraph, node_n, silu);
+        if (prev < 0 || !ggml_fusion_can_defer(cgraph, prev, node_n, true)) {
+            return -1;
+        }
+        return prev;
+    }
+
+    return -1;
+}
+
+// normal mode rope of K, with the rope of Q at the same positions a few nodes before it
+static int ggml_fusion_rope_pair(const struct ggml_cgraph * cgraph, const struct ggml_fusion * fusion, int node_n) {
+    const struct ggml_tensor * node = cgraph->nodes[node_n];
+
+    const int mode = ((const int32_t *) node->op_params)[2];
+    if (mode != 0 || !ggml_fusion_is_f32(node->src[0], node) || node->src[0]->nb[0] != sizeof(float)) {
+        return -1;
+    }
+
+    for (int prev = node_n - 1; prev >= 0 && prev >= node_n - GGML_FUSION_WINDOW; prev--) {
+        const struct ggml_tensor * other = cgraph->nodes[prev];
+        if (other->op != GGML_OP_ROPE || fusion[prev].op != GGML_FUSION_NONE) {
+            continue;
+        }
+        if (other->src[1] != node->src[1] || memcmp(other->op_params, node->op_params, sizeof(node->op_params)) != 0 ||
+            !ggml_fusion_is_f32(other->src[0], other) || other->src[0]->nb[0] != sizeof(float) ||
+            other->ne[0] != node->ne[0] || other->ne[2] != node->ne[2] || other->ne[3] != node->ne[3]) {
+            continue;
+        }
+        if (ggml_fusion_can_defer(cgraph, prev, node_n, false)) {
+            return prev;
+        }
+    }
+
+    return -1;
+}
+
+// finds the groups of nodes of cgraph that are computed as one kernel
+static void ggml_graph_fuse(const struct ggml_cgraph * cgraph, struct ggml_fusion * fusion) {
+    memset(fusion, 0, cgraph->n_nodes*sizeof(struct ggml_fusion));
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        const struct ggml_tensor * node = cgraph->nodes[i];
+
+        enum ggml_fusion_op op = GGML_FUSION_NONE;
+        int prev = -1;
+
+        switch (node->op) {
+            case GGML_OP_MUL:
+                {
+                    if ((prev = ggml_fusion_rms_norm_mul(cgraph, i)) >= 0) {
+                        op = GGML_FUSION_RMS_NORM_MUL;
+                    } else if ((prev = ggml_fusion_swiglu(cgraph, i)) >= 0) {
+                        op = GGML_FUSION_SWIGLU;
+                    }
+                } break;
+            case GGML_OP_ROPE:
+                {
+                    if ((prev = ggml_fusion_rope_pair(cgraph, fusion, i)) >= 0) {
+                        op = GGML_FUSION_ROPE_PAIR;
+                    }
+                } break;
+            default:
+                break;
+        }
+
+        // a node already in a group stays computed on its own
+        if (op == GGML_FUSION_NONE || fusion[prev].op != GGML_FUSION_NONE) {
+            continue;
+        }
+
+        fusion[prev].op = GGML_FUSION_DEFERRED;
+        fusion[i].op    = op;
+        fusion[i].prev  = i - prev;
+    }
+}
+
+static bool ggml_graph_node_deferred(const struct ggml_compute_state_shared * shared, int node_n) {
+    return shared->fusion != NULL && shared->fusion[node_n].op == GGML_FUSION_DEFERRED;
+}
+
+// computes node node_n of the graph, with the node deferred to it when it is the last of a group
+static void ggml_graph_compute_forward(struct ggml_compute_params * params, const struct ggml_compute_state_shared * shared, int node_n) {
+    struct ggml_tensor * node = shared->cgraph->nodes[node_n];
+
+    const struct ggml_fusion fusion = shared->fusion != NULL ? shared->fusion[node_n] : (struct ggml_fusion) { GGML_FUSION_NONE, 0 };
+
+    struct ggml_tensor * prev = fusion.prev > 0 ? shared->cgraph->nodes[node_n - fusion.prev] : NULL;
+
+    switch (fusion.op) {
+        case GGML_FUSION_RMS_NORM_MUL:
+            {
+                ggml_compute_forward_rms_norm_mul_f32(params, prev, node);
+            } break;
+        case GGML_FUSION_SWIGLU:
+            {
+                ggml_compute_forward_swiglu_f32(params, prev, node);
+            } break;
+        case GGML_FUSION_ROPE_PAIR:
+            {
+                ggml_compute_forward_rope_pair_f32(params, prev, node);
+            } break;
+        default:
+            {
+                ggml_compute_forward(params, node);
+            } break;
+    }
+}
+
+// mul_mat works in its own area of the work buffer, see ggml_cplan
+static void ggml_compute_params_set_work(struct ggml_compute_params * params, const struct ggml_cplan * cplan, const struct ggml_tensor * node) {
+    if (cplan->mul_mat_size > 0 && node->op == GGML_OP_MUL_MAT) {
+        params->wsize = cplan->mul_mat_size;
+        params->wdata = cplan->work_data + cplan->mul_mat_offs;
+    } else {
+        params->wsize = cplan->mul_mat_size > 0 ? cplan->mul_mat_offs : cplan->work_size;
+        params->wdata = cplan->work_data;
+    }
+}
+
+struct ggml_compute_threadpool;
+
+struct ggml_compute_state {
+    ggml_thread_t thrd;
+    int ith;
+    struct ggml_compute_state_shared * shared;
+    struct ggml_compute_threadpool * threadpool; // NULL when the thread only lives for one graph
+    int cpu;           // CPU the thread is pinned to, -1 if not pinned
+#if defined(__gnu_linux__)
+    cpu_set_t cpuset_saved;        // affinity of the thread before it was pinned, put back when it is released
+#elif defined(_WIN32)
+    GROUP_AFFINITY affinity_saved; // same
+#endif
+    int64_t t_busy_us; // time spent computing nodes, only tracked for thread pool workers
+    enum ggml_status ec;
+};
+
+struct ggml_compute_threadpool {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+
+    // incremented every time a new graph is dispatched to the workers
+    atomic_int n_graph;
+    // number of workers that have not yet finished the current graph
+    atomic_int n_pending;
+    atomic_int stop;
+
+    // number of threads used by the current graph (<= n_threads)
+    int n_threads_cur;
+    int n_threads;
+
+    // explicit thread placement: thread i runs on cpus[i % n_cpus], cpu_node[i % n_cpus] is its NUMA node
+    int32_t * cpus;
+    int32_t * cpu_node;
+    int       n_cpus;
+
+    struct ggml_compute_state * workers;
+};
+
+#if defined(__gnu_linux__)
+static void ggml_thread_set_cpuset(const cpu_set_t * cpuset) {
+    int rv = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), cpuset);
+    if (rv) {
+        fprintf(stderr, "warning: pthread_setaffinity_np() failed: %s\n", strerror(rv));
+    }
+}
+
+// pin the calling thread to cpu, or release it with cpu < 0, putting back the affinity it had before it was pinned
+static void ggml_thread_set_cpu(struct ggml_compute_state * state, int cpu) {
+    if (cpu == state->cpu) {
+        return;
+    }
+
+    if (cpu >= 0) {
+        if (state->cpu < 0) {
+            int rv = pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &state->cpuset_saved);
+            if (rv) {
+                fprintf(stderr, "warning: pthread_getaffinity_np() failed: %s\n", strerror(rv));
+                CPU_ZERO(&state->cpuset_saved);
+                for (int i = 0; i < CPU_SETSIZE; ++i) {
+                    CPU_SET(i, &state->cpuset_saved);
+                }
+            }
+        }
+
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpu, &cpuset);
+        ggml_thread_set_cpuset(&cpuset);
+    } else {
+        ggml_thread_set_cpuset(&state->cpuset_saved);
+    }
+
+    state->cpu = cpu;
+}
+
+static int ggml_numa_cpu_node(int cpu) {
+    for (uint32_t n = 0; n < g_state.numa.n_nodes; ++n) {
+        const struct ggml_numa_node * node = &g_state.numa.nodes[n];
+        for (uint32_t i = 0; i < node->n_cpus; ++i) {
+            if ((int) node->cpus[i] == cpu) {
+                return n;
+            }
+        }
+    }
+    return 0;
+}
+#elif defined(_WIN32)
+// CPUs are numbered across the active processor groups, in group order
+static bool ggml_thread_cpu_group(int cpu, WORD * group, BYTE * number) {
+    const WORD n_groups = GetActiveProcessorGroupCount();
+    for (WORD g = 0; g < n_groups; ++g) {
+        const int n = (int) GetActiveProcessorCount(g);
+        if (cpu < n) {
+            *group  = g;
+            *number = (BYTE) cpu;
+            return true;
+        }
+        cpu -= n;
+    }
+    return false;
+}
+
+// pin the calling thread to cpu, or release it with cpu < 0, putting back the affinity it had before it was pinned
+static void ggml_thread_set_cpu(struct ggml_compute_state * state, int cpu) {
+    if (cpu == state->cpu) {
+        return;
+    }
+
+    if (cpu >= 0) {
+        GROUP_AFFINITY affinity;
+        memset(&affinity, 0, sizeof(affinity));
+
+        BYTE number;
+        if (!ggml_thread_cpu_group(cpu, &affinity.Group, &number)) {
+            fprintf(stderr, "warning: CPU %d does not exist\n", cpu);
+            return;
+        }
+
+        GROUP_AFFINITY previous;
+        affinity.Mask = (KAFFINITY) 1 << number;
+        if (!SetThreadGroupAffinity(GetCurrentThread(), &affinity, &previous)) {
+            fprintf(stderr, "warning: SetThreadGroupAffinity() failed: %lu\n", GetLastError());
+            return;
+        }
+        if (state->cpu < 0) {
+            state->affinity_saved = previous;
+        }
+    } else {
+        if (!SetThreadGroupAffinity(GetCurrentThread(), &state->affinity_saved, NULL)) {
+            fprintf(stderr, "warning: SetThreadGroupAffinity() failed: %lu\n", GetLastError());
+        }
+    }
+
+    state->cpu = cpu;
+}
+
+static int ggml_numa_cpu_node(int cpu) {
+    PROCESSOR_NUMBER processor;
+    memset(&processor, 0, sizeof(processor));
+
+    USHORT node;
+    if (!ggml_thread_cpu_group(cpu, &processor.Group, &processor.Number) ||
+        !GetNumaProcessorNodeEx(&processor, &node) || node == 0xffff) {
+        return 0;
+    }
+    return node;
+}
+#else
+// thread placement is not implemented here, ggml_threadpool_set_affinity says so when it is asked for
+static void ggml_thread_set_cpu(struct ggml_compute_state * state, int cpu) { UNUSED(state); UNUSED(cpu); }
+static int ggml_numa_cpu_node(int cpu) { UNUSED(cpu); return 0; }
+#endif
+
+// pin the calling thread to the CPU requested by the thread pool, or release it if the pool has no placement
+static void set_threadpool_thread_affinity(struct ggml_compute_state * state) {
+    const struct ggml_compute_threadpool * tp = state->threadpool;
+
+    ggml_thread_set_cpu(state, tp->n_cpus > 0 ? tp->cpus[state->ith % tp->n_cpus] : -1);
+}
+
+static void ggml_graph_compute_perf_stats_node(struct ggml_tensor * node, const struct ggml_compute_state_shared * st) {
+    int64_t cycles_cur  = ggml_perf_cycles()  - st->perf_node_start_cycles;
+    int64_t time_us_cur = ggml_perf_time_us() - st->perf_node_start_time_us;
+
+    node->perf_runs++;
+    node->perf_cycles  += cycles_cur;
+    node->perf_time_us += time_us_cur;
+}
+
+static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads, int n_cur_threads) {
+    int n_tasks = 0;
+
+    if (ggml_is_empty(node)) {
         // no need to multi-thread a no-op
         n_tasks = 1;
         return n_tasks;
@@ -18427,6 +19524,10 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads, int n_cur_
                 //n_tasks = MIN(n_threads, ggml_nelements(node->src[1]));
                 n_tasks = MIN(n_cur_threads, ggml_nelements(node->src[1]));
             } break;
+        case GGML_OP_SET_ROWS:
+            {
+                n_tasks = MIN(n_cur_threads, ggml_nelements(node->src[1]));
+            } break;
         case GGML_OP_SCALE:
         case GGML_OP_SET:
         case GGML_OP_CONT:
@@ -18625,7 +19726,14 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
 
     const int   n_threads   = state->shared->n_threads;
 
-    set_numa_thread_affinity(state->ith);
+    // per-thread busy time is only reported for thread pool workers
+    const bool track_time = state->threadpool != NULL;
+
+    if (state->threadpool && (state->threadpool->n_cpus > 0 || state->cpu >= 0)) {
+        set_threadpool_thread_affinity(state);
+    } else {
+        set_numa_thread_affinity(state->ith);
+    }
 
     int node_n     = -1;
     int task_phase = GGML_TASK_TYPE_FINALIZE;
@@ -18638,14 +19746,18 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
         }
 
         if (atomic_fetch_sub(&state->shared->n_active, 1) == 1) {
+            const int64_t t_start_us = track_time ? ggml_time_us() : 0;
+
             // all other threads are finished and spinning
             // do finalize and init here so we don't have synchronize again
             struct ggml_compute_params params = {
-                /*.type  =*/ GGML_TASK_TYPE_FINALIZE,
-                /*.ith   =*/ 0,
-                /*.nth   =*/ 0,
-                /*.wsize =*/ cplan->work_size,
-                /*.wdata =*/ cplan->work_data,
+                /*.type        =*/ GGML_TASK_TYPE_FINALIZE,
+                /*.ith         =*/ 0,
+                /*.nth         =*/ 0,
+                /*.wsize       =*/ cplan->work_size,
+                /*.wdata       =*/ cplan->work_data,
+                /*.thread_node =*/ state->shared->thread_node,
+                /*.shared      =*/ state->shared,
             };
 
             if (node_n != -1) {
@@ -18653,7 +19765,8 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
                 struct ggml_tensor * node = cgraph->nodes[node_n];
                 if (GGML_OP_HAS_FINALIZE[node->op]) {
                     params.nth = ggml_get_n_tasks(node, n_threads, state->shared->n_threads);
-                    ggml_compute_forward(&params, node);
+                    ggml_compute_params_set_work(&params, cplan, node);
+                    ggml_graph_compute_forward(&params, state->shared, node_n);
                 }
                 ggml_graph_compute_perf_stats_node(node, state->shared);
             }
@@ -18662,28 +19775,36 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
             while (++node_n < cgraph->n_nodes) {
                 GGML_PRINT_DEBUG_5("%s: %d/%d\n", __func__, node_n, cgraph->n_nodes);
                 struct ggml_tensor * node = cgraph->nodes[node_n];
+
+                // computed together with a later node
+                if (ggml_graph_node_deferred(state->shared, node_n)) {
+                    continue;
+                }
+
                 const int n_tasks = ggml_get_n_tasks(node, n_threads, state->shared->n_threads);
 
                 state->shared->perf_node_start_cycles  = ggml_perf_cycles();
                 state->shared->perf_node_start_time_us = ggml_perf_time_us();
 
                 params.nth = n_tasks;
+                ggml_compute_params_set_work(&params, cplan, node);
 
                 if (n_tasks == 1) {
                     /* INIT */
                     if (GGML_OP_HAS_INIT[node->op]) {
                         params.type = GGML_TASK_TYPE_INIT;
-                        ggml_compute_forward(&params, node);
+                        ggml_graph_compute_forward(&params, state->shared, node_n);
                     }
 
                     // TODO: maybe push node_n to the atomic but if other threads see n_tasks is 1,
                     // they do something more efficient than spinning (?)
+                    atomic_store(&state->shared->current_chunk, 1);
                     params.type = GGML_TASK_TYPE_COMPUTE;
-                    ggml_compute_forward(&params, node);
+                    ggml_graph_compute_forward(&params, state->shared, node_n);
 
                     if (GGML_OP_HAS_FINALIZE[node->op]) {
                         params.type = GGML_TASK_TYPE_FINALIZE;
-                        ggml_compute_forward(&params, node);
+                        ggml_graph_compute_forward(&params, state->shared, node_n);
                     }
 
                     ggml_graph_compute_perf_stats_node(node, state->shared);
@@ -18696,6 +19817,10 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
                 }
             }
 
+            if (track_time) {
+                state->t_busy_us += ggml_time_us() - t_start_us;
+            }
+
             task_phase = GGML_TASK_TYPE_INIT;
             atomic_store(&state->shared->n_active,  n_threads);
             atomic_store(&state->shared->node_n,    node_n);
@@ -18713,21 +19838,25 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
         const int n_tasks = ggml_get_n_tasks(node, n_threads, state->shared->n_threads);
 
         struct ggml_compute_params params = {
-            /*.type  =*/ GGML_TASK_TYPE_INIT,
-            /*.ith   =*/ state->ith,
-            /*.nth   =*/ n_tasks,
-            /*.wsize =*/ cplan->work_size,
-            /*.wdata =*/ cplan->work_data,
+            /*.type        =*/ GGML_TASK_TYPE_INIT,
+            /*.ith         =*/ state->ith,
+            /*.nth         =*/ n_tasks,
+            /*.wsize       =*/ cplan->work_size,
+            /*.wdata       =*/ cplan->work_data,
+            /*.thread_node =*/ state->shared->thread_node,
+            /*.shared      =*/ state->shared,
         };
+        ggml_compute_params_set_work(&params, cplan, node);
 
         if (state->ith < n_tasks) {
             if (GGML_OP_HAS_INIT[node->op]) {
-                ggml_compute_forward(&params, node);
+                ggml_graph_compute_forward(&params, state->shared, node_n);
             }
         }
 
         if (atomic_fetch_sub(&state->shared->n_active, 1) == 1) {
             task_phase = GGML_TASK_TYPE_COMPUTE;
+            atomic_store(&state->shared->current_chunk, n_tasks);
             atomic_store(&state->shared->n_active,  n_threads);
             atomic_store(&state->shared->node_task, task_phase);
         }
@@ -18742,8 +19871,14 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
         }
 
         if (state->ith < n_tasks) {
+            const int64_t t_start_us = track_time ? ggml_time_us() : 0;
+
             params.type = GGML_TASK_TYPE_COMPUTE;
-            ggml_compute_forward(&params, node);
+            ggml_graph_compute_forward(&params, state->shared, node_n);
+
+            if (track_time) {
+                state->t_busy_us += ggml_time_us() - t_start_us;
+            }
         }
 
         if (atomic_fetch_sub(&state->shared->n_active, 1) == 1) {
@@ -18764,7 +19899,8 @@ struct ggml_cplan ggml_graph_plan(const struct ggml_cgraph * cgraph, int n_threa
         n_threads = GGML_DEFAULT_N_THREADS;
     }
 
-    size_t work_size = 0;
+    size_t work_size    = 0;
+    size_t mul_mat_size = 0;
 
     struct ggml_cplan cplan;
     memset(&cplan, 0, sizeof(struct ggml_cplan));
@@ -18825,6 +19961,9 @@ struct ggml_cplan ggml_graph_plan(const struct ggml_cgraph * cgraph, int n_threa
                     if (node->src[1]->type != vec_dot_type) {
                         cur = ggml_row_size(vec_dot_type, ggml_nelements(node->src[1]));
                     }
+
+                    mul_mat_size = MAX(mul_mat_size, cur);
+                    cur = 0;
                 } break;
             case GGML_OP_MUL_MAT_ID:
                 {
@@ -18906,7 +20045,7 @@ struct ggml_cplan ggml_graph_plan(const struct ggml_cgraph * cgraph, int n_threa
                 {
                     const int64_t ne00 = node->src[0]->ne[0]; // D
 
-                    cur = 2*sizeof(float)*ne00*n_tasks; // 2x head size
+                    cur = 3*sizeof(float)*ne00*n_tasks; // 3x head size: V accumulator, dequantized V row, converted Q
                 } break;
             case GGML_OP_FLASH_FF:
                 {
@@ -18951,6 +20090,21 @@ struct ggml_cplan ggml_graph_plan(const struct ggml_cgraph * cgraph, int n_threa
         work_size += CACHE_LINE_SIZE*(n_threads - 1);
     }
 
+    // mul_mat gets an area of its own after the scratch of the other ops, so that a converted src1 survives them
+    if (mul_mat_size > 0) {
+        cplan.mul_mat_offs = GGML_PAD(work_size, CACHE_LINE_SIZE);
+        cplan.mul_mat_size = mul_mat_size;
+        work_size = cplan.mul_mat_offs + mul_mat_size;
+    }
+
+    // followed by the fused groups of the graph, found again on each compute since they depend on the memory
+    // ggml-alloc gave the nodes
+    if (cgraph->n_nodes > 0) {
+        cplan.fusion_offs = work_size;
+        cplan.fusion_size = cgraph->n_nodes*sizeof(struct ggml_fusion);
+        work_size = cplan.fusion_offs + cplan.fusion_size;
+    }
+
     cplan.n_threads = MIN(max_tasks, n_threads);
     cplan.work_size = work_size;
     cplan.work_data = NULL;
@@ -18958,6 +20112,181 @@ struct ggml_cplan ggml_graph_plan(const struct ggml_cgraph * cgraph, int n_threa
     return cplan;
 }
 
+//
+// persistent thread pool
+//
+
+// number of iterations a parked worker spins before going to sleep on the condition variable
+#ifndef GGML_THREADPOOL_SPIN_COUNT
+#define GGML_THREADPOOL_SPIN_COUNT (1 << 16)
+#endif
+
+static inline void ggml_thread_cpu_relax(void) {
+#if defined(_MSC_VER)
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+static thread_ret_t ggml_threadpool_worker(void * data) {
+    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+    struct ggml_compute_threadpool * tp = state->threadpool;
+
+    int last_graph = 0;
+
+    while (true) {
+        // spin for a while so back-to-back graphs (e.g. token generation) do not pay for a wake-up
+        for (int i = 0; i < GGML_THREADPOOL_SPIN_COUNT; ++i) {
+            if (atomic_load(&tp->n_graph) != last_graph || atomic_load(&tp->stop)) {
+                break;
+            }
+            ggml_thread_cpu_relax();
+        }
+
+        // read the graph counter and the thread count of that graph under the lock so they are consistent
+        pthread_mutex_lock(&tp->mutex);
+        while (atomic_load(&tp->n_graph) == last_graph && !atomic_load(&tp->stop)) {
+            pthread_cond_wait(&tp->cond, &tp->mutex);
+        }
+        const bool stop      = atomic_load(&tp->stop);
+        const int  n_threads = tp->n_threads_cur;
+        last_graph = atomic_load(&tp->n_graph);
+        pthread_mutex_unlock(&tp->mutex);
+
+        if (stop) {
+            break;
+        }
+
+        if (state->ith < n_threads) {
+            ggml_graph_compute_thread(state);
+            atomic_fetch_sub(&tp->n_pending, 1);
+        }
+    }
+
+    return 0;
+}
+
+struct ggml_compute_threadpool * ggml_threadpool_new(int n_threads) {
+    if (n_threads <= 0) {
+        n_threads = GGML_DEFAULT_N_THREADS;
+    }
+
+    struct ggml_compute_threadpool * tp = GGML_MALLOC(sizeof(struct ggml_compute_threadpool));
+
+    pthread_mutex_init(&tp->mutex, NULL);
+    pthread_cond_init(&tp->cond, NULL);
+
+    atomic_store(&tp->n_graph,   0);
+    atomic_store(&tp->n_pending, 0);
+    atomic_store(&tp->stop,      0);
+
+    tp->n_threads_cur = 0;
+    tp->n_threads     = n_threads;
+    tp->cpus          = NULL;
+    tp->cpu_node      = NULL;
+    tp->n_cpus        = 0;
+    tp->workers       = GGML_MALLOC(sizeof(struct ggml_compute_state)*n_threads);
+
+    for (int j = 0; j < n_threads; ++j) {
+        tp->workers[j] = (struct ggml_compute_state) {
+            .thrd       = 0,
+            .ith        = j,
+            .shared     = NULL,
+            .threadpool = tp,
+            .cpu        = -1,
+            .t_busy_us  = 0,
+            .ec         = GGML_STATUS_SUCCESS,
+        };
+    }
+
+    // worker 0 is the thread that calls ggml_graph_compute()
+    for (int j = 1; j < n_threads; ++j) {
+        const int rc = ggml_thread_create(&tp->workers[j].thrd, NULL, ggml_threadpool_worker, &tp->workers[j]);
+        GGML_ASSERT(rc == 0);
+        UNUSED(rc);
+    }
+
+    return tp;
+}
+
+void ggml_threadpool_free(struct ggml_compute_threadpool * tp) {
+    if (tp == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&tp->mutex);
+    atomic_store(&tp->stop, 1);
+    pthread_cond_broadcast(&tp->cond);
+    pthread_mutex_unlock(&tp->mutex);
+
+    for (int j = 1; j < tp->n_threads; ++j) {
+        const int rc = ggml_thread_join(tp->workers[j].thrd, NULL);
+        GGML_ASSERT(rc == 0);
+        UNUSED(rc);
+    }
+
+    pthread_cond_destroy(&tp->cond);
+    pthread_mutex_destroy(&tp->mutex);
+
+    GGML_FREE(tp->cpus);
+    GGML_FREE(tp->cpu_node);
+    GGML_FREE(tp->workers);
+    GGML_FREE(tp);
+}
+
+int ggml_threadpool_get_n_threads(const struct ggml_compute_threadpool * tp) {
+    return tp->n_threads;
+}
+
+void ggml_threadpool_set_affinity(struct ggml_compute_threadpool * tp, const int32_t * cpus, int n_cpus) {
+    GGML_ASSERT(n_cpus >= 0);
+
+#if !defined(__gnu_linux__) && !defined(_WIN32)
+    if (n_cpus > 0) {
+        fprintf(stderr, "warning: CPU affinity is not supported on this platform, the threads will not be pinned\n");
+    }
+#endif
+
+    pthread_mutex_lock(&tp->mutex);
+
+    GGML_FREE(tp->cpus);
+    GGML_FREE(tp->cpu_node);
+    tp->cpus     = NULL;
+    tp->cpu_node = NULL;
+    tp->n_cpus   = 0;
+
+    if (n_cpus > 0) {
+        tp->cpus     = GGML_MALLOC(sizeof(int32_t)*n_cpus);
+        tp->cpu_node = GGML_MALLOC(sizeof(int32_t)*n_cpus);
+        for (int i = 0; i < n_cpus; ++i) {
+            tp->cpus[i]     = cpus[i];
+            tp->cpu_node[i] = ggml_numa_cpu_node(cpus[i]);
+        }
+        tp->n_cpus = n_cpus;
+    }
+
+    pthread_mutex_unlock(&tp->mutex);
+
+    // the workers apply the new placement at the start of the next graph
+}
+
+int ggml_threadpool_get_thread_times(const struct ggml_compute_threadpool * tp, int64_t * t_busy_us, int n_max) {
+    const int n = MIN(n_max, tp->n_threads);
+    for (int j = 0; j < n; ++j) {
+        t_busy_us[j] = tp->workers[j].t_busy_us;
+    }
+    return n;
+}
+
+void ggml_threadpool_reset_thread_times(struct ggml_compute_threadpool * tp) {
+    for (int j = 0; j < tp->n_threads; ++j) {
+        tp->workers[j].t_busy_us = 0;
+    }
+}
+
 enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
     {
         GGML_ASSERT(cplan);
@@ -18966,32 +20295,83 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
         if (cplan->work_size > 0) {
             GGML_ASSERT(cplan->work_data);
         }
+
+        if (cplan->threadpool) {
+            GGML_ASSERT(cplan->n_threads <= cplan->threadpool->n_threads);
+        }
     }
 
     const int n_threads = cplan->n_threads;
 
+    struct ggml_compute_threadpool * tp = cplan->threadpool;
+
+    // node of each thread, so that ops can give the threads of a node a node-local share of the weights
+    int32_t * thread_node = NULL;
+    if (ggml_is_numa() && n_threads > 1) {
+        if (tp && tp->n_cpus > 0) {
+            thread_node = alloca(sizeof(int32_t)*n_threads);
+            for (int j = 0; j < n_threads; ++j) {
+                thread_node[j] = tp->cpu_node[j % tp->n_cpus];
+            }
+        } else if (g_state.numa.numa_strategy == GGML_NUMA_STRATEGY_DISTRIBUTE) {
+            // matches set_numa_thread_affinity()
+            thread_node = alloca(sizeof(int32_t)*n_threads);
+            for (int j = 0; j < n_threads; ++j) {
+                thread_node[j] = j % g_state.numa.n_nodes;
+            }
+        }
+    }
+
+    struct ggml_fusion * fusion = NULL;
+    if (cplan->fusion_size > 0 && cplan->fusion_size >= cgraph->n_nodes*sizeof(struct ggml_fusion)) {
+        fusion = (struct ggml_fusion *) (cplan->work_data + cplan->fusion_offs);
+        ggml_graph_fuse(cgraph, fusion);
+    }
+
     struct ggml_compute_state_shared state_shared = {
         /*.cgraph                  =*/ cgraph,
         /*.cgraph_plan             =*/ cplan,
         /*.perf_node_start_cycles  =*/ 0,
         /*.perf_node_start_time_us =*/ 0,
         /*.n_threads               =*/ n_threads,
+        /*.thread_node             =*/ thread_node,
         /*.n_active                =*/ n_threads,
         /*.node_n                  =*/ -1,
         /*.node_task               =*/ GGML_TASK_TYPE_FINALIZE,
+        /*.current_chunk           =*/ 0,
+        /*.mul_mat_src1            =*/ NULL,
+        /*.mul_mat_vec_dot_type    =*/ GGML_TYPE_COUNT,
+        /*.mul_mat_node_n          =*/ -1,
+        /*.fusion                  =*/ fusion,
         /*.abort_callback          =*/ NULL,
         /*.abort_callback_data     =*/ NULL,
     };
-    struct ggml_compute_state * workers = alloca(sizeof(struct ggml_compute_state)*n_threads);
 
-    // create thread pool
-    if (n_threads > 1) {
+    struct ggml_compute_state * workers = tp ? tp->workers : alloca(sizeof(struct ggml_compute_state)*n_threads);
+
+    if (tp) {
+        // wake up the parked workers
+        pthread_mutex_lock(&tp->mutex);
+        for (int j = 0; j < n_threads; ++j) {
+            workers[j].shared = &state_shared;
+            workers[j].ec     = GGML_STATUS_SUCCESS;
+        }
+        tp->n_threads_cur = n_threads;
+        atomic_store(&tp->n_pending, n_threads - 1);
+        atomic_fetch_add(&tp->n_graph, 1);
+        pthread_cond_broadcast(&tp->cond);
+        pthread_mutex_unlock(&tp->mutex);
+    } else if (n_threads > 1) {
+        // create thread pool
         for (int j = 1; j < n_threads; ++j) {
             workers[j] = (struct ggml_compute_state) {
-                .thrd   = 0,
-                .ith = j,
-                .shared = &state_shared,
-                .ec = GGML_STATUS_SUCCESS,
+                .thrd       = 0,
+                .ith        = j,
+                .shared     = &state_shared,
+                .threadpool = NULL,
+                .cpu        = -1,
+                .t_busy_us  = 0,
+                .ec         = GGML_STATUS_SUCCESS,
             };
 
             const int rc = ggml_thread_create(&workers[j].thrd, NULL, ggml_graph_compute_thread, &workers[j]);
@@ -19002,7 +20382,12 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
 
     workers[0].ith = 0;
     workers[0].shared = &state_shared;
+    workers[0].threadpool = tp;
+    workers[0].cpu = -1; // the calling thread is released again at the end of the graph
     workers[0].ec = GGML_STATUS_SUCCESS;
+    if (!tp) {
+        workers[0].t_busy_us = 0;
+    }
 
     const int64_t perf_start_cycles  = ggml_perf_cycles();
     const int64_t perf_start_time_us = ggml_perf_time_us();
@@ -19011,11 +20396,24 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
     ggml_graph_compute_thread(&workers[0]);
     enum ggml_status compute_status = workers[0].ec;
 
-    // don't leave affinity set on the main thread
-    clear_numa_thread_affinity();
+    // don't leave affinity set on the main thread: it is pinned like the workers for the duration of the graph only
+    if (tp && tp->n_cpus > 0) {
+        ggml_thread_set_cpu(&workers[0], -1);
+    } else {
+        clear_numa_thread_affinity();
+    }
 
-    // join or kill thread pool
-    if (n_threads > 1) {
+    if (tp) {
+        // wait for the workers to leave the graph, they stay alive for the next one
+        while (atomic_load(&tp->n_pending) > 0) {
+            ggml_thread_cpu_relax();
+        }
+        for (int j = 1; j < n_threads; j++) {
+            if (workers[j].ec != GGML_STATUS_SUCCESS)
+                compute_status = workers[j].ec;
+        }
+    } else if (n_threads > 1) {
+        // join or kill thread pool
         for (int j = 1; j < n_threads; j++) {
             const int rc = ggml_thread_join(workers[j].thrd, NULL);
             GGML_ASSERT(rc == 0);
@@ -20778,6 +22176,40 @@ size_t ggml_quantize_chunk(
     return result;
 }
 
+enum ggml_type ggml_get_interleaved_type(enum ggml_type type, int64_t ne0, int64_t ne1) {
+    if (ne1 % 4 != 0) {
+        return type;
+    }
+
+    switch (type) {
+        case GGML_TYPE_Q4_0: return ne0 % QK4_0 == 0 ? GGML_TYPE_Q4_0_X4 : type;
+        case GGML_TYPE_Q8_0: return ne0 % QK8_0 == 0 ? GGML_TYPE_Q8_0_X4 : type;
+        default:             return type;
+    }
+}
+
+bool ggml_is_interleaved(enum ggml_type type) {
+    return type == GGML_TYPE_Q4_0_X4 || type == GGML_TYPE_Q8_0_X4;
+}
+
+void ggml_repack_rows(enum ggml_type type, void * dst, const void * src, int64_t nrows, int64_t n_per_row) {
+    switch (type) {
+        case GGML_TYPE_Q4_0_X4: repack_q4_0_x4(src, dst, nrows, n_per_row); break;
+        case GGML_TYPE_Q8_0_X4: repack_q8_0_x4(src, dst, nrows, n_per_row); break;
+        default:
+            GGML_ASSERT(false && "not an interleaved type");
+    }
+}
+
+void ggml_unpack_rows(enum ggml_type type, void * dst, const void * src, int64_t nrows, int64_t n_per_row) {
+    switch (type) {
+        case GGML_TYPE_Q4_0_X4: unpack_q4_0_x4(src, dst, nrows, n_per_row); break;
+        case GGML_TYPE_Q8_0_X4: unpack_q8_0_x4(src, dst, nrows, n_per_row); break;
+        default:
+            GGML_ASSERT(false && "not an interleaved type");
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 struct gguf_str {
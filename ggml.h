@@ -337,6 +337,7 @@ extern "C" {
 
     struct ggml_object;
     struct ggml_context;
+    struct ggml_compute_state_shared;
 
     // NOTE: always add types at the end of the enum to keep backward compatibility
     enum ggml_type {
@@ -370,6 +371,10 @@ extern "C" {
         GGML_TYPE_I64     = 27,
         GGML_TYPE_F64     = 28,
         GGML_TYPE_IQ1_M   = 29,
+        // Q4_0 and Q8_0 with the blocks of 4 consecutive rows interleaved, see ggml_repack_rows
+        // these layouts are created at load time and are never stored in files
+        GGML_TYPE_Q4_0_X4 = 30,
+        GGML_TYPE_Q8_0_X4 = 31,
         GGML_TYPE_COUNT,
     };
 
@@ -453,6 +458,7 @@ extern "C" {
         GGML_OP_TRANSPOSE,
         GGML_OP_GET_ROWS,
         GGML_OP_GET_ROWS_BACK,
+        GGML_OP_SET_ROWS,
         GGML_OP_DIAG,
         GGML_OP_DIAG_MASK_INF,
         GGML_OP_DIAG_MASK_ZERO,
@@ -602,6 +608,9 @@ extern "C" {
     // If it returns true, the computation is aborted
     typedef bool (*ggml_abort_callback)(void * data);
 
+    // persistent pool of worker threads that can be reused across ggml_graph_compute() calls
+    struct ggml_compute_threadpool;
+
     // the compute plan that needs to be prepared for ggml_graph_compute()
     // since https://github.com/ggerganov/ggml/issues/287
     struct ggml_cplan {
@@ -610,6 +619,24 @@ extern "C" {
 
         int n_threads;
 
+        // optional: run on these worker threads instead of creating new ones for each call
+        // must have been created with at least n_threads threads
+        struct ggml_compute_threadpool * threadpool;
+
+        // by default the heavy ops (mul_mat, flash_attn_ext, ...) are split into chunks that idle threads
+        // take from a shared counter; set to true to give every thread a fixed share of the work instead
+        bool static_chunking;
+
+        // area of work_data that holds src1 of MUL_MAT converted to vec_dot_type, kept apart from the scratch of
+        // the other ops so that mul_mats sharing src1 (Q/K/V, gate/up) convert it once per graph; 0 when not used
+        size_t mul_mat_offs;
+        size_t mul_mat_size;
+
+        // area of work_data where ggml_graph_compute records the nodes it computes as one fused kernel
+        // (rms_norm + mul, silu + mul, the ropes of Q and K); 0 computes every node on its own
+        size_t fusion_offs;
+        size_t fusion_size;
+
         // abort ggml_graph_compute when true
         ggml_abort_callback abort_callback;
         void *              abort_callback_data;
@@ -680,6 +707,12 @@ extern "C" {
         // work buffer for all threads
         size_t wsize;
         void * wdata;
+
+        // NUMA node of each thread, NULL when the thread placement is not node-aware
+        const int32_t * thread_node;
+
+        // state shared by the threads computing the graph (work distribution)
+        struct ggml_compute_state_shared * shared;
     };
 
     // numa strategies
@@ -1383,6 +1416,16 @@ extern "C" {
             struct ggml_tensor  * b,
             struct ggml_tensor  * c);
 
+    // a[b[i]] = c[i], converting the F32 rows of c to the type of a
+    // b is an I32 vector, c an F32 matrix with b->ne[0] rows
+    // the elements of a row of a do not have to be consecutive for F32 and F16 (e.g. a transposed view)
+    // returns a view of a
+    GGML_API struct ggml_tensor * ggml_set_rows(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b,
+            struct ggml_tensor  * c);
+
     GGML_API struct ggml_tensor * ggml_diag(
         struct ggml_context     * ctx,
         struct ggml_tensor      * a);
@@ -2003,6 +2046,24 @@ extern "C" {
     // note: the drawback of this API is that you must have ensured that the context has enough memory for the work data
     GGML_API enum ggml_status  ggml_graph_compute_with_ctx(struct ggml_context * ctx, struct ggml_cgraph * cgraph, int n_threads);
 
+    // worker threads stay alive between graph computations: they spin for a short while after
+    // each graph and then sleep until the next one is dispatched
+    // the calling thread is always used as worker 0, so n_threads - 1 threads are created
+    GGML_API struct ggml_compute_threadpool * ggml_threadpool_new          (int n_threads);
+    GGML_API void                             ggml_threadpool_free         (struct ggml_compute_threadpool * threadpool);
+    GGML_API int                              ggml_threadpool_get_n_threads(const struct ggml_compute_threadpool * threadpool);
+
+    // pin the worker threads: thread i runs on cpus[i % n_cpus]
+    // n_cpus = 0 restores the default placement (see ggml_numa_init)
+    // implemented on Linux and Windows, elsewhere a warning is printed and the threads are not pinned
+    // must not be called while a graph is being computed on the pool
+    GGML_API void ggml_threadpool_set_affinity(struct ggml_compute_threadpool * threadpool, const int32_t * cpus, int n_cpus);
+
+    // time in microseconds each thread spent computing graph nodes since the pool was created or the last reset
+    // returns the number of entries written to t_busy_us
+    GGML_API int  ggml_threadpool_get_thread_times  (const struct ggml_compute_threadpool * threadpool, int64_t * t_busy_us, int n_max);
+    GGML_API void ggml_threadpool_reset_thread_times(struct ggml_compute_threadpool * threadpool);
+
     GGML_API struct ggml_tensor * ggml_graph_get_tensor(struct ggml_cgraph * cgraph, const char * name);
 
     GGML_API void                 ggml_graph_export(const struct ggml_cgraph * cgraph, const char * fname);
@@ -2235,6 +2296,19 @@ extern "C" {
                    int64_t   n_per_row,
                const float * imatrix);
 
+    // interleaved weight layouts
+    //
+    // the blocks of 4 consecutive rows are stored next to each other, so that the CPU mat-mul kernels compute
+    // 4 rows per load of the activations and reduce them together; only usable as src0 of ggml_mul_mat
+    //
+    // returns the interleaved variant of type for a matrix of ne0 x ne1 elements, or type if there is none
+    GGML_API enum ggml_type ggml_get_interleaved_type(enum ggml_type type, int64_t ne0, int64_t ne1);
+    GGML_API bool           ggml_is_interleaved      (enum ggml_type type);
+
+    // convert nrows rows (a multiple of 4) between the row-major layout and the interleaved type
+    GGML_API void ggml_repack_rows(enum ggml_type type, void * dst, const void * src, int64_t nrows, int64_t n_per_row);
+    GGML_API void ggml_unpack_rows(enum ggml_type type, void * dst, const void * src, int64_t nrows, int64_t n_per_row);
+
     //
     // gguf
     //
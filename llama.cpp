@@ -60,6 +60,7 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <cfloat>
@@ -1763,10 +1764,34 @@ struct llama_state {
     // We save the log callback globally
     ggml_log_callback log_callback = llama_log_callback_default;
     void * log_callback_user_data = nullptr;
+
+    // structured events, see llama_event_set
+    llama_event_callback event_callback = nullptr;
+    void * event_callback_user_data = nullptr;
 };
 
 static llama_state g_state;
 
+static void llama_event_emit(llama_event & event, const llama_context * ctx = nullptr) {
+    if (g_state.event_callback) {
+        event.ctx = ctx;
+        g_state.event_callback(&event, g_state.event_callback_user_data);
+    }
+}
+
+static void llama_event_buffer(enum llama_buffer_usage usage, ggml_backend_buffer_t buf, const llama_context * ctx = nullptr) {
+    if (!g_state.event_callback || buf == nullptr) {
+        return;
+    }
+    llama_event event;
+    event.type           = LLAMA_EVENT_TYPE_BUFFER;
+    event.buffer.usage   = usage;
+    event.buffer.name    = ggml_backend_buffer_name(buf);
+    event.buffer.size    = ggml_backend_buffer_get_size(buf);
+    event.buffer.is_host = ggml_backend_buffer_is_host(buf);
+    llama_event_emit(event, ctx);
+}
+
 // available llama models
 enum e_model {
     MODEL_UNKNOWN,
@@ -2057,6 +2082,23 @@ struct llama_kv_cache {
 
     std::vector<llama_kv_cell> cells;
 
+    // cells are handed out in pages of page_size cells: a sequence appends to the page of its last token and takes a
+    // free page when that one is full, so the tokens of a sequence stay together while a ubatch can be scattered over
+    // any free cells without defragmenting the cache first
+    // scattering needs the backends of the cache to store K and V with ggml_set_rows, otherwise a ubatch is only
+    // placed in consecutive cells
+    uint32_t page_size = 32;
+    bool     set_rows  = false;
+
+    // cell of the last token stored for each sequence, a hint that is checked before use
+    std::unordered_map<llama_seq_id, uint32_t> seq_tail;
+
+    // cell of each token of the last ubatch placed by llama_kv_cache_find_slot
+    std::vector<uint32_t> slots;
+
+    // input of the graph with the cells of kv.slots, the rows K and V are stored to when set_rows is enabled
+    struct ggml_tensor * inp_slots = nullptr; // I32 [n_batch]
+
     std::vector<struct ggml_tensor *> k_l; // per layer
     std::vector<struct ggml_tensor *> v_l;
 
@@ -2162,6 +2204,21 @@ struct llama_vocab {
     }
 };
 
+// prefix trie over the decoded code points of the vocabulary, used to compute grammar masks
+// nodes are stored in pre-order: the children of a node follow it, and each subtree ends at node.end
+struct llama_grammar_trie {
+    struct node {
+        uint32_t code_point;
+        uint32_t end;         // one past the last node of the subtree
+        uint32_t token_begin; // range in tokens of the tokens that end at this node
+        uint32_t token_end;
+    };
+
+    std::vector<node>               nodes;
+    std::vector<llama_token>        tokens;
+    std::vector<llama_partial_utf8> partial_utf8; // incomplete UTF-8 sequence at the end of each token
+};
+
 struct llama_model {
     e_model     type  = MODEL_UNKNOWN;
     llm_arch    arch  = LLM_ARCH_UNKNOWN;
@@ -2225,6 +2282,10 @@ struct llama_model {
     int64_t t_load_us = 0;
     int64_t t_start_us = 0;
 
+    // built on first use by a grammar, see llama_grammar_allowed_tokens
+    mutable std::once_flag                      grammar_trie_once;
+    mutable std::unique_ptr<llama_grammar_trie> grammar_trie;
+
     ~llama_model() {
         for (struct ggml_context * ctx : ctxs) {
             ggml_free(ctx);
@@ -2240,6 +2301,36 @@ struct llama_model {
     }
 };
 
+// the last decode graph, kept built, split and allocated by the scheduler so that following ubatches of the same
+// shape (typically one token per sequence during generation) only rewrite the input tensors and, unless K and V are
+// stored with ggml_set_rows, re-point the KV cache stores to the new cells
+// any other graph built in buf_compute_meta, or scheduled with lctx.sched, invalidates it
+struct llama_graph_cache {
+    struct shape {
+        int32_t  n_tokens;
+        int32_t  n_outputs;
+        uint32_t n_kv;
+        bool     embd;        // embeddings instead of tokens as input
+        bool     causal_attn;
+
+        bool operator==(const shape & other) const {
+            return n_tokens == other.n_tokens && n_outputs == other.n_outputs && n_kv == other.n_kv &&
+                   embd == other.embd && causal_attn == other.causal_attn;
+        }
+    };
+
+    struct ggml_cgraph * graph = nullptr;
+    shape                key   = {};
+
+    // the views (and copies) the graph stores K and V through, with the bytes between consecutive cells of each
+    std::vector<std::pair<struct ggml_tensor *, size_t>> stores;
+
+    void clear() {
+        graph = nullptr;
+        stores.clear();
+    }
+};
+
 struct llama_context {
     llama_context(const llama_model & model) : model(model), t_start_us(model.t_start_us), t_load_us(model.t_load_us) {}
     ~llama_context() {
@@ -2271,14 +2362,15 @@ struct llama_context {
 
     int64_t t_start_us;
     int64_t t_load_us;
-    int64_t t_sample_us = 0;
+    // sampling may run concurrently for different sequences of the same context
+    std::atomic<int64_t> t_sample_us{0};
     int64_t t_p_eval_us = 0;
     int64_t t_eval_us   = 0;
 
     int64_t t_compute_start_us = 0;
     int64_t n_queued_tokens = 0;
 
-    int32_t n_sample = 0; // number of tokens sampled
+    std::atomic<int32_t> n_sample{0}; // number of tokens sampled
     int32_t n_p_eval = 0; // number of tokens in eval calls for the prompt (with batch size > 1)
     int32_t n_eval   = 0; // number of eval calls
 
@@ -2328,6 +2420,9 @@ struct llama_context {
     // control vectors
     struct llama_control_vector cvec;
 
+    // decode graph reused across steps
+    struct llama_graph_cache graph_cache;
+
 #ifdef GGML_USE_MPI
     ggml_mpi_context * ctx_mpi = NULL;
 #endif
@@ -2337,6 +2432,53 @@ struct llama_context {
 // kv cache helpers
 //
 
+// true when the backend of every buffer of the cache can store a ubatch to arbitrary cells with ggml_set_rows
+static bool llama_kv_cache_supports_set_rows(const struct llama_kv_cache & cache, const llama_context * ctx) {
+    const auto & hparams = ctx->model.hparams;
+
+    const int64_t n_embd_k_gqa = hparams.n_embd_k_gqa();
+    const int64_t n_embd_v_gqa = hparams.n_embd_v_gqa();
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 16*ggml_tensor_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+    ggml_context * ctx_probe = ggml_init(params);
+    if (!ctx_probe) {
+        return false;
+    }
+
+    // the same stores as llm_build_kv_store, for a single token
+    ggml_tensor * slots = ggml_new_tensor_1d(ctx_probe, GGML_TYPE_I32, 1);
+    ggml_tensor * k = ggml_new_tensor_2d(ctx_probe, cache.type_k, n_embd_k_gqa, cache.size);
+    ggml_tensor * v = cache.v_trans
+        ? ggml_transpose(ctx_probe, ggml_new_tensor_2d(ctx_probe, cache.type_v, cache.size, n_embd_v_gqa))
+        : ggml_new_tensor_2d(ctx_probe, cache.type_v, n_embd_v_gqa, cache.size);
+    ggml_tensor * k_store = ggml_set_rows(ctx_probe, k, slots, ggml_new_tensor_2d(ctx_probe, GGML_TYPE_F32, n_embd_k_gqa, 1));
+    ggml_tensor * v_store = ggml_set_rows(ctx_probe, v, slots, ggml_new_tensor_2d(ctx_probe, GGML_TYPE_F32, n_embd_v_gqa, 1));
+
+    bool supported = true;
+    for (ggml_backend_buffer_t buf : cache.bufs) {
+        // the scheduler runs the store on the first backend that can use the buffer
+        ggml_backend_t backend = nullptr;
+        for (ggml_backend_t b : ctx->backends) {
+            if (ggml_backend_buft_supports_backend(ggml_backend_buffer_get_type(buf), b)) {
+                backend = b;
+                break;
+            }
+        }
+        if (!backend || !ggml_backend_supports_op(backend, k_store) || !ggml_backend_supports_op(backend, v_store)) {
+            supported = false;
+            break;
+        }
+    }
+
+    ggml_free(ctx_probe);
+
+    return supported;
+}
+
 static bool llama_kv_cache_init(
              struct llama_kv_cache & cache,
                const llama_context * ctx,
@@ -2376,6 +2518,9 @@ static bool llama_kv_cache_init(
     cache.cells.clear();
     cache.cells.resize(kv_size);
 
+    cache.seq_tail.clear();
+    cache.slots.clear();
+
     if (cache.recurrent) {
         // init state copy sources
         for (uint32_t i = 0; i < cache.size; ++i) {
@@ -2431,27 +2576,86 @@ static bool llama_kv_cache_init(
     // allocate tensors and initialize the buffers to avoid NaNs in the padding
     for (auto it : ctx_map) {
         ggml_backend_buffer_type_t buft = it.first;
-        ggml_context * ctx = it.second;
-        ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors_from_buft(ctx, buft);
+        ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors_from_buft(it.second, buft);
         if (!buf) {
             LLAMA_LOG_ERROR("%s: failed to allocate buffer for kv cache\n", __func__);
             return false;
         }
         ggml_backend_buffer_clear(buf, 0);
         LLAMA_LOG_INFO("%s: %10s KV buffer size = %8.2f MiB\n", __func__, ggml_backend_buffer_name(buf), ggml_backend_buffer_get_size(buf)/1024.0/1024.0);
+        llama_event_buffer(LLAMA_BUFFER_USAGE_KV, buf, ctx);
         cache.bufs.push_back(buf);
     }
 
+    cache.set_rows = !cache.recurrent && llama_kv_cache_supports_set_rows(cache, ctx);
+
+    return true;
+}
+
+static bool llama_kv_cache_page_is_free(const struct llama_kv_cache & cache, uint32_t page) {
+    const uint32_t i0 = page*cache.page_size;
+    const uint32_t i1 = std::min(i0 + cache.page_size, cache.size);
+
+    for (uint32_t i = i0; i < i1; ++i) {
+        if (cache.cells[i].pos >= 0) {
+            return false;
+        }
+    }
+
     return true;
 }
 
-// find an empty slot of size "n_tokens" in the cache
+// find a free cell for the next token of seq_id
+// has_free_pages is cleared once the page search fails, so that it is not repeated for the rest of the batch
+static int32_t llama_kv_cache_find_cell(struct llama_kv_cache & cache, llama_seq_id seq_id, bool & has_free_pages) {
+    // continue the page of the last token of the sequence
+    auto it = cache.seq_tail.find(seq_id);
+    if (it != cache.seq_tail.end()) {
+        const uint32_t tail = it->second;
+        if (tail + 1 < cache.size && (tail + 1) % cache.page_size != 0 &&
+            cache.cells[tail].has_seq_id(seq_id) && cache.cells[tail + 1].pos < 0) {
+            return tail + 1;
+        }
+    }
+
+    // start a free page, searching from the head
+    if (has_free_pages) {
+        const uint32_t n_pages = (cache.size + cache.page_size - 1)/cache.page_size;
+        const uint32_t page0   = cache.head/cache.page_size;
+
+        for (uint32_t k = 0; k < n_pages; ++k) {
+            const uint32_t page = (page0 + k) % n_pages;
+            if (llama_kv_cache_page_is_free(cache, page)) {
+                cache.head = page*cache.page_size;
+                return cache.head;
+            }
+        }
+
+        has_free_pages = false;
+    }
+
+    // no free page left: any free cell will do
+    for (uint32_t k = 0; k < cache.size; ++k) {
+        const uint32_t i = (cache.head + k) % cache.size;
+        if (cache.cells[i].pos < 0) {
+            cache.head = i;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// find empty cells for the "n_tokens" tokens of the batch
+// the cells do not have to be contiguous unless requested or the cache is not stored with ggml_set_rows,
+// cache.slots receives the cell of each token
 // updates the cache head
 // Note: On success, it's important that cache.head points
-// to the first cell of the slot.
+// to the cell of the first token.
 static bool llama_kv_cache_find_slot(
            struct llama_kv_cache & cache,
-        const struct llama_batch & batch) {
+        const struct llama_batch & batch,
+                            bool   contiguous = false) {
     const uint32_t n_ctx    = cache.size;
     const uint32_t n_tokens = batch.n_tokens;
 
@@ -2508,16 +2712,19 @@ static bool llama_kv_cache_find_slot(
         return false;
     }
 
+    // look for a contiguous range first, the only placement when the cache cannot be stored with ggml_set_rows
+    bool found = false;
+
     uint32_t n_tested = 0;
 
-    while (true) {
+    while (n_tested < n_ctx) {
         if (cache.head + n_tokens > n_ctx) {
             n_tested += n_ctx - cache.head;
             cache.head = 0;
             continue;
         }
 
-        bool found = true;
+        found = true;
         for (uint32_t i = 0; i < n_tokens; i++) {
             if (cache.cells[cache.head + i].pos >= 0) {
                 found = false;
@@ -2530,21 +2737,54 @@ static bool llama_kv_cache_find_slot(
         if (found) {
             break;
         }
+    }
 
-        if (n_tested >= n_ctx) {
-            //LLAMA_LOG_ERROR("%s: failed to find a slot for %d tokens\n", __func__, n_tokens);
-            return false;
+    if (found) {
+        cache.slots.resize(n_tokens);
+
+        for (uint32_t i = 0; i < n_tokens; i++) {
+            cache.cells[cache.head + i].pos = batch.pos[i];
+
+            for (int32_t j = 0; j < batch.n_seq_id[i]; j++) {
+                cache.cells[cache.head + i].seq_id.insert(batch.seq_id[i][j]);
+                cache.seq_tail[batch.seq_id[i][j]] = cache.head + i;
+            }
+
+            cache.slots[i] = cache.head + i;
         }
+
+        cache.used += n_tokens;
+
+        return true;
     }
 
+    // the cache is fragmented: place the tokens page by page into any free cells
+    if (contiguous || !cache.set_rows || n_tokens > n_ctx - cache.used) {
+        //LLAMA_LOG_ERROR("%s: failed to find a slot for %d tokens\n", __func__, n_tokens);
+        return false;
+    }
+
+    cache.slots.resize(n_tokens);
+
+    bool has_free_pages = true;
+
     for (uint32_t i = 0; i < n_tokens; i++) {
-        cache.cells[cache.head + i].pos = batch.pos[i];
+        const llama_seq_id seq_id = batch.n_seq_id[i] > 0 ? batch.seq_id[i][0] : 0;
+
+        const int32_t cell = llama_kv_cache_find_cell(cache, seq_id, has_free_pages);
+        GGML_ASSERT(cell >= 0); // cannot fail, cache.used counts the occupied cells
+
+        cache.cells[cell].pos = batch.pos[i];
 
         for (int32_t j = 0; j < batch.n_seq_id[i]; j++) {
-            cache.cells[cache.head + i].seq_id.insert(batch.seq_id[i][j]);
+            cache.cells[cell].seq_id.insert(batch.seq_id[i][j]);
+            cache.seq_tail[batch.seq_id[i][j]] = cell;
         }
+
+        cache.slots[i] = cell;
     }
 
+    cache.head = cache.slots[0];
     cache.used += n_tokens;
 
     return true;
@@ -2570,6 +2810,7 @@ static void llama_kv_cache_clear(struct llama_kv_cache & cache) {
     }
     cache.head = 0;
     cache.used = 0;
+    cache.seq_tail.clear();
 
     for (auto & buf : cache.bufs) {
         ggml_backend_buffer_clear(buf, 0);
@@ -3238,6 +3479,12 @@ struct llama_model_loader {
                 }
 
                 LLAMA_LOG_INFO("%s: - type %4s: %4d tensors\n", __func__, ggml_type_name(kv.first), kv.second);
+
+                llama_event event;
+                event.type                  = LLAMA_EVENT_TYPE_TENSOR_TYPE;
+                event.tensor_type.name      = ggml_type_name(kv.first);
+                event.tensor_type.n_tensors = kv.second;
+                llama_event_emit(event);
             }
         }
 
@@ -3540,6 +3787,12 @@ struct llama_model_loader {
                     return false;
                 }
             }
+            if (g_state.event_callback) {
+                llama_event event;
+                event.type     = LLAMA_EVENT_TYPE_LOAD_PROGRESS;
+                event.progress = (float) size_done / size_data;
+                llama_event_emit(event);
+            }
 
             size_t n_size = ggml_nbytes(cur);
 
@@ -3552,8 +3805,10 @@ struct llama_model_loader {
                 uint8_t * data = (uint8_t *) mapping->addr + weight->offs;
 
                 if (check_tensors) {
-                    validation_result.emplace_back(std::async(std::launch::async, [cur, data, n_size] {
-                        return std::make_pair(cur, ggml_validate_row_data(cur->type, data, n_size));
+                    // the data is validated in the file layout, the tensor may be repacked when it is set
+                    const ggml_type type = weight->tensor->type;
+                    validation_result.emplace_back(std::async(std::launch::async, [cur, type, data, n_size] {
+                        return std::make_pair(cur, ggml_validate_row_data(type, data, n_size));
                     }));
                 }
 
@@ -3587,7 +3842,7 @@ struct llama_model_loader {
                     file->seek(weight->offs, SEEK_SET);
                     file->read_raw(read_buf.data(), n_size);
                     ggml_backend_tensor_set(cur, read_buf.data(), 0, n_size);
-                    if (check_tensors && !ggml_validate_row_data(cur->type, read_buf.data(), n_size)) {
+                    if (check_tensors && !ggml_validate_row_data(weight->tensor->type, read_buf.data(), n_size)) {
                         throw std::runtime_error(format("tensor '%s' has invalid data", ggml_get_name(cur)));
                     }
                 }
@@ -3622,6 +3877,12 @@ struct llama_model_loader {
                     }
                 }
             }
+            if (g_state.event_callback) {
+                llama_event event;
+                event.type     = LLAMA_EVENT_TYPE_LOAD_PROGRESS;
+                event.progress = 1.0f;
+                llama_event_emit(event);
+            }
             if (progress_callback) {
                 // Even though the model is done loading, we still honor
                 // cancellation since we need to free allocations.
@@ -4604,6 +4865,55 @@ static void llm_load_vocab(
     }
 }
 
+static void llm_load_print_meta_emit(const char * key, enum llama_meta_type type, int64_t value_int, double value_float, const char * value) {
+    LLAMA_LOG_INFO("%s: %-16s = %s\n", "llm_load_print_meta", key, value);
+
+    llama_event event;
+    event.type             = LLAMA_EVENT_TYPE_MODEL_META;
+    event.meta.key         = key;
+    event.meta.type        = type;
+    event.meta.value_int   = value_int;
+    event.meta.value_float = value_float;
+    event.meta.value       = value;
+    llama_event_emit(event);
+}
+
+// a string property
+LLAMA_ATTRIBUTE_FORMAT(2, 3)
+static void llm_load_print_meta_kv(const char * key, const char * fmt, ...) {
+    char value[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(value, sizeof(value), fmt, args);
+    va_end(args);
+
+    llm_load_print_meta_emit(key, LLAMA_META_TYPE_STR, 0, 0.0, value);
+}
+
+// an integer property, printed as fmt
+LLAMA_ATTRIBUTE_FORMAT(3, 4)
+static void llm_load_print_meta_int(const char * key, int64_t value_int, const char * fmt, ...) {
+    char value[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(value, sizeof(value), fmt, args);
+    va_end(args);
+
+    llm_load_print_meta_emit(key, LLAMA_META_TYPE_INT, value_int, 0.0, value);
+}
+
+static void llm_load_print_meta_int(const char * key, int64_t value_int) {
+    llm_load_print_meta_int(key, value_int, "%" PRId64, value_int);
+}
+
+// a floating point property, fmt is a printf format for a single double
+static void llm_load_print_meta_float(const char * key, double value_float, const char * fmt) {
+    char value[256];
+    snprintf(value, sizeof(value), fmt, value_float);
+
+    llm_load_print_meta_emit(key, LLAMA_META_TYPE_FLOAT, 0, value_float, value);
+}
+
 static void llm_load_print_meta(llama_model_loader & ml, llama_model & model) {
     const auto & hparams = model.hparams;
     const auto & vocab   = model.vocab;
@@ -4611,76 +4921,76 @@ static void llm_load_print_meta(llama_model_loader & ml, llama_model & model) {
     const char * rope_scaling_type = LLAMA_ROPE_SCALING_TYPES.at(hparams.rope_scaling_type_train);
 
     // hparams
-    LLAMA_LOG_INFO("%s: format           = %s\n",     __func__, llama_file_version_name(ml.fver));
-    LLAMA_LOG_INFO("%s: arch             = %s\n",     __func__, LLM_ARCH_NAMES.at(model.arch));
-    LLAMA_LOG_INFO("%s: vocab type       = %s\n",     __func__, llama_model_vocab_type_name(vocab.type));
-    LLAMA_LOG_INFO("%s: n_vocab          = %u\n",     __func__, hparams.n_vocab);
-    LLAMA_LOG_INFO("%s: n_merges         = %u\n",     __func__, (int) vocab.bpe_ranks.size());
-    LLAMA_LOG_INFO("%s: n_ctx_train      = %u\n",     __func__, hparams.n_ctx_train);
-    LLAMA_LOG_INFO("%s: n_embd           = %u\n",     __func__, hparams.n_embd);
-    LLAMA_LOG_INFO("%s: n_head           = %u\n",     __func__, hparams.n_head);
-    LLAMA_LOG_INFO("%s: n_head_kv        = %u\n",     __func__, hparams.n_head_kv);
-    LLAMA_LOG_INFO("%s: n_layer          = %u\n",     __func__, hparams.n_layer);
-    LLAMA_LOG_INFO("%s: n_rot            = %u\n",     __func__, hparams.n_rot);
-    LLAMA_LOG_INFO("%s: n_embd_head_k    = %u\n",     __func__, hparams.n_embd_head_k);
-    LLAMA_LOG_INFO("%s: n_embd_head_v    = %u\n",     __func__, hparams.n_embd_head_v);
-    LLAMA_LOG_INFO("%s: n_gqa            = %u\n",     __func__, hparams.n_gqa());
-    LLAMA_LOG_INFO("%s: n_embd_k_gqa     = %u\n",     __func__, hparams.n_embd_k_gqa());
-    LLAMA_LOG_INFO("%s: n_embd_v_gqa     = %u\n",     __func__, hparams.n_embd_v_gqa());
-    LLAMA_LOG_INFO("%s: f_norm_eps       = %.1e\n",   __func__, hparams.f_norm_eps);
-    LLAMA_LOG_INFO("%s: f_norm_rms_eps   = %.1e\n",   __func__, hparams.f_norm_rms_eps);
-    LLAMA_LOG_INFO("%s: f_clamp_kqv      = %.1e\n",   __func__, hparams.f_clamp_kqv);
-    LLAMA_LOG_INFO("%s: f_max_alibi_bias = %.1e\n",   __func__, hparams.f_max_alibi_bias);
-    LLAMA_LOG_INFO("%s: f_logit_scale    = %.1e\n",   __func__, hparams.f_logit_scale);
-    LLAMA_LOG_INFO("%s: n_ff             = %u\n",     __func__, hparams.n_ff);
-    LLAMA_LOG_INFO("%s: n_expert         = %u\n",     __func__, hparams.n_expert);
-    LLAMA_LOG_INFO("%s: n_expert_used    = %u\n",     __func__, hparams.n_expert_used);
-    LLAMA_LOG_INFO("%s: causal attn      = %d\n",     __func__, hparams.causal_attn);
-    LLAMA_LOG_INFO("%s: pooling type     = %d\n",     __func__, hparams.pooling_type);
-    LLAMA_LOG_INFO("%s: rope type        = %d\n",     __func__, hparams.rope_type);
-    LLAMA_LOG_INFO("%s: rope scaling     = %s\n",     __func__, rope_scaling_type);
-    LLAMA_LOG_INFO("%s: freq_base_train  = %.1f\n",   __func__, hparams.rope_freq_base_train);
-    LLAMA_LOG_INFO("%s: freq_scale_train = %g\n",     __func__, hparams.rope_freq_scale_train);
-    LLAMA_LOG_INFO("%s: n_yarn_orig_ctx  = %u\n",     __func__, hparams.n_yarn_orig_ctx);
-    LLAMA_LOG_INFO("%s: rope_finetuned   = %s\n",     __func__, hparams.rope_finetuned ? "yes" : "unknown");
-    LLAMA_LOG_INFO("%s: ssm_d_conv       = %u\n",     __func__, hparams.ssm_d_conv);
-    LLAMA_LOG_INFO("%s: ssm_d_inner      = %u\n",     __func__, hparams.ssm_d_inner);
-    LLAMA_LOG_INFO("%s: ssm_d_state      = %u\n",     __func__, hparams.ssm_d_state);
-    LLAMA_LOG_INFO("%s: ssm_dt_rank      = %u\n",     __func__, hparams.ssm_dt_rank);
-    LLAMA_LOG_INFO("%s: model type       = %s\n",     __func__, llama_model_type_name(model.type));
-    LLAMA_LOG_INFO("%s: model ftype      = %s\n",     __func__, llama_model_ftype_name(model.ftype).c_str());
+    llm_load_print_meta_kv("format", "%s", llama_file_version_name(ml.fver));
+    llm_load_print_meta_kv("arch", "%s", LLM_ARCH_NAMES.at(model.arch));
+    llm_load_print_meta_kv("vocab type", "%s", llama_model_vocab_type_name(vocab.type));
+    llm_load_print_meta_int("n_vocab", hparams.n_vocab);
+    llm_load_print_meta_int("n_merges", (int) vocab.bpe_ranks.size());
+    llm_load_print_meta_int("n_ctx_train", hparams.n_ctx_train);
+    llm_load_print_meta_int("n_embd", hparams.n_embd);
+    llm_load_print_meta_int("n_head", hparams.n_head);
+    llm_load_print_meta_int("n_head_kv", hparams.n_head_kv);
+    llm_load_print_meta_int("n_layer", hparams.n_layer);
+    llm_load_print_meta_int("n_rot", hparams.n_rot);
+    llm_load_print_meta_int("n_embd_head_k", hparams.n_embd_head_k);
+    llm_load_print_meta_int("n_embd_head_v", hparams.n_embd_head_v);
+    llm_load_print_meta_int("n_gqa", hparams.n_gqa());
+    llm_load_print_meta_int("n_embd_k_gqa", hparams.n_embd_k_gqa());
+    llm_load_print_meta_int("n_embd_v_gqa", hparams.n_embd_v_gqa());
+    llm_load_print_meta_float("f_norm_eps", hparams.f_norm_eps, "%.1e");
+    llm_load_print_meta_float("f_norm_rms_eps", hparams.f_norm_rms_eps, "%.1e");
+    llm_load_print_meta_float("f_clamp_kqv", hparams.f_clamp_kqv, "%.1e");
+    llm_load_print_meta_float("f_max_alibi_bias", hparams.f_max_alibi_bias, "%.1e");
+    llm_load_print_meta_float("f_logit_scale", hparams.f_logit_scale, "%.1e");
+    llm_load_print_meta_int("n_ff", hparams.n_ff);
+    llm_load_print_meta_int("n_expert", hparams.n_expert);
+    llm_load_print_meta_int("n_expert_used", hparams.n_expert_used);
+    llm_load_print_meta_int("causal attn", hparams.causal_attn);
+    llm_load_print_meta_int("pooling type", hparams.pooling_type);
+    llm_load_print_meta_int("rope type", hparams.rope_type);
+    llm_load_print_meta_kv("rope scaling", "%s", rope_scaling_type);
+    llm_load_print_meta_float("freq_base_train", hparams.rope_freq_base_train, "%.1f");
+    llm_load_print_meta_float("freq_scale_train", hparams.rope_freq_scale_train, "%g");
+    llm_load_print_meta_int("n_yarn_orig_ctx", hparams.n_yarn_orig_ctx);
+    llm_load_print_meta_kv("rope_finetuned", "%s", hparams.rope_finetuned ? "yes" : "unknown");
+    llm_load_print_meta_int("ssm_d_conv", hparams.ssm_d_conv);
+    llm_load_print_meta_int("ssm_d_inner", hparams.ssm_d_inner);
+    llm_load_print_meta_int("ssm_d_state", hparams.ssm_d_state);
+    llm_load_print_meta_int("ssm_dt_rank", hparams.ssm_dt_rank);
+    llm_load_print_meta_kv("model type", "%s", llama_model_type_name(model.type));
+    llm_load_print_meta_kv("model ftype", "%s", llama_model_ftype_name(model.ftype).c_str());
     if (ml.n_elements >= 1e12) {
-        LLAMA_LOG_INFO("%s: model params     = %.2f T\n", __func__, ml.n_elements*1e-12);
+        llm_load_print_meta_int("model params", ml.n_elements, "%.2f T", ml.n_elements*1e-12);
     } else if (ml.n_elements >= 1e9) {
-        LLAMA_LOG_INFO("%s: model params     = %.2f B\n", __func__, ml.n_elements*1e-9);
+        llm_load_print_meta_int("model params", ml.n_elements, "%.2f B", ml.n_elements*1e-9);
     } else if (ml.n_elements >= 1e6) {
-        LLAMA_LOG_INFO("%s: model params     = %.2f M\n", __func__, ml.n_elements*1e-6);
+        llm_load_print_meta_int("model params", ml.n_elements, "%.2f M", ml.n_elements*1e-6);
     } else {
-        LLAMA_LOG_INFO("%s: model params     = %.2f K\n", __func__, ml.n_elements*1e-3);
+        llm_load_print_meta_int("model params", ml.n_elements, "%.2f K", ml.n_elements*1e-3);
     }
     if (ml.n_bytes < GiB) {
-        LLAMA_LOG_INFO("%s: model size       = %.2f MiB (%.2f BPW) \n", __func__, ml.n_bytes/1024.0/1024.0,        ml.n_bytes*8.0/ml.n_elements);
+        llm_load_print_meta_int("model size", ml.n_bytes, "%.2f MiB (%.2f BPW)", ml.n_bytes/1024.0/1024.0,        ml.n_bytes*8.0/ml.n_elements);
     } else {
-        LLAMA_LOG_INFO("%s: model size       = %.2f GiB (%.2f BPW) \n", __func__, ml.n_bytes/1024.0/1024.0/1024.0, ml.n_bytes*8.0/ml.n_elements);
+        llm_load_print_meta_int("model size", ml.n_bytes, "%.2f GiB (%.2f BPW)", ml.n_bytes/1024.0/1024.0/1024.0, ml.n_bytes*8.0/ml.n_elements);
     }
 
     // general kv
-    LLAMA_LOG_INFO("%s: general.name     = %s\n",    __func__, model.name.c_str());
+    llm_load_print_meta_kv("general.name", "%s", model.name.c_str());
 
     // special tokens
-    if (vocab.special_bos_id    != -1) { LLAMA_LOG_INFO( "%s: BOS token        = %d '%s'\n", __func__, vocab.special_bos_id,  vocab.id_to_token[vocab.special_bos_id].text.c_str() );  }
-    if (vocab.special_eos_id    != -1) { LLAMA_LOG_INFO( "%s: EOS token        = %d '%s'\n", __func__, vocab.special_eos_id,  vocab.id_to_token[vocab.special_eos_id].text.c_str() );  }
-    if (vocab.special_unk_id    != -1) { LLAMA_LOG_INFO( "%s: UNK token        = %d '%s'\n", __func__, vocab.special_unk_id,  vocab.id_to_token[vocab.special_unk_id].text.c_str() );  }
-    if (vocab.special_sep_id    != -1) { LLAMA_LOG_INFO( "%s: SEP token        = %d '%s'\n", __func__, vocab.special_sep_id,  vocab.id_to_token[vocab.special_sep_id].text.c_str() );  }
-    if (vocab.special_pad_id    != -1) { LLAMA_LOG_INFO( "%s: PAD token        = %d '%s'\n", __func__, vocab.special_pad_id,  vocab.id_to_token[vocab.special_pad_id].text.c_str() );  }
-    if (vocab.special_cls_id    != -1) { LLAMA_LOG_INFO( "%s: CLS token        = %d '%s'\n", __func__, vocab.special_cls_id,  vocab.id_to_token[vocab.special_cls_id].text.c_str() );  }
-    if (vocab.special_mask_id   != -1) { LLAMA_LOG_INFO( "%s: MASK token       = %d '%s'\n", __func__, vocab.special_mask_id, vocab.id_to_token[vocab.special_mask_id].text.c_str() ); }
-
-    if (vocab.linefeed_id       != -1) { LLAMA_LOG_INFO( "%s: LF token         = %d '%s'\n", __func__, vocab.linefeed_id,       vocab.id_to_token[vocab.linefeed_id].text.c_str() );       }
-    if (vocab.special_prefix_id != -1) { LLAMA_LOG_INFO( "%s: PRE token        = %d '%s'\n", __func__, vocab.special_prefix_id, vocab.id_to_token[vocab.special_prefix_id].text.c_str() ); }
-    if (vocab.special_suffix_id != -1) { LLAMA_LOG_INFO( "%s: SUF token        = %d '%s'\n", __func__, vocab.special_suffix_id, vocab.id_to_token[vocab.special_suffix_id].text.c_str() ); }
-    if (vocab.special_middle_id != -1) { LLAMA_LOG_INFO( "%s: MID token        = %d '%s'\n", __func__, vocab.special_middle_id, vocab.id_to_token[vocab.special_middle_id].text.c_str() ); }
-    if (vocab.special_eot_id    != -1) { LLAMA_LOG_INFO( "%s: EOT token        = %d '%s'\n", __func__, vocab.special_eot_id,    vocab.id_to_token[vocab.special_eot_id].text.c_str() );    }
+    if (vocab.special_bos_id    != -1) { llm_load_print_meta_int("BOS token", vocab.special_bos_id, "%d '%s'", vocab.special_bos_id,  vocab.id_to_token[vocab.special_bos_id].text.c_str());  }
+    if (vocab.special_eos_id    != -1) { llm_load_print_meta_int("EOS token", vocab.special_eos_id, "%d '%s'", vocab.special_eos_id,  vocab.id_to_token[vocab.special_eos_id].text.c_str());  }
+    if (vocab.special_unk_id    != -1) { llm_load_print_meta_int("UNK token", vocab.special_unk_id, "%d '%s'", vocab.special_unk_id,  vocab.id_to_token[vocab.special_unk_id].text.c_str());  }
+    if (vocab.special_sep_id    != -1) { llm_load_print_meta_int("SEP token", vocab.special_sep_id, "%d '%s'", vocab.special_sep_id,  vocab.id_to_token[vocab.special_sep_id].text.c_str());  }
+    if (vocab.special_pad_id    != -1) { llm_load_print_meta_int("PAD token", vocab.special_pad_id, "%d '%s'", vocab.special_pad_id,  vocab.id_to_token[vocab.special_pad_id].text.c_str());  }
+    if (vocab.special_cls_id    != -1) { llm_load_print_meta_int("CLS token", vocab.special_cls_id, "%d '%s'", vocab.special_cls_id,  vocab.id_to_token[vocab.special_cls_id].text.c_str());  }
+    if (vocab.special_mask_id   != -1) { llm_load_print_meta_int("MASK token", vocab.special_mask_id, "%d '%s'", vocab.special_mask_id, vocab.id_to_token[vocab.special_mask_id].text.c_str()); }
+
+    if (vocab.linefeed_id       != -1) { llm_load_print_meta_int("LF token", vocab.linefeed_id, "%d '%s'", vocab.linefeed_id,       vocab.id_to_token[vocab.linefeed_id].text.c_str());       }
+    if (vocab.special_prefix_id != -1) { llm_load_print_meta_int("PRE token", vocab.special_prefix_id, "%d '%s'", vocab.special_prefix_id, vocab.id_to_token[vocab.special_prefix_id].text.c_str()); }
+    if (vocab.special_suffix_id != -1) { llm_load_print_meta_int("SUF token", vocab.special_suffix_id, "%d '%s'", vocab.special_suffix_id, vocab.id_to_token[vocab.special_suffix_id].text.c_str()); }
+    if (vocab.special_middle_id != -1) { llm_load_print_meta_int("MID token", vocab.special_middle_id, "%d '%s'", vocab.special_middle_id, vocab.id_to_token[vocab.special_middle_id].text.c_str()); }
+    if (vocab.special_eot_id    != -1) { llm_load_print_meta_int("EOT token", vocab.special_eot_id, "%d '%s'", vocab.special_eot_id,    vocab.id_to_token[vocab.special_eot_id].text.c_str());    }
 }
 
 // Returns false if cancelled by progress_callback
@@ -4692,6 +5002,7 @@ static bool llm_load_tensors(
         int main_gpu,
         const float * tensor_split,
         bool use_mlock,
+        bool repack,
         llama_progress_callback progress_callback,
         void * progress_callback_user_data) {
     model.t_start_us = ggml_time_us();
@@ -4787,6 +5098,23 @@ static bool llm_load_tensors(
         }
     }
 
+    // repacked weights are only usable by the CPU backend, with GPU backends the scheduler may copy them to the device
+    if (repack && llama_supports_gpu_offload()) {
+        LLAMA_LOG_WARN("%s: weight repacking is not supported with GPU offload, ignoring\n", __func__);
+        repack = false;
+    }
+    if (repack) {
+        ggml_backend_buffer_type_t buft_cpu = llama_default_buffer_type_cpu(true);
+        for (int64_t i = 0; i < n_layer; ++i) {
+            if (model.buft_layer[i].buft_matrix == buft_cpu) {
+                model.buft_layer[i].buft_matrix = ggml_backend_cpu_repack_buffer_type();
+            }
+        }
+        if (model.buft_output.buft_matrix == buft_cpu) {
+            model.buft_output.buft_matrix = ggml_backend_cpu_repack_buffer_type();
+        }
+    }
+
     // count used buffer types
     std::map<ggml_backend_buffer_type_t, int> buft_layer_count;
     buft_layer_count[model.buft_input.buft]++;
@@ -4821,6 +5149,14 @@ static bool llm_load_tensors(
 
     LLAMA_LOG_INFO("%s: ggml ctx size = %7.2f MiB\n", __func__, model.ctxs.size()*ctx_size/1024.0/1024.0);
 
+    {
+        llama_event event;
+        event.type             = LLAMA_EVENT_TYPE_TENSOR_CTX;
+        event.tensor_ctx.n_ctx = (int32_t) model.ctxs.size();
+        event.tensor_ctx.size  = model.ctxs.size()*ctx_size;
+        llama_event_emit(event);
+    }
+
     // create tensors for the weights
     {
         const int64_t n_embd       = hparams.n_embd;
@@ -6044,11 +6380,20 @@ static bool llm_load_tensors(
         const int max_offloadable_layers       = hparams.n_layer + 1;
 
         LLAMA_LOG_INFO("%s: offloaded %d/%d layers to GPU\n", __func__, std::min(n_gpu_layers, max_offloadable_layers), max_backend_supported_layers);
+
+        llama_event event;
+        event.type                  = LLAMA_EVENT_TYPE_OFFLOAD;
+        event.offload.n_repeating   = n_gpu;
+        event.offload.non_repeating = n_gpu_layers > (int) hparams.n_layer;
+        event.offload.n_offloaded   = std::min(n_gpu_layers, max_offloadable_layers);
+        event.offload.n_layers      = max_backend_supported_layers;
+        llama_event_emit(event);
     }
 
     // print memory requirements
     for (ggml_backend_buffer_t buf : model.bufs) {
         LLAMA_LOG_INFO("%s: %10s buffer size = %8.2f MiB\n", __func__, ggml_backend_buffer_name(buf), ggml_backend_buffer_get_size(buf) / 1024.0 / 1024.0);
+        llama_event_buffer(LLAMA_BUFFER_USAGE_MODEL, buf);
     }
 
     // populate tensors_by_name
@@ -6142,7 +6487,7 @@ static int llama_model_load(const std::string & fname, llama_model & model, llam
 
         if (!llm_load_tensors(
             ml, model, params.n_gpu_layers, params.split_mode,  params.main_gpu, params.tensor_split, params.use_mlock,
-            params.progress_callback, params.progress_callback_user_data
+            params.repack, params.progress_callback, params.progress_callback_user_data
         )) {
             return -2;
         }
@@ -6227,6 +6572,40 @@ static void llm_build_kv_store(
 
     GGML_ASSERT(kv.size == n_ctx);
 
+    assert(v_cur->ne[0] == n_embd_v_gqa && v_cur->ne[1] == n_tokens);
+
+    if (kv.inp_slots) {
+        // the tokens of the ubatch can be scattered over several pages of the cache (see llama_kv_cache_find_slot),
+        // store the K and V row of each token to its cell
+        if (!ggml_is_contiguous(k_cur)) {
+            k_cur = ggml_cont(ctx, k_cur);
+        }
+        k_cur = ggml_reshape_2d(ctx, k_cur, n_embd_k_gqa, n_tokens);
+
+        struct ggml_tensor * k_cache_view = ggml_view_2d(ctx, kv.k_l[il], n_embd_k_gqa, n_ctx,
+                ggml_row_size(kv.k_l[il]->type, n_embd_k_gqa), 0);
+        cb(k_cache_view, "k_cache_view", il);
+
+        // note: storing RoPE-ed version of K in the KV cache
+        ggml_build_forward_expand(graph, ggml_set_rows(ctx, k_cache_view, kv.inp_slots, k_cur));
+
+        struct ggml_tensor * v_cache_view = nullptr;
+
+        if (cparams.flash_attn) {
+            v_cache_view = ggml_view_2d(ctx, kv.v_l[il], n_embd_v_gqa, n_ctx,
+                    ggml_row_size(kv.v_l[il]->type, n_embd_v_gqa), 0);
+        } else {
+            // note: the V cache is transposed when not using flash attention, the row of a cell is strided
+            v_cache_view = ggml_transpose(ctx, ggml_view_2d(ctx, kv.v_l[il], n_ctx, n_embd_v_gqa,
+                    n_ctx*ggml_element_size(kv.v_l[il]), 0));
+        }
+        cb(v_cache_view, "v_cache_view", il);
+
+        ggml_build_forward_expand(graph, ggml_set_rows(ctx, v_cache_view, kv.inp_slots, v_cur));
+
+        return;
+    }
+
     struct ggml_tensor * k_cache_view = ggml_view_1d(ctx, kv.k_l[il], n_tokens*n_embd_k_gqa,
             (ggml_row_size(kv.k_l[il]->type, n_embd_k_gqa))*kv_head);
     cb(k_cache_view, "k_cache_view", il);
@@ -6234,8 +6613,6 @@ static void llm_build_kv_store(
     // note: storing RoPE-ed version of K in the KV cache
     ggml_build_forward_expand(graph, ggml_cpy(ctx, k_cur, k_cache_view));
 
-    assert(v_cur->ne[0] == n_embd_v_gqa && v_cur->ne[1] == n_tokens);
-
     struct ggml_tensor * v_cache_view = nullptr;
 
     if (cparams.flash_attn) {
@@ -6753,6 +7130,9 @@ struct llm_build_context {
 
         ctx0 = ggml_init(params);
 
+        // the new graph overwrites the cached one in buf_compute_meta
+        lctx.graph_cache.clear();
+
         lctx.inp_tokens = nullptr;
         lctx.inp_embd = nullptr;
         lctx.inp_pos = nullptr;
@@ -6765,6 +7145,7 @@ struct llm_build_context {
         lctx.inp_s_copy = nullptr;
         lctx.inp_s_mask = nullptr;
         lctx.inp_s_seq = nullptr;
+        lctx.kv_self.inp_slots = nullptr;
     }
 
     void free() {
@@ -6906,6 +7287,13 @@ struct llm_build_context {
     struct ggml_tensor * build_inp_KQ_mask(bool causal = true) {
         if (causal) {
             lctx.inp_KQ_mask = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_kv,     GGML_PAD(n_tokens, GGML_KQ_MASK_PAD));
+
+            // the mask covers the ubatch wherever it is placed, its K and V are then stored through the same cells
+            if (kv_self.set_rows) {
+                lctx.kv_self.inp_slots = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+                cb(lctx.kv_self.inp_slots, "inp_slots", -1);
+                ggml_set_input(lctx.kv_self.inp_slots);
+            }
         } else {
             lctx.inp_KQ_mask = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_tokens, GGML_PAD(n_tokens, GGML_KQ_MASK_PAD));
         }
@@ -7016,7 +7404,9 @@ struct llm_build_context {
                     cb(Vcur, "Vcur", il);
                 }
 
-                Qcur = ggml_rope_custom(
+                // Q is roped in place: its memory then stays in use until K is roped, which lets the CPU backend
+                // rope both in one pass (the allocator would otherwise hand it to Kcur in between)
+                Qcur = ggml_rope_custom_inplace(
                     ctx0, ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head, n_tokens), inp_pos,
                     n_rot, rope_type, 0, n_orig_ctx, freq_base, freq_scale,
                     ext_factor, attn_factor, beta_fast, beta_slow
@@ -10991,6 +11381,18 @@ static void llama_set_inputs(llama_context & lctx, const llama_batch & batch) {
         "causal attention with embedding models is not supported"
     );
 
+    if (kv_self.inp_slots) {
+        const int64_t n_tokens = batch.n_tokens;
+
+        GGML_ASSERT(ggml_backend_buffer_is_host(kv_self.inp_slots->buffer));
+        int32_t * data = (int32_t *) kv_self.inp_slots->data;
+
+        // the cell of each token, see llama_kv_cache_find_slot
+        for (int i = 0; i < n_tokens; ++i) {
+            data[i] = kv_self.slots.size() == (size_t) n_tokens ? kv_self.slots[i] : kv_self.head + i;
+        }
+    }
+
     if (lctx.inp_KQ_mask) {
         // NOTE: hparams.causal_attn indicates the model is capable of generation and uses the kv cache.
         if (cparams.causal_attn) {
@@ -11237,6 +11639,60 @@ static size_t llama_output_reserve(llama_context & lctx, size_t n_outputs) {
 }
 
 
+// keep the decode graph that was just allocated for the next ubatches of the same shape
+static void llama_graph_cache_store(llama_context & lctx, ggml_cgraph * gf, const llama_graph_cache::shape & key) {
+    const auto & hparams = lctx.model.hparams;
+    const auto & kv_self = lctx.kv_self;
+    auto & cache = lctx.graph_cache;
+
+    cache.clear();
+
+    std::unordered_map<const ggml_tensor *, size_t> cell_size;
+    for (size_t il = 0; il < kv_self.k_l.size(); ++il) {
+        cell_size[kv_self.k_l[il]] = ggml_row_size(kv_self.k_l[il]->type, hparams.n_embd_k_gqa());
+        cell_size[kv_self.v_l[il]] = kv_self.v_trans ? ggml_element_size(kv_self.v_l[il]) : ggml_row_size(kv_self.v_l[il]->type, hparams.n_embd_v_gqa());
+    }
+
+    for (int i = 0; i < gf->n_nodes; ++i) {
+        ggml_tensor * node = gf->nodes[i];
+        if (node->op != GGML_OP_CPY || node->view_src == nullptr) {
+            continue;
+        }
+        const auto it = cell_size.find(node->view_src);
+        if (it == cell_size.end()) {
+            continue;
+        }
+        // both the copy and the view it writes through point at the cell of the first token
+        for (ggml_tensor * t : { node, node->src[1] }) {
+            if (t->view_src != node->view_src || t->view_offs != it->second*kv_self.head) {
+                cache.clear();
+                return;
+            }
+            cache.stores.emplace_back(t, it->second);
+        }
+    }
+
+    // a single K and V store per layer, none when the stores take their cells from an input
+    if (cache.stores.size() != (kv_self.set_rows ? 0 : 4*kv_self.k_l.size())) {
+        cache.clear();
+        return;
+    }
+
+    cache.graph = gf;
+    cache.key   = key;
+}
+
+// point the KV cache stores of the cached graph at the cells from `cell`
+static void llama_graph_cache_set_cell(llama_graph_cache & cache, uint32_t cell) {
+    for (auto & store : cache.stores) {
+        ggml_tensor * t = store.first;
+        ggml_backend_buffer_t buffer = t->buffer;
+        t->view_offs = store.second*cell;
+        t->buffer    = nullptr;
+        ggml_backend_view_init(buffer, t);
+    }
+}
+
 static void llama_graph_compute(
         llama_context & lctx,
           ggml_cgraph * gf,
@@ -11444,10 +11900,29 @@ static int llama_decode_internal(
 
         //printf("kv_self.n = %5d, kv_self.used = %5d, kv_self.head = %5d\n", kv_self.n, kv_self.used, kv_self.head);
 
-        ggml_backend_sched_reset(lctx.sched);
-        ggml_backend_sched_set_eval_callback(lctx.sched, lctx.cparams.cb_eval, lctx.cparams.cb_eval_user_data);
+        // generation graphs only differ in their inputs and the cells K and V are stored to, so they are reused
+        const llama_graph_cache::shape shape = {
+            /* .n_tokens    = */ (int32_t) n_tokens,
+            /* .n_outputs   = */ lctx.n_outputs,
+            /* .n_kv        = */ kv_self.n,
+            /* .embd        = */ u_batch.embd != nullptr,
+            /* .causal_attn = */ cparams.causal_attn,
+        };
+        const bool cacheable = hparams.causal_attn && !cparams.embeddings && !kv_self.recurrent;
+        const bool reuse = cacheable && lctx.graph_cache.graph != nullptr && lctx.graph_cache.key == shape;
+
+        ggml_cgraph * gf = nullptr;
+
+        if (reuse) {
+            gf = lctx.graph_cache.graph;
+            llama_graph_cache_set_cell(lctx.graph_cache, kv_self.head);
+            ggml_backend_sched_set_eval_callback(lctx.sched, lctx.cparams.cb_eval, lctx.cparams.cb_eval_user_data);
+        } else {
+            ggml_backend_sched_reset(lctx.sched);
+            ggml_backend_sched_set_eval_callback(lctx.sched, lctx.cparams.cb_eval, lctx.cparams.cb_eval_user_data);
 
-        ggml_cgraph * gf = llama_build_graph(lctx, u_batch, false);
+            gf = llama_build_graph(lctx, u_batch, false);
+        }
 
         // the output is always the last tensor in the graph
         struct ggml_tensor * res  = gf->nodes[gf->n_nodes - 1];
@@ -11498,7 +11973,13 @@ static int llama_decode_internal(
             n_threads = std::min(4, n_threads);
         }
 
-        ggml_backend_sched_alloc_graph(lctx.sched, gf);
+        if (!reuse) {
+            ggml_backend_sched_alloc_graph(lctx.sched, gf);
+
+            if (cacheable) {
+                llama_graph_cache_store(lctx, gf, shape);
+            }
+        }
 
         llama_set_inputs(lctx, u_batch);
 
@@ -11506,7 +11987,9 @@ static int llama_decode_internal(
 
         // update the kv ring buffer
         {
-            kv_self.head += n_tokens;
+            // continue after the cell of the last token, the ubatch may have been scattered over several pages
+            kv_self.head = kv_self.slots.empty() ? kv_self.head + n_tokens : kv_self.slots.back() + 1;
+            kv_self.slots.clear();
 
             // Ensure kv cache head points to a valid index.
             if (kv_self.head >= kv_self.size) {
@@ -11607,7 +12090,10 @@ static int llama_decode_internal(
 
     // Reset state for the next token before backend sync, to allow the CPU activities in the reset to
     // overlap with device computation.
-    ggml_backend_sched_reset(lctx.sched);
+    // a cached graph keeps the scheduler state it was split and allocated with
+    if (lctx.graph_cache.graph == nullptr) {
+        ggml_backend_sched_reset(lctx.sched);
+    }
 
     return 0;
 }
@@ -13073,6 +13559,158 @@ static std::vector<llama_grammar_candidate> llama_grammar_reject_candidates(
     return rejects;
 }
 
+static void llama_grammar_trie_build_node(
+        llama_grammar_trie                       & trie,
+        const std::vector<std::vector<uint32_t>> & code_points,
+        uint32_t                                   begin,
+        uint32_t                                   end,
+        size_t                                     depth,
+        uint32_t                                   code_point) {
+    const uint32_t id = trie.nodes.size();
+    trie.nodes.push_back({ code_point, 0, begin, begin });
+
+    // the tokens are sorted, so the ones that end here come first and each child is a contiguous range
+    uint32_t i = begin;
+    while (i < end && code_points[trie.tokens[i]].size() == depth) {
+        i++;
+    }
+    trie.nodes[id].token_end = i;
+
+    while (i < end) {
+        const uint32_t chr = code_points[trie.tokens[i]][depth];
+
+        uint32_t j = i;
+        while (j < end && code_points[trie.tokens[j]][depth] == chr) {
+            j++;
+        }
+        llama_grammar_trie_build_node(trie, code_points, i, j, depth + 1, chr);
+        i = j;
+    }
+
+    trie.nodes[id].end = trie.nodes.size();
+}
+
+static void llama_grammar_trie_build(const struct llama_context * ctx, llama_grammar_trie & trie) {
+    const llama_model & model = ctx->model;
+    const int32_t n_vocab = model.vocab.id_to_token.size();
+
+    std::vector<std::vector<uint32_t>> code_points(n_vocab);
+    std::vector<llama_partial_utf8>    partial_utf8(n_vocab);
+
+    // end-of-generation tokens, empty pieces and invalid UTF-8 are decided without the trie
+    for (llama_token id = 0; id < n_vocab; ++id) {
+        if (llama_token_is_eog(&model, id)) {
+            continue;
+        }
+
+        const std::string piece = llama_token_to_piece(ctx, id, false);
+        if (piece.empty() || piece[0] == 0) {
+            continue;
+        }
+
+        auto decoded = decode_utf8(piece, { 0, 0 });
+        if (decoded.second.n_remain < 0) {
+            continue;
+        }
+
+        decoded.first.pop_back(); // terminating 0
+
+        code_points[id]  = std::move(decoded.first);
+        partial_utf8[id] = decoded.second;
+
+        trie.tokens.push_back(id);
+    }
+
+    std::sort(trie.tokens.begin(), trie.tokens.end(), [&](llama_token a, llama_token b) {
+        return code_points[a] < code_points[b];
+    });
+
+    trie.partial_utf8.reserve(trie.tokens.size());
+    for (const llama_token id : trie.tokens) {
+        trie.partial_utf8.push_back(partial_utf8[id]);
+    }
+
+    llama_grammar_trie_build_node(trie, code_points, 0, trie.tokens.size(), 0, 0);
+}
+
+// marks in allowed the tokens of the subtree at node_id that the stacks accept
+// the stacks have already consumed the code points on the path to the node, so the work for a common prefix is shared
+static void llama_grammar_trie_walk(
+        const llama_grammar_trie                                      & trie,
+        const std::vector<std::vector<llama_grammar_element>>         & rules,
+        const std::vector<std::vector<const llama_grammar_element *>> & stacks,
+        uint32_t                                                        node_id,
+        std::vector<uint32_t>                                         & allowed) {
+    const auto & node = trie.nodes[node_id];
+
+    for (uint32_t i = node.token_begin; i < node.token_end; ++i) {
+        const llama_partial_utf8 partial_utf8 = trie.partial_utf8[i];
+
+        // a trailing partial sequence must be able to complete to a char allowed by one of the stacks
+        bool accept = partial_utf8.n_remain == 0;
+        for (size_t is = 0; !accept && is < stacks.size(); ++is) {
+            accept = !stacks[is].empty() && llama_grammar_match_partial_char(stacks[is].back(), partial_utf8);
+        }
+
+        if (accept) {
+            const llama_token id = trie.tokens[i];
+            allowed[id / 32] |= 1u << (id % 32);
+        }
+    }
+
+    std::vector<std::vector<const llama_grammar_element *>> next_stacks;
+
+    for (uint32_t child = node_id + 1; child < node.end; child = trie.nodes[child].end) {
+        llama_grammar_accept(rules, stacks, trie.nodes[child].code_point, next_stacks);
+        if (!next_stacks.empty()) {
+            llama_grammar_trie_walk(trie, rules, next_stacks, child, allowed);
+        }
+    }
+}
+
+bool llama_grammar_allowed_tokens(
+        struct llama_context * ctx,
+        const struct llama_grammar * grammar,
+        std::vector<uint32_t> & allowed) {
+    if (grammar->partial_utf8.n_remain != 0) {
+        return false;
+    }
+
+    const llama_model & model = ctx->model;
+    const int32_t n_vocab = model.vocab.id_to_token.size();
+
+    std::call_once(model.grammar_trie_once, [&]() {
+        const int64_t t_start_us = ggml_time_us();
+
+        model.grammar_trie.reset(new llama_grammar_trie());
+        llama_grammar_trie_build(ctx, *model.grammar_trie);
+
+        LLAMA_LOG_INFO("%s: built vocabulary trie with %zu nodes in %.2f ms\n", "llama_grammar_allowed_tokens",
+                model.grammar_trie->nodes.size(), (ggml_time_us() - t_start_us) / 1000.0);
+    });
+
+    allowed.assign((n_vocab + 31) / 32, 0);
+
+    bool allow_eog = false;
+    for (const auto & stack : grammar->stacks) {
+        if (stack.empty()) {
+            allow_eog = true;
+            break;
+        }
+    }
+    if (allow_eog) {
+        for (llama_token id = 0; id < n_vocab; ++id) {
+            if (llama_token_is_eog(&model, id)) {
+                allowed[id / 32] |= 1u << (id % 32);
+            }
+        }
+    }
+
+    llama_grammar_trie_walk(*model.grammar_trie, grammar->rules, grammar->stacks, 0, allowed);
+
+    return true;
+}
+
 //
 // grammar - external
 //
@@ -13114,7 +13752,7 @@ struct llama_grammar * llama_grammar_init(
         }
     } while (true);
 
-    return new llama_grammar{ std::move(vec_rules), std::move(stacks), {} };
+    return new llama_grammar{ std::move(vec_rules), std::move(stacks), {}, {} };
 }
 
 void llama_grammar_free(struct llama_grammar * grammar) {
@@ -13122,7 +13760,8 @@ void llama_grammar_free(struct llama_grammar * grammar) {
 }
 
 struct llama_grammar * llama_grammar_copy(const struct llama_grammar * grammar) {
-    llama_grammar * result = new llama_grammar{ grammar->rules, grammar->stacks, grammar->partial_utf8 };
+    // the allowed tokens cache is keyed by element pointers, so it is not copied
+    llama_grammar * result = new llama_grammar{ grammar->rules, grammar->stacks, grammar->partial_utf8, {} };
 
     // redirect elements in stacks to point to new rules
     for (size_t is = 0; is < result->stacks.size(); is++) {
@@ -13603,10 +14242,81 @@ void llama_sample_repetition_penalties(
     }
 }
 
+// sets the logits of the candidates that are not in the allowed bitset to -INFINITY
+static void llama_grammar_apply_mask(llama_token_data_array * candidates, const std::vector<uint32_t> & allowed, int32_t n_vocab) {
+    llama_token_data * data = candidates->data;
+    const size_t       size = candidates->size;
+
+    // candidates that cover the vocabulary in id order, e.g. from llama_sampling_prepare, are masked 32 at a time
+    bool in_order = size == (size_t) n_vocab;
+    for (size_t i = 0; in_order && i < size; ++i) {
+        in_order = data[i].id == (llama_token) i;
+    }
+
+    if (in_order) {
+        for (size_t w = 0; w * 32 < size; ++w) {
+            const uint32_t bits = allowed[w];
+            const size_t   n    = std::min<size_t>(32, size - w * 32);
+            if (bits == 0xFFFFFFFFu) {
+                continue;
+            }
+            llama_token_data * cur = data + w * 32;
+            if (bits == 0) {
+                for (size_t j = 0; j < n; ++j) {
+                    cur[j].logit = -INFINITY;
+                }
+                continue;
+            }
+            for (size_t j = 0; j < n; ++j) {
+                cur[j].logit = (bits >> j) & 1 ? cur[j].logit : -INFINITY;
+            }
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+        const llama_token id = data[i].id;
+        if (!((allowed[id / 32] >> (id % 32)) & 1)) {
+            data[i].logit = -INFINITY;
+        }
+    }
+}
+
 void llama_sample_grammar(struct llama_context * ctx, llama_token_data_array * candidates, const struct llama_grammar * grammar) {
     GGML_ASSERT(ctx);
     const int64_t t_start_sample_us = ggml_time_us();
 
+    // walking the vocabulary trie evaluates every token, which only pays off over a single candidate check
+    // when there are enough candidates or when the result can be reused from the cache
+    const size_t n_candidates_trie = 64;
+    const size_t n_allowed_cache   = 256;
+
+    if (grammar->partial_utf8.n_remain == 0) {
+        std::vector<const llama_grammar_element *> key;
+        for (const auto & stack : grammar->stacks) {
+            key.insert(key.end(), stack.begin(), stack.end());
+            key.push_back(nullptr);
+        }
+
+        auto it = grammar->allowed_cache.find(key);
+        if (it == grammar->allowed_cache.end() && candidates->size >= n_candidates_trie) {
+            if (grammar->allowed_cache.size() >= n_allowed_cache) {
+                grammar->allowed_cache.clear();
+            }
+
+            std::vector<uint32_t> allowed;
+            llama_grammar_allowed_tokens(ctx, grammar, allowed);
+            it = grammar->allowed_cache.emplace(std::move(key), std::move(allowed)).first;
+        }
+
+        if (it != grammar->allowed_cache.end()) {
+            llama_grammar_apply_mask(candidates, it->second, ctx->model.vocab.id_to_token.size());
+
+            ctx->t_sample_us += ggml_time_us() - t_start_sample_us;
+            return;
+        }
+    }
+
     bool allow_eog = false;
     for (const auto & stack : grammar->stacks) {
         if (stack.empty()) {
@@ -15046,6 +15756,12 @@ static int llama_apply_lora_from_file_internal(
             continue;
         }
 
+        if (ggml_is_interleaved(model_t->type)) {
+            LLAMA_LOG_ERROR("%s: error: tensor '%s' is repacked, lora adapters cannot be applied to repacked models\n", __func__, base_name.c_str());
+            ggml_backend_free(backend_cpu);
+            return 1;
+        }
+
         tensor_meta & metaA = tensor_meta_map.at(base_name + ".loraA");
         tensor_meta & metaB = tensor_meta_map.at(base_name + ".loraB");
 
@@ -15207,6 +15923,7 @@ struct llama_model_params llama_model_default_params() {
         /*.use_mmap                    =*/ true,
         /*.use_mlock                   =*/ false,
         /*.check_tensors               =*/ false,
+        /*.repack                      =*/ false,
     };
 
 #ifdef GGML_USE_METAL
@@ -15513,6 +16230,13 @@ struct llama_context * llama_new_context_with_model(
     GGML_ASSERT(hparams.n_embd_head_k % ggml_blck_size(type_k) == 0);
     GGML_ASSERT(hparams.n_embd_head_v % ggml_blck_size(type_v) == 0);
 
+    // without flash attention the V cache is stored transposed, which cannot be done with quantized blocks
+    if (ggml_is_quantized(type_v) && !cparams.flash_attn) {
+        LLAMA_LOG_ERROR("%s: V cache quantization requires flash_attn\n", __func__);
+        llama_free(ctx);
+        return nullptr;
+    }
+
     if (!hparams.vocab_only) {
         // initialize backends
 #ifdef GGML_USE_METAL
@@ -15652,6 +16376,7 @@ struct llama_context * llama_new_context_with_model(
             LLAMA_LOG_INFO("%s: %10s  output buffer size = %8.2f MiB\n", __func__,
                     ggml_backend_buffer_name(ctx->buf_output),
                     ggml_backend_buffer_get_size(ctx->buf_output) / 1024.0 / 1024.0);
+            llama_event_buffer(LLAMA_BUFFER_USAGE_OUTPUT, ctx->buf_output, ctx);
         }
 
         // scheduler and compute buffers
@@ -15704,6 +16429,14 @@ struct llama_context * llama_new_context_with_model(
                     LLAMA_LOG_INFO("%s: %10s compute buffer size = %8.2f MiB\n", __func__,
                             ggml_backend_buft_name(buft),
                             size / 1024.0 / 1024.0);
+
+                    llama_event event;
+                    event.type           = LLAMA_EVENT_TYPE_BUFFER;
+                    event.buffer.usage   = LLAMA_BUFFER_USAGE_COMPUTE;
+                    event.buffer.name    = ggml_backend_buft_name(buft);
+                    event.buffer.size    = size;
+                    event.buffer.is_host = ggml_backend_buft_is_host(buft);
+                    llama_event_emit(event, ctx);
                 }
             }
 
@@ -15987,6 +16720,9 @@ int32_t llama_control_vector_apply(struct llama_context * lctx, const float * da
     const llama_model & model = lctx->model;
     llama_control_vector & cvec = lctx->cvec;
 
+    // the layers the vector is added to are part of the graph
+    lctx->graph_cache.clear();
+
     if (data == nullptr) {
         // disable the current control vector (but leave allocated for later)
         cvec.layer_start = -1;
@@ -16965,7 +17701,7 @@ size_t llama_state_seq_set_data(struct llama_context * ctx, const uint8_t * src,
             batch.n_seq_id[i] = 1;
             batch.seq_id[i][0] = dest_seq_id;
         }
-        if (!llama_kv_cache_find_slot(kv_self, batch)) {
+        if (!llama_kv_cache_find_slot(kv_self, batch, /*contiguous*/ true)) {
             llama_batch_free(batch);
             LLAMA_LOG_ERROR("%s: failed to find available cells in kv cache\n", __func__);
             return 0;
@@ -17180,6 +17916,12 @@ void llama_set_abort_callback(struct llama_context * ctx, bool (*abort_callback)
     ctx->abort_callback_data = abort_callback_data;
 }
 
+void llama_set_cpu_affinity(struct llama_context * ctx, const int32_t * cpus, int32_t n_cpus) {
+    if (ctx->backend_cpu != nullptr) {
+        ggml_backend_cpu_set_affinity(ctx->backend_cpu, cpus, n_cpus);
+    }
+}
+
 void llama_set_causal_attn(struct llama_context * ctx, bool causal_attn) {
     ctx->cparams.causal_attn = causal_attn;
 }
@@ -17242,11 +17984,22 @@ void llama_batch_free(struct llama_batch batch) {
 int32_t llama_decode(
         struct llama_context * ctx,
           struct llama_batch   batch) {
+    const int64_t t_start_us = g_state.event_callback ? ggml_time_us() : 0;
+
     const int ret = llama_decode_internal(*ctx, batch);
     if (ret < 0) {
         LLAMA_LOG_ERROR("%s: failed to decode, ret = %d\n", __func__, ret);
     }
 
+    if (ret == 0 && g_state.event_callback) {
+        llama_event event;
+        event.type             = LLAMA_EVENT_TYPE_DECODE;
+        event.decode.n_tokens  = batch.n_tokens;
+        event.decode.n_outputs = ctx->n_outputs;
+        event.decode.t_us      = ggml_time_us() - t_start_us;
+        llama_event_emit(event, ctx);
+    }
+
     return ret;
 }
 
@@ -17257,6 +18010,12 @@ void llama_synchronize(struct llama_context * ctx) {
     // the stats will be added to the prompt evaluation stats
     // this should only happen when using batch size 1 to evaluate a batch
 
+    // nothing was evaluated since the last call, leave the context untouched so that threads sampling from the
+    // same logits only read it
+    if (ctx->n_queued_tokens == 0) {
+        return;
+    }
+
     // add the evaluation to the stats
     if (ctx->n_queued_tokens == 1) {
         ctx->t_eval_us += ggml_time_us() - ctx->t_compute_start_us;
@@ -17267,7 +18026,7 @@ void llama_synchronize(struct llama_context * ctx) {
     }
 
     // get a more accurate load time, upon first eval
-    if (ctx->n_queued_tokens > 0 && !ctx->has_evaluated_once) {
+    if (!ctx->has_evaluated_once) {
         ctx->t_load_us = ggml_time_us() - ctx->t_start_us;
         ctx->has_evaluated_once = true;
     }
@@ -17831,7 +18590,7 @@ struct llama_timings llama_get_timings(struct llama_context * ctx) {
         /*.t_p_eval_ms =*/ 1e-3 * ctx->t_p_eval_us,
         /*.t_eval_ms   =*/ 1e-3 * ctx->t_eval_us,
 
-        /*.n_sample =*/ std::max(1, ctx->n_sample),
+        /*.n_sample =*/ std::max(1, ctx->n_sample.load()),
         /*.n_p_eval =*/ std::max(1, ctx->n_p_eval),
         /*.n_eval   =*/ std::max(1, ctx->n_eval),
     };
@@ -17858,6 +18617,18 @@ void llama_reset_timings(struct llama_context * ctx) {
     ctx->t_sample_us = ctx->n_sample = 0;
     ctx->t_eval_us   = ctx->n_eval   = 0;
     ctx->t_p_eval_us = ctx->n_p_eval = 0;
+
+    if (ctx->backend_cpu != nullptr) {
+        ggml_backend_cpu_reset_thread_times(ctx->backend_cpu);
+    }
+}
+
+int32_t llama_get_thread_timings(struct llama_context * ctx, int64_t * t_busy_us, int32_t n_max) {
+    if (ctx->backend_cpu == nullptr) {
+        return 0;
+    }
+
+    return ggml_backend_cpu_get_thread_times(ctx->backend_cpu, t_busy_us, n_max);
 }
 
 const char * llama_print_system_info(void) {
@@ -17905,11 +18676,11 @@ void llama_dump_timing_info_yaml(FILE * stream, const llama_context * ctx) {
             1.0e-3 * ctx->t_sample_us / ctx->n_sample);
     fprintf(stream, "n_eval: %d  # number of tokens generated (excluding the first one)\n", ctx->n_eval);
     fprintf(stream, "n_p_eval: %d  # number of tokens processed in batches at the beginning\n", ctx->n_p_eval);
-    fprintf(stream, "n_sample: %d  # number of sampled tokens\n", ctx->n_sample);
+    fprintf(stream, "n_sample: %d  # number of sampled tokens\n", ctx->n_sample.load());
     fprintf(stream, "t_eval_us: %" PRId64 "  # total microseconds spent generating tokens\n", ctx->t_eval_us);
     fprintf(stream, "t_load_us: %" PRId64 "  # total microseconds spent loading the model\n", ctx->t_load_us);
     fprintf(stream, "t_p_eval_us: %" PRId64 "  # total microseconds spent prompt processing\n", ctx->t_p_eval_us);
-    fprintf(stream, "t_sample_us: %" PRId64 "  # total microseconds spent sampling\n", ctx->t_sample_us);
+    fprintf(stream, "t_sample_us: %" PRId64 "  # total microseconds spent sampling\n", ctx->t_sample_us.load());
     fprintf(stream, "ts_eval: %.2f  # tokens / second during generation\n",
             1.0e6 * ctx->n_eval / ctx->t_eval_us);
     fprintf(stream, "ts_p_eval: %.2f  # tokens / second during prompt processing\n",
@@ -17925,6 +18696,11 @@ const std::vector<std::pair<std::string, struct ggml_tensor *>> & llama_internal
     return ctx->model.tensors_by_name;
 }
 
+void llama_event_set(llama_event_callback event_callback, void * user_data) {
+    g_state.event_callback           = event_callback;
+    g_state.event_callback_user_data = user_data;
+}
+
 void llama_log_set(ggml_log_callback log_callback, void * user_data) {
     g_state.log_callback = log_callback ? log_callback : llama_log_callback_default;
     g_state.log_callback_user_data = user_data;
@@ -252,6 +252,7 @@ extern "C" {
         bool use_mmap;      // use mmap if possible
         bool use_mlock;     // force system to keep model in RAM
         bool check_tensors; // validate model tensor data
+        bool repack;        // store the Q4_0/Q8_0 matrices of CPU layers with interleaved rows (faster CPU matmul, no mmap)
     };
 
     struct llama_context_params {
@@ -359,6 +360,83 @@ extern "C" {
         int32_t n_eval;
     };
 
+    enum llama_event_type {
+        LLAMA_EVENT_TYPE_MODEL_META    = 0, // meta:        a model property, as printed by the loader
+        LLAMA_EVENT_TYPE_TENSOR_TYPE   = 1, // tensor_type: number of tensors of a type in the model file
+        LLAMA_EVENT_TYPE_LOAD_PROGRESS = 2, // progress:    fraction of the tensor data loaded, 0.0 - 1.0
+        LLAMA_EVENT_TYPE_OFFLOAD       = 3, // offload:     layers placed on the GPU
+        LLAMA_EVENT_TYPE_BUFFER        = 4, // buffer:      a backend buffer was allocated
+        LLAMA_EVENT_TYPE_DECODE        = 5, // decode:      a llama_decode call finished
+        LLAMA_EVENT_TYPE_TENSOR_CTX    = 6, // tensor_ctx:  the ggml contexts holding the model tensors were created
+    };
+
+    enum llama_meta_type {
+        LLAMA_META_TYPE_STR   = 0,
+        LLAMA_META_TYPE_INT   = 1,
+        LLAMA_META_TYPE_FLOAT = 2,
+    };
+
+    enum llama_buffer_usage {
+        LLAMA_BUFFER_USAGE_MODEL   = 0, // model weights
+        LLAMA_BUFFER_USAGE_KV      = 1, // KV cache
+        LLAMA_BUFFER_USAGE_OUTPUT  = 2, // logits and embeddings
+        LLAMA_BUFFER_USAGE_COMPUTE = 3, // compute graph
+    };
+
+    // structured counterpart of the information printed to the log
+    // pointers are only valid for the duration of the callback
+    struct llama_event {
+        enum llama_event_type type;
+
+        // context the event is about, to tell apart the contexts of a process (e.g. of a draft model)
+        // NULL for the events emitted while loading a model
+        const struct llama_context * ctx;
+
+        union {
+            struct {
+                const char *         key;
+                enum llama_meta_type type;
+                int64_t              value_int;   // LLAMA_META_TYPE_INT
+                double               value_float; // LLAMA_META_TYPE_FLOAT
+                const char *         value;       // as printed, e.g. "6.74 B" for the INT "model params"
+            } meta;
+
+            struct {
+                const char * name;
+                int32_t      n_tensors;
+            } tensor_type;
+
+            float progress;
+
+            struct {
+                int32_t n_repeating;   // repeating layers offloaded
+                bool    non_repeating; // whether the output layer is offloaded too
+                int32_t n_offloaded;   // total layers offloaded
+                int32_t n_layers;      // total layers that can be offloaded
+            } offload;
+
+            struct {
+                enum llama_buffer_usage usage;
+                const char * name;     // backend buffer type, e.g. "CPU", "CUDA0"
+                size_t       size;     // bytes
+                bool         is_host;
+            } buffer;
+
+            struct {
+                int32_t n_tokens;
+                int32_t n_outputs;
+                int64_t t_us;          // wall time spent in llama_decode
+            } decode;
+
+            struct {
+                int32_t n_ctx;         // one per buffer type
+                size_t  size;          // bytes, for all of them
+            } tensor_ctx;
+        };
+    };
+
+    typedef void (*llama_event_callback)(const struct llama_event * event, void * user_data);
+
     // used in chat template
     typedef struct llama_chat_message {
         const char * role;
@@ -756,6 +834,10 @@ extern "C" {
     // Set abort callback
     LLAMA_API void llama_set_abort_callback(struct llama_context * ctx, ggml_abort_callback abort_callback, void * abort_callback_data);
 
+    // Pin the CPU compute threads: thread i runs on cpus[i % n_cpus]
+    // n_cpus = 0 restores the default placement (see llama_numa_init)
+    LLAMA_API void llama_set_cpu_affinity(struct llama_context * ctx, const int32_t * cpus, int32_t n_cpus);
+
     // Wait until all computations are finished
     // This is automatically done when using one of the functions below to obtain the computation results
     // and is not necessary to call it explicitly in most cases
@@ -1079,6 +1161,10 @@ extern "C" {
     LLAMA_API void llama_print_timings(struct llama_context * ctx);
     LLAMA_API void llama_reset_timings(struct llama_context * ctx);
 
+    // Time in microseconds each CPU compute thread spent computing since the last llama_reset_timings()
+    // Returns the number of threads written to t_busy_us
+    LLAMA_API int32_t llama_get_thread_timings(struct llama_context * ctx, int64_t * t_busy_us, int32_t n_max);
+
     // Print system information
     LLAMA_API const char * llama_print_system_info(void);
 
@@ -1086,6 +1172,12 @@ extern "C" {
     // If this is not called, or NULL is supplied, everything is output on stderr.
     LLAMA_API void llama_log_set(ggml_log_callback log_callback, void * user_data);
 
+    // Set callback for all future structured events (model metadata, load progress, buffer sizes, offload and
+    // decode timings), so callers can read the values without parsing the log.
+    // The callback runs synchronously on the thread that loads the model or calls llama_decode.
+    // Supply NULL to disable.
+    LLAMA_API void llama_event_set(llama_event_callback event_callback, void * user_data);
+
     LLAMA_API void llama_dump_timing_info_yaml(FILE * stream, const struct llama_context * ctx);
 
 #ifdef __cplusplus
@@ -1095,6 +1187,7 @@ extern "C" {
 // Internal API to be implemented by llama.cpp and used by tests/benchmarks only
 #ifdef LLAMA_API_INTERNAL
 
+#include <map>
 #include <random>
 #include <string>
 #include <vector>
@@ -1112,6 +1205,9 @@ struct llama_grammar {
 
     // buffer for partially generated UTF-8 sequence from accepted tokens
     llama_partial_utf8                                      partial_utf8;
+
+    // bitsets of the tokens allowed in previously seen states (stacks separated by nullptr), see llama_sample_grammar
+    mutable std::map<std::vector<const llama_grammar_element *>, std::vector<uint32_t>> allowed_cache;
 };
 
 struct llama_grammar_candidate {
@@ -1134,6 +1230,14 @@ std::pair<std::vector<uint32_t>, llama_partial_utf8> decode_utf8(
         const std::string & src,
         llama_partial_utf8   partial_start);
 
+// Computes the tokens the grammar accepts next as a bitset over the vocabulary, by walking a prefix trie
+// of the vocabulary that is built once per model.
+// Returns false if the grammar is in the middle of a UTF-8 sequence, where the trie cannot be used.
+bool llama_grammar_allowed_tokens(
+        struct llama_context * ctx,
+        const struct llama_grammar * grammar,
+        std::vector<uint32_t> & allowed);
+
 // Randomly selects a token from the candidates based on their probabilities using given std::mt19937.
 // This is a temporary workaround in order to fix race conditions when sampling with multiple sequences.
 llama_token llama_sample_token_with_rng(struct llama_context * ctx, llama_token_data_array * candidates, std::mt19937 & rng);
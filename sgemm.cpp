@@ -53,6 +53,8 @@
 #include "ggml-impl.h"
 #include "ggml-quants.h"
 
+#include <type_traits>
+
 #ifdef _MSC_VER
 #define NOINLINE __declspec(noinline)
 #else
@@ -73,6 +75,11 @@ inline float unhalf(ggml_fp16_t d) {
     return GGML_FP16_TO_FP32(d);
 }
 
+#if defined(__AVX2__) || defined(__AVX512F__)
+// non-linear code book of IQ4_NL and IQ4_XS, same as in ggml-quants.c
+alignas(16) const int8_t kvalues_iq4nl[16] = {-127, -104, -83, -65, -49, -35, -22, -10, 1, 13, 25, 38, 53, 69, 89, 113};
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // VECTORIZED ARITHMETIC OPERATIONS
 
@@ -750,6 +757,11 @@ class tinyBLAS_Q0_AVX2 {
         return _mm256_sub_epi8(denibble(b->qs), _mm256_set1_epi8(8));
     }
 
+    inline __m256i load(const block_iq4_nl *b) {
+        const __m128i values = _mm_loadu_si128((const __m128i *)kvalues_iq4nl);
+        return _mm256_shuffle_epi8(MM256_SET_M128I(values, values), denibble(b->qs));
+    }
+
     inline __m256 updot(__m256i u, __m256i s) {
         __m256i res;
 #if defined(__AVXVNNI__) || (defined(__AVX512VNNI__) && defined(__AVX512VL__))
@@ -777,6 +789,333 @@ class tinyBLAS_Q0_AVX2 {
     const int ith;
     const int nth;
 };
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// K-QUANT MATRIX MULTIPLICATION
+
+#if QK_K == 256
+/**
+ * Multiplies super-block quantized weights (Q4_K, Q5_K, Q6_K, IQ4_XS)
+ * with Q8_K activations.
+ *
+ * Each super-block of 256 weights is processed as eight sub-blocks of
+ * 32. For every sub-block the quants of the RM rows of A are unpacked
+ * into registers once and reused for the RN columns of B, the integer
+ * products are scaled by the 6/8-bit sub-block scales and accumulated
+ * as int32 until the end of the super-block, where they're multiplied
+ * by the fp16/fp32 super-block deltas. The zero points of the K-quants
+ * (mins of Q4_K/Q5_K, the -32 bias of Q6_K) are applied separately by
+ * using the 16-element sums that Q8_K already stores in `bsums`.
+ */
+template <typename TA>
+class tinyBLAS_K_AVX2 {
+  public:
+    tinyBLAS_K_AVX2(int64_t k,
+                    const TA *A, int64_t lda,
+                    const block_q8_K *B, int64_t ldb,
+                    float *C, int64_t ldc,
+                    int ith, int nth)
+        : A(A), B(B), C(C), k(k), lda(lda), ldb(ldb), ldc(ldc), ith(ith), nth(nth) {
+    }
+
+    void matmul(int64_t m, int64_t n, int task) {
+        if (task == GGML_TASK_TYPE_COMPUTE)
+            mnpack(0, m, 0, n);
+    }
+
+  private:
+    // every tile keeps RM*RN int32 and RM*RN float accumulators live, so
+    // the tiles are smaller than the ones used by tinyBLAS_Q0_AVX2
+    void mnpack(int64_t m0, int64_t m, int64_t n0, int64_t n) {
+        int64_t mc, nc, mp, np;
+        switch ((MIN(m - m0, 4) << 4) | MIN(n - n0, 4)) {
+#if VECTOR_REGISTERS == 32
+        case 0x44:
+        case 0x43:
+            mc = 4;
+            nc = 3;
+            gemm<4, 3>(m0, m, n0, n);
+            break;
+        case 0x34:
+            mc = 3;
+            nc = 4;
+            gemm<3, 4>(m0, m, n0, n);
+            break;
+        case 0x33:
+            mc = 3;
+            nc = 3;
+            gemm<3, 3>(m0, m, n0, n);
+            break;
+        case 0x42:
+            mc = 4;
+            nc = 2;
+            gemm<4, 2>(m0, m, n0, n);
+            break;
+        case 0x24:
+            mc = 2;
+            nc = 4;
+            gemm<2, 4>(m0, m, n0, n);
+            break;
+        case 0x32:
+            mc = 3;
+            nc = 2;
+            gemm<3, 2>(m0, m, n0, n);
+            break;
+        case 0x23:
+            mc = 2;
+            nc = 3;
+            gemm<2, 3>(m0, m, n0, n);
+            break;
+#else
+        case 0x44:
+        case 0x43:
+        case 0x42:
+        case 0x34:
+        case 0x33:
+        case 0x32:
+        case 0x24:
+        case 0x23:
+#endif
+        case 0x22:
+            mc = 2;
+            nc = 2;
+            gemm<2, 2>(m0, m, n0, n);
+            break;
+        case 0x41:
+            mc = 4;
+            nc = 1;
+            gemm<4, 1>(m0, m, n0, n);
+            break;
+        case 0x14:
+            mc = 1;
+            nc = 4;
+            gemm<1, 4>(m0, m, n0, n);
+            break;
+        case 0x31:
+            mc = 3;
+            nc = 1;
+            gemm<3, 1>(m0, m, n0, n);
+            break;
+        case 0x13:
+            mc = 1;
+            nc = 3;
+            gemm<1, 3>(m0, m, n0, n);
+            break;
+        case 0x21:
+            mc = 2;
+            nc = 1;
+            gemm<2, 1>(m0, m, n0, n);
+            break;
+        case 0x12:
+            mc = 1;
+            nc = 2;
+            gemm<1, 2>(m0, m, n0, n);
+            break;
+        case 0x11:
+            mc = 1;
+            nc = 1;
+            gemm<1, 1>(m0, m, n0, n);
+            break;
+        default:
+            return;
+        }
+        mp = m0 + (m - m0) / mc * mc;
+        np = n0 + (n - n0) / nc * nc;
+        mnpack(mp, m, n0, np);
+        mnpack(m0, m, np, n);
+    }
+
+    template <int RM, int RN>
+    NOINLINE void gemm(int64_t m0, int64_t m, int64_t n0, int64_t n) {
+        int64_t ytiles = (m - m0) / RM;
+        int64_t xtiles = (n - n0) / RN;
+        int64_t tiles = xtiles * ytiles;
+        int64_t duty = (tiles + nth - 1) / nth;
+        int64_t start = duty * ith;
+        int64_t end = start + duty;
+        if (end > tiles)
+            end = tiles;
+        for (int64_t job = start; job < end; ++job) {
+            int64_t ii = m0 + job / xtiles * RM;
+            int64_t jj = n0 + job % xtiles * RN;
+            __m256 Cv[RN][RM] = {};
+            for (int64_t l = 0; l < k; ++l) {
+                const TA *a[RM];
+                const block_q8_K *b[RN];
+                int16_t scales[RM][16];
+                int16_t mins[RM][16];
+                for (int64_t i = 0; i < RM; ++i) {
+                    a[i] = A + lda * (ii + i) + l;
+                    unpack_scales(a[i], scales[i], mins[i]);
+                }
+                for (int64_t j = 0; j < RN; ++j)
+                    b[j] = B + ldb * (jj + j) + l;
+                __m256i acc[RN][RM] = {};
+                for (int s = 0; s < QK_K/32; ++s) {
+                    __m256i qa[RM];
+                    __m256i sc[RM];
+                    for (int64_t i = 0; i < RM; ++i) {
+                        qa[i] = load(a[i], s);
+                        sc[i] = MM256_SET_M128I(_mm_set1_epi16(scales[i][2*s + 1]),
+                                                _mm_set1_epi16(scales[i][2*s + 0]));
+                    }
+                    for (int64_t j = 0; j < RN; ++j) {
+                        const __m256i qb = _mm256_loadu_si256((const __m256i *)(b[j]->qs + 32*s));
+                        for (int64_t i = 0; i < RM; ++i)
+                            acc[j][i] = _mm256_add_epi32(acc[j][i],
+                                                         _mm256_madd_epi16(dot16(qa[i], qb), sc[i]));
+                    }
+                }
+                for (int64_t j = 0; j < RN; ++j) {
+                    const __m256i bsums = _mm256_loadu_si256((const __m256i *)b[j]->bsums);
+                    for (int64_t i = 0; i < RM; ++i) {
+                        Cv[j][i] = madd(_mm256_set1_ps(delta(a[i]) * b[j]->d),
+                                        _mm256_cvtepi32_ps(acc[j][i]),
+                                        Cv[j][i]);
+                        if (has_bias)
+                            Cv[j][i] = madd(_mm256_set1_ps(bias_delta(a[i]) * b[j]->d),
+                                            _mm256_cvtepi32_ps(_mm256_madd_epi16(
+                                                _mm256_loadu_si256((const __m256i *)mins[i]), bsums)),
+                                            Cv[j][i]);
+                    }
+                }
+            }
+            for (int64_t j = 0; j < RN; ++j)
+                for (int64_t i = 0; i < RM; ++i)
+                    C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]);
+        }
+    }
+
+    // the quants of Q4_K, Q5_K and Q6_K are unsigned with a separate bias,
+    // IQ4_XS maps to signed values so it needs the sign trick of Q8_0
+    static constexpr bool has_bias = !std::is_same<TA, block_iq4_xs>::value;
+
+    inline __m256i dot16(__m256i a, __m256i b) {
+        if (has_bias)
+            return _mm256_maddubs_epi16(a, b);
+        return _mm256_maddubs_epi16(_mm256_sign_epi8(a, a), _mm256_sign_epi8(b, a));
+    }
+
+    static inline __m256i nibbles(__m256i x, int hi) {
+        return _mm256_and_si256(hi ? _mm256_srli_epi16(x, 4) : x, _mm256_set1_epi8(15));
+    }
+
+    // Q4_K
+
+    inline void unpack_scales(const block_q4_K *x, int16_t *sc, int16_t *mn) {
+        unpack_scales_k4(x->scales, sc, mn);
+    }
+
+    inline float delta(const block_q4_K *x) {
+        return unhalf(x->d);
+    }
+
+    inline float bias_delta(const block_q4_K *x) {
+        return -unhalf(x->dmin);
+    }
+
+    inline __m256i load(const block_q4_K *x, int s) {
+        return nibbles(_mm256_loadu_si256((const __m256i *)(x->qs + 32*(s/2))), s & 1);
+    }
+
+    // Q5_K
+
+    inline void unpack_scales(const block_q5_K *x, int16_t *sc, int16_t *mn) {
+        unpack_scales_k4(x->scales, sc, mn);
+    }
+
+    inline float delta(const block_q5_K *x) {
+        return unhalf(x->d);
+    }
+
+    inline float bias_delta(const block_q5_K *x) {
+        return -unhalf(x->dmin);
+    }
+
+    inline __m256i load(const block_q5_K *x, int s) {
+        const __m256i bit = _mm256_set1_epi8(1 << s);
+        const __m256i qh = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)x->qh), bit);
+        return _mm256_or_si256(nibbles(_mm256_loadu_si256((const __m256i *)(x->qs + 32*(s/2))), s & 1),
+                               _mm256_and_si256(_mm256_cmpeq_epi8(qh, bit), _mm256_set1_epi8(16)));
+    }
+
+    // Q6_K
+
+    inline void unpack_scales(const block_q6_K *x, int16_t *sc, int16_t *mn) {
+        for (int i = 0; i < 16; ++i)
+            mn[i] = sc[i] = x->scales[i];
+    }
+
+    inline float delta(const block_q6_K *x) {
+        return unhalf(x->d);
+    }
+
+    inline float bias_delta(const block_q6_K *x) {
+        return -32 * unhalf(x->d);
+    }
+
+    inline __m256i load(const block_q6_K *x, int s) {
+        const int g = s % 4;
+        const uint8_t *ql = x->ql + 64*(s/4) + 32*(g & 1);
+        const __m256i qh = _mm256_loadu_si256((const __m256i *)(x->qh + 32*(s/4)));
+        return _mm256_or_si256(nibbles(_mm256_loadu_si256((const __m256i *)ql), g >> 1),
+                               _mm256_and_si256(_mm256_slli_epi16(_mm256_srl_epi16(qh, _mm_cvtsi32_si128(2*g)), 4),
+                                                _mm256_set1_epi8(0x30)));
+    }
+
+    // IQ4_XS
+
+    inline void unpack_scales(const block_iq4_xs *x, int16_t *sc, int16_t *mn) {
+        for (int ib = 0; ib < QK_K/32; ++ib)
+            sc[2*ib + 0] = sc[2*ib + 1] = (((x->scales_l[ib/2] >> 4*(ib%2)) & 0xf) |
+                                           (((x->scales_h >> 2*ib) & 3) << 4)) - 32;
+        (void)mn;
+    }
+
+    inline float delta(const block_iq4_xs *x) {
+        return unhalf(x->d);
+    }
+
+    inline float bias_delta(const block_iq4_xs *x) {
+        (void)x;
+        return 0;
+    }
+
+    inline __m256i load(const block_iq4_xs *x, int s) {
+        const __m128i values = _mm_loadu_si128((const __m128i *)kvalues_iq4nl);
+        const __m128i q = _mm_loadu_si128((const __m128i *)(x->qs + 16*s));
+        return _mm256_shuffle_epi8(MM256_SET_M128I(values, values),
+                                   _mm256_and_si256(_mm256_set1_epi8(15),
+                                                    MM256_SET_M128I(_mm_srli_epi16(q, 4), q)));
+    }
+
+    // 6-bit scales and mins of Q4_K and Q5_K, see get_scale_min_k4 in ggml-quants.c
+    static inline void unpack_scales_k4(const uint8_t *q, int16_t *sc, int16_t *mn) {
+        for (int j = 0; j < QK_K/32; ++j) {
+            int d, m;
+            if (j < 4) {
+                d = q[j] & 63;
+                m = q[j + 4] & 63;
+            } else {
+                d = (q[j + 4] & 0xF) | ((q[j - 4] >> 6) << 4);
+                m = (q[j + 4] >>  4) | ((q[j - 0] >> 6) << 4);
+            }
+            sc[2*j + 0] = sc[2*j + 1] = d;
+            mn[2*j + 0] = mn[2*j + 1] = m;
+        }
+    }
+
+    const TA *const A;
+    const block_q8_K *const B;
+    float *const C;
+    const int64_t k;
+    const int64_t lda;
+    const int64_t ldb;
+    const int64_t ldc;
+    const int ith;
+    const int nth;
+};
+#endif // QK_K == 256
 #endif // __AVX2__
 
 } // namespace
@@ -973,6 +1312,86 @@ bool llamafile_sgemm(int64_t m, int64_t n, int64_t k, const void *A, int64_t lda
 #endif
     }
 
+    case GGML_TYPE_IQ4_NL: {
+        if (Btype != GGML_TYPE_Q8_0)
+            return false;
+#if defined(__AVX2__) || defined(__AVX512F__)
+        tinyBLAS_Q0_AVX2<block_iq4_nl, block_q8_0, float> tb{
+            k, (const block_iq4_nl *)A, lda,
+            (const block_q8_0 *)B, ldb,
+            (float *)C, ldc,
+            ith, nth};
+        tb.matmul(m, n, task);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q4_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if (defined(__AVX2__) || defined(__AVX512F__)) && QK_K == 256
+        tinyBLAS_K_AVX2<block_q4_K> tb{
+            k, (const block_q4_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            ith, nth};
+        tb.matmul(m, n, task);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q5_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if (defined(__AVX2__) || defined(__AVX512F__)) && QK_K == 256
+        tinyBLAS_K_AVX2<block_q5_K> tb{
+            k, (const block_q5_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            ith, nth};
+        tb.matmul(m, n, task);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q6_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if (defined(__AVX2__) || defined(__AVX512F__)) && QK_K == 256
+        tinyBLAS_K_AVX2<block_q6_K> tb{
+            k, (const block_q6_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            ith, nth};
+        tb.matmul(m, n, task);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_IQ4_XS: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if (defined(__AVX2__) || defined(__AVX512F__)) && QK_K == 256
+        tinyBLAS_K_AVX2<block_iq4_xs> tb{
+            k, (const block_iq4_xs *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            ith, nth};
+        tb.matmul(m, n, task);
+        return true;
+#else
+        return false;
+#endif
+    }
+
     default:
         return false;
     }
@@ -6,9 +6,11 @@
 
 #include "ggml.h"
 #include "llama.h"
+#include "common.h"
 #include "grammar-parser.h"
 #include "unicode.h"
 #include <cassert>
+#include <cmath>
 #include <string>
 #include <vector>
 
@@ -131,12 +133,7 @@ static void test_simple_grammar() {
     );
 }
 
-static void test_complex_grammar() {
-    // Test case for a more complex grammar, with both failure strings and success strings
-    test_grammar(
-        "medium complexity grammar",
-        // Grammar
-        R"""(
+static const std::string complex_grammar_str = R"""(
             root ::= expression
             expression ::= term ws (("+"|"-") ws term)*
             term ::= factor ws (("*"|"/") ws factor)*
@@ -144,7 +141,14 @@ static void test_complex_grammar() {
             number ::= [0-9]+
             variable ::= [a-zA-Z_][a-zA-Z0-9_]*
             function-call ::= variable ws "(" (expression ("," ws expression)*)? ")"
-            ws ::= [ \t\n\r]?)""",
+            ws ::= [ \t\n\r]?)""";
+
+static void test_complex_grammar() {
+    // Test case for a more complex grammar, with both failure strings and success strings
+    test_grammar(
+        "medium complexity grammar",
+        // Grammar
+        complex_grammar_str,
         // Passing strings
         {
             "42",
@@ -320,13 +324,179 @@ number ::= [0-9]+)""";
     fprintf(stderr, "  ✅︎ Passed\n");
 }
 
-int main() {
+// same as grammars/json.gbnf
+static const std::string json_grammar_str = R"""(
+root   ::= object
+value  ::= object | array | string | number | ("true" | "false" | "null") ws
+
+object ::=
+  "{" ws (
+            string ":" ws value
+    ("," ws string ":" ws value)*
+  )? "}" ws
+
+array  ::=
+  "[" ws (
+            value
+    ("," ws value)*
+  )? "]" ws
+
+string ::=
+  "\"" (
+    [^"\\\x7F\x00-\x1F] |
+    "\\" (["\\/bfnrt] | "u" [0-9a-fA-F] [0-9a-fA-F] [0-9a-fA-F] [0-9a-fA-F]) # escapes
+  )* "\"" ws
+
+number ::= ("-"? ([0-9] | [1-9] [0-9]*)) ("." [0-9]+)? ([eE] [-+]? [0-9]+)? ws
+
+ws ::= ([ \t\n] ws)?)""";
+
+// walks the code points of a token through a copy of the grammar stacks, like llama_sample_grammar used to per candidate
+static bool token_accepted(const llama_grammar * grammar, const std::vector<uint32_t> & code_points) {
+    auto stacks = grammar->stacks;
+    std::vector<std::vector<const llama_grammar_element *>> next_stacks;
+
+    for (const uint32_t chr : code_points) {
+        llama_grammar_accept(grammar->rules, stacks, chr, next_stacks);
+        if (next_stacks.empty()) {
+            return false;
+        }
+        stacks.swap(next_stacks);
+    }
+
+    return true;
+}
+
+// compares the trie masks against walking every token, and times both and llama_sample_grammar with a warm cache,
+// over the grammar states visited while matching input
+static void bench_grammar_masks(llama_context * ctx, const std::string & desc, const std::string & grammar_str, const std::string & input) {
+    const llama_model * model = llama_get_model(ctx);
+    const int n_vocab = llama_n_vocab(model);
+
+    // tokens that end in the middle of a UTF-8 sequence are only checked by the trie
+    std::vector<std::vector<uint32_t>> token_code_points(n_vocab);
+    std::vector<bool> comparable(n_vocab, false);
+    for (llama_token id = 0; id < n_vocab; id++) {
+        const std::string piece = llama_token_to_piece(ctx, id, false);
+        if (llama_token_is_eog(model, id) || piece.empty() || piece[0] == 0) {
+            continue;
+        }
+        auto decoded = decode_utf8(piece, {});
+        if (decoded.second.n_remain != 0) {
+            continue;
+        }
+        decoded.first.pop_back();
+        token_code_points[id] = std::move(decoded.first);
+        comparable[id] = true;
+    }
+
+    llama_grammar * grammar = build_grammar(grammar_str);
+    const auto original_stacks = grammar->stacks;
+
+    const auto code_points = decode_utf8(input, {}).first;
+    const int n_states = code_points.size(); // including the state after the last code point, without the terminating 0
+
+    std::vector<std::vector<uint32_t>> allowed(n_states);
+    std::vector<llama_token_data> candidates(n_vocab);
+
+    int64_t t_naive_us  = 0;
+    int64_t t_trie_us   = 0;
+    int64_t t_cached_us = 0;
+
+    for (int pass = 0; pass < 3; pass++) {
+        grammar->stacks = original_stacks;
+
+        for (int i = 0; i < n_states; i++) {
+            if (pass == 0) {
+                int64_t t_start_us = ggml_time_us();
+
+                std::vector<bool> naive(n_vocab, false);
+                for (llama_token id = 0; id < n_vocab; id++) {
+                    naive[id] = comparable[id] && token_accepted(grammar, token_code_points[id]);
+                }
+
+                t_naive_us += ggml_time_us() - t_start_us;
+                t_start_us = ggml_time_us();
+
+                const bool ok = llama_grammar_allowed_tokens(ctx, grammar, allowed[i]);
+
+                t_trie_us += ggml_time_us() - t_start_us;
+
+                assert(ok);
+                for (llama_token id = 0; id < n_vocab; id++) {
+                    if (comparable[id]) {
+                        assert(naive[id] == (bool) ((allowed[i][id / 32] >> (id % 32)) & 1));
+                    }
+                }
+            } else {
+                // the first pass over llama_sample_grammar fills the cache of allowed tokens, the second one is timed
+                for (llama_token id = 0; id < n_vocab; id++) {
+                    candidates[id] = llama_token_data{ id, 0.0f, 0.0f };
+                }
+                llama_token_data_array candidates_p = { candidates.data(), candidates.size(), false };
+
+                const int64_t t_start_us = ggml_time_us();
+
+                llama_sample_grammar(ctx, &candidates_p, grammar);
+
+                if (pass == 2) {
+                    t_cached_us += ggml_time_us() - t_start_us;
+                }
+
+                for (llama_token id = 0; id < n_vocab; id++) {
+                    assert(std::isinf(candidates[id].logit) != (bool) ((allowed[i][id / 32] >> (id % 32)) & 1));
+                }
+            }
+
+            if (i + 1 < n_states) {
+                auto prev_stacks = grammar->stacks;
+                llama_grammar_accept(grammar->rules, prev_stacks, code_points[i], grammar->stacks);
+                assert(!grammar->stacks.empty());
+            }
+        }
+    }
+
+    fprintf(stdout, "%s: %s: %d states, per state: every token %.3f ms, trie %.3f ms, cached mask %.3f ms\n",
+            __func__, desc.c_str(), n_states, t_naive_us / 1e3 / n_states, t_trie_us / 1e3 / n_states, t_cached_us / 1e3 / n_states);
+
+    llama_grammar_free(grammar);
+}
+
+static void bench_grammar_masks(const char * fname_vocab) {
+    llama_backend_init();
+
+    auto mparams = llama_model_default_params();
+    mparams.vocab_only = true;
+
+    llama_model * model = llama_load_model_from_file(fname_vocab, mparams);
+    assert(model != NULL);
+
+    auto cparams = llama_context_default_params();
+    llama_context * ctx = llama_new_context_with_model(model, cparams);
+    assert(ctx != NULL);
+
+    bench_grammar_masks(ctx, "medium complexity grammar", complex_grammar_str, "f(g(x), h(y, z)) * (a + b) - func(x, y + 2)");
+    bench_grammar_masks(ctx, "json grammar", json_grammar_str,
+            "{\"name\": \"wingman\", \"tags\": [\"llm\", \"server\"], \"version\": 1.5, \"nested\": {\"ok\": true, \"value\": null}}");
+
+    llama_free(ctx);
+    llama_free_model(model);
+    llama_backend_free();
+}
+
+int main(int argc, char ** argv) {
     fprintf(stdout, "Running grammar integration tests...\n");
     test_simple_grammar();
     test_complex_grammar();
     test_quantifiers();
     test_failure_missing_root();
     test_failure_missing_reference();
+
+    // optional: vocabulary to benchmark the grammar masks with
+    if (argc > 1) {
+        bench_grammar_masks(argv[1]);
+    }
+
     fprintf(stdout, "All tests passed.\n");
     return 0;
 }
@@ -3,6 +3,7 @@
 #include "ggml.h"
 
 #undef NDEBUG
+#include <algorithm>
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
@@ -94,6 +95,95 @@ static float dot_product_error(
     return fabsf(result - dot_ref) / test_size;
 }
 
+// Interleaved rows: the 4 x nc tile of the repacked type must match the row-by-row dot products of the base type,
+// and unpacking must restore the original rows
+static float interleaved_dot_product_error(
+    ggml_type type, ggml_type itype, size_t test_size, const float * test_data1, const float * test_data2
+) {
+    const int64_t nrows     = 4;
+    const int64_t ncols     = 5; // exercise the full and the partial column blocks
+    const int64_t n_per_row = test_size / 8;
+
+    auto qfns = ggml_internal_get_type_traits(type);
+    auto ifns = ggml_internal_get_type_traits(itype);
+    auto vdot = ggml_internal_get_type_traits(qfns.vec_dot_type);
+
+    const size_t row_size   = ggml_row_size(type, n_per_row);
+    const size_t row_size_y = ggml_row_size(qfns.vec_dot_type, n_per_row);
+
+    std::vector<uint8_t> tmp_q(nrows*row_size);
+    std::vector<uint8_t> tmp_i(nrows*row_size);
+    std::vector<uint8_t> tmp_u(nrows*row_size);
+    std::vector<uint8_t> tmp_y(ncols*row_size_y);
+
+    for (int64_t r = 0; r < nrows; r++) {
+        qfns.from_float(test_data1 + r*n_per_row, tmp_q.data() + r*row_size, n_per_row);
+    }
+    for (int64_t c = 0; c < ncols; c++) {
+        vdot.from_float(test_data2 + c*n_per_row, tmp_y.data() + c*row_size_y, n_per_row);
+    }
+
+    ggml_repack_rows(itype, tmp_i.data(), tmp_q.data(), nrows, n_per_row);
+    ggml_unpack_rows(itype, tmp_u.data(), tmp_i.data(), nrows, n_per_row);
+    if (tmp_u != tmp_q) {
+        return INFINITY;
+    }
+
+    std::vector<float> result(nrows*ncols);
+    ifns.vec_dot(n_per_row, result.data(), nrows, tmp_i.data(), 0, tmp_y.data(), row_size_y, ncols);
+
+    float max_err = 0.0f;
+    for (int64_t c = 0; c < ncols; c++) {
+        for (int64_t r = 0; r < nrows; r++) {
+            float ref = INFINITY;
+            qfns.vec_dot(n_per_row, &ref, 0, tmp_q.data() + r*row_size, 0, tmp_y.data() + c*row_size_y, 0, 1);
+            max_err = std::max(max_err, fabsf(result[c*nrows + r] - ref) / n_per_row);
+        }
+    }
+
+    return max_err;
+}
+
+// Interleaved rows through mul_mat: large enough to take the BLAS branch on BLAS builds, which has to leave the
+// interleaved types to their own kernel
+static float interleaved_mul_mat_error(ggml_type type, ggml_type itype, size_t test_size, const float * test_data1) {
+    const int64_t nrows     = 32;
+    const int64_t ncols     = 64;
+    const int64_t n_per_row = test_size / nrows;
+
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 16*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+
+    struct ggml_tensor * a  = ggml_new_tensor_2d(ctx, type,          n_per_row, nrows);
+    struct ggml_tensor * ai = ggml_new_tensor_2d(ctx, itype,         n_per_row, nrows);
+    struct ggml_tensor * b  = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_per_row, ncols);
+
+    ggml_internal_get_type_traits(type).from_float(test_data1, a->data, nrows*n_per_row);
+    ggml_repack_rows(itype, ai->data, a->data, nrows, n_per_row);
+    generate_data(2.0, ncols*n_per_row, (float *) b->data);
+
+    struct ggml_tensor * c  = ggml_mul_mat(ctx, a,  b);
+    struct ggml_tensor * ci = ggml_mul_mat(ctx, ai, b);
+
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, c);
+    ggml_build_forward_expand(gf, ci);
+    ggml_graph_compute_with_ctx(ctx, gf, 2);
+
+    float max_err = 0.0f;
+    for (int64_t i = 0; i < nrows*ncols; i++) {
+        max_err = std::max(max_err, fabsf(((const float *) ci->data)[i] - ((const float *) c->data)[i]) / n_per_row);
+    }
+
+    ggml_free(ctx);
+
+    return max_err;
+}
+
 int main(int argc, char * argv[]) {
     bool verbose = false;
     const size_t test_size = 32 * 128;
@@ -172,6 +262,23 @@ int main(int argc, char * argv[]) {
             if (failed || verbose) {
                 printf("%5s dot product error:              %s (%f)\n", ggml_type_name(type), RESULT_STR[failed], vec_dot_error);
             }
+
+            const ggml_type itype = ggml_get_interleaved_type(type, test_size / 8, 4);
+            if (itype != type) {
+                const float gemm_error = interleaved_dot_product_error(type, itype, test_size, test_data.data(), test_data2.data());
+                failed = !(gemm_error < MAX_QUANTIZATION_REFERENCE_ERROR);
+                num_failed += failed;
+                if (failed || verbose) {
+                    printf("%5s interleaved dot product error:  %s (%f)\n", ggml_type_name(itype), RESULT_STR[failed], gemm_error);
+                }
+
+                const float mul_mat_error = interleaved_mul_mat_error(type, itype, test_size, test_data.data());
+                failed = !(mul_mat_error < MAX_DOT_PRODUCT_ERROR);
+                num_failed += failed;
+                if (failed || verbose) {
+                    printf("%5s interleaved mul_mat error:      %s (%f)\n", ggml_type_name(itype), RESULT_STR[failed], mul_mat_error);
+                }
+            }
         }
     }
 
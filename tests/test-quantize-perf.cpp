@@ -1,6 +1,9 @@
 // Benchmark quantization specific functions on synthetic data
 
 #include "ggml.h"
+#ifdef GGML_USE_LLAMAFILE
+#include "sgemm.h"
+#endif
 
 #undef NDEBUG
 #include <algorithm>
@@ -28,6 +31,9 @@
 #define L3_SIZE    32*20480
 #define MEM_SIZE 32*2048000
 
+// rows of both operands of the gemm_q benchmark
+#define GEMM_ROWS 8
+
 struct quantize_perf_params {
     std::vector<std::string> include_types;
     std::vector<size_t> test_sizes;
@@ -37,6 +43,7 @@ struct quantize_perf_params {
     bool op_dequantize_row_q = false;
     bool op_quantize_row_q_dot = false;
     bool op_vec_dot_q = false;
+    bool op_gemm_q = false;
     int64_t iterations = ITERATIONS;
 };
 
@@ -118,7 +125,7 @@ static void usage(char * argv[]) {
     printf("  -3                    use size as L1, L2, L3 sizes (L1:%d L2:%d L3:%d)\n", L1_SIZE, L2_SIZE, L3_SIZE);
     printf("  -4                    use size as L1, L2, L3, MEM sizes (L1:%d L2:%d L3:%d MEM:%d)\n", L1_SIZE, L2_SIZE, L3_SIZE, MEM_SIZE);
     printf("  --op OP               set test operation as quantize_row_q_reference, quantize_row_q, dequantize_row_q,\n");
-    printf("                        quantize_row_q_dot, vec_dot_q (all)\n");
+    printf("                        quantize_row_q_dot, vec_dot_q, gemm_q (all)\n");
     printf("  --type TYPE           set test type as");
     for (int i = 0; i < GGML_TYPE_COUNT; i++) {
         ggml_type type = (ggml_type) i;
@@ -185,6 +192,8 @@ int main(int argc, char * argv[]) {
                 params.op_quantize_row_q_dot = true;
             } else if (op == "vec_dot_q") {
                 params.op_vec_dot_q = true;
+            } else if (op == "gemm_q") {
+                params.op_gemm_q = true;
             } else {
                 invalid_param = true;
                 break;
@@ -235,8 +244,8 @@ int main(int argc, char * argv[]) {
     if (params.test_sizes.empty()) {
         params.test_sizes.push_back(L1_SIZE);
     }
-    if (!(params.op_quantize_row_q_reference || params.op_quantize_row_q || params.op_dequantize_row_q || params.op_quantize_row_q_dot || params.op_vec_dot_q)) {
-        params.op_quantize_row_q_reference = params.op_quantize_row_q = params.op_dequantize_row_q = params.op_quantize_row_q_dot = params.op_vec_dot_q = true;
+    if (!(params.op_quantize_row_q_reference || params.op_quantize_row_q || params.op_dequantize_row_q || params.op_quantize_row_q_dot || params.op_vec_dot_q || params.op_gemm_q)) {
+        params.op_quantize_row_q_reference = params.op_quantize_row_q = params.op_dequantize_row_q = params.op_quantize_row_q_dot = params.op_vec_dot_q = params.op_gemm_q = true;
     }
 
     std::sort(params.test_sizes.begin(), params.test_sizes.end());
@@ -354,6 +363,69 @@ int main(int argc, char * argv[]) {
                 }
                 printf("\n");
             }
+
+            if (params.op_gemm_q) {
+                printf("  gemm_q\n");
+#ifdef GGML_USE_LLAMAFILE
+                const ggml_type vdot_type = qfns.vec_dot_type;
+                auto vdot = ggml_internal_get_type_traits(vdot_type);
+                for (size_t size : params.test_sizes) {
+                    printf("    %d x %d x %zu values (%.2f MB)\n", GEMM_ROWS, GEMM_ROWS, size, 4*GEMM_ROWS*size/(float)(1024*1024));
+
+                    const size_t row_size_a = ggml_row_size(type, size);
+                    const size_t row_size_b = ggml_row_size(vdot_type, size);
+                    std::vector<float>   data(size);
+                    std::vector<uint8_t> a(GEMM_ROWS*row_size_a);
+                    std::vector<uint8_t> b(GEMM_ROWS*row_size_b);
+                    std::vector<float>   c(GEMM_ROWS*GEMM_ROWS);
+                    for (int r = 0; r < GEMM_ROWS; r++) {
+                        generate_data(r, size, data.data());
+                        qfns.from_float(data.data(), a.data() + r*row_size_a, size);
+                        generate_data(r + 0.5f, size, data.data());
+                        vdot.from_float(data.data(), b.data() + r*row_size_b, size);
+                    }
+
+                    auto gemm_fn = [&](void) -> float {
+                        bool ok = llamafile_sgemm(GEMM_ROWS, GEMM_ROWS, size/ggml_blck_size(type),
+                                                  a.data(), row_size_a/ggml_type_size(type),
+                                                  b.data(), row_size_b/ggml_type_size(vdot_type),
+                                                  c.data(), GEMM_ROWS,
+                                                  0, 1, GGML_TASK_TYPE_COMPUTE,
+                                                  type, vdot_type, GGML_TYPE_F32);
+                        return ok ? c[0] : 0.0f;
+                    };
+
+                    if (!llamafile_sgemm(GEMM_ROWS, GEMM_ROWS, size/ggml_blck_size(type),
+                                         a.data(), row_size_a/ggml_type_size(type),
+                                         b.data(), row_size_b/ggml_type_size(vdot_type),
+                                         c.data(), GEMM_ROWS,
+                                         0, 1, GGML_TASK_TYPE_COMPUTE,
+                                         type, vdot_type, GGML_TYPE_F32)) {
+                        printf("      not supported\n");
+                        continue;
+                    }
+
+                    // the tiled kernels must agree with vec_dot up to the summation order
+                    float max_ref = 0.0f;
+                    float max_err = 0.0f;
+                    for (int j = 0; j < GEMM_ROWS; j++) {
+                        for (int i = 0; i < GEMM_ROWS; i++) {
+                            float ref;
+                            qfns.vec_dot(size, &ref, 0, a.data() + i*row_size_a, 0, b.data() + j*row_size_b, 0, 1);
+                            max_ref = std::max(max_ref, fabsf(ref));
+                            max_err = std::max(max_err, fabsf(ref - c[j*GEMM_ROWS + i]));
+                        }
+                    }
+                    printf("      max error vs vec_dot : %9.2e\n", max_err);
+                    assert(max_err <= 1e-4f*max_ref);
+
+                    benchmark_function(GEMM_ROWS*size, GEMM_ROWS*row_size_a, iterations, gemm_fn);
+                }
+#else
+                printf("    not supported (built without GGML_USE_LLAMAFILE)\n");
+#endif
+                printf("\n");
+            }
         }
     }
 
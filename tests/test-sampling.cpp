@@ -1,5 +1,6 @@
 #include "ggml.h"
 #include "llama.h"
+#include "sampling.h"
 
 #ifdef NDEBUG
 #undef NDEBUG
@@ -7,6 +8,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -230,6 +232,113 @@ static void test_sampler_queue(
            samplers_sequence.c_str(), n_vocab, top_k, top_p, min_p);
 }
 
+static void bench_top_candidates(const int n_vocab, const int top_k, const float min_p, const int n_iter) {
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> dist(0.0f, 3.0f);
+
+    std::vector<float> logits(n_vocab);
+    for (auto & logit : logits) {
+        logit = dist(rng);
+    }
+
+    auto apply = [&](llama_token_data_array & cur_p) {
+        if (top_k > 0) {
+            llama_sample_top_k(nullptr, &cur_p, top_k, 1);
+        }
+        if (min_p > 0.0f) {
+            llama_sample_min_p(nullptr, &cur_p, min_p, 1);
+        }
+        llama_sample_softmax(nullptr, &cur_p);
+    };
+
+    std::vector<llama_token_data> cur_full;
+    std::vector<llama_token_data> cur_fast;
+
+    int64_t t_full_us = 0;
+    int64_t t_fast_us = 0;
+
+    for (int iter = 0; iter < n_iter; ++iter) {
+        int64_t t_start_us = ggml_time_us();
+
+        cur_full.clear();
+        for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
+            cur_full.emplace_back(llama_token_data{token_id, logits[token_id], 0.0f});
+        }
+        llama_token_data_array full_p = { cur_full.data(), cur_full.size(), false };
+        apply(full_p);
+
+        t_full_us += ggml_time_us() - t_start_us;
+        t_start_us = ggml_time_us();
+
+        llama_sampling_top_candidates(logits.data(), n_vocab, std::max(top_k, 1), min_p, cur_fast);
+        llama_token_data_array fast_p = { cur_fast.data(), cur_fast.size(), false };
+        apply(fast_p);
+
+        t_fast_us += ggml_time_us() - t_start_us;
+
+        GGML_ASSERT(full_p.size == fast_p.size);
+        for (size_t i = 0; i < full_p.size; i++) {
+            GGML_ASSERT(full_p.data[i].id == fast_p.data[i].id);
+            GGML_ASSERT(fabs(full_p.data[i].p - fast_p.data[i].p) < 1e-5);
+        }
+    }
+
+    printf("%s: n_vocab = %6d, top_k = %3d, min_p = %.2f: full = %8.2f us/token, prefiltered = %8.2f us/token\n",
+            __func__, n_vocab, top_k, min_p, (double) t_full_us / n_iter, (double) t_fast_us / n_iter);
+}
+
+// the prefiltered candidates with repetition penalties applied must give the same top-k as the full vocabulary
+static void test_top_candidates_penalties(
+    const int n_vocab, const int top_k, const float repeat_penalty, const float alpha_frequency, const float alpha_presence
+) {
+    std::mt19937 rng(4321);
+    std::normal_distribution<float> dist(0.0f, 3.0f);
+
+    std::vector<float> logits(n_vocab);
+    for (auto & logit : logits) {
+        logit = dist(rng);
+    }
+
+    std::vector<llama_token> order(n_vocab);
+    for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
+        order[token_id] = token_id;
+    }
+    std::sort(order.begin(), order.end(), [&](llama_token a, llama_token b) { return logits[a] > logits[b]; });
+
+    // repeated tokens from the top of the distribution and from anywhere in the vocabulary
+    std::vector<llama_token> last_tokens;
+    for (int i = 0; i < 64; i++) {
+        last_tokens.push_back(i % 2 == 0 ? order[rng() % (2*top_k)] : (llama_token) (rng() % n_vocab));
+    }
+
+    auto apply = [&](llama_token_data_array & cur_p) {
+        llama_sample_repetition_penalties(nullptr, &cur_p, last_tokens.data(), last_tokens.size(), repeat_penalty, alpha_frequency, alpha_presence);
+        llama_sample_top_k(nullptr, &cur_p, top_k, 1);
+        llama_sample_softmax(nullptr, &cur_p);
+    };
+
+    std::vector<llama_token_data> cur_full;
+    for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
+        cur_full.emplace_back(llama_token_data{token_id, logits[token_id], 0.0f});
+    }
+    llama_token_data_array full_p = { cur_full.data(), cur_full.size(), false };
+    apply(full_p);
+
+    std::vector<llama_token_data> cur_fast;
+    llama_sampling_top_candidates_penalized(logits.data(), n_vocab, top_k, 0.0f, last_tokens.data(), last_tokens.size(), cur_fast);
+    llama_token_data_array fast_p = { cur_fast.data(), cur_fast.size(), false };
+    apply(fast_p);
+
+    GGML_ASSERT(full_p.size == fast_p.size);
+    for (size_t i = 0; i < full_p.size; i++) {
+        GGML_ASSERT(full_p.data[i].id == fast_p.data[i].id);
+        GGML_ASSERT(fabs(full_p.data[i].p - fast_p.data[i].p) < 1e-5);
+    }
+
+    printf("%s: n_vocab = %6d, top_k = %3d, repeat = %.2f, frequency = %.2f, presence = %.2f OK\n",
+            __func__, n_vocab, top_k, repeat_penalty, alpha_frequency, alpha_presence);
+}
+
 int main(void) {
     ggml_time_init();
 
@@ -295,6 +404,18 @@ int main(void) {
     test_sampler_queue(10000, "mkp", 100, 0.8f, 0.1f);
     test_sampler_queue(10000, "mpk", 100, 0.8f, 0.1f);
 
+    test_top_candidates_penalties(32000, 40, 1.30f,  0.50f,  0.50f);
+    test_top_candidates_penalties(32000,  1, 1.10f,  1.00f,  2.00f);
+    // penalties below 1 and negative alphas raise the repeated tokens, which may come from below the threshold
+    test_top_candidates_penalties(32000, 40, 0.50f, -1.00f, -5.00f);
+    test_top_candidates_penalties(32000,  1, 0.20f, -2.00f, -9.00f);
+
+    bench_top_candidates(128256,  1, 0.00f, 20);
+    bench_top_candidates(128256, 40, 0.00f, 20);
+    bench_top_candidates(128256,  0, 0.05f, 20);
+    bench_top_candidates(128256, 40, 0.05f, 20);
+    bench_top_candidates(  1000,  5, 1.00f, 20);
+
     printf("OK\n");
 
     return 0;
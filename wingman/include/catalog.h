@@ -0,0 +1,115 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+#include "types.h"
+
+namespace wingman {
+
+	/**
+	 * \brief a JSON parser that is pushed the document in chunks, as they arrive, and reports it to a SAX handler
+	 *
+	 * Drives the same `nlohmann::json_sax` interface as `nlohmann::json::sax_parse`, but only keeps the token being
+	 * read and the nesting of the document, so a large response is parsed while it downloads without holding the
+	 * body in memory.
+	 */
+	class JsonStreamParser {
+	public:
+		using Sax = nlohmann::json_sax<nlohmann::json>;
+
+	private:
+		enum class Expect {
+			value,
+			valueOrEnd,		// first element of an array
+			keyOrEnd,		// first key of an object
+			key,
+			colon,
+			commaOrEnd,
+			end				// the document is complete, only whitespace may follow
+		};
+		enum class Token {
+			none,
+			string,
+			number,
+			literal
+		};
+
+		Sax &sax;
+		std::vector<char> stack;	// '{' or '[' for each open object or array
+		Expect expect = Expect::value;
+		Token token = Token::none;
+		std::string text;
+		bool isKey = false;
+		bool escape = false;
+		int unicodeDigits = 0;		// hex digits of a \u escape still to read
+		uint32_t codepoint = 0;
+		uint32_t highSurrogate = 0;
+		size_t position = 0;
+		std::string error;
+
+		bool fail(const std::string &reason);
+
+		bool startValue(char c);
+
+		bool valueDone();
+
+		bool endToken();
+
+		bool consume(char c);
+
+	public:
+		explicit JsonStreamParser(Sax &sax);
+
+		// parse the next chunk of the document, returns false on a syntax error or if the handler stops the parse
+		bool feed(const char *data, size_t size);
+
+		// call at the end of the document, returns true if it held exactly one complete value
+		bool finish();
+
+		[[nodiscard]] const std::string &getError() const;
+	};
+
+	/**
+	 * \brief picks the fields the catalog index keeps out of the Hugging Face `/api/models` listing
+	 *
+	 * Only GGUF repositories (`HF_MODEL_ENDS_WITH`) that have at least one single-file model are kept. The rest of
+	 * each record (card data, tags, config) is skipped as it streams past.
+	 */
+	class CatalogSax : public JsonStreamParser::Sax {
+		std::vector<CatalogItem> &items;
+		int depth = 0;
+		bool isListing = false;
+		std::string field;			// key of the current model field
+		std::string siblingField;	// key of the current field of a sibling (file) of the model
+		bool inSiblings = false;
+		bool isSplitModel = false;
+		CatalogItem model;
+
+		void addFile(const std::string &fileName);
+
+	public:
+		explicit CatalogSax(std::vector<CatalogItem> &items);
+
+		// true once the top level of the document was an array, i.e. the body was a listing and not an error
+		[[nodiscard]] bool sawListing() const;
+
+		bool null() override;
+		bool boolean(bool val) override;
+		bool number_integer(number_integer_t val) override;
+		bool number_unsigned(number_unsigned_t val) override;
+		bool number_float(number_float_t val, const string_t &s) override;
+		bool string(string_t &val) override;
+		bool binary(binary_t &val) override;
+		bool start_object(std::size_t elements) override;
+		bool key(string_t &val) override;
+		bool end_object() override;
+		bool start_array(std::size_t elements) override;
+		bool end_array() override;
+		bool parse_error(std::size_t position, const std::string &last_token, const nlohmann::detail::exception &ex) override;
+	};
+
+	// true for the parts of a model split across several files, e.g. `model.Q4_K_M-00001-of-00003.gguf`
+	bool IsSplitModelFile(const std::string &fileName);
+
+} // namespace wingman
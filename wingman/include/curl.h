@@ -6,6 +6,7 @@
 // #include <nlohmann/json.hpp>
 
 #include "json.hpp"
+#include "download.verifier.h"
 #include "orm.h"
 #include "util.hpp"
 
@@ -27,6 +28,22 @@ namespace wingman::curl {
 	const std::string EQ_MODEL_DATA_PATH_DEV = "../../../../../../ux/assets";
 	const std::string EQ_MODEL_DATA_PATH_PROD = "../../..";
 
+	// number of connections a download is fetched over, each takes the next byte range when its last one is done
+	constexpr int DOWNLOAD_SEGMENTS = 4;
+	// files are not split into ranges smaller than this
+	constexpr long long MIN_SEGMENT_BYTES = 1024 * 1024;
+	// or larger than this, so the ranges finish close to the order the file is hashed in
+	constexpr long long MAX_SEGMENT_BYTES = 8 * 1024 * 1024;
+	// ranges are only started this far past the hashed part of the file, bounding the bytes held in memory until
+	//	the ranges before them are hashed
+	constexpr long long MAX_REORDER_BYTES = 2 * DOWNLOAD_SEGMENTS * MAX_SEGMENT_BYTES;
+	// times the unfinished ranges are retried before the download is marked as an error
+	constexpr int MAX_SEGMENT_ATTEMPTS = 3;
+	// seconds between saving the progress of a download to the database
+	constexpr int PROGRESS_UPDATE_INTERVAL = 3;
+	// seconds the local model catalog is listed from before the server is asked whether it changed
+	constexpr int CATALOG_REFRESH_INTERVAL = 10 * 60;
+
 	// add HF_MODEL_ENDS_WITH to the end of the modelRepo if it's not already there
 	std::string UnstripFormatFromModelRepo(const std::string &modelRepo);
 
@@ -40,6 +57,8 @@ namespace wingman::curl {
 		CURLcode curlCode;
 		long statusCode;
 		std::map<std::string, std::string, util::ci_less> headers;
+		// see Request::onData
+		std::function<bool(const char *, size_t)> onData = nullptr;
 
 		struct ResponseFile {
 			std::time_t start;
@@ -49,6 +68,8 @@ namespace wingman::curl {
 			std::optional<std::string> quantization = std::nullopt;
 			std::shared_ptr<orm::DownloadItemActions> actions = nullptr;
 			std::function<bool(Response *)>	 onProgress = nullptr;
+			// fed the bytes of the file in order, rejects a corrupt download before it is marked complete
+			std::shared_ptr<DownloadVerifier> verifier = nullptr;
 			bool checkExistsThenExit = false;
 			bool fileExists = false;
 			bool overwrite = false;
@@ -94,6 +115,9 @@ namespace wingman::curl {
 		std::string method;
 		std::map<std::string, std::string, util::ci_less> headers;
 		std::string body;
+		// when set, the body is passed to it as it arrives instead of being kept in `Response::data`. return false to
+		//	stop the transfer
+		std::function<bool(const char *, size_t)> onData = nullptr;
 
 		// setting this will cause the file to be downloaded to the specified path
 		struct RequestFile {
@@ -113,6 +137,14 @@ namespace wingman::curl {
 
 	Response Fetch(const std::string &url);
 
+	// returns the size of the remote file if the server accepts byte range requests for it
+	std::optional<long long> GetRangedContentLength(const std::string &url);
+
+	// download `request.file` over `segments` connections fetching byte ranges into a preallocated file, resuming
+	//	from `request.file.item->segments` when they belong to an earlier attempt at the same file. falls back to
+	//	`Fetch` when the server does not accept range requests
+	Response FetchSegmented(const Request &request, int segments = DOWNLOAD_SEGMENTS);
+
 	bool RemoteFileExists(const std::string &url);
 
 	nlohmann::json GetRawModels();
@@ -123,6 +155,12 @@ namespace wingman::curl {
 
 	nlohmann::json GetAIModels(orm::ItemActionsFactory &actionsFactory);
 
+	// bring the local model catalog up to date with HF_ALL_MODELS_URL when it is older than CATALOG_REFRESH_INTERVAL,
+	//	or always if `force`. the listing is parsed as it streams in, and the validators of the last listing are
+	//	sent so an unchanged one costs a `304 Not Modified`. returns false if the catalog could not be refreshed
+	bool RefreshCatalog(orm::ItemActionsFactory &actionsFactory, bool force = false);
+
+	// list the models from the local catalog, refreshing it first if it is stale
 	nlohmann::json GetAIModelsFast(orm::ItemActionsFactory &actionsFactory);
 
 	bool HasAIModel(const std::string &modelRepo, const std::string &filePath);
@@ -0,0 +1,104 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace wingman {
+
+	class Sha256 {
+		std::array<uint32_t, 8> state;
+		std::array<uint8_t, 64> block;
+		size_t blockSize = 0;
+		uint64_t length = 0;
+
+		void transform(const uint8_t *chunk);
+
+	public:
+		Sha256();
+
+		void update(const void *data, size_t size);
+
+		// pads the message and returns the digest as lowercase hex, the object must not be updated afterwards
+		std::string hexDigest();
+	};
+
+	/**
+	 * \brief checks a download from the bytes of the file fed in order, as they arrive
+	 *
+	 * Computes the SHA-256 of the file and, for GGUF files, parses the header and tensor info table so a file that is
+	 * corrupt, or shorter than its tensors need, is rejected without reading it back from disk.
+	 */
+	class DownloadVerifier {
+		enum class Stage {
+			header,
+			kvKey,
+			kvValue,
+			arrayHeader,
+			arrayElements,
+			tensorInfo,
+			done,
+			failed
+		};
+
+		Sha256 sha256;
+		std::string digest;
+		long long received = 0;
+		long long expectedSize;
+
+		bool isGGUF;
+		Stage stage = Stage::header;
+		std::string error;
+
+		// bytes of the header not parsed yet, `pending[0]` is at file offset `pendingOffset`
+		std::string pending;
+		size_t pos = 0;
+		uint64_t pendingOffset = 0;
+
+		uint64_t tensorCount = 0;
+		uint64_t kvCount = 0;
+		uint64_t tensorIndex = 0;
+		uint64_t kvIndex = 0;
+		std::string key;
+		uint32_t valueType = 0;
+		uint32_t arrayType = 0;
+		uint64_t arrayRemaining = 0;
+		uint32_t alignment;
+		uint64_t tensorDataSize = 0;
+		uint64_t requiredSize = 0;
+
+		bool fail(const std::string &reason);
+
+		bool parse();
+
+		bool takeString(std::string *value);
+
+		bool nextKv();
+
+		bool finishHeader();
+
+	public:
+		/**
+		 * \param isGGUF whether the file must be a valid GGUF file
+		 * \param expectedSize size announced by the server, 0 if unknown
+		 */
+		explicit DownloadVerifier(bool isGGUF, long long expectedSize = 0);
+
+		// feed the next bytes of the file, returns false once the file is known to be invalid
+		bool update(const char *data, size_t size);
+
+		// number of bytes fed so far
+		[[nodiscard]] long long size() const;
+
+		[[nodiscard]] bool failed() const;
+
+		[[nodiscard]] const std::string &getError() const;
+
+		// call once every byte is fed, returns why the file is rejected or std::nullopt if it is valid
+		std::optional<std::string> finish(long long totalBytes);
+
+		// hex SHA-256 of the file, set by finish()
+		[[nodiscard]] const std::string &getSha256() const;
+	};
+
+} // namespace wingman
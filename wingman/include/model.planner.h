@@ -0,0 +1,80 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+#include "hwinfo.h"
+
+namespace wingman {
+
+	/**
+	 * \brief the shape and weight sizes of a GGUF model, read from its header without loading any tensor data
+	 */
+	struct ModelProfile {
+		std::string architecture;
+		int layerCount = 0;
+		int trainContextSize = 0;
+		int embeddingLength = 0;
+		int feedForwardLength = 0;
+		int headCount = 0;
+		int headCountKv = 0;
+		int keyLength = 0;			// per attention head
+		int valueLength = 0;		// per attention head
+		int vocabSize = 0;
+		std::vector<uint64_t> layerBytes;	// weights of each repeating block (`blk.N.*`)
+		uint64_t inputBytes = 0;	// token embeddings, always kept on the CPU
+		uint64_t outputBytes = 0;	// output norm and head, on the GPU only when every block is offloaded
+
+		[[nodiscard]] uint64_t weightBytes() const;
+	};
+
+	NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(ModelProfile, architecture, layerCount, trainContextSize, embeddingLength,
+		feedForwardLength, headCount, headCountKv, keyLength, valueLength, vocabSize, layerBytes, inputBytes, outputBytes)
+
+	struct PlanOptions {
+		int contextSize = 0;			// 0 picks the largest context, up to the trained one, that still fits
+		int batchSize = 512;			// physical batch (n_ubatch) the compute buffers are sized for
+		std::string cacheType = "f16";	// KV cache type, as `--cache-type-k`
+		int gpuLayers = -1;				// -1 picks the most layers that fit
+		uint64_t gpuBytes = 0;			// memory available on the GPU, 0 when there is none
+		uint64_t cpuBytes = 0;			// memory available to the CPU, 0 when unknown
+		uint64_t gpuHeadroomBytes = 512ull * 1024 * 1024;	// left free for the backend's own context and scratch
+	};
+
+	/**
+	 * \brief how a model is split between GPU and CPU, and the bytes each side needs for it
+	 *
+	 * `gpuLayers` follows `--n-gpu-layers`: the last `gpuLayers` blocks are offloaded, and the output layer too once
+	 * it exceeds `layerCount`.
+	 */
+	struct ModelPlan {
+		int gpuLayers = 0;
+		int contextSize = 0;
+		int batchSize = 0;
+		std::string cacheType;
+		uint64_t weightBytes = 0;
+		uint64_t kvCacheBytes = 0;
+		uint64_t computeBytes = 0;
+		uint64_t gpuBytes = 0;			// needed on the GPU
+		uint64_t cpuBytes = 0;			// needed on the CPU
+		bool fitsGpu = false;
+		bool fitsCpu = false;
+	};
+
+	NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(ModelPlan, gpuLayers, contextSize, batchSize, cacheType, weightBytes,
+		kvCacheBytes, computeBytes, gpuBytes, cpuBytes, fitsGpu, fitsCpu)
+
+	// reads hparams and the tensor table of a GGUF model, nullopt if it is not one or lacks the hparams needed to plan
+	std::optional<ModelProfile> ReadModelProfile(const std::string &modelPath);
+
+	// bytes of K and V cache per block for `contextSize` cells, 0 for an unknown cache type
+	uint64_t KvCacheBytesPerLayer(const ModelProfile &profile, int contextSize, const std::string &cacheType);
+
+	// sizes the split of `profile` for the given options, picking the layer count and context when they are automatic
+	ModelPlan PlanModelFit(const ModelProfile &profile, const PlanOptions &options);
+
+	// plan options for the memory this machine reports
+	PlanOptions GetPlanOptions(const HardwareInfo &hardwareInfo);
+
+} // namespace wingman
@@ -3,8 +3,10 @@
 #include <map>
 #include <vector>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <filesystem>
+#include <unordered_map>
 #include <sqlite3.h>
 // #include <nlohmann/json.hpp>
 
@@ -23,11 +25,29 @@ namespace wingman::orm {
 	};
 
 	namespace sqlite {
+		class Statement;
+		class PreparedStatement;
+
 		class Database {
 			sqlite3 *db;
 			fs::path dbPath;
 			int lastErrorCode;
 
+			/**
+			 * \brief a prepared statement kept for the lifetime of the connection, see prepare()
+			 */
+			struct CachedStatement {
+				std::mutex mutex;
+				std::unique_ptr<Statement> statement;
+			};
+			mutable std::mutex statementsMutex;
+			mutable std::unordered_map<std::string, std::unique_ptr<CachedStatement>> statements;
+
+			mutable std::recursive_mutex transactionMutex;
+			mutable int transactionDepth = 0;
+
+			friend class Transaction;
+
 		public:
 			explicit Database(const fs::path &dbPath, int mode = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
 
@@ -39,9 +59,25 @@ namespace wingman::orm {
 
 			bool tableExists(const char *name) const;
 
+			bool columnExists(const char *table, const char *name) const;
+
 			int exec(const std::string &sql) const;
 
 			int getErrorCode() const;
+
+			/**
+			 * \brief returns a counter that moves whenever rows are changed, through this connection or any other
+			 */
+			int64_t changeCounter() const;
+
+			/**
+			 * \brief returns the cached prepared statement for sql, preparing it on first use
+			 *
+			 * The statement is reserved for the returned handle and is reset with its bindings cleared when the handle
+			 * goes out of scope. If it is already in use (by another thread or further up the call stack) a private
+			 * statement is prepared instead. While another thread has a Transaction open this waits for it to end.
+			 */
+			PreparedStatement prepare(const std::string &sql) const;
 		};
 
 		class Statement {
@@ -116,16 +152,74 @@ namespace wingman::orm {
 
 			void reset();
 
+			void clearBindings();
+
 			int exec();
 
 		private:
 		};
 
+		/**
+		 * \brief handle to a statement returned by Database::prepare
+		 */
+		class PreparedStatement {
+			// keeps other threads from opening a transaction that would take in this statement, released last
+			std::unique_lock<std::recursive_mutex> transactionLock;
+			std::unique_lock<std::mutex> lock;
+			std::unique_ptr<Statement> owned;
+			Statement *statement;
+
+		public:
+			PreparedStatement(std::unique_lock<std::recursive_mutex> &&transactionLock, std::unique_lock<std::mutex> &&lock, Statement *statement);
+
+			PreparedStatement(std::unique_lock<std::recursive_mutex> &&transactionLock, std::unique_ptr<Statement> &&owned);
+
+			PreparedStatement(const PreparedStatement &) = delete;
+
+			PreparedStatement &operator=(const PreparedStatement &) = delete;
+
+			~PreparedStatement();
+
+			Statement &operator*() const;
+
+			Statement *operator->() const;
+		};
+
+		/**
+		 * \brief groups the statements run until commit() into a single write transaction, rolled back if not committed
+		 *
+		 * Transactions on the same connection are serialized, nesting one in another on the same thread is a no-op. The
+		 * connection is shared, so statements prepared and exec() calls made on other threads wait until the transaction
+		 * ends instead of becoming part of it.
+		 */
+		class Transaction {
+			const Database &database;
+			std::unique_lock<std::recursive_mutex> lock;
+			bool owner;
+			bool committed = false;
+
+		public:
+			explicit Transaction(const Database &database);
+
+			Transaction(const Transaction &) = delete;
+
+			Transaction &operator=(const Transaction &) = delete;
+
+			~Transaction();
+
+			void commit();
+		};
+
 		template<typename T>
 		std::vector<T> GetSome(Statement &query, std::function<T(Statement &)> getItem);
 
 		void initializeColumns(const sqlite::Database &database, const std::string &tableName, std::map<std::string, Column> &columns, std::vector<std::string> &columnNames);
 
+		/**
+		 * \brief builds an INSERT ... ON CONFLICT DO UPDATE statement for all columns, `created` is only set on insert
+		 */
+		std::string buildUpsert(const std::string &tableName, const std::map<std::string, Column> &columns, const std::vector<std::string> &columnNames);
+
 	}
 
 	class DatabaseActions {
@@ -145,6 +239,10 @@ namespace wingman::orm {
 		[[nodiscard]] static const char *getCreateApp();
 
 		void createAppTable() const;
+
+		[[nodiscard]] static const char *getCreateCatalog();
+
+		void createCatalogTable() const;
 	};
 
 	class AppItemActions {
@@ -156,6 +254,7 @@ namespace wingman::orm {
 		 */
 		std::map<std::string, Column> columns;
 		std::vector<std::string> columnNames;
+		std::string upsertSql;
 
 		static std::vector<AppItem> getSome(sqlite::Statement &query);
 
@@ -191,9 +290,15 @@ namespace wingman::orm {
 		 */
 		std::map<std::string, Column> columns;
 		std::vector<std::string> columnNames;
+		std::string upsertSql;
 
 		std::vector<DownloadItemStatus> activeDownloadStatuses = { DownloadItemStatus::queued, DownloadItemStatus::downloading };
 
+		// progress updates waiting to be written by flushProgress(), keyed by modelRepo and filePath
+		mutable std::mutex progressMutex;
+		mutable std::map<std::pair<std::string, std::string>, DownloadItem> pendingProgress;
+		mutable std::time_t progressFlushed = 0;
+
 		static std::vector<DownloadItem> getSome(sqlite::Statement &query);
 	public:
 		DownloadItemActions(sqlite::Database &dbInstance, const fs::path &downloadsDir);
@@ -211,6 +316,19 @@ namespace wingman::orm {
 
 		void set(DownloadItem& item) const;
 
+		/**
+		 * \brief queues a progress update of item, the queued updates of all items are written in a single transaction
+		 *	once `interval` seconds have passed since the last write
+		 *
+		 * A later set() of the same item replaces its queued update.
+		 */
+		void setProgress(const DownloadItem &item, std::time_t interval) const;
+
+		/**
+		 * \brief writes the queued progress updates in a single transaction
+		 */
+		void flushProgress() const;
+
 		std::optional<DownloadItem> enqueue(const std::string &modelRepo, const std::string &filePath) const;
 
 		void remove(const std::string &modelRepo, const std::string &filePath) const;
@@ -271,6 +389,7 @@ namespace wingman::orm {
 		 */
 		std::map<std::string, Column> columns;
 		std::vector<std::string> columnNames;
+		std::string upsertSql;
 
 		static std::vector<WingmanItem> getSome(sqlite::Statement &query);
 
@@ -307,6 +426,40 @@ namespace wingman::orm {
 		static WingmanItem fromJson(const nlohmann::json &j);
 	};
 
+	/**
+	 * \brief the local index of the Hugging Face model listing, so models are listed without going to the network
+	 */
+	class CatalogItemActions {
+		const std::string TABLE_NAME = "catalog";
+		const sqlite::Database &dbInstance;
+
+		/**
+		 * \brief columns variable is a map of column names to a Column
+		 */
+		std::map<std::string, Column> columns;
+		std::vector<std::string> columnNames;
+		std::string upsertSql;
+
+		static std::vector<CatalogItem> getSome(sqlite::Statement &query);
+
+	public:
+		CatalogItemActions(sqlite::Database &dbInstance);
+
+		std::optional<CatalogItem> get(const std::string &id) const;
+
+		// all models in listing order
+		std::vector<CatalogItem> getAll() const;
+
+		void set(CatalogItem &item) const;
+
+		// replace the whole index with a fresh listing in a single transaction
+		void replaceAll(std::vector<CatalogItem> &items) const;
+
+		void clear() const;
+
+		int count() const;
+	};
+
 	class ItemActionsFactory {
 		std::shared_ptr<sqlite::Database> db;
 		fs::path wingmanHome;
@@ -326,6 +479,7 @@ namespace wingman::orm {
 		std::shared_ptr<AppItemActions> pAppItemActions;
 		std::shared_ptr<DownloadItemActions> pDownloadItemItemActions;
 		std::shared_ptr<WingmanItemActions> pWingmanItemItemActions;
+		std::shared_ptr<CatalogItemActions> pCatalogItemActions;
 
 		/**
 		* @brief Construct a new Item Actions Factory object
@@ -341,6 +495,18 @@ namespace wingman::orm {
 
 		std::shared_ptr <WingmanItemActions> wingman();
 
+		std::shared_ptr <CatalogItemActions> catalog();
+
+		/**
+		 * \brief starts a transaction on the database, used to batch several updates into a single commit
+		 */
+		sqlite::Transaction transaction() const;
+
+		/**
+		 * \brief returns a counter that moves whenever any table is changed, used to skip re-reading unchanged tables
+		 */
+		int64_t changeCounter() const;
+
 		// create getters for vital paths
 		const fs::path &getWingmanHome() const;
 
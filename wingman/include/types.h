@@ -1,6 +1,7 @@
 
 // ReSharper disable CppClangTidyClangDiagnosticSwitchEnum
 #pragma once
+#include <map>
 #include <optional>
 #include <string>
 #include <filesystem>
@@ -82,6 +83,20 @@ namespace wingman {
 	};
 	NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(DownloadItemName, isa, modelRepo, filePath, quantization, quantizationName)
 
+	// a byte range of a download fetched in one request, see curl::FetchSegmented
+	struct DownloadSegment {
+		long long start = 0;		// offset of the first byte
+		long long end = 0;			// offset of the last byte, inclusive
+		long long downloaded = 0;	// bytes written from `start`
+
+		[[nodiscard]] bool isComplete() const
+		{
+			return downloaded >= end - start + 1;
+		}
+	};
+
+	NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(DownloadSegment, start, end, downloaded)
+
 	struct DownloadItem {
 		std::string isa = "DownloadItem";
 		std::string modelRepo;
@@ -100,6 +115,10 @@ namespace wingman {
 		std::string downloadSpeed;
 		double progress;
 		std::string error;
+		// progress of each range while a segmented download is unfinished, used to resume it
+		std::vector<DownloadSegment> segments;
+		// hex SHA-256 of the file, computed while it downloads and set once it is complete
+		std::string sha256;
 		long long created;
 		long long updated;
 
@@ -171,7 +190,7 @@ namespace wingman {
 		}
 	};
 
-	NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(DownloadItem, isa, modelRepo, filePath, status, totalBytes, downloadedBytes, downloadSpeed, progress, error, created, updated)
+	NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(DownloadItem, isa, modelRepo, filePath, status, totalBytes, downloadedBytes, downloadSpeed, progress, error, segments, sha256, created, updated)
 
 	enum class WingmanItemStatus {
 		queued,
@@ -753,6 +772,32 @@ namespace wingman {
 
 	NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(ModelIQEval, evalName, precision, type, modelType, weightType, architecture, modelLink, modelNameForQuery, modelSha, averageUp, mmluPlusArc, hubLicense, hubLikes, hubDownloads, likesPerWeek, likabilityStar, paramsBillion, availableOnTheHub, recent7Days, recent14Days, recent21Days, arc, hellaSwag, mmlu, truthfulQa, winogrande, gsm8K)
 
+	// a GGUF model repository from the Hugging Face listing, as kept in the local catalog index
+	struct CatalogItem {
+		std::string isa = "CatalogItem";
+		std::string id;				// the modelRepo, e.g. `TheBloke/Arithmo-Mistral-7B-GGUF`
+		int rank;					// position in the listing, which is sorted by last modified
+		std::string createdAt;
+		std::string lastModified;
+		int downloads;
+		int likes;
+		std::string size;			// parameter count taken from the name, e.g. `7B`
+		// the file offered for each quantization, keyed by quantization
+		std::map<std::string, std::string> quantizations;
+		long long created;
+		long long updated;
+
+		CatalogItem() :
+			rank(0)
+			, downloads(0)
+			, likes(0)
+			, created(util::now())
+			, updated(util::now())
+		{}
+	};
+
+	NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(CatalogItem, isa, id, rank, createdAt, lastModified, downloads, likes, size, quantizations, created, updated)
+
 	struct AIModel {
 		std::string isa = "AIModel";
 		std::string id;
@@ -33,7 +33,7 @@ struct extra_server_info {
 	float vram_used = -1.0;
 	float vram_per_layer_avg = -1.0;
 	std::map<std::string, int> tensor_type_map;
-	std::map<std::string, std::string> meta_map;
+	std::map<std::string, nlohmann::json> meta_map; // numbers for the numeric properties
 	bool has_next_token = false;
 };
 
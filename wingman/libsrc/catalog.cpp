@@ -0,0 +1,443 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+
+#include "catalog.h"
+#include "curl.h"
+#include "util.hpp"
+
+namespace wingman {
+
+#pragma region JsonStreamParser
+
+	JsonStreamParser::JsonStreamParser(Sax &sax) : sax(sax)
+	{}
+
+	bool JsonStreamParser::fail(const std::string &reason)
+	{
+		if (error.empty()) {
+			error = fmt::format("{} at byte {}", reason, position);
+			sax.parse_error(position, text, nlohmann::detail::parse_error::create(101, position, error, nullptr));
+		}
+		return false;
+	}
+
+	bool JsonStreamParser::startValue(const char c)
+	{
+		switch (c) {
+			case '{':
+				stack.push_back('{');
+				expect = Expect::keyOrEnd;
+				return sax.start_object(static_cast<std::size_t>(-1));
+			case '[':
+				stack.push_back('[');
+				expect = Expect::valueOrEnd;
+				return sax.start_array(static_cast<std::size_t>(-1));
+			case '"':
+				token = Token::string;
+				isKey = false;
+				return true;
+			default:
+				if (c == '-' || std::isdigit(static_cast<unsigned char>(c))) {
+					token = Token::number;
+				} else if (c == 't' || c == 'f' || c == 'n') {
+					token = Token::literal;
+				} else {
+					return fail(fmt::format("unexpected '{}'", c));
+				}
+				text.push_back(c);
+				return true;
+		}
+	}
+
+	bool JsonStreamParser::valueDone()
+	{
+		expect = stack.empty() ? Expect::end : Expect::commaOrEnd;
+		return true;
+	}
+
+	// report the number or literal that was cut short by the character after it
+	bool JsonStreamParser::endToken()
+	{
+		const auto kind = token;
+		token = Token::none;
+		bool ok;
+		if (kind == Token::literal) {
+			if (text == "true")
+				ok = sax.boolean(true);
+			else if (text == "false")
+				ok = sax.boolean(false);
+			else if (text == "null")
+				ok = sax.null();
+			else
+				return fail(fmt::format("invalid literal '{}'", text));
+		} else {
+			char *end = nullptr;
+			errno = 0;
+			const auto isFloat = text.find_first_of(".eE") != std::string::npos;
+			const auto isNegative = text[0] == '-';
+			const auto floatValue = isFloat ? std::strtod(text.c_str(), &end) : 0.0;
+			const auto integerValue = !isFloat && isNegative ? std::strtoll(text.c_str(), &end, 10) : 0;
+			const auto unsignedValue = !isFloat && !isNegative ? std::strtoull(text.c_str(), &end, 10) : 0;
+			if (end != text.c_str() + text.size() || errno != 0)
+				return fail(fmt::format("invalid number '{}'", text));
+			if (isFloat)
+				ok = sax.number_float(floatValue, text);
+			else if (isNegative)
+				ok = sax.number_integer(integerValue);
+			else
+				ok = sax.number_unsigned(unsignedValue);
+		}
+		text.clear();
+		return ok && valueDone();
+	}
+
+	bool JsonStreamParser::consume(const char c)
+	{
+		if (token == Token::string) {
+			if (unicodeDigits > 0) {
+				if (!std::isxdigit(static_cast<unsigned char>(c)))
+					return fail("invalid \\u escape");
+				codepoint = codepoint << 4 | static_cast<uint32_t>(std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : (std::tolower(c) - 'a' + 10));
+				if (--unicodeDigits > 0)
+					return true;
+				if (codepoint >= 0xd800 && codepoint <= 0xdbff) {
+					if (highSurrogate != 0)
+						return fail("unpaired surrogate");
+					// the low half of the surrogate pair follows as another \u escape
+					highSurrogate = codepoint;
+					return true;
+				}
+				if (codepoint >= 0xdc00 && codepoint <= 0xdfff) {
+					if (highSurrogate == 0)
+						return fail("unpaired surrogate");
+					codepoint = 0x10000 + ((highSurrogate - 0xd800) << 10) + (codepoint - 0xdc00);
+					highSurrogate = 0;
+				} else if (highSurrogate != 0) {
+					return fail("unpaired surrogate");
+				}
+				if (codepoint < 0x80) {
+					text.push_back(static_cast<char>(codepoint));
+				} else if (codepoint < 0x800) {
+					text.push_back(static_cast<char>(0xc0 | codepoint >> 6));
+					text.push_back(static_cast<char>(0x80 | (codepoint & 0x3f)));
+				} else if (codepoint < 0x10000) {
+					text.push_back(static_cast<char>(0xe0 | codepoint >> 12));
+					text.push_back(static_cast<char>(0x80 | (codepoint >> 6 & 0x3f)));
+					text.push_back(static_cast<char>(0x80 | (codepoint & 0x3f)));
+				} else {
+					text.push_back(static_cast<char>(0xf0 | codepoint >> 18));
+					text.push_back(static_cast<char>(0x80 | (codepoint >> 12 & 0x3f)));
+					text.push_back(static_cast<char>(0x80 | (codepoint >> 6 & 0x3f)));
+					text.push_back(static_cast<char>(0x80 | (codepoint & 0x3f)));
+				}
+				return true;
+			}
+			if (highSurrogate != 0 && !escape && c != '\\')
+				return fail("unpaired surrogate");
+			if (escape) {
+				escape = false;
+				if (highSurrogate != 0 && c != 'u')
+					return fail("unpaired surrogate");
+				switch (c) {
+					case '"': text.push_back('"'); break;
+					case '\\': text.push_back('\\'); break;
+					case '/': text.push_back('/'); break;
+					case 'b': text.push_back('\b'); break;
+					case 'f': text.push_back('\f'); break;
+					case 'n': text.push_back('\n'); break;
+					case 'r': text.push_back('\r'); break;
+					case 't': text.push_back('\t'); break;
+					case 'u':
+						unicodeDigits = 4;
+						codepoint = 0;
+						break;
+					default:
+						return fail(fmt::format("invalid escape '\\{}'", c));
+				}
+				return true;
+			}
+			if (c == '\\') {
+				escape = true;
+				return true;
+			}
+			if (c == '"') {
+				token = Token::none;
+				bool ok;
+				if (isKey) {
+					ok = sax.key(text);
+					expect = Expect::colon;
+				} else {
+					ok = sax.string(text) && valueDone();
+				}
+				text.clear();
+				return ok;
+			}
+			if (static_cast<unsigned char>(c) < 0x20)
+				return fail("control character in string");
+			text.push_back(c);
+			return true;
+		}
+
+		if (token == Token::number || token == Token::literal) {
+			const auto continues = token == Token::number
+				? std::isdigit(static_cast<unsigned char>(c)) || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-'
+				: std::isalpha(static_cast<unsigned char>(c)) != 0;
+			if (continues) {
+				text.push_back(c);
+				return true;
+			}
+			if (!endToken())
+				return false;
+		}
+
+		if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+			return true;
+
+		switch (expect) {
+			case Expect::value:
+				return startValue(c);
+			case Expect::valueOrEnd:
+				if (c == ']') {
+					stack.pop_back();
+					return sax.end_array() && valueDone();
+				}
+				return startValue(c);
+			case Expect::keyOrEnd:
+				if (c == '}') {
+					stack.pop_back();
+					return sax.end_object() && valueDone();
+				}
+				[[fallthrough]];
+			case Expect::key:
+				if (c != '"')
+					return fail("expected a key");
+				token = Token::string;
+				isKey = true;
+				return true;
+			case Expect::colon:
+				if (c != ':')
+					return fail("expected ':'");
+				expect = Expect::value;
+				return true;
+			case Expect::commaOrEnd:
+				if (c == ',') {
+					expect = stack.back() == '{' ? Expect::key : Expect::value;
+					return true;
+				}
+				if (c == (stack.back() == '{' ? '}' : ']')) {
+					const auto isObject = stack.back() == '{';
+					stack.pop_back();
+					return (isObject ? sax.end_object() : sax.end_array()) && valueDone();
+				}
+				return fail(fmt::format("unexpected '{}'", c));
+			case Expect::end:
+				return fail("unexpected content after the document");
+		}
+		return false;
+	}
+
+	bool JsonStreamParser::feed(const char *data, const size_t size)
+	{
+		if (!error.empty())
+			return false;
+		for (size_t i = 0; i < size; i++, position++) {
+			if (token == Token::string && !escape && unicodeDigits == 0 && highSurrogate == 0) {
+				// copy the plain run of a string in one go
+				auto run = i;
+				while (run < size && data[run] != '"' && data[run] != '\\' && static_cast<unsigned char>(data[run]) >= 0x20)
+					run++;
+				text.append(data + i, run - i);
+				position += run - i;
+				i = run;
+				if (i == size)
+					break;
+			}
+			if (!consume(data[i])) {
+				if (error.empty())
+					error = fmt::format("parse stopped at byte {}", position);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool JsonStreamParser::finish()
+	{
+		if (!error.empty())
+			return false;
+		// a number or literal at the top level only ends with the document
+		if ((token == Token::number || token == Token::literal) && !endToken())
+			return false;
+		if (token != Token::none || expect != Expect::end)
+			return fail("unexpected end of the document");
+		return true;
+	}
+
+	const std::string &JsonStreamParser::getError() const
+	{
+		return error;
+	}
+
+#pragma endregion
+
+#pragma region CatalogSax
+
+	CatalogSax::CatalogSax(std::vector<CatalogItem> &items) : items(items)
+	{}
+
+	bool CatalogSax::sawListing() const
+	{
+		return isListing;
+	}
+
+	void CatalogSax::addFile(const std::string &fileName)
+	{
+		if (isSplitModel)
+			return;
+		if (IsSplitModelFile(fileName)) {
+			// split models are not supported yet
+			isSplitModel = true;
+			return;
+		}
+		if (!util::stringEndsWith(fileName, curl::HF_MODEL_FILE_EXTENSION, false))
+			return;
+		const auto quantization = util::extractQuantizationFromFilename(fileName);
+		if (quantization.empty()) {
+			spdlog::debug("Failed to extract quantization from filename: {}", fileName);
+			return;
+		}
+		// the first file listed for a quantization is the one offered for download
+		model.quantizations.emplace(quantization, fileName);
+	}
+
+	bool CatalogSax::null()
+	{
+		return true;
+	}
+
+	bool CatalogSax::boolean(bool)
+	{
+		return true;
+	}
+
+	bool CatalogSax::number_integer(const number_integer_t val)
+	{
+		if (depth == 2) {
+			if (field == "downloads")
+				model.downloads = static_cast<int>(val);
+			else if (field == "likes")
+				model.likes = static_cast<int>(val);
+		}
+		return true;
+	}
+
+	bool CatalogSax::number_unsigned(const number_unsigned_t val)
+	{
+		return number_integer(static_cast<number_integer_t>(std::min<number_unsigned_t>(val, std::numeric_limits<int>::max())));
+	}
+
+	bool CatalogSax::number_float(number_float_t, const string_t &)
+	{
+		return true;
+	}
+
+	bool CatalogSax::string(string_t &val)
+	{
+		if (depth == 2) {
+			if (field == "id")
+				model.id = std::move(val);
+			else if (field == "createdAt")
+				model.createdAt = std::move(val);
+			else if (field == "lastModified")
+				model.lastModified = std::move(val);
+		} else if (depth == 4 && inSiblings && siblingField == "rfilename") {
+			addFile(val);
+		}
+		return true;
+	}
+
+	bool CatalogSax::binary(binary_t &)
+	{
+		return true;
+	}
+
+	bool CatalogSax::start_object(std::size_t)
+	{
+		depth++;
+		if (depth == 2) {
+			model = CatalogItem();
+			isSplitModel = false;
+			field.clear();
+		}
+		return true;
+	}
+
+	bool CatalogSax::key(string_t &val)
+	{
+		if (depth == 2)
+			field = std::move(val);
+		else if (depth == 4 && inSiblings)
+			siblingField = std::move(val);
+		return true;
+	}
+
+	bool CatalogSax::end_object()
+	{
+		if (depth == 2 && isListing && !isSplitModel && !model.quantizations.empty()
+			&& util::stringEndsWith(model.id, curl::HF_MODEL_ENDS_WITH, false)) {
+			model.rank = static_cast<int>(items.size());
+			items.push_back(std::move(model));
+		}
+		depth--;
+		return true;
+	}
+
+	bool CatalogSax::start_array(std::size_t)
+	{
+		depth++;
+		if (depth == 1)
+			isListing = true;
+		else if (depth == 3 && field == "siblings")
+			inSiblings = true;
+		return true;
+	}
+
+	bool CatalogSax::end_array()
+	{
+		if (depth == 3)
+			inSiblings = false;
+		depth--;
+		return true;
+	}
+
+	bool CatalogSax::parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &ex)
+	{
+		spdlog::error("Failed to parse the model catalog: {}", ex.what());
+		return false;
+	}
+
+#pragma endregion
+
+	bool IsSplitModelFile(const std::string &fileName)
+	{
+		const auto name = util::stringLower(fileName);
+		if (name.find("split") != std::string::npos)
+			return true;
+		// look for `-<digits>-of-<digits>`
+		for (auto pos = name.find("-of-"); pos != std::string::npos; pos = name.find("-of-", pos + 1)) {
+			auto first = pos;
+			while (first > 0 && std::isdigit(static_cast<unsigned char>(name[first - 1])))
+				first--;
+			auto last = pos + 4;
+			while (last < name.size() && std::isdigit(static_cast<unsigned char>(name[last])))
+				last++;
+			if (first < pos && first > 0 && name[first - 1] == '-' && last > pos + 4)
+				return true;
+		}
+		return false;
+	}
+
+} // namespace wingman
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <curl/curl.h>
@@ -12,6 +13,7 @@
 #include "util.hpp"
 #include "parse_evals.h"
 #include "inferable.h"
+#include "catalog.h"
 
 namespace wingman::curl {
 	// add HF_MODEL_ENDS_WITH to the end of the modelRepo if it's not already there
@@ -40,9 +42,9 @@ namespace wingman::curl {
 
 	bool UpdateItemProgress(Response *res)
 	{
-		// only update db every 3 seconds
+		// only update db every PROGRESS_UPDATE_INTERVAL seconds
 		const auto seconds = util::now() - res->file.item->updated;
-		if (seconds < 3)
+		if (seconds < PROGRESS_UPDATE_INTERVAL)
 			return true;
 		if (res->file.item->totalBytes == 0) {
 			// get the expected file size from the headers
@@ -63,7 +65,7 @@ namespace wingman::curl {
 		else
 			res->file.item->progress = -1;
 
-		res->file.actions->set(*res->file.item);
+		res->file.actions->setProgress(*res->file.item, PROGRESS_UPDATE_INTERVAL);
 		try {
 			if (res->file.onProgress)
 				return res->file.onProgress(res);
@@ -73,10 +75,18 @@ namespace wingman::curl {
 		return true;
 	}
 
+	// model files are parsed as GGUF while they download, anything else is only hashed
+	static std::shared_ptr<DownloadVerifier> MakeVerifier(const DownloadItem &item, const long long totalBytes = 0)
+	{
+		const auto isGGUF = util::stringEndsWith(item.filePath, HF_MODEL_FILE_EXTENSION, false);
+		return std::make_shared<DownloadVerifier>(isGGUF, totalBytes);
+	}
+
 	Response Fetch(const Request &request)
 	{
 		Response response;
 		[[maybe_unused]] CURLcode res;
+		fs::path path;
 
 #pragma region CURL event handlers
 
@@ -111,6 +121,10 @@ namespace wingman::curl {
 			const auto bytes = reinterpret_cast<std::byte *>(ptr);
 			const auto numBytes = size * nmemb;
 
+			if (res->onData) {
+				// exit with CURLE_WRITE_ERROR to stop the transfer
+				return res->onData(ptr, numBytes) ? static_cast<unsigned long long>(numBytes) : 0ULL;
+			}
 			spdlog::trace("Writing {} bytes to response memory", numBytes);
 			res->data.insert(res->data.end(), bytes, bytes + numBytes);
 			return numBytes;
@@ -129,6 +143,10 @@ namespace wingman::curl {
 			const auto numBytes = static_cast<std::streamsize>(size * nmemb);
 			std::streamsize bytesWritten = 0;
 			if (res->file.handle != nullptr) {
+				if (res->file.verifier && !res->file.verifier->update(bytes, numBytes)) {
+					spdlog::error("Download of {} rejected: {}", res->file.item->filePath, res->file.verifier->getError());
+					return static_cast<std::streamsize>(0);
+				}
 				res->file.handle->write(bytes, numBytes);
 				bytesWritten = numBytes;
 				res->file.totalBytesWritten += bytesWritten;
@@ -164,7 +182,6 @@ namespace wingman::curl {
 				}
 				response.file.start = util::now();
 				response.file.item = request.file.item;
-				fs::path path;
 				if (request.file.quantization) {
 					path = request.file.actions->getDownloadItemOutputFilePathQuant(
 						request.file.item->modelRepo, request.file.quantization.value());
@@ -181,6 +198,7 @@ namespace wingman::curl {
 				}
 				response.file.actions = request.file.actions;
 				response.file.onProgress = request.file.onProgress;
+				response.file.verifier = MakeVerifier(*request.file.item);
 				spdlog::trace("Setting up CURLOPT_WRITEFUNCTION to writeFileFunction");
 				res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeFileFunction);
 				spdlog::trace("Setting CURLOPT_WRITEDATA to &response");
@@ -193,6 +211,7 @@ namespace wingman::curl {
 				res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
 			}
 			response.file.checkExistsThenExit = request.file.checkExistsThenExit;
+			response.onData = request.onData;
 			spdlog::trace("Setting up CURLOPT_HEADERFUNCTION to headerFunction");
 			res = curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerFunction);
 			res = curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response);
@@ -254,16 +273,34 @@ namespace wingman::curl {
 				}
 				spdlog::trace("Setting DownloadItem status");
 				item.value().downloadedBytes = fileSizeOnDisk;
+				std::optional<std::string> rejected;
+				if (!response.file.wasCancelled && !response.file.checkExistsThenExit) {
+					// a transfer cut short is caught by comparing against the size the server announced
+					long long expectedBytes = fileSizeOnDisk;
+					const auto contentLength = response.headers.find("Content-Length");
+					if (contentLength != response.headers.end()) {
+						expectedBytes = std::strtoll(contentLength->second.c_str(), nullptr, 10);
+					}
+					rejected = response.file.verifier->finish(expectedBytes);
+				}
 				if (response.file.wasCancelled)
 					item.value().status = DownloadItemStatus::cancelled;
-				else {
+				else if (rejected) {
+					spdlog::error("Download of {}:{} is invalid: {}", item.value().modelRepo, item.value().filePath, rejected.value());
+					item.value().status = DownloadItemStatus::error;
+					item.value().error = rejected.value();
+					std::error_code ec;
+					fs::remove(path, ec);
+				} else {
 					item.value().progress = static_cast<double>(response.file.totalBytesWritten) / static_cast<double>(fileSizeOnDisk) * 100.0;
 					if (item.value().progress > 100.0)
 						item.value().progress = 100.0;
 					if (item.value().progress < 100.0)
 						item.value().status = DownloadItemStatus::cancelled;
-					else
+					else {
 						item.value().status = DownloadItemStatus::complete;
+						item.value().sha256 = response.file.verifier->getSha256();
+					}
 				}
 				item.value().updated = util::now();
 				response.file.actions->set(item.value());
@@ -292,6 +329,388 @@ namespace wingman::curl {
 		return Fetch(request);
 	}
 
+	std::optional<long long> GetRangedContentLength(const std::string &url)
+	{
+		// ask for a single byte, a server that supports ranges answers with `Content-Range: bytes 0-0/<size>`
+		auto request = Request{ url };
+		request.headers["Range"] = "bytes=0-0";
+		const auto response = Fetch(request);
+		if (response.curlCode != CURLE_OK || response.statusCode != 206) {
+			return std::nullopt;
+		}
+		const auto contentRange = response.headers.find("Content-Range");
+		if (contentRange == response.headers.end()) {
+			return std::nullopt;
+		}
+		const auto slash = contentRange->second.rfind('/');
+		if (slash == std::string::npos) {
+			return std::nullopt;
+		}
+		try {
+			const auto totalBytes = std::stoll(contentRange->second.substr(slash + 1));
+			if (totalBytes > 0)
+				return totalBytes;
+		} catch (const std::exception &) {
+			// the size is `*` when the server does not know it
+		}
+		return std::nullopt;
+	}
+
+	// split the bytes from `start` to the end of the file into ranges that `connections` can take turns on
+	static std::vector<DownloadSegment> MakeSegments(const long long start, const long long totalBytes, const int connections)
+	{
+		const auto length = std::clamp<long long>((totalBytes - start + connections - 1) / std::max(connections, 1), MIN_SEGMENT_BYTES, MAX_SEGMENT_BYTES);
+		std::vector<DownloadSegment> result;
+		for (long long offset = start; offset < totalBytes; offset += length) {
+			result.push_back({ offset, std::min(offset + length, totalBytes) - 1, 0 });
+		}
+		return result;
+	}
+
+	// bytes of the ranges ahead of the hashed part of the file, by the start of the range they belong to
+	typedef std::map<long long, std::vector<char>> PendingBytes;
+
+	struct SegmentTransfer {
+		Response *response;
+		PendingBytes *pending;
+		std::fstream *file;
+		CURL *curl;
+		DownloadSegment *segment = nullptr;
+		bool statusChecked = false;
+	};
+
+	// the verifier needs the file in order, but the ranges arrive side by side. the range it has reached is fed
+	//	to it as it downloads, the ones after it are kept in memory until it gets to them. returns false if the
+	//	file is rejected
+	static bool AdvanceVerifier(Response &response, PendingBytes &pending)
+	{
+		const auto &verifier = response.file.verifier;
+		for (const auto &segment : response.file.item->segments) {
+			if (segment.start + segment.downloaded <= verifier->size())
+				continue;
+			if (segment.start > verifier->size())
+				break;
+			if (const auto bytes = pending.find(segment.start); bytes != pending.end()) {
+				const auto ok = verifier->update(bytes->second.data(), bytes->second.size());
+				pending.erase(bytes);
+				if (!ok)
+					return false;
+			}
+			if (!segment.isComplete())
+				break;
+		}
+		return true;
+	}
+
+	// hash the bytes an earlier attempt left on disk before the first gap, once before any range is fetched
+	static bool VerifyDownloadedPrefix(Response &response, std::fstream &file, const long long length)
+	{
+		const auto &verifier = response.file.verifier;
+		std::vector<char> buffer(static_cast<size_t>(std::min<long long>(length, 4 * 1024 * 1024)));
+		while (verifier->size() < length) {
+			const auto count = std::min<long long>(length - verifier->size(), static_cast<long long>(buffer.size()));
+			file.seekg(verifier->size());
+			file.read(buffer.data(), count);
+			if (file.gcount() != count) {
+				file.clear();
+				spdlog::error("Failed to read back {} bytes at {} to verify", count, verifier->size());
+				return false;
+			}
+			if (!verifier->update(buffer.data(), static_cast<size_t>(count)))
+				return false;
+		}
+		return true;
+	}
+
+	static size_t WriteSegment(char *ptr, size_t size, size_t nmemb, void *userdata)
+	{
+		const auto transfer = static_cast<SegmentTransfer *>(userdata);
+		const auto res = transfer->response;
+		auto &segment = *transfer->segment;
+		const auto numBytes = static_cast<long long>(size * nmemb);
+
+		if (res->file.verifier->failed()) {
+			// another range found the file is invalid, the rest of it is not worth fetching
+			return 0;
+		}
+		if (!transfer->statusChecked) {
+			long statusCode = 0;
+			curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &statusCode);
+			if (statusCode != 206) {
+				// a server ignoring the range would write the whole file at this segment's offset
+				spdlog::error("Range {}-{} answered with status {}", segment.start + segment.downloaded, segment.end, statusCode);
+				return 0;
+			}
+			transfer->statusChecked = true;
+		}
+		if (numBytes > segment.end - segment.start + 1 - segment.downloaded) {
+			spdlog::error("Range {}-{} received more bytes than requested", segment.start, segment.end);
+			return 0;
+		}
+
+		const auto offset = segment.start + segment.downloaded;
+		const auto &verifier = res->file.verifier;
+		if (offset == verifier->size()) {
+			if (!verifier->update(ptr, numBytes)) {
+				spdlog::error("Download of {} rejected: {}", res->file.item->filePath, verifier->getError());
+				return 0;
+			}
+		} else {
+			auto &bytes = (*transfer->pending)[segment.start];
+			bytes.insert(bytes.end(), ptr, ptr + numBytes);
+		}
+		transfer->file->seekp(offset);
+		transfer->file->write(ptr, numBytes);
+		if (!*transfer->file) {
+			spdlog::error("Failed to write range {}-{} to disk", segment.start, segment.end);
+			return 0;
+		}
+		segment.downloaded += numBytes;
+		res->file.totalBytesWritten += numBytes;
+		if (segment.isComplete() && verifier->size() == segment.end + 1 && !AdvanceVerifier(*res, *transfer->pending)) {
+			spdlog::error("Download of {} rejected: {}", res->file.item->filePath, verifier->getError());
+			return 0;
+		}
+
+		if (util::now() - res->file.item->updated >= PROGRESS_UPDATE_INTERVAL) {
+			// the segments saved with the progress must not count bytes still sitting in the stream buffer
+			transfer->file->flush();
+		}
+		if (!UpdateItemProgress(res)) {
+			// exit with CURLE_WRITE_ERROR to stop the download
+			res->file.wasCancelled = true;
+			return 0;
+		}
+		return numBytes;
+	}
+
+	// fetch the unfinished segments of `response.file.item` over `connections` connections, each taking the next
+	//	segment in file order when it is done. returns the first transfer error
+	static CURLcode PerformSegments(const Request &request, Response &response, std::fstream &file, PendingBytes &pending, const int connections)
+	{
+		auto &segments = response.file.item->segments;
+		const auto &verifier = response.file.verifier;
+
+		curl_slist *headers = nullptr;
+		for (const auto &[key, value] : request.headers) {
+			headers = curl_slist_append(headers, fmt::format("{}: {}", key, value).c_str());
+		}
+
+		CURLM *multi = curl_multi_init();
+		if (multi == nullptr) {
+			throw std::runtime_error("Failed to initialize curl multi");
+		}
+		std::vector<SegmentTransfer> transfers;
+		transfers.reserve(std::max(connections, 1));
+		for (int i = 0; i < std::max(connections, 1); i++) {
+			CURL *curl = curl_easy_init();
+			if (curl == nullptr) {
+				spdlog::error("Failed to initialize curl for connection {}", i);
+				continue;
+			}
+			auto &transfer = transfers.emplace_back(SegmentTransfer{ &response, &pending, &file, curl });
+			curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
+			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteSegment);
+			curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+			curl_easy_setopt(curl, CURLOPT_PRIVATE, &transfer);
+			curl_easy_setopt(curl, CURLOPT_AUTOREFERER, 1L);
+			curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+			if (headers != nullptr)
+				curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+		}
+
+		// segments are handed out in order and only within MAX_REORDER_BYTES of the hashed part of the file, the
+		//	one the verifier has reached always fits so the download cannot stall on the window
+		size_t next = 0;
+		const auto startNext = [&](SegmentTransfer &transfer) {
+			while (next < segments.size() && segments[next].isComplete())
+				next++;
+			if (next == segments.size() || segments[next].end >= verifier->size() + MAX_REORDER_BYTES)
+				return;
+			auto &segment = segments[next++];
+			const auto range = fmt::format("{}-{}", segment.start + segment.downloaded, segment.end);
+			transfer.segment = &segment;
+			transfer.statusChecked = false;
+			curl_easy_setopt(transfer.curl, CURLOPT_RANGE, range.c_str());
+			curl_multi_add_handle(multi, transfer.curl);
+		};
+
+		CURLcode result = CURLE_OK;
+		CURLMcode multiCode = CURLM_OK;
+		while (multiCode == CURLM_OK && !response.file.wasCancelled) {
+			int active = 0;
+			for (auto &transfer : transfers) {
+				if (transfer.segment == nullptr && result == CURLE_OK && !verifier->failed())
+					startNext(transfer);
+				if (transfer.segment != nullptr)
+					active++;
+			}
+			if (active == 0)
+				break;
+
+			int running = 0;
+			multiCode = curl_multi_perform(multi, &running);
+			bool finished = false;
+			int queued = 0;
+			while (const CURLMsg *message = curl_multi_info_read(multi, &queued)) {
+				if (message->msg != CURLMSG_DONE)
+					continue;
+				SegmentTransfer *transfer = nullptr;
+				curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, reinterpret_cast<char **>(&transfer));
+				if (result == CURLE_OK) {
+					if (message->data.result != CURLE_OK)
+						result = message->data.result;
+					else if (!transfer->segment->isComplete())
+						result = CURLE_PARTIAL_FILE;
+				}
+				long statusCode = 0;
+				curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &statusCode);
+				if (statusCode != 0)
+					response.statusCode = statusCode;
+				curl_multi_remove_handle(multi, transfer->curl);
+				transfer->segment = nullptr;
+				finished = true;
+			}
+			// a connection that just finished takes its next segment straight away
+			if (multiCode == CURLM_OK && running > 0 && !finished && !response.file.wasCancelled)
+				multiCode = curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+		}
+		if (multiCode != CURLM_OK && result == CURLE_OK)
+			result = CURLE_RECV_ERROR;
+
+		for (const auto &transfer : transfers) {
+			if (transfer.segment != nullptr)
+				curl_multi_remove_handle(multi, transfer.curl);
+			curl_easy_cleanup(transfer.curl);
+		}
+		curl_multi_cleanup(multi);
+		curl_slist_free_all(headers);
+		return result;
+	}
+
+	Response FetchSegmented(const Request &request, const int segments)
+	{
+		if (!request.file.item || !request.file.actions) {
+			throw std::runtime_error("FetchSegmented requires an item and actions.");
+		}
+
+		const auto totalBytes = GetRangedContentLength(request.url);
+		if (!totalBytes) {
+			spdlog::debug("Server does not accept ranges for {}, downloading as a single stream", request.url);
+			return Fetch(request);
+		}
+
+		Response response;
+		response.statusCode = 0;
+		response.file.start = util::now();
+		response.file.item = request.file.item;
+		response.file.quantization = request.file.quantization;
+		response.file.actions = request.file.actions;
+		response.file.onProgress = request.file.onProgress;
+		response.file.overwrite = request.file.overwrite;
+		response.file.fileExists = true;
+
+		auto &item = *response.file.item;
+		spdlog::debug("Downloading item: {}:{} in ranges", item.modelRepo, item.filePath);
+		fs::path path;
+		if (request.file.quantization) {
+			path = request.file.actions->getDownloadItemOutputFilePathQuant(item.modelRepo, request.file.quantization.value());
+		} else {
+			path = request.file.actions->getDownloadItemOutputPath(item.modelRepo, item.filePath);
+		}
+
+		// resume only when the segments are from an earlier attempt at this same file
+		std::error_code ec;
+		const auto resume = !item.segments.empty() && item.totalBytes == totalBytes.value()
+			&& static_cast<long long>(fs::file_size(path, ec)) == totalBytes.value() && !ec;
+		// only the bytes before the first gap are kept, the ones after it were never hashed and are fetched again
+		long long downloaded = 0;
+		if (resume) {
+			spdlog::info("Resuming download of {}:{}", item.modelRepo, item.filePath);
+			for (const auto &segment : item.segments) {
+				if (segment.start != downloaded)
+					break;
+				downloaded += segment.downloaded;
+				if (!segment.isComplete())
+					break;
+			}
+			item.segments.clear();
+			if (downloaded > 0)
+				item.segments.push_back({ 0, downloaded - 1, downloaded });
+			const auto rest = MakeSegments(downloaded, totalBytes.value(), segments);
+			item.segments.insert(item.segments.end(), rest.begin(), rest.end());
+		} else {
+			item.segments = MakeSegments(0, totalBytes.value(), segments);
+			std::ofstream(path, std::ios::binary | std::ios::trunc).close();
+			fs::resize_file(path, totalBytes.value());
+		}
+		item.totalBytes = totalBytes.value();
+		response.file.totalBytesWritten = downloaded;
+
+		std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+		if (!file) {
+			throw std::runtime_error(fmt::format("Failed to open file for writing: {}", path.string()));
+		}
+		// a resumed download is hashed from what is already on disk before the rest arrives
+		response.file.verifier = MakeVerifier(item, totalBytes.value());
+		if (!VerifyDownloadedPrefix(response, file, downloaded) && !response.file.verifier->failed()) {
+			throw std::runtime_error(fmt::format("Failed to read back the downloaded part of {}", path.string()));
+		}
+		PendingBytes pending;
+
+		const auto isComplete = [&item] {
+			return std::ranges::all_of(item.segments, [](const auto &segment) { return segment.isComplete(); });
+		};
+		response.curlCode = CURLE_OK;
+		const auto &verifier = response.file.verifier;
+		for (int attempt = 0; attempt < MAX_SEGMENT_ATTEMPTS && !response.file.wasCancelled && !verifier->failed() && !isComplete(); attempt++) {
+			if (attempt > 0) {
+				spdlog::warn("Retrying unfinished ranges of {}:{} ({})", item.modelRepo, item.filePath, curl_easy_strerror(response.curlCode));
+			}
+			response.curlCode = PerformSegments(request, response, file, pending, segments);
+		}
+		std::optional<std::string> rejected;
+		if (!response.file.wasCancelled && (verifier->failed() || isComplete())) {
+			AdvanceVerifier(response, pending);
+			rejected = verifier->finish(item.totalBytes);
+		}
+		file.flush();
+		file.close();
+
+		// send a progress update after file is closed
+		if (response.file.onProgress) {
+			response.file.onProgress(&response);
+		}
+
+		item.downloadedBytes = response.file.totalBytesWritten;
+		item.progress = static_cast<double>(item.downloadedBytes) / static_cast<double>(item.totalBytes) * 100.0;
+		if (response.file.wasCancelled) {
+			item.status = DownloadItemStatus::cancelled;
+		} else if (rejected) {
+			// the bytes are wrong rather than missing, so the download starts over when it is queued again
+			spdlog::error("Download of {}:{} is invalid: {}", item.modelRepo, item.filePath, rejected.value());
+			item.status = DownloadItemStatus::error;
+			item.error = rejected.value();
+			item.segments.clear();
+			fs::remove(path, ec);
+		} else if (isComplete()) {
+			item.status = DownloadItemStatus::complete;
+			item.sha256 = verifier->getSha256();
+			item.segments.clear();
+		} else {
+			// the segments are kept so the download resumes when it is queued again
+			item.status = DownloadItemStatus::error;
+			item.error = curl_easy_strerror(response.curlCode);
+		}
+		item.updated = util::now();
+		response.file.actions->set(item);
+		// send last progress update with the new status
+		if (response.file.onProgress) {
+			response.file.onProgress(&response);
+		}
+		return response;
+	}
+
 	bool RemoteFileExists(const std::string &url)
 	{
 		auto request = Request{ url };
@@ -782,6 +1201,76 @@ namespace wingman::curl {
 		return models;
 	}
 
+	// app item holding the validators of the listing the catalog was built from, and when it was last checked
+	const std::string CATALOG_APP_ITEM_NAME = "ModelCatalog";
+
+	bool RefreshCatalog(orm::ItemActionsFactory &actionsFactory, const bool force)
+	{
+		// one refresh at a time, a caller that waited finds the catalog fresh
+		static std::mutex refreshMutex;
+		std::lock_guard lock(refreshMutex);
+
+		auto state = actionsFactory.app()->get(CATALOG_APP_ITEM_NAME).value_or(AppItem::make(CATALOG_APP_ITEM_NAME));
+		auto validators = nlohmann::json::parse(state.value, nullptr, false);
+		if (!validators.is_object())
+			validators = nlohmann::json::object();
+		const auto hasCatalog = validators.value("url", "") == HF_ALL_MODELS_URL && actionsFactory.catalog()->count() > 0;
+		if (hasCatalog && !force && util::now() - validators.value("checked", 0LL) < CATALOG_REFRESH_INTERVAL)
+			return true;
+
+		const auto startTime = std::chrono::high_resolution_clock::now();
+		auto request = Request{ HF_ALL_MODELS_URL };
+		if (hasCatalog) {
+			const auto etag = validators.value("etag", "");
+			if (!etag.empty())
+				request.headers["If-None-Match"] = etag;
+			const auto lastModified = validators.value("lastModified", "");
+			if (!lastModified.empty())
+				request.headers["If-Modified-Since"] = lastModified;
+		}
+		std::vector<CatalogItem> items;
+		CatalogSax sax(items);
+		JsonStreamParser parser(sax);
+		request.onData = [&parser](const char *data, const size_t size) {
+			return parser.feed(data, size);
+		};
+		spdlog::trace("Fetching models from {}", HF_ALL_MODELS_URL);
+		const auto response = Fetch(request);
+
+		bool refreshed = true;
+		if (response.curlCode == CURLE_OK && response.statusCode == 304) {
+			spdlog::debug("Model catalog is unchanged");
+		} else if (response.curlCode != CURLE_OK || response.statusCode != 200 || !parser.finish() || !sax.sawListing()) {
+			std::string reason = parser.getError();
+			if (reason.empty())
+				reason = response.curlCode != CURLE_OK ? curl_easy_strerror(response.curlCode) : fmt::format("HTTP status {}", response.statusCode);
+			spdlog::error("Failed to refresh the model catalog: {}", reason);
+			refreshed = false;
+		} else {
+			for (auto &item : items) {
+				AIModel aiModel;
+				aiModel.name = StripFormatFromModelRepo(item.id);
+				item.size = GetModelSize(aiModel);
+			}
+			actionsFactory.catalog()->replaceAll(items);
+			const auto etag = response.headers.find("ETag");
+			validators["etag"] = etag != response.headers.end() ? etag->second : "";
+			const auto lastModified = response.headers.find("Last-Modified");
+			validators["lastModified"] = lastModified != response.headers.end() ? lastModified->second : "";
+			validators["url"] = HF_ALL_MODELS_URL;
+			spdlog::debug("Model catalog refreshed with {} models", items.size());
+		}
+		if (refreshed || hasCatalog) {
+			// a failed check keeps listing the catalog already on hand rather than retrying on every request
+			validators["checked"] = util::now();
+			state.value = validators.dump();
+			actionsFactory.app()->set(state);
+		}
+		const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startTime).count();
+		spdlog::debug("Time taken to refresh the model catalog: {} ms", duration);
+		return refreshed;
+	}
+
 	nlohmann::json GetAIModelsFast(orm::ItemActionsFactory &actionsFactory)
 	{
 		try {
@@ -789,16 +1278,9 @@ namespace wingman::curl {
 			const HardwareInfo hardwareInfo = GetHardwareInfo(); // Get hardware information
 			std::vector<AIModel> aiModels;
 
-			// Fetch raw model data directly
-			spdlog::trace("Fetching models from {}", HF_ALL_MODELS_URL);
-			auto response = Fetch(HF_ALL_MODELS_URL);
-			if (response.curlCode != CURLE_OK || response.statusCode != 200) {
-				throw std::runtime_error("Failed to fetch models");
-			}
-
-			// Parse the JSON just once
-			auto models = nlohmann::json::parse(response.text());
-			spdlog::debug("Total number of raw models fetched: {}", models.size());
+			RefreshCatalog(actionsFactory);
+			const auto catalog = actionsFactory.catalog()->getAll();
+			spdlog::debug("Total number of models in the catalog: {}", catalog.size());
 
 			// Containers for model details and error handling
 			const auto downloadedModelNamesOnDisk = orm::DownloadItemActions::getDownloadItemNames(actionsFactory.download());
@@ -811,32 +1293,9 @@ namespace wingman::curl {
 			}
 
 			int index = 0;
-			std::regex splitRegex(R"(\-\d+\-OF\-\d+)", std::regex_constants::icase);
-			for (auto &model : models) {
-				const auto &id = model["id"].get<std::string>();
-				if (!util::stringEndsWith(id, HF_MODEL_ENDS_WITH, false))
-					continue;
+			for (const auto &model : catalog) {
+				const auto &id = model.id;
 				const auto &name = StripFormatFromModelRepo(id);
-				bool isSplitModel = false;
-				std::map<std::string, std::vector<nlohmann::json>> quantizations;
-				for (auto &sibling : model["siblings"]) {
-					const auto n = sibling["rfilename"].get<std::string>();
-					// isSplitModel = util::stringContains(n, "gguf-split");
-					isSplitModel = util::stringContains(n, "split", false)
-						|| std::regex_search(n, splitRegex);
-					if (isSplitModel)
-						break; // split models are not supported yet (TODO: support split models
-					if (util::stringEndsWith(n, HF_MODEL_FILE_EXTENSION, false)) {
-						const auto quantization = util::extractQuantizationFromFilename(n);
-						if (!quantization.empty())
-							quantizations[quantization].emplace_back(n);
-						else
-							spdlog::warn("Failed to extract quantization from filename: {}", n);
-					}
-				}
-
-				if (isSplitModel || quantizations.empty())
-					continue;
 
 				AIModel aiModel;
 				aiModel.id = id;
@@ -845,11 +1304,11 @@ namespace wingman::curl {
 				aiModel.location = fmt::format("{}/{}", HF_MODEL_URL, id);
 				aiModel.maxLength = DEFAULT_CONTEXT_LENGTH;
 				aiModel.tokenLimit = DEFAULT_CONTEXT_LENGTH * 16;
-				aiModel.downloads = model["downloads"].get<int>();
-				aiModel.likes = model["likes"].get<int>();
-				aiModel.updated = model["lastModified"].get<std::string>();
-				aiModel.created = model["createdAt"].get<std::string>();
-				aiModel.size = GetModelSize(aiModel);
+				aiModel.downloads = model.downloads;
+				aiModel.likes = model.likes;
+				aiModel.updated = model.lastModified;
+				aiModel.created = model.createdAt;
+				aiModel.size = model.size;
 				// SetModelScores(aiModel, modelIQData, modelEQData, meanEqBench, meanMagi, correlation);
 				aiModel.iQScore = -1.0;
 				aiModel.eQScore = -1.0;
@@ -860,11 +1319,11 @@ namespace wingman::curl {
 				aiModel.availableMemory = defaultInferability.availableMemory;
 				aiModel.normalizedQuantizedMemRequired = defaultInferability.normalizedQuantizedMemRequired;
 				std::vector<DownloadableItem> items;
-				for (auto &[key, value] : quantizations) {
+				for (auto &[key, value] : model.quantizations) {
 					DownloadableItem di;
 					di.modelRepo = id;
 					di.modelRepoName = name;
-					di.filePath = value.front().get<std::string>();
+					di.filePath = value;
 					di.quantization = key;
 					std::string quantizationName;
 					di.quantizationName = util::quantizationNameFromQuantization(di.quantization);
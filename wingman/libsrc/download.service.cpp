@@ -35,7 +35,7 @@ namespace wingman::services {
 		request.file.overwrite = overwrite;
 
 		keepDownloading = true;
-		const auto response = Fetch(request);
+		const auto response = FetchSegmented(request);
 	}
 
 	void DownloadService::stopDownload(const DownloadItem &downloadItem)
@@ -45,6 +45,7 @@ namespace wingman::services {
 
 	void DownloadService::updateServerStatus(const DownloadServiceAppItemStatus &status, std::optional<DownloadItem> downloadItem, std::optional<std::string> error)
 	{
+		auto transaction = actions.transaction();
 		auto appItem = actions.app()->get(SERVER_NAME).value_or(AppItem::make(SERVER_NAME));
 
 		nlohmann::json j = nlohmann::json::parse(appItem.value);
@@ -59,6 +60,7 @@ namespace wingman::services {
 		nlohmann::json j2 = downloadServerItem;
 		appItem.value = j2.dump();
 		actions.app()->set(appItem);
+		transaction.commit();
 	}
 
 	void DownloadService::runOrphanedDownloadCleanup() const
@@ -141,9 +143,13 @@ namespace wingman::services {
 
 					if (currentItem.status == DownloadItemStatus::queued) {
 						// Update status to downloading
-						currentItem.status = DownloadItemStatus::downloading;
-						actions.download()->set(currentItem);
-						updateServerStatus(DownloadServiceAppItemStatus::preparing, currentItem);
+						{
+							auto transaction = actions.transaction();
+							currentItem.status = DownloadItemStatus::downloading;
+							actions.download()->set(currentItem);
+							updateServerStatus(DownloadServiceAppItemStatus::preparing, currentItem);
+							transaction.commit();
+						}
 
 						spdlog::debug(SERVER_NAME + "::run calling startDownload " + modelName + "...");
 						try {
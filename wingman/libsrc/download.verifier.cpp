@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "ggml.h"
+#include "download.verifier.h"
+
+namespace wingman {
+
+#pragma region Sha256
+
+	namespace {
+		constexpr std::array<uint32_t, 64> SHA256_K = {
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+			0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+			0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+			0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+			0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+			0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+			0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+		};
+
+		constexpr uint32_t rotr(const uint32_t x, const int n)
+		{
+			return (x >> n) | (x << (32 - n));
+		}
+	}
+
+	Sha256::Sha256() :
+		state({ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 })
+		, block()
+	{}
+
+	void Sha256::transform(const uint8_t *chunk)
+	{
+		std::array<uint32_t, 64> w;
+		for (int i = 0; i < 16; i++) {
+			w[i] = static_cast<uint32_t>(chunk[i * 4]) << 24 | static_cast<uint32_t>(chunk[i * 4 + 1]) << 16
+				| static_cast<uint32_t>(chunk[i * 4 + 2]) << 8 | static_cast<uint32_t>(chunk[i * 4 + 3]);
+		}
+		for (int i = 16; i < 64; i++) {
+			const auto s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			const auto s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		auto [a, b, c, d, e, f, g, h] = state;
+		for (int i = 0; i < 64; i++) {
+			const auto s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+			const auto ch = (e & f) ^ (~e & g);
+			const auto t1 = h + s1 + ch + SHA256_K[i] + w[i];
+			const auto s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+			const auto maj = (a & b) ^ (a & c) ^ (b & c);
+			const auto t2 = s0 + maj;
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+
+	void Sha256::update(const void *data, size_t size)
+	{
+		auto bytes = static_cast<const uint8_t *>(data);
+		length += size;
+		if (blockSize > 0) {
+			const auto n = std::min(size, block.size() - blockSize);
+			std::memcpy(block.data() + blockSize, bytes, n);
+			blockSize += n;
+			bytes += n;
+			size -= n;
+			if (blockSize < block.size())
+				return;
+			transform(block.data());
+			blockSize = 0;
+		}
+		// whole blocks are hashed straight from the caller's buffer
+		for (; size >= block.size(); bytes += block.size(), size -= block.size()) {
+			transform(bytes);
+		}
+		std::memcpy(block.data(), bytes, size);
+		blockSize = size;
+	}
+
+	std::string Sha256::hexDigest()
+	{
+		const auto bits = length * 8;
+		block[blockSize++] = 0x80;
+		if (blockSize > 56) {
+			std::fill(block.begin() + static_cast<long>(blockSize), block.end(), 0);
+			transform(block.data());
+			blockSize = 0;
+		}
+		std::fill(block.begin() + static_cast<long>(blockSize), block.begin() + 56, 0);
+		for (int i = 0; i < 8; i++) {
+			block[63 - i] = static_cast<uint8_t>(bits >> (i * 8));
+		}
+		transform(block.data());
+
+		static constexpr char HEX[] = "0123456789abcdef";
+		std::string hex;
+		hex.reserve(64);
+		for (const auto word : state) {
+			for (int shift = 28; shift >= 0; shift -= 4) {
+				hex.push_back(HEX[(word >> shift) & 0xf]);
+			}
+		}
+		return hex;
+	}
+
+#pragma endregion
+
+#pragma region DownloadVerifier
+
+	namespace {
+		// limits that no real model comes close to, so a corrupt count fails fast rather than waiting for the data
+		constexpr uint64_t MAX_KV_COUNT = 1 << 20;
+		constexpr uint64_t MAX_TENSOR_COUNT = 1 << 20;
+		constexpr uint64_t MAX_STRING_LENGTH = 1 << 26;
+
+		size_t GGUFTypeSize(const uint32_t type)
+		{
+			switch (type) {
+				case GGUF_TYPE_UINT8:
+				case GGUF_TYPE_INT8:
+				case GGUF_TYPE_BOOL:
+					return 1;
+				case GGUF_TYPE_UINT16:
+				case GGUF_TYPE_INT16:
+					return 2;
+				case GGUF_TYPE_UINT32:
+				case GGUF_TYPE_INT32:
+				case GGUF_TYPE_FLOAT32:
+					return 4;
+				case GGUF_TYPE_UINT64:
+				case GGUF_TYPE_INT64:
+				case GGUF_TYPE_FLOAT64:
+					return 8;
+				default:
+					return 0;
+			}
+		}
+
+		template<typename T>
+		T Read(const std::string &buffer, const size_t offset)
+		{
+			T value;
+			std::memcpy(&value, buffer.data() + offset, sizeof(T));
+			return value;
+		}
+	}
+
+	DownloadVerifier::DownloadVerifier(const bool isGGUF, const long long expectedSize) :
+		expectedSize(expectedSize)
+		, isGGUF(isGGUF)
+		, alignment(GGUF_DEFAULT_ALIGNMENT)
+	{}
+
+	bool DownloadVerifier::fail(const std::string &reason)
+	{
+		stage = Stage::failed;
+		error = reason;
+		pending.clear();
+		pos = 0;
+		return false;
+	}
+
+	bool DownloadVerifier::update(const char *data, const size_t size)
+	{
+		if (stage == Stage::failed)
+			return false;
+		sha256.update(data, size);
+		received += static_cast<long long>(size);
+		if (!isGGUF || stage == Stage::done)
+			return true;
+
+		pending.append(data, size);
+		const auto ok = parse();
+		if (ok) {
+			pending.erase(0, pos);
+			pendingOffset += pos;
+			pos = 0;
+		}
+		return ok;
+	}
+
+	bool DownloadVerifier::takeString(std::string *value)
+	{
+		if (pending.size() - pos < sizeof(uint64_t))
+			return false;
+		const auto length = Read<uint64_t>(pending, pos);
+		if (length > MAX_STRING_LENGTH) {
+			fail("GGUF string of " + std::to_string(length) + " bytes at offset " + std::to_string(pendingOffset + pos));
+			return false;
+		}
+		if (pending.size() - pos - sizeof(uint64_t) < length)
+			return false;
+		if (value != nullptr)
+			value->assign(pending, pos + sizeof(uint64_t), length);
+		pos += sizeof(uint64_t) + length;
+		return true;
+	}
+
+	bool DownloadVerifier::nextKv()
+	{
+		kvIndex++;
+		if (kvIndex < kvCount) {
+			stage = Stage::kvKey;
+			return true;
+		}
+		if (tensorCount > 0) {
+			stage = Stage::tensorInfo;
+			return true;
+		}
+		return finishHeader();
+	}
+
+	bool DownloadVerifier::finishHeader()
+	{
+		const auto headerSize = pendingOffset + pos;
+		const auto dataOffset = (headerSize + alignment - 1) / alignment * alignment;
+		requiredSize = dataOffset + tensorDataSize;
+		stage = Stage::done;
+		pending.clear();
+		pos = 0;
+		if (expectedSize > 0 && requiredSize > static_cast<uint64_t>(expectedSize)) {
+			return fail("GGUF tensors need " + std::to_string(requiredSize) + " bytes but the file has " + std::to_string(expectedSize));
+		}
+		return true;
+	}
+
+	// parse as much of the header as `pending` holds, returns false only if the header is invalid
+	bool DownloadVerifier::parse()
+	{
+		while (true) {
+			const auto available = pending.size() - pos;
+			switch (stage) {
+				case Stage::header:
+				{
+					if (available < 4 + sizeof(uint32_t) + 2 * sizeof(uint64_t))
+						return true;
+					if (std::memcmp(pending.data() + pos, GGUF_MAGIC, 4) != 0)
+						return fail("not a GGUF file");
+					const auto version = Read<uint32_t>(pending, pos + 4);
+					if (version < 2 || version > 3)
+						return fail("unsupported GGUF version " + std::to_string(version));
+					tensorCount = Read<uint64_t>(pending, pos + 8);
+					kvCount = Read<uint64_t>(pending, pos + 16);
+					if (tensorCount > MAX_TENSOR_COUNT || kvCount > MAX_KV_COUNT)
+						return fail("GGUF header declares " + std::to_string(tensorCount) + " tensors and " + std::to_string(kvCount) + " keys");
+					pos += 24;
+					if (kvCount > 0)
+						stage = Stage::kvKey;
+					else if (tensorCount > 0)
+						stage = Stage::tensorInfo;
+					else
+						return finishHeader();
+					break;
+				}
+				case Stage::kvKey:
+				{
+					const auto start = pos;
+					if (!takeString(&key))
+						return stage != Stage::failed;
+					if (pending.size() - pos < sizeof(uint32_t)) {
+						pos = start;
+						return true;
+					}
+					valueType = Read<uint32_t>(pending, pos);
+					pos += sizeof(uint32_t);
+					if (valueType == GGUF_TYPE_ARRAY)
+						stage = Stage::arrayHeader;
+					else if (valueType == GGUF_TYPE_STRING || GGUFTypeSize(valueType) > 0)
+						stage = Stage::kvValue;
+					else
+						return fail("GGUF key " + key + " has unknown type " + std::to_string(valueType));
+					break;
+				}
+				case Stage::kvValue:
+				{
+					if (valueType == GGUF_TYPE_STRING) {
+						if (!takeString(nullptr))
+							return stage != Stage::failed;
+					} else {
+						const auto size = GGUFTypeSize(valueType);
+						if (available < size)
+							return true;
+						if (key == "general.alignment") {
+							if (valueType != GGUF_TYPE_UINT32)
+								return fail("GGUF general.alignment is not a uint32");
+							alignment = Read<uint32_t>(pending, pos);
+							if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+								return fail("GGUF alignment " + std::to_string(alignment) + " is not a power of two");
+						}
+						pos += size;
+					}
+					if (!nextKv())
+						return false;
+					break;
+				}
+				case Stage::arrayHeader:
+				{
+					if (available < sizeof(uint32_t) + sizeof(uint64_t))
+						return true;
+					arrayType = Read<uint32_t>(pending, pos);
+					arrayRemaining = Read<uint64_t>(pending, pos + sizeof(uint32_t));
+					if (arrayType != GGUF_TYPE_STRING && GGUFTypeSize(arrayType) == 0)
+						return fail("GGUF array " + key + " has unknown element type " + std::to_string(arrayType));
+					pos += sizeof(uint32_t) + sizeof(uint64_t);
+					stage = Stage::arrayElements;
+					break;
+				}
+				case Stage::arrayElements:
+				{
+					if (arrayType == GGUF_TYPE_STRING) {
+						while (arrayRemaining > 0 && takeString(nullptr)) {
+							arrayRemaining--;
+						}
+						if (stage == Stage::failed)
+							return false;
+					} else {
+						const auto size = GGUFTypeSize(arrayType);
+						const auto n = std::min<uint64_t>(available / size, arrayRemaining);
+						pos += n * size;
+						arrayRemaining -= n;
+					}
+					if (arrayRemaining > 0)
+						return true;
+					if (!nextKv())
+						return false;
+					break;
+				}
+				case Stage::tensorInfo:
+				{
+					const auto start = pos;
+					std::string name;
+					if (!takeString(&name))
+						return stage != Stage::failed;
+					if (pending.size() - pos < sizeof(uint32_t)) {
+						pos = start;
+						return true;
+					}
+					const auto nDims = Read<uint32_t>(pending, pos);
+					if (nDims == 0 || nDims > GGML_MAX_DIMS)
+						return fail("GGUF tensor " + name + " has " + std::to_string(nDims) + " dimensions");
+					if (pending.size() - pos < sizeof(uint32_t) + nDims * sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t)) {
+						pos = start;
+						return true;
+					}
+					pos += sizeof(uint32_t);
+					std::array<uint64_t, GGML_MAX_DIMS> ne = { 1, 1, 1, 1 };
+					for (uint32_t i = 0; i < nDims; i++) {
+						ne[i] = Read<uint64_t>(pending, pos);
+						pos += sizeof(uint64_t);
+					}
+					const auto type = Read<uint32_t>(pending, pos);
+					pos += sizeof(uint32_t);
+					const auto offset = Read<uint64_t>(pending, pos);
+					pos += sizeof(uint64_t);
+
+					if (type >= GGML_TYPE_COUNT || ggml_blck_size(static_cast<ggml_type>(type)) == 0)
+						return fail("GGUF tensor " + name + " has unknown type " + std::to_string(type));
+					if (ne[0] % ggml_blck_size(static_cast<ggml_type>(type)) != 0)
+						return fail("GGUF tensor " + name + " row size is not a multiple of its block size");
+					if (offset % alignment != 0)
+						return fail("GGUF tensor " + name + " is not aligned");
+					uint64_t size = ggml_row_size(static_cast<ggml_type>(type), static_cast<int64_t>(ne[0]));
+					for (uint32_t i = 1; i < GGML_MAX_DIMS; i++) {
+						if (ne[i] != 0 && size > std::numeric_limits<uint64_t>::max() / ne[i])
+							return fail("GGUF tensor " + name + " is too large");
+						size *= ne[i];
+					}
+					if (offset > std::numeric_limits<uint64_t>::max() - size)
+						return fail("GGUF tensor " + name + " is too large");
+					tensorDataSize = std::max(tensorDataSize, offset + size);
+
+					tensorIndex++;
+					if (tensorIndex == tensorCount)
+						return finishHeader();
+					break;
+				}
+				case Stage::done:
+					return true;
+				case Stage::failed:
+					return false;
+			}
+		}
+	}
+
+	long long DownloadVerifier::size() const
+	{
+		return received;
+	}
+
+	bool DownloadVerifier::failed() const
+	{
+		return stage == Stage::failed;
+	}
+
+	const std::string &DownloadVerifier::getError() const
+	{
+		return error;
+	}
+
+	std::optional<std::string> DownloadVerifier::finish(const long long totalBytes)
+	{
+		if (stage == Stage::failed)
+			return error;
+		if (received != totalBytes)
+			return "download is truncated, " + std::to_string(received) + " of " + std::to_string(totalBytes) + " bytes received";
+		if (isGGUF) {
+			if (stage != Stage::done)
+				return "GGUF header is truncated";
+			if (requiredSize > static_cast<uint64_t>(totalBytes))
+				return "GGUF tensors need " + std::to_string(requiredSize) + " bytes but the file has " + std::to_string(totalBytes);
+		}
+		if (digest.empty())
+			digest = sha256.hexDigest();
+		return std::nullopt;
+	}
+
+	const std::string &DownloadVerifier::getSha256() const
+	{
+		return digest;
+	}
+
+#pragma endregion
+
+} // namespace wingman
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+
+#include <spdlog/spdlog.h>
+
+#include "ggml.h"
+#include "model.planner.h"
+
+namespace wingman {
+
+	namespace {
+		constexpr int MIN_AUTO_CONTEXT_SIZE = 2048;
+		constexpr int CONTEXT_PADDING = 256;	// llama pads n_ctx to this many cells
+		constexpr int MASK_PADDING = 32;		// GGML_KQ_MASK_PAD
+		constexpr uint64_t MB = 1024 * 1024;
+
+		// KV cache types the server accepts for `--cache-type-k/-v`
+		std::optional<ggml_type> CacheTypeFromString(const std::string &cacheType)
+		{
+			for (const auto type : { GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q4_0, GGML_TYPE_Q4_1,
+					GGML_TYPE_IQ4_NL, GGML_TYPE_Q5_0, GGML_TYPE_Q5_1 }) {
+				if (cacheType == ggml_type_name(type))
+					return type;
+			}
+			return std::nullopt;
+		}
+
+		uint64_t RowBytes(const ggml_type type, const int64_t elements)
+		{
+			const int64_t block = ggml_blck_size(type);
+			return static_cast<uint64_t>((elements + block - 1) / block) * ggml_type_size(type);
+		}
+
+		// an integer hparam, the largest entry when it is given per layer as an array
+		std::optional<int64_t> GetInt(const gguf_context *gguf, const std::string &key)
+		{
+			const int id = gguf_find_key(gguf, key.c_str());
+			if (id < 0)
+				return std::nullopt;
+			switch (gguf_get_kv_type(gguf, id)) {
+				case GGUF_TYPE_UINT8: return gguf_get_val_u8(gguf, id);
+				case GGUF_TYPE_INT8: return gguf_get_val_i8(gguf, id);
+				case GGUF_TYPE_UINT16: return gguf_get_val_u16(gguf, id);
+				case GGUF_TYPE_INT16: return gguf_get_val_i16(gguf, id);
+				case GGUF_TYPE_UINT32: return gguf_get_val_u32(gguf, id);
+				case GGUF_TYPE_INT32: return gguf_get_val_i32(gguf, id);
+				case GGUF_TYPE_UINT64: return static_cast<int64_t>(gguf_get_val_u64(gguf, id));
+				case GGUF_TYPE_INT64: return gguf_get_val_i64(gguf, id);
+				case GGUF_TYPE_ARRAY: {
+					const auto n = gguf_get_arr_n(gguf, id);
+					const auto *data = gguf_get_arr_data(gguf, id);
+					std::optional<int64_t> max;
+					for (int i = 0; i < n; i++) {
+						int64_t value;
+						if (gguf_get_arr_type(gguf, id) == GGUF_TYPE_UINT32)
+							value = static_cast<const uint32_t *>(data)[i];
+						else if (gguf_get_arr_type(gguf, id) == GGUF_TYPE_INT32)
+							value = static_cast<const int32_t *>(data)[i];
+						else
+							return std::nullopt;
+						max = std::max(max.value_or(value), value);
+					}
+					return max;
+				}
+				default: return std::nullopt;
+			}
+		}
+
+		// the largest tensors alive at once while the graph for one ubatch runs, following llama.cpp's graph: the
+		// attention scores (softmax is done in place), the feed forward gate/up/product, or the logits, plus the
+		// hidden state tensors that stay live across a block
+		struct ComputeBytes {
+			uint64_t block;
+			uint64_t logits;
+			uint64_t hidden;
+		};
+
+		ComputeBytes GetComputeBytes(const ModelProfile &profile, const int contextSize, const int batchSize)
+		{
+			const uint64_t f32 = sizeof(float);
+			const uint64_t batch = batchSize;
+			const uint64_t paddedBatch = (batch + MASK_PADDING - 1) / MASK_PADDING * MASK_PADDING;
+			const uint64_t attention = static_cast<uint64_t>(profile.headCount) * contextSize * batch * f32 + contextSize * paddedBatch * f32;
+			const uint64_t feedForward = 3 * profile.feedForwardLength * batch * f32;
+			return { std::max(attention, feedForward), profile.vocabSize * batch * f32, 5 * profile.embeddingLength * batch * f32 };
+		}
+
+		ModelPlan PlanSplit(const ModelProfile &profile, const int contextSize, const int gpuLayers, const PlanOptions &options)
+		{
+			const int layers = profile.layerCount;
+			const bool outputOnGpu = gpuLayers > layers;
+			const int offloaded = std::min(gpuLayers, layers);
+			const uint64_t kvLayer = KvCacheBytesPerLayer(profile, contextSize, options.cacheType);
+			const auto compute = GetComputeBytes(profile, contextSize, options.batchSize);
+
+			ModelPlan plan;
+			plan.gpuLayers = gpuLayers;
+			plan.contextSize = contextSize;
+			plan.batchSize = options.batchSize;
+			plan.cacheType = options.cacheType;
+			plan.weightBytes = profile.weightBytes();
+			plan.kvCacheBytes = kvLayer * layers;
+			plan.cpuBytes = profile.inputBytes;
+			for (int i = 0; i < layers; i++) {
+				// llama offloads the last `gpuLayers` blocks
+				if (i >= layers - offloaded)
+					plan.gpuBytes += profile.layerBytes[i] + kvLayer;
+				else
+					plan.cpuBytes += profile.layerBytes[i] + kvLayer;
+			}
+			(outputOnGpu ? plan.gpuBytes : plan.cpuBytes) += profile.outputBytes;
+
+			uint64_t gpuCompute = 0;
+			if (gpuLayers > 0)
+				gpuCompute = std::max(compute.block, outputOnGpu ? compute.logits : 0) + compute.hidden;
+			uint64_t cpuCompute = 0;
+			if (!outputOnGpu)
+				cpuCompute = std::max(offloaded < layers ? compute.block : 0, compute.logits) + compute.hidden;
+			plan.computeBytes = gpuCompute + cpuCompute;
+			plan.gpuBytes += gpuCompute;
+			// the output buffer the logits are copied to is always on the host
+			plan.cpuBytes += cpuCompute + compute.logits;
+
+			plan.fitsGpu = plan.gpuBytes == 0 || plan.gpuBytes + options.gpuHeadroomBytes <= options.gpuBytes;
+			plan.fitsCpu = options.cpuBytes == 0 || plan.cpuBytes <= options.cpuBytes;
+			return plan;
+		}
+
+		ModelPlan PlanContext(const ModelProfile &profile, const int contextSize, const PlanOptions &options)
+		{
+			if (options.gpuLayers >= 0)
+				return PlanSplit(profile, contextSize, std::min(options.gpuLayers, profile.layerCount + 1), options);
+			// the GPU need grows with every layer, so the first count that fits from the top is the most that fits
+			for (int gpuLayers = profile.layerCount + 1; gpuLayers > 0; gpuLayers--) {
+				auto plan = PlanSplit(profile, contextSize, gpuLayers, options);
+				if (plan.fitsGpu)
+					return plan;
+			}
+			return PlanSplit(profile, contextSize, 0, options);
+		}
+	}
+
+	uint64_t ModelProfile::weightBytes() const
+	{
+		uint64_t bytes = inputBytes + outputBytes;
+		for (const auto layer : layerBytes)
+			bytes += layer;
+		return bytes;
+	}
+
+	std::optional<ModelProfile> ReadModelProfile(const std::string &modelPath)
+	{
+		ggml_context *meta = nullptr;
+		gguf_init_params params = { true, &meta };
+		gguf_context *gguf = gguf_init_from_file(modelPath.c_str(), params);
+		if (gguf == nullptr) {
+			spdlog::debug("(ReadModelProfile) {} is not a GGUF model", modelPath);
+			return std::nullopt;
+		}
+
+		ModelProfile profile;
+		const int archId = gguf_find_key(gguf, "general.architecture");
+		if (archId >= 0 && gguf_get_kv_type(gguf, archId) == GGUF_TYPE_STRING)
+			profile.architecture = gguf_get_val_str(gguf, archId);
+		const auto &arch = profile.architecture;
+		profile.layerCount = static_cast<int>(GetInt(gguf, arch + ".block_count").value_or(0));
+		profile.trainContextSize = static_cast<int>(GetInt(gguf, arch + ".context_length").value_or(0));
+		profile.embeddingLength = static_cast<int>(GetInt(gguf, arch + ".embedding_length").value_or(0));
+		profile.headCount = static_cast<int>(GetInt(gguf, arch + ".attention.head_count").value_or(0));
+		profile.headCountKv = static_cast<int>(GetInt(gguf, arch + ".attention.head_count_kv").value_or(profile.headCount));
+		profile.feedForwardLength = static_cast<int>(GetInt(gguf, arch + ".feed_forward_length").value_or(4 * profile.embeddingLength));
+		if (profile.headCount > 0) {
+			profile.keyLength = static_cast<int>(GetInt(gguf, arch + ".attention.key_length").value_or(profile.embeddingLength / profile.headCount));
+			profile.valueLength = static_cast<int>(GetInt(gguf, arch + ".attention.value_length").value_or(profile.embeddingLength / profile.headCount));
+		}
+		profile.vocabSize = static_cast<int>(GetInt(gguf, arch + ".vocab_size").value_or(0));
+		const int tokensId = gguf_find_key(gguf, "tokenizer.ggml.tokens");
+		if (profile.vocabSize == 0 && tokensId >= 0 && gguf_get_kv_type(gguf, tokensId) == GGUF_TYPE_ARRAY)
+			profile.vocabSize = gguf_get_arr_n(gguf, tokensId);
+
+		if (profile.layerCount <= 0 || profile.trainContextSize <= 0 || profile.embeddingLength <= 0 || profile.headCount <= 0) {
+			spdlog::debug("(ReadModelProfile) {} is missing the hparams of architecture '{}'", modelPath, arch);
+			gguf_free(gguf);
+			ggml_free(meta);
+			return std::nullopt;
+		}
+
+		profile.layerBytes.resize(profile.layerCount);
+		uint64_t tokenEmbeddingBytes = 0;
+		bool hasOutput = false;
+		for (int i = 0; i < gguf_get_n_tensors(gguf); i++) {
+			const char *name = gguf_get_tensor_name(gguf, i);
+			const uint64_t bytes = ggml_nbytes(ggml_get_tensor(meta, name));
+			int layer = -1;
+			if (std::strncmp(name, "blk.", 4) == 0)
+				layer = std::atoi(name + 4);
+			if (layer >= 0 && layer < profile.layerCount) {
+				profile.layerBytes[layer] += bytes;
+			} else if (std::strncmp(name, "output", 6) == 0) {
+				profile.outputBytes += bytes;
+				hasOutput = hasOutput || std::strcmp(name, "output.weight") == 0;
+			} else {
+				profile.inputBytes += bytes;
+				if (std::strcmp(name, "token_embd.weight") == 0) {
+					tokenEmbeddingBytes = bytes;
+					if (profile.vocabSize == 0)
+						profile.vocabSize = static_cast<int>(ggml_get_tensor(meta, name)->ne[1]);
+				}
+			}
+		}
+		// tied embeddings: llama loads a second copy of the token embeddings as the output head
+		if (!hasOutput)
+			profile.outputBytes += tokenEmbeddingBytes;
+
+		gguf_free(gguf);
+		ggml_free(meta);
+		return profile;
+	}
+
+	uint64_t KvCacheBytesPerLayer(const ModelProfile &profile, const int contextSize, const std::string &cacheType)
+	{
+		const auto type = CacheTypeFromString(cacheType);
+		if (!type)
+			return 0;
+		const int64_t cells = (static_cast<int64_t>(contextSize) + CONTEXT_PADDING - 1) / CONTEXT_PADDING * CONTEXT_PADDING;
+		return cells * (RowBytes(type.value(), static_cast<int64_t>(profile.keyLength) * profile.headCountKv)
+			+ RowBytes(type.value(), static_cast<int64_t>(profile.valueLength) * profile.headCountKv));
+	}
+
+	ModelPlan PlanModelFit(const ModelProfile &profile, const PlanOptions &options)
+	{
+		if (options.contextSize > 0)
+			return PlanContext(profile, options.contextSize, options);
+
+		// halve the trained context until the wanted layers fit; when none of them get there, keep the one that
+		// fits the CPU with the most layers on the GPU, preferring the longer context on a tie
+		int wantedLayers = options.gpuBytes == 0 ? 0 : profile.layerCount + 1;
+		if (options.gpuLayers >= 0)
+			wantedLayers = std::min(options.gpuLayers, profile.layerCount + 1);
+		std::optional<ModelPlan> best;
+		for (int contextSize = profile.trainContextSize; ; contextSize /= 2) {
+			const auto plan = PlanContext(profile, contextSize, options);
+			if (plan.fitsCpu && plan.fitsGpu && plan.gpuLayers >= wantedLayers)
+				return plan;
+			const auto rank = [](const ModelPlan &p) { return std::make_tuple(p.fitsCpu, p.fitsGpu, p.gpuLayers); };
+			if (!best || rank(plan) > rank(best.value()))
+				best = plan;
+			if (contextSize / 2 < MIN_AUTO_CONTEXT_SIZE)
+				break;
+		}
+		return best.value();
+	}
+
+	PlanOptions GetPlanOptions(const HardwareInfo &hardwareInfo)
+	{
+		PlanOptions options;
+		const int gpuMB = hardwareInfo.gpu.freeMemoryMB > 0 ? hardwareInfo.gpu.freeMemoryMB : hardwareInfo.gpu.totalMemoryMB;
+		const int cpuMB = hardwareInfo.cpu.freeMemoryMB > 0 ? hardwareInfo.cpu.freeMemoryMB : hardwareInfo.cpu.totalMemoryMB;
+		options.gpuBytes = static_cast<uint64_t>(std::max(gpuMB, 0)) * MB;
+		options.cpuBytes = static_cast<uint64_t>(std::max(cpuMB, 0)) * MB;
+		return options;
+	}
+
+} // namespace wingman
@@ -39,10 +39,16 @@ namespace wingman::orm {
 				sqlite3_sleep(timeout);
 				return timeout;
 			}, nullptr);
+
+			// readers no longer block the writer (and vice versa), and commits only sync the WAL at checkpoints
+			exec("PRAGMA journal_mode=WAL");
+			exec("PRAGMA synchronous=NORMAL");
 		}
 
 		Database::~Database()
 		{
+			// cached statements must be finalized before the connection can be closed
+			statements.clear();
 			if (db != nullptr) {
 				lastErrorCode = sqlite3_close(db);
 			}
@@ -60,6 +66,7 @@ namespace wingman::orm {
 
 		int Database::exec(const std::string &sql) const
 		{
+			std::lock_guard<std::recursive_mutex> transactionLock(transactionMutex);
 			char *errMsg = nullptr;
 			const auto result = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg);
 			if (result != SQLITE_OK) {
@@ -75,15 +82,116 @@ namespace wingman::orm {
 			return lastErrorCode;
 		}
 
+		int64_t Database::changeCounter() const
+		{
+			// total_changes counts writes made through this connection, data_version moves on commits made by others
+			const auto query = prepare("PRAGMA data_version");
+			query->executeStep();
+			return static_cast<int64_t>(sqlite3_total_changes(db)) + query->getInt64("data_version");
+		}
+
 		bool Database::tableExists(const char *name) const
 		{
-			Statement query(*this, "SELECT COUNT(*) FROM sqlite_master WHERE type='table' AND name=$name");
-			query.bind("$name", name);
-			query.executeStep();
-			const auto count = query.getInt("COUNT(*)");
+			const auto query = prepare("SELECT COUNT(*) FROM sqlite_master WHERE type='table' AND name=$name");
+			query->bind("$name", name);
+			query->executeStep();
+			const auto count = query->getInt("COUNT(*)");
+			return count > 0;
+		}
+
+		bool Database::columnExists(const char *table, const char *name) const
+		{
+			const auto query = prepare("SELECT COUNT(*) FROM pragma_table_info($table) WHERE name = $name");
+			query->bind("$table", table);
+			query->bind("$name", name);
+			query->executeStep();
+			const auto count = query->getInt("COUNT(*)");
 			return count > 0;
 		}
 
+		PreparedStatement Database::prepare(const std::string &sql) const
+		{
+			CachedStatement *cached;
+			{
+				std::lock_guard<std::mutex> lock(statementsMutex);
+				auto &entry = statements[sql];
+				if (!entry) {
+					entry = std::make_unique<CachedStatement>();
+				}
+				cached = entry.get();
+			}
+
+			// taken before the statement, a thread holding a transaction never waits for a statement here
+			std::unique_lock<std::recursive_mutex> transactionLock(transactionMutex);
+			std::unique_lock<std::mutex> lock(cached->mutex, std::try_to_lock);
+			if (!lock.owns_lock()) {
+				return { std::move(transactionLock), std::make_unique<Statement>(*this, sql) };
+			}
+			if (!cached->statement) {
+				cached->statement = std::make_unique<Statement>(*this, sql);
+			}
+			return { std::move(transactionLock), std::move(lock), cached->statement.get() };
+		}
+
+		PreparedStatement::PreparedStatement(std::unique_lock<std::recursive_mutex> &&transactionLock, std::unique_lock<std::mutex> &&lock, Statement *statement) : transactionLock(std::move(transactionLock))
+			, lock(std::move(lock))
+			, statement(statement)
+		{}
+
+		PreparedStatement::PreparedStatement(std::unique_lock<std::recursive_mutex> &&transactionLock, std::unique_ptr<Statement> &&owned) : transactionLock(std::move(transactionLock))
+			, owned(std::move(owned))
+			, statement(this->owned.get())
+		{}
+
+		PreparedStatement::~PreparedStatement()
+		{
+			// leave the cached statement ready for the next user
+			if (lock.owns_lock()) {
+				statement->reset();
+				statement->clearBindings();
+			}
+		}
+
+		Statement &PreparedStatement::operator*() const
+		{
+			return *statement;
+		}
+
+		Statement *PreparedStatement::operator->() const
+		{
+			return statement;
+		}
+
+		Transaction::Transaction(const Database &database) : database(database)
+			, lock(database.transactionMutex)
+			, owner(database.transactionDepth == 0)
+		{
+			if (owner) {
+				database.exec("BEGIN IMMEDIATE");
+			}
+			database.transactionDepth++;
+		}
+
+		Transaction::~Transaction()
+		{
+			database.transactionDepth--;
+			if (owner && !committed) {
+				try {
+					database.exec("ROLLBACK");
+				} catch (const std::exception &e) {
+					spdlog::error("(Transaction) Failed to roll back: {}", e.what());
+				}
+			}
+		}
+
+		void Transaction::commit()
+		{
+			if (owner && !committed) {
+				database.exec("COMMIT");
+			}
+			committed = true;
+		}
+
 		Statement::Statement(const Database &database, const std::string &sql, bool longRunning) : stmt(nullptr)
 			, db(database.get())
 			, sql(sql)
@@ -267,6 +375,11 @@ namespace wingman::orm {
 			sqliteHasRow = false;
 		}
 
+		void Statement::clearBindings()
+		{
+			lastErrorCode = sqlite3_clear_bindings(stmt);
+		}
+
 		int Statement::exec()
 		{
 			const int result = sqlite3_step(stmt);
@@ -349,6 +462,26 @@ namespace wingman::orm {
                 }
 			}
 		}
+
+		std::string buildUpsert(const std::string &tableName, const std::map<std::string, Column> &columns, const std::vector<std::string> &columnNames)
+		{
+			std::string fields, values, keys, updates;
+			for (const auto &name : columnNames) {
+				fields.append(fmt::format("{}, ", name));
+				values.append(fmt::format("${}, ", name));
+				if (columns.at(name).isPrimaryKey) {
+					keys.append(fmt::format("{}, ", name));
+				} else if (name != "created") {
+					updates.append(fmt::format("{} = excluded.{}, ", name, name));
+				}
+			}
+			for (auto *part : { &fields, &values, &keys, &updates }) {
+				if (!part->empty()) {
+					part->resize(part->size() - 2);
+				}
+			}
+			return fmt::format("INSERT INTO {} ({}) VALUES ({}) ON CONFLICT ({}) DO UPDATE SET {}", tableName, fields, values, keys, updates);
+		}
 	}
 
 	DatabaseActions::DatabaseActions(sqlite::Database &dbInstance) : dbInstance(dbInstance)
@@ -365,6 +498,8 @@ namespace wingman::orm {
 			"downloadSpeed TEXT, "
 			"progress REAL DEFAULT 0.0 NOT NULL, "
 			"error TEXT, "
+			"segments TEXT DEFAULT '[]' NOT NULL, "
+			"sha256 TEXT DEFAULT '' NOT NULL, "
 			"created INTEGER DEFAULT (unixepoch('now')) NOT NULL, "
 			"updated INTEGER DEFAULT (unixepoch('now')) NOT NULL, "
 			"PRIMARY KEY (modelRepo, filePath)"
@@ -377,6 +512,15 @@ namespace wingman::orm {
 		if (dbInstance.tableExists("downloads") == false) {
 			dbInstance.exec(sql);
 			spdlog::debug("(createDownloadsTable) Downloads table created.");
+		} else {
+			if (dbInstance.columnExists("downloads", "segments") == false) {
+				dbInstance.exec("ALTER TABLE downloads ADD COLUMN segments TEXT DEFAULT '[]' NOT NULL");
+				spdlog::debug("(createDownloadsTable) Downloads table segments column added.");
+			}
+			if (dbInstance.columnExists("downloads", "sha256") == false) {
+				dbInstance.exec("ALTER TABLE downloads ADD COLUMN sha256 TEXT DEFAULT '' NOT NULL");
+				spdlog::debug("(createDownloadsTable) Downloads table sha256 column added.");
+			}
 		}
 	}
 
@@ -431,9 +575,37 @@ namespace wingman::orm {
 		}
 	}
 
+	const char *DatabaseActions::getCreateCatalog()
+	{
+		return "CREATE TABLE IF NOT EXISTS catalog ("
+			"id TEXT NOT NULL, "
+			"rank INTEGER DEFAULT 0 NOT NULL, "
+			"createdAt TEXT, "
+			"lastModified TEXT, "
+			"downloads INTEGER DEFAULT 0 NOT NULL, "
+			"likes INTEGER DEFAULT 0 NOT NULL, "
+			"size TEXT, "
+			"quantizations TEXT DEFAULT '{}' NOT NULL, "
+			"created INTEGER DEFAULT (unixepoch('now')) NOT NULL, "
+			"updated INTEGER DEFAULT (unixepoch('now')) NOT NULL, "
+			"PRIMARY KEY (id)"
+			")";
+	}
+
+	void DatabaseActions::createCatalogTable() const
+	{
+		const std::string sql = getCreateCatalog();
+
+		if (dbInstance.tableExists("catalog") == false) {
+			const auto result = dbInstance.exec(sql);
+			spdlog::debug("(createCatalogTable) Catalog table created. result: {}", result);
+		}
+	}
+
 	AppItemActions::AppItemActions(sqlite::Database &dbInstance) : dbInstance(dbInstance)
 	{
 		initializeColumns(dbInstance, TABLE_NAME, columns, columnNames);
+		upsertSql = sqlite::buildUpsert(TABLE_NAME, columns, columnNames);
 	}
 
 	std::vector<AppItem> AppItemActions::getSome(sqlite::Statement &query)
@@ -452,11 +624,10 @@ namespace wingman::orm {
 
 	std::optional<AppItem> AppItemActions::get(const std::string &name, const std::optional<std::string> &key) const
 	{
-		sqlite::Statement query(dbInstance,
-			fmt::format("SELECT * FROM {} WHERE name = $name AND key = $key", TABLE_NAME));
-		query.bind("$name", name);
-		query.bind("$key", key.value_or("default"));
-		auto items = getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE name = $name AND key = $key", TABLE_NAME));
+		query->bind("$name", name);
+		query->bind("$key", key.value_or("default"));
+		auto items = getSome(*query);
 		if (!items.empty())
 			return items[0];
 		return std::nullopt;
@@ -469,12 +640,11 @@ namespace wingman::orm {
 		const auto diff = now - cachedTimeout.count();
 		// convert to seconds
 		const auto diffSeconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::milliseconds(diff)).count();
-		sqlite::Statement query(dbInstance,
-			fmt::format("SELECT * FROM {} WHERE name = $name AND key = $key AND updated > $updated", TABLE_NAME));
-		query.bind("$name", name);
-		query.bind("$key", key.value_or(""));
-		query.bind("$updated", static_cast<int64_t>(diffSeconds));
-		auto items = getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE name = $name AND key = $key AND updated > $updated", TABLE_NAME));
+		query->bind("$name", name);
+		query->bind("$key", key.value_or(""));
+		query->bind("$updated", static_cast<int64_t>(diffSeconds));
+		auto items = getSome(*query);
 		if (!items.empty())
 			return items[0];
 		return std::nullopt;
@@ -482,81 +652,38 @@ namespace wingman::orm {
 
 	std::vector<AppItem> AppItemActions::getAll() const
 	{
-		sqlite::Statement query(dbInstance, fmt::format("SELECT * FROM {}", TABLE_NAME));
-		return getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {}", TABLE_NAME));
+		return getSome(*query);
 	}
 
 	void AppItemActions::set(AppItem& item) const
 	{
-		// check if item exists, if not insert, else update
-		const auto existingItem = get(item.name, item.key);
-		std::string sql;
-		std::string updateType;
-		bool insert = false;
-		if (existingItem) {
-			updateType = "update";
-			sql = fmt::format("UPDATE {} SET", TABLE_NAME);
-			std::string fields;
-			for (const auto &name : columnNames) {
-				// skip key columns and the created column
-				if (name == "created" || name == "key" || name == "name") {
-					continue;
-				}
-				fields.append(fmt::format(" {} = ${}, ", name, name));
-			}
-			fields.pop_back();
-			fields.pop_back();
-			sql.append(fields);
-			sql.append(" WHERE name = $name AND key = $key");
-		} else {
-			updateType = "insert";
-			insert = true;
-			sql = fmt::format("INSERT INTO {} (", TABLE_NAME);
-			std::string fields;
-			for (const auto &name : columnNames) {
-				fields.append(fmt::format("{}, ", name));
-			}
-			fields.pop_back();
-			fields.pop_back();
-			sql.append(fields);
-			sql.append(") VALUES (");
-			std::string values;
-			for (const auto &name : columnNames) {
-				values.append(fmt::format("${}, ", name));
-			}
-			values.pop_back();
-			values.pop_back();
-			sql.append(values);
-			sql.append(")");
-		}
-		sqlite::Statement query(dbInstance, sql);
-		query.bind("$value", item.value);
-		query.bind("$enabled", item.enabled);
-		//query.bind("$updated", item.updated);
+		const auto query = dbInstance.prepare(upsertSql);
+		query->bind("$value", item.value);
+		query->bind("$enabled", item.enabled);
+		// only used when the item is inserted
+		query->bind("$created", static_cast<int64_t>(item.created));
 		// always set updated to now
-		query.bind("$updated", static_cast<int64_t>(util::now()));
-		if (insert) {
-			query.bind("$created", static_cast<int64_t>(item.created));
-		}
+		query->bind("$updated", static_cast<int64_t>(util::now()));
 
 		// key columns
-		query.bind("$name", item.name);
-		query.bind("$key", item.key);
+		query->bind("$name", item.name);
+		query->bind("$key", item.key);
 
-		const auto errorCode = query.exec();
+		const auto errorCode = query->exec();
 		if (errorCode != SQLITE_DONE) {
 			auto error = dbInstance.getErrorMsg();
-			throw std::runtime_error("(set) Failed to : " + updateType + " record: " + error);
+			throw std::runtime_error("(set) Failed to upsert record: " + error);
 		}
 	}
 
 	void AppItemActions::remove(const std::string &name, const std::string &key) const
 	{
-		sqlite::Statement query(dbInstance, fmt::format("DELETE FROM {} WHERE name = $name AND key = $key", TABLE_NAME));
-		query.bind("$name", name);
-		query.bind("$key", key);
+		const auto query = dbInstance.prepare(fmt::format("DELETE FROM {} WHERE name = $name AND key = $key", TABLE_NAME));
+		query->bind("$name", name);
+		query->bind("$key", key);
 
-		const auto errorCode = query.exec();
+		const auto errorCode = query->exec();
 		if (errorCode != SQLITE_DONE) {
 			throw std::runtime_error("(remove) Failed to delete record: " + std::to_string(errorCode));
 		}
@@ -564,9 +691,9 @@ namespace wingman::orm {
 
 	void AppItemActions::clear() const
 	{
-		sqlite::Statement query(dbInstance, fmt::format("DELETE FROM {}", TABLE_NAME), true);
+		const auto query = dbInstance.prepare(fmt::format("DELETE FROM {}", TABLE_NAME));
 
-		const auto errorCode = query.exec();
+		const auto errorCode = query->exec();
 
 		if (errorCode != SQLITE_DONE) {
 			throw std::runtime_error("(clear) Failed to clear records: " + std::to_string(errorCode));
@@ -575,12 +702,12 @@ namespace wingman::orm {
 
 	int AppItemActions::count() const
 	{
-		sqlite::Statement query(dbInstance, fmt::format("SELECT COUNT(*) FROM {}", TABLE_NAME), true);
-		const auto errorCode = query.executeStep();
-		if (query.hasRow()) {
-			return query.getInt("COUNT(*)");
+		const auto query = dbInstance.prepare(fmt::format("SELECT COUNT(*) FROM {}", TABLE_NAME));
+		const auto errorCode = query->executeStep();
+		if (query->hasRow()) {
+			return query->getInt("COUNT(*)");
 		}
-		if (query.getErrorCode() != SQLITE_DONE) {
+		if (query->getErrorCode() != SQLITE_DONE) {
 			throw std::runtime_error("(count) Failed to count records: " + std::to_string(errorCode));
 		}
 		return -1;
@@ -619,6 +746,7 @@ namespace wingman::orm {
 		fs::create_directories(downloadsDir);
 		// initialize columns cache
 		initializeColumns(dbInstance, TABLE_NAME, columns, columnNames);
+		upsertSql = sqlite::buildUpsert(TABLE_NAME, columns, columnNames);
 	}
 
 	std::vector<DownloadItem> DownloadItemActions::getSome(sqlite::Statement &query)
@@ -633,6 +761,11 @@ namespace wingman::orm {
 			item.downloadSpeed = q.getText("downloadSpeed");
 			item.progress = q.getDouble("progress");
 			item.error = q.getText("error");
+			const auto segments = nlohmann::json::parse(q.getText("segments", "[]"), nullptr, false);
+			if (segments.is_array()) {
+				item.segments = segments.get<std::vector<DownloadSegment>>();
+			}
+			item.sha256 = q.getText("sha256");
 			item.created = q.getInt64("created");
 			item.updated = q.getInt64("updated");
 			return item;
@@ -642,11 +775,10 @@ namespace wingman::orm {
 	std::optional<DownloadItem> DownloadItemActions::get(
 		const std::string &modelRepo, const std::string &filePath) const
 	{
-		sqlite::Statement query(dbInstance,
-									fmt::format("SELECT * FROM {} WHERE modelRepo = $modelRepo AND filePath = $filePath", TABLE_NAME));
-		query.bind("$modelRepo", modelRepo);
-		query.bind("$filePath", filePath);
-		auto items = getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE modelRepo = $modelRepo AND filePath = $filePath", TABLE_NAME));
+		query->bind("$modelRepo", modelRepo);
+		query->bind("$filePath", filePath);
+		auto items = getSome(*query);
 		if (!items.empty())
 			return items[0];
 		return std::nullopt;
@@ -654,8 +786,8 @@ namespace wingman::orm {
 
 	std::vector<DownloadItem> DownloadItemActions::getAll() const
 	{
-		sqlite::Statement query(dbInstance, fmt::format("SELECT * FROM {}", TABLE_NAME));
-		return getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {}", TABLE_NAME));
+		return getSome(*query);
 	}
 
 	std::vector<DownloadItem> DownloadItemActions::getAllSince(const std::chrono::milliseconds timeout) const
@@ -665,25 +797,22 @@ namespace wingman::orm {
 		const auto diff = now - timeout.count();
 		// convert to seconds
 		const auto diffSeconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::milliseconds(diff)).count();
-		sqlite::Statement query(dbInstance,
-			fmt::format("SELECT * FROM {} WHERE updated > $updated", TABLE_NAME));
-		query.bind("$updated", static_cast<int64_t>(diffSeconds));
-		return getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE updated > $updated", TABLE_NAME));
+		query->bind("$updated", static_cast<int64_t>(diffSeconds));
+		return getSome(*query);
 	}
 
 	std::vector<DownloadItem> DownloadItemActions::getAllByStatus(const DownloadItemStatus status) const
 	{
-		sqlite::Statement query(dbInstance,
-						fmt::format("SELECT * FROM {} WHERE status = $status", TABLE_NAME));
-		query.bind("$status", DownloadItem::toString(status));
-		return getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE status = $status", TABLE_NAME));
+		query->bind("$status", DownloadItem::toString(status));
+		return getSome(*query);
 	}
 
 	std::optional<DownloadItem> DownloadItemActions::getNextQueued() const
 	{
-		sqlite::Statement query(dbInstance,
-									fmt::format("SELECT * FROM {} WHERE status = 'queued' ORDER BY created ASC LIMIT 1", TABLE_NAME));
-		auto items = getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE status = 'queued' ORDER BY created ASC LIMIT 1", TABLE_NAME));
+		auto items = getSome(*query);
 		if (!items.empty())
 			return items[0];
 		return std::nullopt;
@@ -691,75 +820,89 @@ namespace wingman::orm {
 
 	void DownloadItemActions::set(DownloadItem& item) const
 	{
-		// check if item exists, if not insert, else update
-		const auto existingItem = get(item.modelRepo, item.filePath);
-		std::string sql;
-		bool insert = false;
-		std::string updateType;
-		if (existingItem) {
-			updateType = "update";
-			sql = fmt::format("UPDATE {} SET", TABLE_NAME);
-			std::string fields;
-			for (const auto &name : columnNames) {
-				// skip key columns and the created column
-				if (name == "created" || name == "modelRepo" || name == "filePath") {
-					continue;
-				}
-				fields.append(fmt::format(" {} = ${}, ", name, name));
-			}
-			fields.pop_back();
-			fields.pop_back();
-			sql.append(fields);
-			sql.append(" WHERE modelRepo = $modelRepo AND filePath = $filePath");
-		} else {
-			updateType = "insert";
-			insert = true;
-			sql = fmt::format("INSERT INTO {} (", TABLE_NAME);
-			std::string fields;
-			for (const auto &name : columnNames) {
-				fields.append(fmt::format("{}, ", name));
-			}
-			fields.pop_back();
-			fields.pop_back();
-			sql.append(fields);
-			sql.append(") VALUES (");
-			std::string values;
-			for (const auto &name : columnNames) {
-				values.append(fmt::format("${}, ", name));
-			}
-			values.pop_back();
-			values.pop_back();
-			sql.append(values);
-			sql.append(")");
-		}
-
-		auto query = sqlite::Statement(dbInstance, sql);
-		query.bind("$status", DownloadItem::toString(item.status));
-		query.bind("$totalBytes", static_cast<int64_t>(item.totalBytes));
-		query.bind("$downloadedBytes", static_cast<int64_t>(item.downloadedBytes));
-		query.bind("$downloadSpeed", item.downloadSpeed);
-		query.bind("$progress", item.progress);
-		query.bind("$error", item.error);
-		if (insert) {
-			query.bind("$created", static_cast<int64_t>(item.created));
-		}
+		{
+			std::lock_guard<std::mutex> lock(progressMutex);
+			pendingProgress.erase({ item.modelRepo, item.filePath });
+		}
+		const auto query = dbInstance.prepare(upsertSql);
+		query->bind("$status", DownloadItem::toString(item.status));
+		query->bind("$totalBytes", static_cast<int64_t>(item.totalBytes));
+		query->bind("$downloadedBytes", static_cast<int64_t>(item.downloadedBytes));
+		query->bind("$downloadSpeed", item.downloadSpeed);
+		query->bind("$progress", item.progress);
+		query->bind("$error", item.error);
+		query->bind("$segments", nlohmann::json(item.segments).dump());
+		query->bind("$sha256", item.sha256);
+		// only used when the item is inserted
+		query->bind("$created", static_cast<int64_t>(item.created));
 		// always set updated to now
-		query.bind("$updated", static_cast<int64_t>(util::now()));
+		query->bind("$updated", static_cast<int64_t>(util::now()));
 
 		// key columns
-		query.bind("$modelRepo", item.modelRepo);
-		query.bind("$filePath", item.filePath);
+		query->bind("$modelRepo", item.modelRepo);
+		query->bind("$filePath", item.filePath);
 
-		const auto errorCode = query.exec();
+		const auto errorCode = query->exec();
 		if (errorCode != SQLITE_DONE) {
 			auto error = dbInstance.getErrorMsg();
-			throw std::runtime_error("(set) Failed to : " + updateType + " record: " + error);
+			throw std::runtime_error("(set) Failed to upsert record: " + error);
 		}
 	}
 
+	void DownloadItemActions::setProgress(const DownloadItem &item, const std::time_t interval) const
+	{
+		{
+			std::lock_guard<std::mutex> lock(progressMutex);
+			pendingProgress[{ item.modelRepo, item.filePath }] = item;
+			if (util::now() - progressFlushed < interval)
+				return;
+		}
+		flushProgress();
+	}
+
+	void DownloadItemActions::flushProgress() const
+	{
+		{
+			std::lock_guard<std::mutex> lock(progressMutex);
+			progressFlushed = util::now();
+			if (pendingProgress.empty())
+				return;
+		}
+
+		// taken before the queue is emptied, a set() of a queued item on another thread then waits for the commit and
+		//	is written after the progress it replaces
+		sqlite::Transaction transaction(dbInstance);
+		std::map<std::pair<std::string, std::string>, DownloadItem> pending;
+		{
+			std::lock_guard<std::mutex> lock(progressMutex);
+			pending.swap(pendingProgress);
+		}
+		for (auto &[key, item] : pending) {
+			set(item);
+		}
+		transaction.commit();
+	}
+
 	std::optional<DownloadItem> DownloadItemActions::enqueue(const std::string &modelRepo, const std::string &filePath) const
 	{
 		try {
+			{
+				std::lock_guard<std::mutex> lock(progressMutex);
+				pendingProgress.erase({ modelRepo, filePath });
+			}
+			// a cancelled or failed download keeps its size and segments so it resumes where it stopped
+			const auto query = dbInstance.prepare(fmt::format("UPDATE {} SET status = 'queued', downloadSpeed = '', error = '', updated = $updated WHERE modelRepo = $modelRepo AND filePath = $filePath", TABLE_NAME));
+			query->bind("$updated", static_cast<int64_t>(util::now()));
+			query->bind("$modelRepo", modelRepo);
+			query->bind("$filePath", filePath);
+			const auto errorCode = query->exec();
+			if (errorCode != SQLITE_DONE) {
+				throw std::runtime_error("(enqueue) Failed to update record: " + dbInstance.getErrorMsg());
+			}
+			if (auto existing = get(modelRepo, filePath)) {
+				return existing;
+			}
+
 			DownloadItem item;
 			item.modelRepo = modelRepo;
 			item.filePath = filePath;
@@ -776,11 +919,10 @@ namespace wingman::orm {
 
 	void DownloadItemActions::remove(const std::string &modelRepo, const std::string &filePath) const
 	{
-		sqlite::Statement query(dbInstance,
-			fmt::format("DELETE FROM {} WHERE modelRepo = $modelRepo AND filePath = $filePath", TABLE_NAME));
-		query.bind("$modelRepo", modelRepo);
-		query.bind("$filePath", filePath);
-		const auto errorCode = query.exec();
+		const auto query = dbInstance.prepare(fmt::format("DELETE FROM {} WHERE modelRepo = $modelRepo AND filePath = $filePath", TABLE_NAME));
+		query->bind("$modelRepo", modelRepo);
+		query->bind("$filePath", filePath);
+		const auto errorCode = query->exec();
 		if (errorCode != SQLITE_DONE) {
 			throw std::runtime_error("(remove) Failed to delete record: " + std::to_string(errorCode));
 		}
@@ -788,8 +930,8 @@ namespace wingman::orm {
 
 	void DownloadItemActions::clear() const
 	{
-		sqlite::Statement query(dbInstance, fmt::format("DELETE FROM {}", TABLE_NAME), true);
-		const auto errorCode = query.exec();
+		const auto query = dbInstance.prepare(fmt::format("DELETE FROM {}", TABLE_NAME));
+		const auto errorCode = query->exec();
 		if (errorCode != SQLITE_DONE) {
 			throw std::runtime_error("(clear) Failed to clear records: " + std::to_string(errorCode));
 		}
@@ -797,13 +939,13 @@ namespace wingman::orm {
 
 	int DownloadItemActions::count() const
 	{
-		sqlite::Statement query(dbInstance, fmt::format("SELECT COUNT(*) FROM {}", TABLE_NAME), true);
-		query.executeStep();
-		if (query.hasRow()) {
-			return query.getInt("COUNT(*)");
+		const auto query = dbInstance.prepare(fmt::format("SELECT COUNT(*) FROM {}", TABLE_NAME));
+		query->executeStep();
+		if (query->hasRow()) {
+			return query->getInt("COUNT(*)");
 		}
 
-		const auto errorCode = query.getErrorCode();
+		const auto errorCode = query->getErrorCode();
 		if (errorCode != SQLITE_DONE) {
 			throw std::runtime_error("(count) Failed to count records: " + std::to_string(errorCode));
 		}
@@ -812,22 +954,30 @@ namespace wingman::orm {
 
 	void DownloadItemActions::reset() const
 	{
+		sqlite::Transaction transaction(dbInstance);
 		{	// enclose in scope to ensure query is destroyed before query
-			sqlite::Statement query(dbInstance,
-				fmt::format("UPDATE {} SET status = 'queued', progress = 0, downloadedBytes = 0, totalBytes = 0, downloadSpeed = '' WHERE status = 'downloading' OR status = 'error' or status = 'idle'", TABLE_NAME));
-			const auto errorCode = query.exec();
+			// interrupted downloads keep their progress and segments so they can be resumed
+			const auto query = dbInstance.prepare(fmt::format("UPDATE {} SET status = 'queued', downloadSpeed = '' WHERE status = 'downloading' OR status = 'error'", TABLE_NAME));
+			const auto errorCode = query->exec();
+			if (errorCode != SQLITE_DONE) {
+				throw std::runtime_error("(reset) Failed to reset update record: " + std::to_string(errorCode));
+			}
+		}
+		{
+			const auto query = dbInstance.prepare(fmt::format("UPDATE {} SET status = 'queued', progress = 0, downloadedBytes = 0, totalBytes = 0, downloadSpeed = '', segments = '[]', sha256 = '' WHERE status = 'idle'", TABLE_NAME));
+			const auto errorCode = query->exec();
 			if (errorCode != SQLITE_DONE) {
 				throw std::runtime_error("(reset) Failed to reset update record: " + std::to_string(errorCode));
 			}
 		}
 		{
-			sqlite::Statement query(dbInstance,
-				fmt::format("DELETE FROM {} WHERE status = 'cancelled' OR status = 'unknown'", TABLE_NAME));
-			const auto errorCode = query.exec();
+			const auto query = dbInstance.prepare(fmt::format("DELETE FROM {} WHERE status = 'cancelled' OR status = 'unknown'", TABLE_NAME));
+			const auto errorCode = query->exec();
 			if (errorCode != SQLITE_DONE) {
 				throw std::runtime_error("(reset) Failed to reset delete record: " + std::to_string(errorCode));
 			}
 		}
+		transaction.commit();
 	}
 
 #pragma region DownloadItemActions (file utilities)
@@ -862,6 +1012,8 @@ namespace wingman::orm {
 		j["downloadSpeed"] = item.downloadSpeed;
 		j["progress"] = item.progress;
 		j["error"] = item.error;
+		j["segments"] = item.segments;
+		j["sha256"] = item.sha256;
 		j["created"] = item.created;
 		j["updated"] = item.updated;
 
@@ -879,6 +1031,8 @@ namespace wingman::orm {
 		item.downloadSpeed = j["downloadSpeed"];
 		item.progress = j["progress"];
 		item.error = j["error"];
+		item.segments = j.value("segments", std::vector<DownloadSegment>());
+		item.sha256 = j.value("sha256", std::string());
 		item.created = j["created"];
 		item.updated = j["updated"];
 
@@ -1127,6 +1281,7 @@ namespace wingman::orm {
 		, modelsDir(modelsDir)
 	{
 		initializeColumns(dbInstance, TABLE_NAME, columns, columnNames);
+		upsertSql = sqlite::buildUpsert(TABLE_NAME, columns, columnNames);
 	}
 
 	std::vector<WingmanItem> WingmanItemActions::getSome(sqlite::Statement &query)
@@ -1150,10 +1305,9 @@ namespace wingman::orm {
 
 	std::optional<WingmanItem> WingmanItemActions::get(const std::string &alias) const
 	{
-		sqlite::Statement query(dbInstance,
-									fmt::format("SELECT * FROM {} WHERE alias = $alias", TABLE_NAME));
-		query.bind("$alias", alias);
-		auto items = getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE alias = $alias", TABLE_NAME));
+		query->bind("$alias", alias);
+		auto items = getSome(*query);
 		if (!items.empty())
 			return items[0];
 		return std::nullopt;
@@ -1161,9 +1315,8 @@ namespace wingman::orm {
 
 	std::vector<WingmanItem> WingmanItemActions::getAll() const
 	{
-		sqlite::Statement query(dbInstance,
-									fmt::format("SELECT * FROM {}", TABLE_NAME));
-		return getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {}", TABLE_NAME));
+		return getSome(*query);
 	}
 
 	std::vector<WingmanItem> WingmanItemActions::getAllActive() const
@@ -1186,10 +1339,9 @@ namespace wingman::orm {
 		const auto diff = now - timeout.count();
 		// convert to seconds
 		const auto diffSeconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::milliseconds(diff)).count();
-		sqlite::Statement query(dbInstance,
-			fmt::format("SELECT * FROM {} WHERE updated > $updated", TABLE_NAME));
-		query.bind("$updated", static_cast<int64_t>(diffSeconds));
-		return getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE updated > $updated", TABLE_NAME));
+		query->bind("$updated", static_cast<int64_t>(diffSeconds));
+		return getSome(*query);
 	}
 
 	std::vector<WingmanItem> WingmanItemActions::getAllBefore(const std::chrono::milliseconds timeout) const
@@ -1204,20 +1356,19 @@ namespace wingman::orm {
 		const auto thresholdTimeSeconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::milliseconds(thresholdTime)).count();
 
 		// Create the SQL query to select items that were updated before the threshold time
-		sqlite::Statement query(dbInstance, fmt::format("SELECT * FROM {} WHERE updated < $updated", TABLE_NAME));
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE updated < $updated", TABLE_NAME));
 
 		// Bind the threshold time to the query
-		query.bind("$updated", static_cast<int64_t>(thresholdTimeSeconds));
+		query->bind("$updated", static_cast<int64_t>(thresholdTimeSeconds));
 
 		// Execute the query and return the results
-		return getSome(query);
+		return getSome(*query);
 	}
 
 	std::optional<WingmanItem> WingmanItemActions::getNextQueued() const
 	{
-		sqlite::Statement query(dbInstance,
-									fmt::format("SELECT * FROM {} WHERE status = 'queued' ORDER BY created ASC LIMIT 1", TABLE_NAME));
-		auto items = getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE status = 'queued' ORDER BY created ASC LIMIT 1", TABLE_NAME));
+		auto items = getSome(*query);
 		if (!items.empty())
 			return items[0];
 		return std::nullopt;
@@ -1225,10 +1376,9 @@ namespace wingman::orm {
 
 	std::optional<WingmanItem> WingmanItemActions::getByPort(const int port) const
 	{
-		sqlite::Statement query(dbInstance,
-									fmt::format("SELECT * FROM {} WHERE port = $port AND status <> 'complete'", TABLE_NAME));
-		query.bind("$port", port);
-		auto items = getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE port = $port AND status <> 'complete'", TABLE_NAME));
+		query->bind("$port", port);
+		auto items = getSome(*query);
 		if (!items.empty())
 			return items[0];
 		return std::nullopt;
@@ -1236,86 +1386,44 @@ namespace wingman::orm {
 
 	std::vector<WingmanItem> WingmanItemActions::getByStatus(const WingmanItemStatus &status) const
 	{
-		sqlite::Statement query(dbInstance,
-									fmt::format("SELECT * FROM {} WHERE status = $status", TABLE_NAME));
-		query.bind("$status", WingmanItem::toString(status));
-		return getSome(query);
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE status = $status", TABLE_NAME));
+		query->bind("$status", WingmanItem::toString(status));
+		return getSome(*query);
 	}
 
 	// SIDE EFFECT: sets the updated time to now
 	void WingmanItemActions::set(WingmanItem& item) const
 	{
-		auto existingItem = get(item.alias);
-		std::string sql;
-		bool insert = false;
-		std::string updateType;
-		if (existingItem) {
-			updateType = "update";
-			sql = fmt::format("UPDATE {} SET", TABLE_NAME);
-			std::string fields;
-			for (const auto &name : columnNames) {
-				// skip key columns and the created column
-				if (name == "created" || name == "alias") {
-					continue;
-				}
-				fields.append(fmt::format(" {} = ${}, ", name, name));
-			}
-			fields.pop_back();
-			fields.pop_back();
-			sql.append(fields);
-			sql.append(" WHERE alias = $alias");
-		} else {
-			updateType = "insert";
-			insert = true;
-			sql = fmt::format("INSERT INTO {} (", TABLE_NAME);
-			std::string fields;
-			for (const auto &name : columnNames) {
-				fields.append(fmt::format("{}, ", name));
-			}
-			fields.pop_back();
-			fields.pop_back();
-			sql.append(fields);
-			sql.append(") VALUES (");
-			std::string values;
-			for (const auto &name : columnNames) {
-				values.append(fmt::format("${}, ", name));
-			}
-			values.pop_back();
-			values.pop_back();
-			sql.append(values);
-			sql.append(")");
-		}
-		auto query = sqlite::Statement(dbInstance, sql);
-		query.bind("$status", WingmanItem::toString(item.status));
-		query.bind("$modelRepo", item.modelRepo);
-		query.bind("$filePath", item.filePath);
-		query.bind("$address", item.address);
-		query.bind("$port", item.port);
-		query.bind("$contextSize", item.contextSize);
-		query.bind("$gpuLayers", item.gpuLayers);
-		query.bind("$force", item.force);
-		query.bind("$error", item.error);
-		if (insert) {
-			query.bind("$created", static_cast<int64_t>(item.created));
-		}
+		const auto query = dbInstance.prepare(upsertSql);
+		query->bind("$status", WingmanItem::toString(item.status));
+		query->bind("$modelRepo", item.modelRepo);
+		query->bind("$filePath", item.filePath);
+		query->bind("$address", item.address);
+		query->bind("$port", item.port);
+		query->bind("$contextSize", item.contextSize);
+		query->bind("$gpuLayers", item.gpuLayers);
+		query->bind("$force", item.force);
+		query->bind("$error", item.error);
+		// only used when the item is inserted
+		query->bind("$created", static_cast<int64_t>(item.created));
 		// always set updated to now
-		query.bind("$updated", static_cast<int64_t>(util::now()));
+		query->bind("$updated", static_cast<int64_t>(util::now()));
 
 		// key columns
-		query.bind("$alias", item.alias);
+		query->bind("$alias", item.alias);
 
-		const auto errorCode = query.exec();
+		const auto errorCode = query->exec();
 		if (errorCode != SQLITE_DONE) {
 			auto error = dbInstance.getErrorMsg();
-			throw std::runtime_error("(set) Failed to : " + updateType + " record: " + error);
+			throw std::runtime_error("(set) Failed to upsert record: " + error);
 		}
 	}
 
 	void WingmanItemActions::remove(const std::string &alias) const
 	{
-		sqlite::Statement query(dbInstance, fmt::format("DELETE FROM {} WHERE alias = $alias", TABLE_NAME));
-		query.bind("$alias", alias);
-		const auto errorCode = query.exec();
+		const auto query = dbInstance.prepare(fmt::format("DELETE FROM {} WHERE alias = $alias", TABLE_NAME));
+		query->bind("$alias", alias);
+		const auto errorCode = query->exec();
 		if (errorCode != SQLITE_DONE) {
 			throw std::runtime_error("(remove) Failed to delete record: " + std::to_string(errorCode));
 		}
@@ -1323,8 +1431,8 @@ namespace wingman::orm {
 
 	void WingmanItemActions::clear() const
 	{
-		sqlite::Statement query(dbInstance, fmt::format("DELETE FROM {}", TABLE_NAME));
-		const auto errorCode = query.exec();
+		const auto query = dbInstance.prepare(fmt::format("DELETE FROM {}", TABLE_NAME));
+		const auto errorCode = query->exec();
 		if (errorCode != SQLITE_DONE) {
 			throw std::runtime_error("(clear) Failed to clear records: " + std::to_string(errorCode));
 		}
@@ -1332,13 +1440,13 @@ namespace wingman::orm {
 
 	int WingmanItemActions::count() const
 	{
-		sqlite::Statement query(dbInstance, fmt::format("SELECT COUNT(*) FROM {}", TABLE_NAME));
-		query.executeStep();
-		if (query.hasRow()) {
-			return query.getInt("COUNT(*)");
+		const auto query = dbInstance.prepare(fmt::format("SELECT COUNT(*) FROM {}", TABLE_NAME));
+		query->executeStep();
+		if (query->hasRow()) {
+			return query->getInt("COUNT(*)");
 		}
 
-		const auto errorCode = query.getErrorCode();
+		const auto errorCode = query->getErrorCode();
 		if (errorCode != SQLITE_DONE) {
 			throw std::runtime_error("(count) Failed to count records: " + std::to_string(errorCode));
 		}
@@ -1355,6 +1463,7 @@ namespace wingman::orm {
 		// then remove all completed items
 		// error items will remain in the db until removed manually
 		// then set all preparing and inferring items to queued
+		sqlite::Transaction transaction(dbInstance);
 		auto activeItems = getAllActive();
 		// sort active items by updated time descending
 		// std::ranges::sort(activeItems,
@@ -1389,6 +1498,7 @@ namespace wingman::orm {
 			if (item.status == WingmanItemStatus::complete)
 				remove(item.alias);
 		}
+		transaction.commit();
 	}
 
 	nlohmann::json WingmanItemActions::toJson(const WingmanItem &item)
@@ -1429,6 +1539,108 @@ namespace wingman::orm {
 		return item;
 	}
 
+	CatalogItemActions::CatalogItemActions(sqlite::Database &dbInstance) : dbInstance(dbInstance)
+	{
+		initializeColumns(dbInstance, TABLE_NAME, columns, columnNames);
+		upsertSql = sqlite::buildUpsert(TABLE_NAME, columns, columnNames);
+	}
+
+	std::vector<CatalogItem> CatalogItemActions::getSome(sqlite::Statement &query)
+	{
+		return sqlite::GetSome<CatalogItem>(query, [](sqlite::Statement &q) {
+			CatalogItem item;
+			item.id = q.getText("id");
+			item.rank = q.getInt("rank");
+			item.createdAt = q.getText("createdAt");
+			item.lastModified = q.getText("lastModified");
+			item.downloads = q.getInt("downloads");
+			item.likes = q.getInt("likes");
+			item.size = q.getText("size");
+			const auto quantizations = nlohmann::json::parse(q.getText("quantizations", "{}"), nullptr, false);
+			if (quantizations.is_object()) {
+				item.quantizations = quantizations.get<std::map<std::string, std::string>>();
+			}
+			item.created = q.getInt64("created");
+			item.updated = q.getInt64("updated");
+			return item;
+		});
+	}
+
+	std::optional<CatalogItem> CatalogItemActions::get(const std::string &id) const
+	{
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} WHERE id = $id", TABLE_NAME));
+		query->bind("$id", id);
+		auto items = getSome(*query);
+		if (!items.empty())
+			return items[0];
+		return std::nullopt;
+	}
+
+	std::vector<CatalogItem> CatalogItemActions::getAll() const
+	{
+		const auto query = dbInstance.prepare(fmt::format("SELECT * FROM {} ORDER BY rank ASC", TABLE_NAME));
+		return getSome(*query);
+	}
+
+	void CatalogItemActions::set(CatalogItem &item) const
+	{
+		const auto query = dbInstance.prepare(upsertSql);
+		query->bind("$rank", item.rank);
+		query->bind("$createdAt", item.createdAt);
+		query->bind("$lastModified", item.lastModified);
+		query->bind("$downloads", item.downloads);
+		query->bind("$likes", item.likes);
+		query->bind("$size", item.size);
+		query->bind("$quantizations", nlohmann::json(item.quantizations).dump());
+		// only used when the item is inserted
+		query->bind("$created", static_cast<int64_t>(item.created));
+		// always set updated to now
+		query->bind("$updated", static_cast<int64_t>(util::now()));
+
+		// key columns
+		query->bind("$id", item.id);
+
+		const auto errorCode = query->exec();
+		if (errorCode != SQLITE_DONE) {
+			auto error = dbInstance.getErrorMsg();
+			throw std::runtime_error("(set) Failed to upsert record: " + error);
+		}
+	}
+
+	void CatalogItemActions::replaceAll(std::vector<CatalogItem> &items) const
+	{
+		sqlite::Transaction transaction(dbInstance);
+		clear();
+		for (auto &item : items) {
+			set(item);
+		}
+		transaction.commit();
+	}
+
+	void CatalogItemActions::clear() const
+	{
+		const auto query = dbInstance.prepare(fmt::format("DELETE FROM {}", TABLE_NAME));
+
+		const auto errorCode = query->exec();
+
+		if (errorCode != SQLITE_DONE) {
+			throw std::runtime_error("(clear) Failed to clear records: " + std::to_string(errorCode));
+		}
+	}
+
+	int CatalogItemActions::count() const
+	{
+		const auto query = dbInstance.prepare(fmt::format("SELECT COUNT(*) FROM {}", TABLE_NAME));
+		const auto errorCode = query->executeStep();
+		if (query->hasRow()) {
+			return query->getInt("COUNT(*)");
+		}
+		if (query->getErrorCode() != SQLITE_DONE) {
+			throw std::runtime_error("(count) Failed to count records: " + std::to_string(errorCode));
+		}
+		return -1;
+	}
+
 	void ItemActionsFactory::openDatabase()
 	{
 		spdlog::debug("(openDatabase) Opening database {}...", dbPath.string());
@@ -1499,10 +1711,12 @@ namespace wingman::orm {
 		dbActions.createDownloadsTable();
 		dbActions.createWingmanTable();
 		dbActions.createAppTable();
+		dbActions.createCatalogTable();
 
 		pAppItemActions = std::make_shared<AppItemActions>(*db);
 		pDownloadItemItemActions = std::make_shared<DownloadItemActions>(*db, modelsDir);
 		pWingmanItemItemActions = std::make_shared<WingmanItemActions>(*db, modelsDir);
+		pCatalogItemActions = std::make_shared<CatalogItemActions>(*db);
 	}
 
 	std::shared_ptr<AppItemActions> ItemActionsFactory::app()
@@ -1520,6 +1734,21 @@ namespace wingman::orm {
 		return pWingmanItemItemActions;
 	}
 
+	std::shared_ptr<CatalogItemActions> ItemActionsFactory::catalog()
+	{
+		return pCatalogItemActions;
+	}
+
+	sqlite::Transaction ItemActionsFactory::transaction() const
+	{
+		return sqlite::Transaction(*db);
+	}
+
+	int64_t ItemActionsFactory::changeCounter() const
+	{
+		return db->changeCounter();
+	}
+
 	const fs::path &ItemActionsFactory::getWingmanHome() const
 	{
 		return wingmanHome;
@@ -12,6 +12,8 @@
 #include "wingman.service.h"
 
 #include "exceptions.h"
+#include "hwinfo.h"
+#include "model.planner.h"
 #include "wingman.server.integration.h"
 
 namespace wingman::services {
@@ -52,13 +54,26 @@ namespace wingman::services {
 		//options["--in-suffix"] = "Assistant:";
 
 		options["--port"] = std::to_string(wingmanItem.port);
-		options["--ctx-size"] = std::to_string(wingmanItem.contextSize);
-		// TODO: if gpuLayers is -1, then try to determine automatically by loading the model, letting it crash if it loads too many layers, and then retrying with
-		//   half as many layers until it loads successfully
+		int contextSize = wingmanItem.contextSize;
 		int gpuLayers = wingmanItem.gpuLayers;
-		if (gpuLayers == -1) {
-			gpuLayers = 99;
+		// size the split from the model's tensor table and the memory available, when either is left to us
+		if (gpuLayers == -1 || contextSize <= 0) {
+			const auto profile = ReadModelProfile(modelPath);
+			if (profile) {
+				auto planOptions = GetPlanOptions(GetHardwareInfo());
+				planOptions.contextSize = contextSize;
+				planOptions.gpuLayers = gpuLayers;
+				const auto plan = PlanModelFit(profile.value(), planOptions);
+				spdlog::info("{}::startInference planned {} GPU layers at context {}: {} on the GPU, {} on the CPU",
+					SERVER_NAME, plan.gpuLayers, plan.contextSize, util::prettyBytes(plan.gpuBytes), util::prettyBytes(plan.cpuBytes));
+				contextSize = plan.contextSize;
+				gpuLayers = plan.gpuLayers;
+			} else if (gpuLayers == -1) {
+				spdlog::warn("{}::startInference unable to plan {}, offloading every layer", SERVER_NAME, modelPath);
+				gpuLayers = 99;
+			}
 		}
+		options["--ctx-size"] = std::to_string(contextSize);
 		options["--n-gpu-layers"] = std::to_string(gpuLayers);
 		options["--model"] = modelPath;
 		options["--alias"] = wingmanItem.alias;
@@ -91,7 +106,7 @@ namespace wingman::services {
 			// IMPORTANT: the following message is used by the frontend to determine if the model is out of memory
 			std::cerr << fmt::format("{}::startInference run_inference returned {}.\n", SERVER_NAME, ret);
 			if (ret == 100) {
-				// try again using half the layers as before, until we're down to 1, then exit
+				// the plan is an estimate, so try again using half the layers as before, until we're down to 1, then exit
 				if (gpuLayers > 1) {
 					gpuLayers /= 2;
 					options["--n-gpu-layers"] = std::to_string(gpuLayers);
@@ -0,0 +1,170 @@
+#include <fstream>
+#include <gtest/gtest.h>
+
+#include "catalog.h"
+#include "orm.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * \brief writes every SAX event as a line of text, so the events of two parsers can be compared
+ */
+class EventRecorder : public nlohmann::json_sax<nlohmann::json> {
+public:
+	std::string events;
+
+	bool null() override { events += "null\n"; return true; }
+	bool boolean(const bool val) override { events += fmt::format("bool {}\n", val); return true; }
+	bool number_integer(const number_integer_t val) override { events += fmt::format("int {}\n", val); return true; }
+	bool number_unsigned(const number_unsigned_t val) override { events += fmt::format("uint {}\n", val); return true; }
+	bool number_float(number_float_t, const string_t &s) override { events += fmt::format("float {}\n", s); return true; }
+	bool string(string_t &val) override { events += fmt::format("string {}\n", val); return true; }
+	bool binary(binary_t &) override { events += "binary\n"; return true; }
+	bool start_object(std::size_t) override { events += "{\n"; return true; }
+	bool key(string_t &val) override { events += fmt::format("key {}\n", val); return true; }
+	bool end_object() override { events += "}\n"; return true; }
+	bool start_array(std::size_t) override { events += "[\n"; return true; }
+	bool end_array() override { events += "]\n"; return true; }
+	bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &) override { events += "error\n"; return false; }
+};
+
+static std::string ReadFile(const fs::path &path)
+{
+	std::ifstream file(path, std::ios::binary);
+	return { std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+}
+
+static std::string RawModels()
+{
+	const std::string file{ __FILE__ };
+	return ReadFile(fs::path(file).parent_path() / "raw.models.json");
+}
+
+static bool StreamParse(const std::string &document, const size_t chunk, nlohmann::json_sax<nlohmann::json> &sax)
+{
+	wingman::JsonStreamParser parser(sax);
+	for (size_t i = 0; i < document.size(); i += chunk) {
+		if (!parser.feed(document.data() + i, std::min(chunk, document.size() - i)))
+			return false;
+	}
+	return parser.finish();
+}
+
+TEST(CatalogTest, StreamParserMatchesSaxParse)
+{
+	const std::vector<std::string> documents = {
+		RawModels(),
+		R"( {"a": [1, -2, 3.5, 1e3, -0.25E-2, true, false, null, [], {}],
+			"escapes": "q\"b\\s\/\b\f\n\r\t", "unicode": "\u00e9\u4e2d\ud83d\ude00", "": ""} )",
+		"[[[]], [{}], \"x\"]",
+		" 42 ",
+		"\"top\"",
+	};
+	for (const auto &document : documents) {
+		EventRecorder expected;
+		EXPECT_TRUE(nlohmann::json::sax_parse(document, &expected));
+		for (const size_t chunk : std::initializer_list<size_t>{ 1, 7, 4096, document.size() }) {
+			EventRecorder actual;
+			EXPECT_TRUE(StreamParse(document, chunk, actual));
+			EXPECT_EQ(actual.events, expected.events);
+		}
+	}
+}
+
+TEST(CatalogTest, StreamParserRejectsInvalid)
+{
+	for (const std::string document : { "[1, 2", "{\"a\" 1}", "{\"a\": 1,}", "[1] 2", "tru", "\"\\x\"", "\"\\ud83d\"", "[01x]", "" }) {
+		EventRecorder recorder;
+		EXPECT_FALSE(StreamParse(document, 1, recorder)) << document;
+	}
+}
+
+TEST(CatalogTest, SplitModelFiles)
+{
+	EXPECT_TRUE(wingman::IsSplitModelFile("model.Q4_K_M-00001-of-00003.gguf"));
+	EXPECT_TRUE(wingman::IsSplitModelFile("MODEL.Q8_0-1-OF-2.gguf"));
+	EXPECT_TRUE(wingman::IsSplitModelFile("model.Q8_0.gguf-split-a"));
+	EXPECT_FALSE(wingman::IsSplitModelFile("arithmo-mistral-7b.Q4_0.gguf"));
+	EXPECT_FALSE(wingman::IsSplitModelFile("state-of-the-art-7b.Q4_0.gguf"));
+}
+
+TEST(CatalogTest, ListingFields)
+{
+	const auto raw = RawModels();
+	std::vector<wingman::CatalogItem> items;
+	wingman::CatalogSax sax(items);
+	EXPECT_TRUE(StreamParse(raw, 1000, sax));
+	EXPECT_TRUE(sax.sawListing());
+
+	// the same models the whole document parsed at once gives
+	std::vector<std::string> expected;
+	for (const auto &model : nlohmann::json::parse(raw)) {
+		const auto id = model["id"].get<std::string>();
+		if (!id.ends_with("-GGUF"))
+			continue;
+		bool isSplitModel = false, hasModelFile = false;
+		for (const auto &sibling : model["siblings"]) {
+			const auto name = sibling["rfilename"].get<std::string>();
+			isSplitModel = isSplitModel || wingman::IsSplitModelFile(name);
+			hasModelFile = hasModelFile || name.ends_with(".gguf");
+		}
+		if (!isSplitModel && hasModelFile)
+			expected.push_back(id);
+	}
+	ASSERT_EQ(items.size(), expected.size());
+	for (size_t i = 0; i < items.size(); i++) {
+		EXPECT_EQ(items[i].id, expected[i]);
+		EXPECT_EQ(items[i].rank, static_cast<int>(i));
+	}
+
+	const auto &first = items.front();
+	EXPECT_EQ(first.id, "TheBloke/Arithmo-Mistral-7B-GGUF");
+	EXPECT_EQ(first.likes, 4);
+	EXPECT_EQ(first.lastModified, "2023-10-20T13:54:18.000Z");
+	EXPECT_EQ(first.quantizations.at("Q4_0"), "arithmo-mistral-7b.Q4_0.gguf");
+	EXPECT_EQ(first.quantizations.at("Q5_K_M"), "arithmo-mistral-7b.Q5_K_M.gguf");
+
+	// an error body is not a listing
+	items.clear();
+	wingman::CatalogSax errorSax(items);
+	EXPECT_TRUE(StreamParse(R"({"error": "rate limited"})", 4096, errorSax));
+	EXPECT_FALSE(errorSax.sawListing());
+	EXPECT_TRUE(items.empty());
+}
+
+TEST(CatalogTest, Index)
+{
+	const std::string file{ __FILE__ };
+	const auto baseDirectory = fs::path(file).parent_path() / fs::path("out");
+	fs::create_directories(baseDirectory);
+	wingman::orm::ItemActionsFactory actionsFactory(baseDirectory);
+	const auto catalog = actionsFactory.catalog();
+	catalog->clear();
+
+	std::vector<wingman::CatalogItem> items;
+	wingman::CatalogSax sax(items);
+	EXPECT_TRUE(StreamParse(RawModels(), 4096, sax));
+	catalog->replaceAll(items);
+	EXPECT_EQ(catalog->count(), static_cast<int>(items.size()));
+
+	const auto all = catalog->getAll();
+	ASSERT_EQ(all.size(), items.size());
+	for (size_t i = 0; i < all.size(); i++) {
+		EXPECT_EQ(all[i].id, items[i].id);
+		EXPECT_EQ(all[i].quantizations, items[i].quantizations);
+	}
+
+	// a fresh listing replaces the old one entirely
+	items.resize(2);
+	std::swap(items[0], items[1]);
+	items[0].rank = 0;
+	items[1].rank = 1;
+	catalog->replaceAll(items);
+	const auto replaced = catalog->getAll();
+	ASSERT_EQ(replaced.size(), 2);
+	EXPECT_EQ(replaced[0].id, items[0].id);
+	EXPECT_EQ(catalog->get(items[1].id).value().likes, items[1].likes);
+
+	catalog->clear();
+	EXPECT_EQ(catalog->count(), 0);
+}
@@ -0,0 +1,301 @@
+#include <future>
+#include <random>
+#include <gtest/gtest.h>
+#include "uwebsockets/App.h"
+
+#include "ggml.h"
+#include "curl.h"
+#include "orm.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * \brief a local stand-in for the model host that serves one file and honours `Range` requests
+ */
+class RangeServer {
+	std::string content;
+	std::thread thread;
+	uWS::Loop *loop = nullptr;
+	us_listen_socket_t *listenSocket = nullptr;
+	int port = 0;
+
+public:
+	std::atomic<long long> bytesServed = 0;
+
+	explicit RangeServer(std::string content) : content(std::move(content))
+	{
+		std::promise<void> listening;
+		auto ready = listening.get_future();
+		thread = std::thread([this, &listening] {
+			loop = uWS::Loop::get();
+			uWS::App()
+				.get("/*", [this](auto *res, auto *req) {
+					const auto size = static_cast<long long>(this->content.size());
+					long long first = 0, last = size - 1;
+					const std::string range(req->getHeader("range"));
+					if (sscanf(range.c_str(), "bytes=%lld-%lld", &first, &last) < 1) {
+						bytesServed += size;
+						res->end(this->content);
+						return;
+					}
+					last = std::min(last, size - 1);
+					bytesServed += last - first + 1;
+					res->writeStatus("206 Partial Content");
+					res->writeHeader("Content-Range", fmt::format("bytes {}-{}/{}", first, last, size));
+					res->end(std::string_view(this->content).substr(first, last - first + 1));
+				})
+				.listen(0, [this, &listening](auto *socket) {
+					listenSocket = socket;
+					if (socket) {
+						port = us_socket_local_port(0, reinterpret_cast<us_socket_t *>(socket));
+					}
+					listening.set_value();
+				})
+				.run();
+		});
+		ready.wait();
+	}
+
+	~RangeServer()
+	{
+		loop->defer([this] {
+			us_listen_socket_close(0, listenSocket);
+		});
+		thread.join();
+	}
+
+	[[nodiscard]] std::string url(const std::string &file) const
+	{
+		return fmt::format("http://localhost:{}/{}", port, file);
+	}
+};
+
+template<typename T>
+static void Append(std::string &content, const T value)
+{
+	content.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+// a GGUF file of `size` bytes holding a single int8 tensor of random data, so it passes the download verifier
+static std::string MakeContent(const size_t size)
+{
+	std::string content("GGUF");
+	Append<uint32_t>(content, 3);			// version
+	Append<uint64_t>(content, 1);			// tensors
+	Append<uint64_t>(content, 0);			// keys
+	Append<uint64_t>(content, 1);			// name
+	content.push_back('t');
+	Append<uint32_t>(content, 1);			// dimensions
+	const auto dataOffset = GGML_PAD(content.size() + sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t), GGUF_DEFAULT_ALIGNMENT);
+	Append<uint64_t>(content, size - dataOffset);
+	Append<uint32_t>(content, GGML_TYPE_I8);
+	Append<uint64_t>(content, 0);			// offset
+	content.resize(dataOffset, '\0');
+
+	std::mt19937 generator(42);
+	content.reserve(size);
+	while (content.size() < size) {
+		content.push_back(static_cast<char>(generator() & 0xff));
+	}
+	return content;
+}
+
+static std::string ReadFile(const fs::path &path)
+{
+	std::ifstream file(path, std::ios::binary);
+	return { std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+}
+
+TEST(DownloadSegmentsTest, Download)
+{
+	const std::string file{ __FILE__ };
+	const fs::path directory = fs::path(file).parent_path();
+	const auto baseDirectory = directory / fs::path("out");
+	fs::create_directories(baseDirectory);
+	wingman::ItemActionsFactory actionsFactory(baseDirectory);
+	actionsFactory.download()->clear();
+
+	const auto content = MakeContent(4 * wingman::curl::MIN_SEGMENT_BYTES + 12345);
+	RangeServer server(content);
+
+	auto item = wingman::DownloadItem::make("wingman/segments-GGUF", "segments.Q4_0.gguf");
+	item.status = wingman::DownloadItemStatus::downloading;
+	actionsFactory.download()->set(item);
+
+	auto request = wingman::curl::Request{ server.url(item.filePath) };
+	request.file.item = std::make_shared<wingman::DownloadItem>(item);
+	request.file.actions = actionsFactory.download();
+	const auto response = wingman::curl::FetchSegmented(request, 4);
+
+	EXPECT_EQ(response.curlCode, CURLE_OK);
+	const auto saved = actionsFactory.download()->get(item.modelRepo, item.filePath);
+	EXPECT_TRUE(saved);
+	EXPECT_EQ(saved.value().status, wingman::DownloadItemStatus::complete);
+	EXPECT_EQ(saved.value().totalBytes, static_cast<long long>(content.size()));
+	EXPECT_TRUE(saved.value().segments.empty());
+	wingman::Sha256 sha256;
+	sha256.update(content.data(), content.size());
+	EXPECT_EQ(saved.value().sha256, sha256.hexDigest());
+	// the whole file once, plus the byte asked for to learn its size
+	EXPECT_EQ(server.bytesServed, static_cast<long long>(content.size()) + 1);
+
+	const auto path = wingman::orm::DownloadItemActions::getDownloadItemOutputPath(item.modelRepo, item.filePath);
+	EXPECT_TRUE(ReadFile(path) == content);
+
+	fs::remove(path);
+	actionsFactory.download()->clear();
+}
+
+TEST(DownloadSegmentsTest, Resume)
+{
+	const std::string file{ __FILE__ };
+	const fs::path directory = fs::path(file).parent_path();
+	const auto baseDirectory = directory / fs::path("out");
+	fs::create_directories(baseDirectory);
+	wingman::ItemActionsFactory actionsFactory(baseDirectory);
+	actionsFactory.download()->clear();
+
+	const auto totalBytes = 4 * wingman::curl::MIN_SEGMENT_BYTES;
+	const auto content = MakeContent(totalBytes);
+	RangeServer server(content);
+
+	// leave an interrupted download behind, with the first half of every range already on disk
+	auto item = wingman::DownloadItem::make("wingman/segments-GGUF", "segments.Q8_0.gguf");
+	item.status = wingman::DownloadItemStatus::downloading;
+	item.totalBytes = totalBytes;
+	const auto path = wingman::orm::DownloadItemActions::getDownloadItemOutputPath(item.modelRepo, item.filePath);
+	{
+		std::ofstream partial(path, std::ios::binary | std::ios::trunc);
+		const auto length = totalBytes / 4;
+		for (long long start = 0; start < totalBytes; start += length) {
+			item.segments.push_back({ start, start + length - 1, length / 2 });
+			partial.seekp(start);
+			partial.write(content.data() + start, length / 2);
+		}
+	}
+	fs::resize_file(path, totalBytes);
+	actionsFactory.download()->set(item);
+	actionsFactory.download()->reset();
+
+	const auto queued = actionsFactory.download()->getNextQueued();
+	EXPECT_TRUE(queued);
+	EXPECT_EQ(queued.value().segments.size(), 4);
+
+	auto request = wingman::curl::Request{ server.url(item.filePath) };
+	request.file.item = std::make_shared<wingman::DownloadItem>(queued.value());
+	request.file.actions = actionsFactory.download();
+	const auto response = wingman::curl::FetchSegmented(request, 4);
+
+	EXPECT_EQ(response.curlCode, CURLE_OK);
+	const auto saved = actionsFactory.download()->get(item.modelRepo, item.filePath);
+	EXPECT_TRUE(saved);
+	EXPECT_EQ(saved.value().status, wingman::DownloadItemStatus::complete);
+	// the half before the first gap is kept, everything after it is fetched again rather than read back to hash
+	EXPECT_EQ(server.bytesServed, totalBytes - totalBytes / 8 + 1);
+	EXPECT_TRUE(ReadFile(path) == content);
+	// the half already on disk is hashed along with the rest
+	wingman::Sha256 sha256;
+	sha256.update(content.data(), content.size());
+	EXPECT_EQ(saved.value().sha256, sha256.hexDigest());
+
+	fs::remove(path);
+	actionsFactory.download()->clear();
+}
+
+TEST(DownloadSegmentsTest, ResumeAfterCancel)
+{
+	const std::string file{ __FILE__ };
+	const fs::path directory = fs::path(file).parent_path();
+	const auto baseDirectory = directory / fs::path("out");
+	fs::create_directories(baseDirectory);
+	wingman::ItemActionsFactory actionsFactory(baseDirectory);
+	actionsFactory.download()->clear();
+
+	const auto totalBytes = 4 * wingman::curl::MIN_SEGMENT_BYTES;
+	const auto content = MakeContent(totalBytes);
+	RangeServer server(content);
+
+	// a download cancelled two and a half ranges in
+	auto item = wingman::DownloadItem::make("wingman/segments-GGUF", "segments.Q5_K.gguf");
+	item.status = wingman::DownloadItemStatus::cancelled;
+	item.totalBytes = totalBytes;
+	const auto path = wingman::orm::DownloadItemActions::getDownloadItemOutputPath(item.modelRepo, item.filePath);
+	const auto length = totalBytes / 4;
+	const auto downloaded = 2 * length + length / 2;
+	{
+		std::ofstream partial(path, std::ios::binary | std::ios::trunc);
+		for (long long start = 0; start < totalBytes; start += length) {
+			item.segments.push_back({ start, start + length - 1, std::clamp(downloaded - start, 0LL, length) });
+		}
+		partial.write(content.data(), downloaded);
+	}
+	fs::resize_file(path, totalBytes);
+	item.downloadedBytes = downloaded;
+	actionsFactory.download()->set(item);
+
+	// queued again, it keeps where each range stopped
+	const auto enqueued = actionsFactory.download()->enqueue(item.modelRepo, item.filePath);
+	EXPECT_TRUE(enqueued);
+	const auto queued = actionsFactory.download()->getNextQueued();
+	EXPECT_TRUE(queued);
+	EXPECT_EQ(queued.value().status, wingman::DownloadItemStatus::queued);
+	EXPECT_EQ(queued.value().totalBytes, totalBytes);
+	EXPECT_EQ(queued.value().downloadedBytes, downloaded);
+	EXPECT_EQ(queued.value().segments.size(), item.segments.size());
+	for (size_t i = 0; i < item.segments.size() && i < queued.value().segments.size(); i++) {
+		EXPECT_EQ(queued.value().segments[i].start, item.segments[i].start);
+		EXPECT_EQ(queued.value().segments[i].end, item.segments[i].end);
+		EXPECT_EQ(queued.value().segments[i].downloaded, item.segments[i].downloaded);
+	}
+
+	auto request = wingman::curl::Request{ server.url(item.filePath) };
+	request.file.item = std::make_shared<wingman::DownloadItem>(queued.value());
+	request.file.actions = actionsFactory.download();
+	const auto response = wingman::curl::FetchSegmented(request, 4);
+
+	EXPECT_EQ(response.curlCode, CURLE_OK);
+	const auto saved = actionsFactory.download()->get(item.modelRepo, item.filePath);
+	EXPECT_TRUE(saved);
+	EXPECT_EQ(saved.value().status, wingman::DownloadItemStatus::complete);
+	// the file is not truncated, only what was missing is fetched
+	EXPECT_EQ(server.bytesServed, totalBytes - downloaded + 1);
+	EXPECT_TRUE(ReadFile(path) == content);
+
+	fs::remove(path);
+	actionsFactory.download()->clear();
+}
+
+TEST(DownloadSegmentsTest, RejectsCorruptModel)
+{
+	const std::string file{ __FILE__ };
+	const fs::path directory = fs::path(file).parent_path();
+	const auto baseDirectory = directory / fs::path("out");
+	fs::create_directories(baseDirectory);
+	wingman::ItemActionsFactory actionsFactory(baseDirectory);
+	actionsFactory.download()->clear();
+
+	// a tensor that runs past the end of the file
+	auto content = MakeContent(4 * wingman::curl::MIN_SEGMENT_BYTES);
+	content.resize(content.size() - 1000);
+	RangeServer server(content);
+
+	auto item = wingman::DownloadItem::make("wingman/segments-GGUF", "segments.Q2_K.gguf");
+	item.status = wingman::DownloadItemStatus::downloading;
+	actionsFactory.download()->set(item);
+
+	auto request = wingman::curl::Request{ server.url(item.filePath) };
+	request.file.item = std::make_shared<wingman::DownloadItem>(item);
+	request.file.actions = actionsFactory.download();
+	wingman::curl::FetchSegmented(request, 4);
+
+	const auto saved = actionsFactory.download()->get(item.modelRepo, item.filePath);
+	EXPECT_TRUE(saved);
+	EXPECT_EQ(saved.value().status, wingman::DownloadItemStatus::error);
+	EXPECT_FALSE(saved.value().error.empty());
+	EXPECT_TRUE(saved.value().segments.empty());
+	EXPECT_TRUE(saved.value().sha256.empty());
+	const auto path = wingman::orm::DownloadItemActions::getDownloadItemOutputPath(item.modelRepo, item.filePath);
+	EXPECT_FALSE(fs::exists(path));
+
+	actionsFactory.download()->clear();
+}
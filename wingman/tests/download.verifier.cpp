@@ -0,0 +1,115 @@
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+
+#include "ggml.h"
+#include "download.verifier.h"
+
+namespace fs = std::filesystem;
+
+static std::string Sha256Of(const std::string &data, const size_t chunk)
+{
+	wingman::Sha256 sha256;
+	for (size_t i = 0; i < data.size(); i += chunk) {
+		sha256.update(data.data() + i, std::min(chunk, data.size() - i));
+	}
+	return sha256.hexDigest();
+}
+
+// a small GGUF file written by ggml, with string arrays and tensors of a block quantized type
+static std::string MakeGGUF()
+{
+	const std::string file{ __FILE__ };
+	const auto path = fs::path(file).parent_path() / fs::path("out") / "verifier.gguf";
+	fs::create_directories(path.parent_path());
+
+	ggml_init_params params = { 1024 * 1024, nullptr, false };
+	ggml_context *ctx = ggml_init(params);
+	gguf_context *gguf = gguf_init_empty();
+	gguf_set_val_str(gguf, "general.name", "verifier");
+	const char *tokens[] = { "<s>", "</s>", "hello", "world" };
+	gguf_set_arr_str(gguf, "tokenizer.ggml.tokens", tokens, 4);
+	const float scores[] = { 0.0f, 0.0f, -1.0f, -2.0f };
+	gguf_set_arr_data(gguf, "tokenizer.ggml.scores", GGUF_TYPE_FLOAT32, scores, 4);
+
+	ggml_tensor *a = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 64, 3);
+	ggml_set_name(a, "a.weight");
+	ggml_tensor *b = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, 128, 5);
+	ggml_set_name(b, "b.weight");
+	gguf_add_tensor(gguf, a);
+	gguf_add_tensor(gguf, b);
+	gguf_write_to_file(gguf, path.string().c_str(), false);
+	gguf_free(gguf);
+	ggml_free(ctx);
+
+	std::ifstream input(path, std::ios::binary);
+	std::string content{ std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>() };
+	input.close();
+	fs::remove(path);
+	return content;
+}
+
+static std::optional<std::string> Verify(const std::string &content, const size_t chunk, const long long totalBytes, const long long expectedSize = 0)
+{
+	wingman::DownloadVerifier verifier(true, expectedSize);
+	for (size_t i = 0; i < content.size(); i += chunk) {
+		if (!verifier.update(content.data() + i, std::min(chunk, content.size() - i)))
+			break;
+	}
+	return verifier.finish(totalBytes);
+}
+
+TEST(DownloadVerifierTest, Sha256)
+{
+	EXPECT_EQ(Sha256Of("", 1), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	EXPECT_EQ(Sha256Of("abc", 1), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+	const std::string million(1000000, 'a');
+	for (const size_t chunk : { 1, 63, 64, 65, 4096, 1000000 }) {
+		EXPECT_EQ(Sha256Of(million, chunk), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+	}
+}
+
+TEST(DownloadVerifierTest, ValidGGUF)
+{
+	const auto content = MakeGGUF();
+	const auto size = static_cast<long long>(content.size());
+	for (const size_t chunk : std::initializer_list<size_t>{ 1, 7, 33, 4096, content.size() }) {
+		EXPECT_EQ(Verify(content, chunk, size), std::nullopt);
+	}
+
+	wingman::DownloadVerifier verifier(true, size);
+	verifier.update(content.data(), content.size());
+	EXPECT_EQ(verifier.finish(size), std::nullopt);
+	EXPECT_EQ(verifier.getSha256(), Sha256Of(content, 4096));
+}
+
+TEST(DownloadVerifierTest, InvalidGGUF)
+{
+	const auto content = MakeGGUF();
+	const auto size = static_cast<long long>(content.size());
+
+	// tensor data cut short, noticed at the end of the download or as soon as the header is in if the size is known
+	const auto truncated = content.substr(0, content.size() - 100);
+	EXPECT_NE(Verify(truncated, 7, size - 100), std::nullopt);
+	EXPECT_NE(Verify(truncated, 7, size), std::nullopt);
+	wingman::DownloadVerifier early(true, size - 100);
+	EXPECT_FALSE(early.update(content.data(), content.size() / 2));
+	EXPECT_TRUE(early.failed());
+
+	auto corrupt = content;
+	corrupt[0] = 'X';
+	EXPECT_NE(Verify(corrupt, 7, size), std::nullopt);
+
+	// a tensor count far beyond any real model
+	corrupt = content;
+	corrupt[15] = 0x7f;
+	EXPECT_NE(Verify(corrupt, 4096, size), std::nullopt);
+
+	// header cut off before the tensor infos
+	EXPECT_NE(Verify(content.substr(0, 40), 7, 40), std::nullopt);
+
+	// anything goes when the file is not a model, only the size is checked
+	wingman::DownloadVerifier plain(false);
+	plain.update(corrupt.data(), corrupt.size());
+	EXPECT_EQ(plain.finish(size), std::nullopt);
+}
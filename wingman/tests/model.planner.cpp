@@ -0,0 +1,164 @@
+#include <filesystem>
+#include <gtest/gtest.h>
+
+#include "ggml.h"
+#include "model.planner.h"
+
+namespace fs = std::filesystem;
+
+// a two block llama shaped GGUF with grouped query attention, written by ggml without any tensor data worth reading
+static std::string MakeModel(const std::string &name, const bool tiedEmbeddings)
+{
+	const std::string file{ __FILE__ };
+	const auto path = fs::path(file).parent_path() / fs::path("out") / name;
+	fs::create_directories(path.parent_path());
+
+	ggml_init_params params = { 1024 * 1024, nullptr, false };
+	ggml_context *ctx = ggml_init(params);
+	gguf_context *gguf = gguf_init_empty();
+	gguf_set_val_str(gguf, "general.architecture", "llama");
+	gguf_set_val_u32(gguf, "llama.block_count", 2);
+	gguf_set_val_u32(gguf, "llama.context_length", 8192);
+	gguf_set_val_u32(gguf, "llama.embedding_length", 64);
+	gguf_set_val_u32(gguf, "llama.feed_forward_length", 128);
+	gguf_set_val_u32(gguf, "llama.attention.head_count", 4);
+	gguf_set_val_u32(gguf, "llama.attention.head_count_kv", 2);
+	const char *tokens[] = { "<s>", "</s>", "a", "b", "c", "d", "e", "f", "g", "h" };
+	gguf_set_arr_str(gguf, "tokenizer.ggml.tokens", tokens, 10);
+
+	const auto add = [&](const std::string &tensorName, const ggml_type type, const int64_t ne0, const int64_t ne1) {
+		ggml_tensor *t = ggml_new_tensor_2d(ctx, type, ne0, ne1);
+		ggml_set_name(t, tensorName.c_str());
+		gguf_add_tensor(gguf, t);
+	};
+	add("token_embd.weight", GGML_TYPE_F16, 64, 10);
+	for (const std::string block : { "blk.0", "blk.1" }) {
+		add(block + ".attn_q.weight", GGML_TYPE_Q4_0, 64, 64);
+		add(block + ".attn_k.weight", GGML_TYPE_Q4_0, 64, 32);
+		add(block + ".ffn_up.weight", GGML_TYPE_Q8_0, 64, 128);
+		add(block + ".attn_norm.weight", GGML_TYPE_F32, 64, 1);
+	}
+	add("output_norm.weight", GGML_TYPE_F32, 64, 1);
+	if (!tiedEmbeddings)
+		add("output.weight", GGML_TYPE_Q8_0, 64, 10);
+	gguf_write_to_file(gguf, path.string().c_str(), false);
+	gguf_free(gguf);
+	ggml_free(ctx);
+	return path.string();
+}
+
+TEST(ModelPlannerTest, ReadsProfile)
+{
+	const auto path = MakeModel("planner.gguf", false);
+	const auto profile = wingman::ReadModelProfile(path);
+	fs::remove(path);
+	ASSERT_TRUE(profile.has_value());
+	EXPECT_EQ(profile->architecture, "llama");
+	EXPECT_EQ(profile->layerCount, 2);
+	EXPECT_EQ(profile->trainContextSize, 8192);
+	EXPECT_EQ(profile->headCountKv, 2);
+	EXPECT_EQ(profile->keyLength, 16);
+	EXPECT_EQ(profile->vocabSize, 10);
+
+	const uint64_t block = 64 * 64 / 32 * 18 + 32 * 64 / 32 * 18 + 128 * 64 / 32 * 34 + 64 * 4;
+	ASSERT_EQ(profile->layerBytes.size(), 2);
+	EXPECT_EQ(profile->layerBytes[0], block);
+	EXPECT_EQ(profile->layerBytes[1], block);
+	EXPECT_EQ(profile->inputBytes, 64 * 10 * 2);
+	EXPECT_EQ(profile->outputBytes, 64 * 4 + 10 * 64 / 32 * 34);
+	EXPECT_EQ(profile->weightBytes(), 2 * block + 64 * 10 * 2 + 64 * 4 + 10 * 64 / 32 * 34);
+
+	// K and V of 2 heads of 16 per cell, with the context padded to 256 cells
+	EXPECT_EQ(wingman::KvCacheBytesPerLayer(profile.value(), 4096, "f16"), 4096 * 2 * 32 * 2);
+	EXPECT_EQ(wingman::KvCacheBytesPerLayer(profile.value(), 4000, "f16"), 4096 * 2 * 32 * 2);
+	EXPECT_EQ(wingman::KvCacheBytesPerLayer(profile.value(), 4096, "q8_0"), 4096 * 2 * 34);
+	EXPECT_EQ(wingman::KvCacheBytesPerLayer(profile.value(), 4096, "bogus"), 0);
+}
+
+TEST(ModelPlannerTest, TiedEmbeddings)
+{
+	const auto path = MakeModel("planner.tied.gguf", true);
+	const auto profile = wingman::ReadModelProfile(path);
+	fs::remove(path);
+	ASSERT_TRUE(profile.has_value());
+	// the output head is a second copy of the token embeddings
+	EXPECT_EQ(profile->outputBytes, 64 * 4 + 64 * 10 * 2);
+}
+
+TEST(ModelPlannerTest, NotAModel)
+{
+	const std::string file{ __FILE__ };
+	EXPECT_FALSE(wingman::ReadModelProfile(file).has_value());
+	EXPECT_FALSE(wingman::ReadModelProfile("does-not-exist.gguf").has_value());
+}
+
+TEST(ModelPlannerTest, PicksSplit)
+{
+	const auto path = MakeModel("planner.split.gguf", false);
+	const auto profile = wingman::ReadModelProfile(path).value();
+	fs::remove(path);
+
+	wingman::PlanOptions options;
+	options.contextSize = 4096;
+	options.gpuHeadroomBytes = 0;
+
+	// every layer count needs more of the GPU than the one before it, and less of the CPU
+	std::vector<wingman::ModelPlan> fixed;
+	for (int layers = 0; layers <= 3; layers++) {
+		options.gpuLayers = layers;
+		fixed.push_back(wingman::PlanModelFit(profile, options));
+		EXPECT_EQ(fixed.back().gpuLayers, layers);
+		if (layers > 0) {
+			EXPECT_GT(fixed[layers].gpuBytes, fixed[layers - 1].gpuBytes);
+			EXPECT_LT(fixed[layers].cpuBytes, fixed[layers - 1].cpuBytes);
+		}
+	}
+	EXPECT_EQ(fixed[0].gpuBytes, 0);
+	EXPECT_EQ(fixed[3].kvCacheBytes, 2 * wingman::KvCacheBytesPerLayer(profile, 4096, "f16"));
+
+	// the most layers whose GPU need fits, for memory just at and just below each threshold
+	options.gpuLayers = -1;
+	for (int layers = 1; layers <= 3; layers++) {
+		options.gpuBytes = fixed[layers].gpuBytes;
+		EXPECT_EQ(wingman::PlanModelFit(profile, options).gpuLayers, layers);
+		options.gpuBytes = fixed[layers].gpuBytes - 1;
+		EXPECT_EQ(wingman::PlanModelFit(profile, options).gpuLayers, layers - 1);
+	}
+	options.gpuBytes = 0;
+	const auto cpuOnly = wingman::PlanModelFit(profile, options);
+	EXPECT_EQ(cpuOnly.gpuLayers, 0);
+	EXPECT_TRUE(cpuOnly.fitsCpu);
+}
+
+TEST(ModelPlannerTest, PicksContext)
+{
+	const auto path = MakeModel("planner.context.gguf", false);
+	const auto profile = wingman::ReadModelProfile(path).value();
+	fs::remove(path);
+
+	wingman::PlanOptions options;
+	options.gpuHeadroomBytes = 0;
+	options.gpuLayers = 3;
+	options.contextSize = 2048;
+	const auto full2048 = wingman::PlanModelFit(profile, options);
+	options.contextSize = 8192;
+	const auto full8192 = wingman::PlanModelFit(profile, options);
+
+	// the trained context when everything fits, otherwise halved until it does
+	options.gpuLayers = -1;
+	options.contextSize = 0;
+	options.gpuBytes = full8192.gpuBytes;
+	EXPECT_EQ(wingman::PlanModelFit(profile, options).contextSize, 8192);
+	options.gpuBytes = full2048.gpuBytes;
+	auto plan = wingman::PlanModelFit(profile, options);
+	EXPECT_EQ(plan.contextSize, 2048);
+	EXPECT_EQ(plan.gpuLayers, 3);
+
+	// without a GPU the context is only bounded by the CPU
+	options.gpuBytes = 0;
+	EXPECT_EQ(wingman::PlanModelFit(profile, options).contextSize, 8192);
+	options.cpuBytes = wingman::PlanModelFit(profile, options).cpuBytes - 1;
+	plan = wingman::PlanModelFit(profile, options);
+	EXPECT_LT(plan.contextSize, 8192);
+	EXPECT_TRUE(plan.fitsCpu);
+}
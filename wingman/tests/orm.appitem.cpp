@@ -42,3 +42,30 @@ TEST(AppItemTest, Methods)
 	actionsFactory.app()->clear();
 	EXPECT_EQ(actionsFactory.app()->count(), 0);
 }
+
+TEST(AppItemTest, ChangeCounter)
+{
+	const std::string file{ __FILE__ };
+	const fs::path directory = fs::path(file).parent_path();
+	const auto baseDirectory = directory / fs::path("out");
+	fs::create_directories(baseDirectory);
+	wingman::ItemActionsFactory actionsFactory(baseDirectory);
+
+	actionsFactory.app()->clear();
+	const auto before = actionsFactory.changeCounter();
+	EXPECT_EQ(actionsFactory.changeCounter(), before);
+
+	wingman::AppItem item;
+	item.name = "Wingman";
+	item.key = "default";
+	actionsFactory.app()->set(item);
+	const auto afterSet = actionsFactory.changeCounter();
+	EXPECT_NE(afterSet, before);
+
+	// reads do not move the counter
+	actionsFactory.app()->getAll();
+	EXPECT_EQ(actionsFactory.changeCounter(), afterSet);
+
+	actionsFactory.app()->clear();
+	EXPECT_NE(actionsFactory.changeCounter(), afterSet);
+}
@@ -0,0 +1,199 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <gtest/gtest.h>
+#include <fmt/core.h>
+#include "orm.h"
+
+namespace {
+	namespace fs = std::filesystem;
+
+	constexpr int ITERATIONS = 2000;
+
+	fs::path getBaseDirectory()
+	{
+		const std::string file{ __FILE__ };
+		const fs::path directory = fs::path(file).parent_path();
+		const auto baseDirectory = directory / fs::path("out");
+		fs::create_directories(baseDirectory);
+		return baseDirectory;
+	}
+
+	template<typename F>
+	double timeMs(F &&f)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		f();
+		const auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	}
+}
+
+// compares the cached statements used by the actions with preparing a statement for every call
+TEST(OrmBenchmark, GetAndSet)
+{
+	wingman::orm::ItemActionsFactory actionsFactory(getBaseDirectory());
+	const auto actions = actionsFactory.download();
+	actions->clear();
+
+	wingman::DownloadItem item;
+	item.modelRepo = "TheBloke/Xwin-LM-13B-V0.1-GGUF";
+	item.filePath = "xwin-lm-13b-v0.1.Q2_K.gguf";
+	item.status = wingman::DownloadItemStatus::downloading;
+	actions->set(item);
+
+	const auto setMs = timeMs([&] {
+		for (int i = 0; i < ITERATIONS; i++) {
+			item.downloadedBytes = i;
+			actions->set(item);
+		}
+	});
+
+	const auto batchedSetMs = timeMs([&] {
+		auto transaction = actionsFactory.transaction();
+		for (int i = 0; i < ITERATIONS; i++) {
+			item.downloadedBytes = i;
+			actions->set(item);
+		}
+		transaction.commit();
+	});
+
+	const auto getMs = timeMs([&] {
+		for (int i = 0; i < ITERATIONS; i++) {
+			EXPECT_TRUE(actions->get(item.modelRepo, item.filePath));
+		}
+	});
+
+	wingman::orm::sqlite::Database db(actionsFactory.getDbPath());
+	const auto uncachedGetMs = timeMs([&] {
+		for (int i = 0; i < ITERATIONS; i++) {
+			wingman::orm::sqlite::Statement query(db, "SELECT * FROM downloads WHERE modelRepo = $modelRepo AND filePath = $filePath");
+			query.bind("$modelRepo", item.modelRepo);
+			query.bind("$filePath", item.filePath);
+			EXPECT_EQ(query.executeStep(), SQLITE_ROW);
+		}
+	});
+
+	fmt::print("set:            {:8.3f} us/op\n", setMs * 1000 / ITERATIONS);
+	fmt::print("set (batched):  {:8.3f} us/op\n", batchedSetMs * 1000 / ITERATIONS);
+	fmt::print("get:            {:8.3f} us/op\n", getMs * 1000 / ITERATIONS);
+	fmt::print("get (uncached): {:8.3f} us/op\n", uncachedGetMs * 1000 / ITERATIONS);
+
+	const auto stored = actions->get(item.modelRepo, item.filePath);
+	EXPECT_TRUE(stored);
+	EXPECT_EQ(stored.value().downloadedBytes, ITERATIONS - 1);
+	EXPECT_EQ(actions->count(), 1);
+
+	actions->clear();
+	EXPECT_EQ(actions->count(), 0);
+}
+
+// a set() must keep the created time of an existing item
+TEST(OrmBenchmark, UpsertKeepsCreated)
+{
+	wingman::orm::ItemActionsFactory actionsFactory(getBaseDirectory());
+	const auto actions = actionsFactory.app();
+	actions->clear();
+
+	wingman::AppItem item;
+	item.name = "Wingman";
+	item.key = "benchmark";
+	item.created = 1000;
+	actions->set(item);
+
+	item.created = 2000;
+	item.value = "updated";
+	actions->set(item);
+
+	const auto stored = actions->get(item.name, item.key);
+	EXPECT_TRUE(stored);
+	EXPECT_EQ(stored.value().created, 1000);
+	EXPECT_EQ(stored.value().value, "updated");
+	EXPECT_EQ(actions->count(), 1);
+
+	actions->clear();
+}
+
+// writes made on another thread while a transaction is open must wait for it instead of being rolled back with it
+TEST(OrmBenchmark, TransactionExcludesOtherThreads)
+{
+	wingman::orm::ItemActionsFactory actionsFactory(getBaseDirectory());
+	const auto actions = actionsFactory.download();
+	actions->clear();
+
+	wingman::DownloadItem inside;
+	inside.modelRepo = "TheBloke/Xwin-LM-13B-V0.1-GGUF";
+	inside.filePath = "xwin-lm-13b-v0.1.Q2_K.gguf";
+	wingman::DownloadItem outside = inside;
+	outside.filePath = "xwin-lm-13b-v0.1.Q4_K_M.gguf";
+
+	std::atomic<bool> written = false;
+	std::thread writer;
+	{
+		auto transaction = actionsFactory.transaction();
+		actions->set(inside);
+		writer = std::thread([&] {
+			actions->set(outside);
+			written = true;
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		EXPECT_FALSE(written);
+		// not committed, rolled back here
+	}
+	writer.join();
+
+	EXPECT_FALSE(actions->get(inside.modelRepo, inside.filePath));
+	EXPECT_TRUE(actions->get(outside.modelRepo, outside.filePath));
+
+	actions->clear();
+}
+
+// progress updates are queued and written together, a set() of the same item replaces its queued update
+TEST(OrmBenchmark, ProgressIsBatched)
+{
+	wingman::orm::ItemActionsFactory actionsFactory(getBaseDirectory());
+	const auto actions = actionsFactory.download();
+	actions->clear();
+	actions->flushProgress();
+
+	wingman::DownloadItem first;
+	first.modelRepo = "TheBloke/Xwin-LM-13B-V0.1-GGUF";
+	first.filePath = "xwin-lm-13b-v0.1.Q2_K.gguf";
+	first.status = wingman::DownloadItemStatus::downloading;
+	wingman::DownloadItem second = first;
+	second.filePath = "xwin-lm-13b-v0.1.Q4_K_M.gguf";
+
+	first.downloadedBytes = 1;
+	actions->setProgress(first, 3600);
+	second.downloadedBytes = 1;
+	actions->setProgress(second, 3600);
+	EXPECT_FALSE(actions->get(second.modelRepo, second.filePath));
+
+	actions->flushProgress();
+	EXPECT_EQ(actions->get(first.modelRepo, first.filePath).value().downloadedBytes, 1);
+	EXPECT_EQ(actions->get(second.modelRepo, second.filePath).value().downloadedBytes, 1);
+
+	first.downloadedBytes = 2;
+	actions->setProgress(first, 3600);
+	first.downloadedBytes = 3;
+	first.status = wingman::DownloadItemStatus::complete;
+	actions->set(first);
+	actions->flushProgress();
+
+	const auto stored = actions->get(first.modelRepo, first.filePath);
+	EXPECT_EQ(stored.value().downloadedBytes, 3);
+	EXPECT_EQ(stored.value().status, wingman::DownloadItemStatus::complete);
+
+	const auto progressMs = timeMs([&] {
+		for (int i = 0; i < ITERATIONS; i++) {
+			first.downloadedBytes = i;
+			actions->setProgress(first, 3600);
+			second.downloadedBytes = i;
+			actions->setProgress(second, 3600);
+		}
+		actions->flushProgress();
+	});
+	fmt::print("setProgress:    {:8.3f} us/op\n", progressMs * 1000 / (2 * ITERATIONS));
+
+	actions->clear();
+}
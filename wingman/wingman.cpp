@@ -1,8 +1,10 @@
 
 // #define DISABLE_LOGGING 1
 #include <csignal>
+#include <condition_variable>
 #include <iostream>
 #include <queue>
+#include <set>
 // #include <nlohmann/json.hpp>
 
 #include "json.hpp"
@@ -16,6 +18,7 @@
 #include "uwebsockets/Loop.h"
 #include "exceptions.h"
 #include "hwinfo.h"
+#include "model.planner.h"
 
 #define LOG_ERROR(MSG, ...) server_log("ERROR", __func__, __LINE__, MSG, __VA_ARGS__)
 #define LOG_WARNING(MSG, ...) server_log("WARNING", __func__, __LINE__, MSG, __VA_ARGS__)
@@ -63,11 +66,18 @@ namespace wingman {
 	std::mutex inference_mutex;
 
 	constexpr unsigned MAX_PAYLOAD_LENGTH = 256 * 1024;
-	constexpr unsigned MAX_BACKPRESSURE = MAX_PAYLOAD_LENGTH * 512;
+	// a socket this far behind has metrics dropped until it drains, then it is sent the latest of what it missed
+	constexpr unsigned MAX_BACKPRESSURE = MAX_PAYLOAD_LENGTH * 4;
 	// ReSharper disable once CppInconsistentNaming
 	typedef uWS::WebSocket<false, true, PerSocketData>::SendStatus SendStatus;
 
 	uWS::Loop *uws_app_loop = nullptr;
+	uWS::App *uws_app = nullptr;
+
+	// last payload published for each metrics key, only touched from the uWS loop thread
+	static std::map<std::string, std::string> published_metrics;
+	// metrics keys each socket dropped under backpressure, resent from the drain handler
+	static std::map<uWS::WebSocket<false, true, PerSocketData> *, std::set<std::string>> dropped_metrics;
 
 	orm::ItemActionsFactory actions_factory;
 
@@ -104,9 +114,11 @@ namespace wingman {
 					break;
 				}
 			}
+			dropped_metrics.erase(addressOfWs);
 		} else if (action == "clear") {
 			// ws may be a nullptr in this case, so we can't use it
 			websocket_connections.clear();
+			dropped_metrics.clear();
 		}
 	}
 
@@ -115,27 +127,80 @@ namespace wingman {
 		return websocket_connections.size();
 	}
 
-	static void WriteTimingMetricsToFile(const nlohmann::json &metrics, const std::string_view action = "append")
-	{
-		// append the metrics to the timing_metrics.json file
-		const auto outputFile = logs_dir / std::filesystem::path("timing_metrics.json");
+	/**
+	 * \brief appends published metrics to timing_metrics.json from a background thread
+	 *
+	 * Payloads are buffered in memory and written in batches so the uWS loop never waits on the disk.
+	 */
+	class TimingMetricsWriter {
+		static constexpr size_t FLUSH_SIZE = 64 * 1024;
+
+		std::ofstream file;
+		std::string pending;
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool stopping = false;
+		bool empty = true;
+		std::thread thread;
+
+		void run()
+		{
+			std::string buffer;
+			std::unique_lock lock(mutex);
+			while (true) {
+				cv.wait_for(lock, 1s, [this] { return stopping || pending.size() >= FLUSH_SIZE; });
+				buffer.swap(pending);
+				const bool done = stopping;
+				lock.unlock();
+				if (!buffer.empty()) {
+					file << buffer;
+					file.flush();
+					buffer.clear();
+				}
+				if (done)
+					return;
+				lock.lock();
+			}
+		}
 
-		if (action == "restart") {
+	public:
+		void start(const std::filesystem::path &outputFile)
+		{
 			std::filesystem::remove(outputFile);
-			WriteTimingMetricsToFile(metrics, "start");
-			return;
+			file.open(outputFile, std::ios_base::app);
+			pending = "[\n";
+			stopping = false;
+			empty = true;
+			thread = std::thread(&TimingMetricsWriter::run, this);
 		}
 
-		std::ofstream timingMetricsFile(outputFile, std::ios_base::app);
-		if (action == "start") {
-			timingMetricsFile << "[" << std::endl;
-		} else if (action == "stop") {
-			timingMetricsFile << metrics.dump() << "]" << std::endl;
-		} else if (action == "append") {
-			timingMetricsFile << metrics.dump() << "," << std::endl;
+		void append(const std::string_view payload)
+		{
+			std::lock_guard lock(mutex);
+			if (!empty)
+				pending.append(",\n");
+			pending.append(payload);
+			empty = false;
+			if (pending.size() >= FLUSH_SIZE)
+				cv.notify_one();
 		}
-		timingMetricsFile.close();
-	}
+
+		void stop()
+		{
+			if (!thread.joinable())
+				return;
+			{
+				std::lock_guard lock(mutex);
+				pending.append("\n]\n");
+				stopping = true;
+			}
+			cv.notify_one();
+			thread.join();
+			file.close();
+		}
+	};
+
+	static TimingMetricsWriter timing_metrics_writer;
 
 	void EnqueueMetrics(const nlohmann::json &json)
 	{
@@ -145,6 +210,16 @@ namespace wingman {
 
 	void EnqueueAllMetrics()
 	{
+		// the tables are only read again when something has written to them since the last pass
+		static int64_t lastChangeCounter = -1;
+		static std::string lastInferringAlias;
+		const auto changeCounter = actions_factory.changeCounter();
+		if (changeCounter == lastChangeCounter && currentInferringAlias == lastInferringAlias) {
+			return;
+		}
+		lastChangeCounter = changeCounter;
+		lastInferringAlias = currentInferringAlias;
+
 		const auto appItems = actions_factory.app()->getAll();
 		std::vector<AppItem> publicServices;
 
@@ -198,24 +273,19 @@ namespace wingman {
 		});
 	}
 
-	static void SendMetrics(const nlohmann::json &metrics)
+	static void SendMetrics(uWS::WebSocket<false, true, PerSocketData> *ws, const std::string &key, const std::string &payload)
 	{
-		// loop through all the websocket connections and send the timing metrics
-		for (const auto ws : websocket_connections) {
-			const auto bufferedAmount = ws->getBufferedAmount();
-			const auto remoteAddress = ws->getRemoteAddressAsText();
-			try {
-				ws->send(metrics.dump(), uWS::TEXT);
-			} catch (const std::exception &e) {
-				LOG_ERROR("error sending timing metrics to websocket", {
-						  {"remote_address", remoteAddress},
-						  {"buffered_amount", bufferedAmount},
-						  {"exception", e.what()},
-						  });
-			}
+		// a socket over MAX_BACKPRESSURE drops the snapshot, remember it so drain can catch the socket up
+		if (ws->send(payload, uWS::TEXT) == SendStatus::DROPPED) {
+			dropped_metrics[ws].insert(key);
 		}
+	}
 
-		WriteTimingMetricsToFile(metrics);
+	static void PublishMetrics(const std::string &key, const std::string &payload)
+	{
+		for (auto *ws : websocket_connections) {
+			SendMetrics(ws, key, payload);
+		}
 	}
 
 	bool SendServiceStatus(const char *serverName)
@@ -723,6 +793,59 @@ namespace wingman {
 		SendJson(res, info);
 	}
 
+	void RequestModelPlan(uWS::HttpResponse<false> *res, uWS::HttpRequest &req)
+	{
+		const auto modelRepo = std::string(req.getQuery("modelRepo"));
+		const auto filePath = std::string(req.getQuery("filePath"));
+		const auto contextSize = std::string(req.getQuery("contextSize"));
+		const auto batchSize = std::string(req.getQuery("batchSize"));
+		const auto cacheType = std::string(req.getQuery("cacheType"));
+		const auto gpuLayers = std::string(req.getQuery("gpuLayers"));
+
+		WriteResponseHeaders(res);
+		if (modelRepo.empty() || filePath.empty()) {
+			res->writeStatus("422 Invalid or Missing Parameter(s)");
+			res->end();
+			return;
+		}
+		const auto di = actions_factory.download()->get(modelRepo, filePath);
+		if (!di || di.value().status != DownloadItemStatus::complete) {
+			res->writeStatus("404 Not Found");
+			res->end();
+			return;
+		}
+		const auto profile = ReadModelProfile(orm::DownloadItemActions::getDownloadItemOutputPath(modelRepo, filePath));
+		if (!profile) {
+			spdlog::error(" (ModelPlan) Unable to read the model header of {}:{}", modelRepo, filePath);
+			res->writeStatus("500 Internal Server Error");
+			res->end();
+			return;
+		}
+		auto options = GetPlanOptions(GetHardwareInfo());
+		try {
+			if (!contextSize.empty())
+				options.contextSize = std::stoi(contextSize);
+			if (!batchSize.empty())
+				options.batchSize = std::stoi(batchSize);
+			if (!gpuLayers.empty())
+				options.gpuLayers = std::stoi(gpuLayers);
+		} catch (const std::exception &) {
+			res->writeStatus("422 Invalid or Missing Parameter(s)");
+			res->end();
+			return;
+		}
+		if (!cacheType.empty())
+			options.cacheType = cacheType;
+		if (options.batchSize <= 0 || KvCacheBytesPerLayer(profile.value(), 1, options.cacheType) == 0) {
+			res->writeStatus("422 Invalid or Missing Parameter(s)");
+			res->end();
+			return;
+		}
+		const auto plan = PlanModelFit(profile.value(), options);
+		const auto json = nlohmann::json{ { "ModelPlan", plan }, { "ModelProfile", profile.value() } };
+		res->end(json.dump());
+	}
+
 	void RequestShutdown(uWS::HttpResponse<false> *res, uWS::HttpRequest &req)
 	{
 		WriteResponseHeaders(res);
@@ -779,11 +902,35 @@ namespace wingman {
 
 	void DrainMetricsSendQueue()
 	{
-		std::lock_guard lock(metrics_send_queue_mutex);
-		while (!metrics_send_queue.empty()) {
-			const auto metrics = metrics_send_queue.front();
-			metrics_send_queue.pop();
-			SendMetrics(metrics);
+		std::queue<nlohmann::json> queued;
+		{
+			std::lock_guard lock(metrics_send_queue_mutex);
+			std::swap(queued, metrics_send_queue);
+		}
+
+		// every snapshot goes to the timing log, but only the newest of each kind is sent to the sockets
+		std::vector<std::string> keys;
+		std::map<std::string, std::string> latest;
+		while (!queued.empty()) {
+			const auto &metrics = queued.front();
+			auto key = metrics.is_object() && !metrics.empty() ? metrics.begin().key() : std::string();
+			auto payload = metrics.dump();
+			timing_metrics_writer.append(payload);
+			if (!latest.contains(key)) {
+				keys.push_back(key);
+			}
+			latest[key] = std::move(payload);
+			queued.pop();
+		}
+
+		for (const auto &key : keys) {
+			auto &payload = latest[key];
+			auto &published = published_metrics[key];
+			if (payload == published) {
+				continue;
+			}
+			PublishMetrics(key, payload);
+			published = std::move(payload);
 		}
 	}
 
@@ -795,6 +942,7 @@ namespace wingman {
 			{
 				.maxPayloadLength = MAX_PAYLOAD_LENGTH,
 				.maxBackpressure = MAX_BACKPRESSURE,
+				.closeOnBackpressureLimit = false,
 
 				.open = [](auto *ws) {
 					/* Open event here, you may access ws->getUserData() which
@@ -802,6 +950,11 @@ namespace wingman {
 					 */
 					UpdateWebsocketConnections("add", ws);
 
+					// only changes are published, so bring the new connection up to date first
+					for (const auto &[key, payload] : published_metrics) {
+						SendMetrics(ws, key, payload);
+					}
+
 					spdlog::info("New connection from remote address {}. Connection count is {}",
 						ws->getRemoteAddressAsText(), GetWebsocketConnectionCount());
 				},
@@ -825,6 +978,18 @@ namespace wingman {
 					/* Check getBufferedAmount here */
 					spdlog::debug("Buffered amount: {}", ws->getBufferedAmount());
 					spdlog::info("Drain from {}", ws->getRemoteAddressAsText());
+
+					// resend the latest snapshot of each key this socket dropped, once it has room again
+					const auto it = dropped_metrics.find(ws);
+					if (it == dropped_metrics.end() || ws->getBufferedAmount() >= MAX_BACKPRESSURE)
+						return;
+					const auto keys = std::move(it->second);
+					dropped_metrics.erase(it);
+					for (const auto &key : keys) {
+						const auto published = published_metrics.find(key);
+						if (published != published_metrics.end())
+							SendMetrics(ws, key, published->second);
+					}
 				},
 				.close = [](auto *ws, int /*code*/, std::string_view /*message*/) {
 					/* You may access ws->getUserData() here, but sending or
@@ -866,6 +1031,8 @@ namespace wingman {
 						RequestResetInference(res, *req);
 					else if (path == "/api/hardware" || path == "/api/hardwareinfo")
 						RequestHardwareInfo(res, *req);
+					else if (path == "/api/plan")
+						RequestModelPlan(res, *req);
 					else if (path == "/api/shutdown")
 						RequestShutdown(res, *req);
 					else {
@@ -913,7 +1080,7 @@ namespace wingman {
 				auto *loop = reinterpret_cast<struct us_loop_t *>(uWS::Loop::get());
 				const auto usAppMetricsTimer = us_create_timer(loop, 0, 0);
 
-				WriteTimingMetricsToFile({}, "restart");
+				timing_metrics_writer.start(logs_dir / std::filesystem::path("timing_metrics.json"));
 				us_timer_handler = [&](us_timer_t * /*t*/) {
 					// check for shutdown
 					if (requested_shutdown) {
@@ -926,8 +1093,10 @@ namespace wingman {
 				us_timer_set(usAppMetricsTimer, UsTimerCallback, 1000, 1000);
 				/* Every thread has its own Loop, and uWS::Loop::get() returns the Loop for current thread.*/
 				uws_app_loop = uWS::Loop::get();
+				uws_app = &uwsApp;
 				uwsApp.run();
-				WriteTimingMetricsToFile({}, "stop");
+				uws_app = nullptr;
+				timing_metrics_writer.stop();
 	}
 
 	void Start(const int port, const int websocketPort, const int gpuLayers)
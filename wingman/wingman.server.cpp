@@ -1,6 +1,7 @@
 #include "utils.hpp"
 
 #include "common.h"
+#include "ngram-cache.h"
 #include "json-schema-to-grammar.h"
 #include "llama.h"
 #include "grammar-parser.h"
@@ -24,6 +25,10 @@
 #include <chrono>
 #include <condition_variable>
 #include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <unordered_map>
 #include <set>
 #include <mutex>
 #include <thread>
@@ -78,6 +83,11 @@ struct server_task {
 
 	bool infill = false;
 	bool embedding = false;
+
+	// the prompt tokenized when the task is first processed, kept while it is deferred and handed to its slot
+	std::vector<llama_token> prompt_tokens;
+	bool prompt_tokenized = false;
+	bool prompt_add_bos = false; // depends on the system prompt at that time
 };
 
 struct server_task_result {
@@ -133,6 +143,13 @@ struct server_params {
 	bool slots_endpoint = true;
 	bool metrics_endpoint = false;
 	std::string slot_save_path;
+
+	std::string kv_disk_cache_path;
+	size_t kv_disk_cache_size = 4096; // MiB
+
+	float slot_prompt_similarity = 0.5f;
+
+	bool lookup = false;
 };
 
 struct server_slot {
@@ -164,6 +181,9 @@ struct server_slot {
 	// when a task is submitted, we first tokenize the prompt and store it here
 	std::vector<llama_token> prompt_tokens;
 
+	// the prompt as tokenized by process_single_task, taken instead of tokenizing it again
+	std::vector<llama_token> prompt_tokens_task;
+
 	std::string generated_text;
 	std::vector<llama_token> cache_tokens;
 	std::vector<completion_token_output> generated_token_probs;
@@ -202,6 +222,17 @@ struct server_slot {
 
 	double t_prompt_processing; // ms
 	double t_token_generation; // ms
+	double t_sampling = 0.0; // ms
+
+	// speculative decoding, with --model-draft or --lookup
+	int32_t n_draft = 0;					// tokens to draft at the next step, one more than were last accepted
+	int32_t n_drafted = 0;					// drafted for the current task
+	int32_t n_draft_accepted = 0;			// of which the target model sampled the same token
+	std::vector<llama_token> drafted;		// decoded after `sampled` in the current batch
+	std::vector<llama_token> tokens_dft;	// in the draft context for this slot, system prompt included
+	size_t n_past_dft = 0;					// leading tokens_dft known to be the tokens of the slot
+	std::vector<llama_token> tokens_ngram;	// n-grams of which are in ngram_context, system prompt and sampled token included
+	llama_ngram_cache ngram_context;
 
 	void reset()
 	{
@@ -218,8 +249,12 @@ struct server_slot {
 		infill = false;
 		ga_i = 0;
 		n_past_se = 0;
+		t_sampling = 0.0;
+		n_drafted = 0;
+		n_draft_accepted = 0;
 
 		generated_token_probs.clear();
+		drafted.clear();
 	}
 
 	bool has_budget(gpt_params &global_params)
@@ -267,7 +302,7 @@ struct server_slot {
 
 	json get_formated_timings() const
 	{
-		return json{
+		json timings = {
 			{"prompt_n",               n_prompt_tokens_processed},
 			{"prompt_ms",              t_prompt_processing},
 			{"prompt_per_token_ms",    t_prompt_processing / n_prompt_tokens_processed},
@@ -278,6 +313,13 @@ struct server_slot {
 			{"predicted_per_token_ms", t_token_generation / n_decoded},
 			{"predicted_per_second",   1e3 / t_token_generation * n_decoded},
 		};
+
+		if (n_drafted > 0) {
+			timings["drafted_n"]        = n_drafted;
+			timings["draft_accepted_n"] = n_draft_accepted;
+		}
+
+		return timings;
 	}
 
 	size_t find_stopping_strings(const std::string &text, const size_t last_token_size, const stop_type type)
@@ -345,6 +387,18 @@ struct server_slot {
 			{"n_tokens_second",    n_tokens_second},
 		});
 
+		if (n_drafted > 0) {
+			snprintf(buffer, 512, "draft acceptance     = %10.2f %%  / %5d drafted (%5d accepted)",
+					100.0 * n_draft_accepted / n_drafted, n_drafted, n_draft_accepted);
+
+			LOG_INFO(buffer, {
+				{"id_slot",          id},
+				{"id_task",          id_task},
+				{"n_drafted",        n_drafted},
+				{"n_draft_accepted", n_draft_accepted},
+			});
+		}
+
 		snprintf(buffer, 512, "          total time = %10.2f ms", t_prompt_processing + t_token_generation);
 
 		LOG_INFO(buffer, {
@@ -371,6 +425,12 @@ struct server_metrics {
 	uint64_t n_tokens_predicted = 0;
 	uint64_t t_tokens_generation = 0;
 
+	double t_sampling_total = 0.0; // ms
+	double t_sampling = 0.0; // ms
+
+	uint64_t n_drafted_total = 0;
+	uint64_t n_draft_accepted_total = 0;
+
 	void init()
 	{
 		t_start = ggml_time_us();
@@ -390,6 +450,10 @@ struct server_metrics {
 		n_tokens_predicted += slot.n_decoded;
 		t_tokens_generation += slot.t_token_generation;
 		t_tokens_generation_total += slot.t_token_generation;
+		t_sampling += slot.t_sampling;
+		t_sampling_total += slot.t_sampling;
+		n_drafted_total += slot.n_drafted;
+		n_draft_accepted_total += slot.n_draft_accepted;
 	}
 
 	void reset_bucket()
@@ -398,6 +462,7 @@ struct server_metrics {
 		t_prompt_processing = 0;
 		n_tokens_predicted = 0;
 		t_tokens_generation = 0;
+		t_sampling = 0.0;
 	}
 };
 
@@ -505,7 +570,7 @@ struct server_queue {
 					lock.unlock();
 					break;
 				}
-				server_task task = queue_tasks.front();
+				server_task task = std::move(queue_tasks.front());
 				queue_tasks.erase(queue_tasks.begin());
 				lock.unlock();
 				LOG_VERBOSE("callback_new_task", { {"id_task", task.id} });
@@ -660,6 +725,706 @@ struct server_response {
 	}
 };
 
+// radix tree over the cached tokens of all slots
+// used to find the slot whose KV cache holds the longest prefix of a new prompt
+struct server_prefix_cache {
+	struct node {
+		std::vector<llama_token> tokens; // tokens on the edge from the parent
+
+		std::map<llama_token, std::unique_ptr<node>> children;
+
+		// slots whose cached tokens cover the whole edge, a superset of the slots of the children
+		std::set<int> slots;
+	};
+
+	// tokens currently inserted for a slot and the node their path ends on
+	struct entry {
+		std::vector<llama_token> tokens;
+		node *last = nullptr;
+	};
+
+	// what a prompt has in common with the cached tokens of the slots
+	struct match {
+		std::vector<int> slots;	// accepted slots holding the longest prefix of the prompt
+		size_t n = 0;			// length of that prefix
+		size_t n_shared = 0;	// length of the prefix all n_slots slots hold, such as the start of a chat template
+	};
+
+	node root;
+
+	std::map<int, entry> entries;
+
+	void clear()
+	{
+		root.children.clear();
+		entries.clear();
+	}
+
+	// replace the tokens of a slot, they must all be present in the KV cache of the slot
+	// only what follows the tokens already inserted is added, the path of the slot is rebuilt if they changed
+	void update(int id_slot, const std::vector<llama_token> &tokens)
+	{
+		auto it = entries.find(id_slot);
+		if (it != entries.end()) {
+			const std::vector<llama_token> &cur = it->second.tokens;
+			if (cur.size() <= tokens.size() && std::equal(cur.begin(), cur.end(), tokens.begin())) {
+				append(id_slot, tokens);
+				return;
+			}
+
+			remove(id_slot, cur);
+			entries.erase(it);
+		}
+
+		append(id_slot, tokens);
+	}
+
+	// add the tokens of a slot that follow the ones already inserted
+	// the caller guarantees that the slot only appended tokens since it was last updated, nothing is compared
+	void append(int id_slot, const std::vector<llama_token> &tokens)
+	{
+		auto it = entries.find(id_slot);
+		if (it == entries.end()) {
+			if (tokens.empty()) {
+				return;
+			}
+			it = entries.emplace(id_slot, entry{ {}, &root }).first;
+		}
+
+		entry &e = it->second;
+		GGML_ASSERT(e.tokens.size() <= tokens.size());
+
+		const size_t n = e.tokens.size();
+		if (n == tokens.size()) {
+			return;
+		}
+
+		// a leaf only this slot reaches grows in place
+		if (e.last != &root && e.last->children.empty() && e.last->slots.size() == 1) {
+			e.last->tokens.insert(e.last->tokens.end(), tokens.begin() + n, tokens.end());
+		} else {
+			e.last = insert(e.last, id_slot, tokens, n);
+		}
+
+		e.tokens.insert(e.tokens.end(), tokens.begin() + n, tokens.end());
+	}
+
+	// find the longest prefix of tokens cached by a slot accepted by the predicate
+	// returns the slot id and the length of the prefix, or { -1, 0 } if there is none
+	template<typename Pred>
+	std::pair<int, size_t> find(const std::vector<llama_token> &tokens, Pred pred) const
+	{
+		const match m = find_all(tokens, pred, 0);
+		if (m.slots.empty()) {
+			return { -1, 0 };
+		}
+		return { m.slots.front(), m.n };
+	}
+
+	// like find(), but returns every accepted slot holding the longest prefix, out of n_slots slots in all
+	template<typename Pred>
+	match find_all(const std::vector<llama_token> &tokens, Pred pred, size_t n_slots) const
+	{
+		match best;
+
+		const node *cur = &root;
+		size_t n = 0;
+
+		while (n < tokens.size()) {
+			const auto it = cur->children.find(tokens[n]);
+			if (it == cur->children.end()) {
+				break;
+			}
+
+			const node *child = it->second.get();
+
+			std::vector<int> ids;
+			for (int id : child->slots) {
+				if (pred(id)) {
+					ids.push_back(id);
+				}
+			}
+
+			// the slots further down are a subset of these
+			if (ids.empty()) {
+				break;
+			}
+
+			size_t m = 0;
+			while (m < child->tokens.size() && n + m < tokens.size() && child->tokens[m] == tokens[n + m]) {
+				m++;
+			}
+
+			best.slots = std::move(ids);
+			best.n = n + m;
+
+			if (child->slots.size() == n_slots) {
+				best.n_shared = n + m;
+			}
+
+			if (m < child->tokens.size()) {
+				break;
+			}
+
+			n += m;
+			cur = child;
+		}
+
+		return best;
+	}
+
+private:
+	// insert tokens[n:] below cur, where the path of the slot for tokens[:n] ends, and return the node it now ends on
+	node *insert(node *cur, int id_slot, const std::vector<llama_token> &tokens, size_t n)
+	{
+		while (n < tokens.size()) {
+			auto &child = cur->children[tokens[n]];
+			if (!child) {
+				child = std::make_unique<node>();
+				child->tokens.assign(tokens.begin() + n, tokens.end());
+			}
+
+			size_t m = 0;
+			while (m < child->tokens.size() && n + m < tokens.size() && child->tokens[m] == tokens[n + m]) {
+				m++;
+			}
+
+			// split the edge so that the path of every slot ends on a node
+			// the lower half keeps its node, so the paths that end on it are unaffected
+			if (m < child->tokens.size()) {
+				auto head = std::make_unique<node>();
+				head->tokens.assign(child->tokens.begin(), child->tokens.begin() + m);
+				head->slots = child->slots;
+
+				child->tokens.erase(child->tokens.begin(), child->tokens.begin() + m);
+
+				const llama_token next = child->tokens[0];
+				head->children[next] = std::move(child);
+				child = std::move(head);
+			}
+
+			child->slots.insert(id_slot);
+
+			n += m;
+			cur = child.get();
+		}
+
+		return cur;
+	}
+
+	void remove(int id_slot, const std::vector<llama_token> &tokens)
+	{
+		node *cur = &root;
+		size_t n = 0;
+
+		while (n < tokens.size()) {
+			auto it = cur->children.find(tokens[n]);
+			GGML_ASSERT(it != cur->children.end());
+
+			node *child = it->second.get();
+			child->slots.erase(id_slot);
+
+			n += child->tokens.size();
+
+			// no other slot passes through here, drop the whole subtree
+			if (child->slots.empty()) {
+				cur->children.erase(it);
+				break;
+			}
+
+			cur = child;
+		}
+	}
+};
+
+// parsed grammars of recent requests, shared by the slots
+// a "json_schema" or "grammar" seen before skips json_schema_to_grammar and grammar_parser::parse
+struct server_grammar_cache {
+	struct entry {
+		std::string source; // the schema or grammar text, to rule out hash collisions
+		std::string grammar;
+		grammar_parser::parse_state parsed_grammar;
+		uint64_t t_last_used;
+	};
+
+	size_t n_max = 64;
+
+	uint64_t n_hit = 0;
+	uint64_t n_miss = 0;
+
+	// keyed by the hash of the source
+	std::unordered_map<size_t, entry> entries;
+
+	uint64_t n_used = 0;
+
+	// returns the entry of source, converting it with to_grammar on a miss
+	// exceptions of to_grammar are passed on and nothing is cached
+	const entry &get(const std::string &source, const std::function<std::string()> &to_grammar)
+	{
+		const size_t hash = std::hash<std::string>{}(source);
+
+		auto it = entries.find(hash);
+		if (it != entries.end() && it->second.source == source) {
+			n_hit++;
+			it->second.t_last_used = ++n_used;
+			return it->second;
+		}
+
+		n_miss++;
+
+		entry e;
+		e.source = source;
+		e.grammar = to_grammar();
+		// an invalid grammar is cached as well, it leaves parsed_grammar empty and fails the same way
+		e.parsed_grammar = grammar_parser::parse(e.grammar.c_str());
+		e.t_last_used = ++n_used;
+
+		if (it != entries.end()) {
+			it->second = std::move(e);
+			return it->second;
+		}
+
+		if (entries.size() >= n_max) {
+			auto lru = entries.begin();
+			for (auto cur = entries.begin(); cur != entries.end(); ++cur) {
+				if (cur->second.t_last_used < lru->second.t_last_used) {
+					lru = cur;
+				}
+			}
+			entries.erase(lru);
+		}
+
+		return entries.emplace(hash, std::move(e)).first->second;
+	}
+};
+
+// on-disk tier for the KV cache of evicted slots
+// a slot whose cached tokens are about to be dropped is saved under the hash of the system prompt and its tokens,
+// a later prompt starting with the same tokens restores it instead of evaluating them
+// the sequence is serialized in update_slots and written to disk by a background thread in the llama_state_seq_save_file
+// format, until the write completes a load restores it from the serialized buffer
+struct server_kv_disk_cache {
+	// a serialized sequence waiting for the writer thread
+	struct write_job {
+		std::string filepath;
+		std::vector<llama_token> tokens;
+		std::vector<uint8_t> state; // freed by the writer once it is done, under the cache mutex
+
+		std::atomic<bool> done    { false };
+		std::atomic<bool> failed  { false };
+		std::atomic<bool> dropped { false }; // evicted before it was written, the writer removes the file
+	};
+
+	struct entry {
+		std::string filepath;
+		size_t  n_tokens;
+		size_t  n_cells; // KV cells the sequence occupies once restored
+		size_t  n_bytes;
+		int64_t t_last_used;
+
+		std::shared_ptr<write_job> pending; // reset once the file is written
+	};
+
+	std::string path; // empty when disabled
+	size_t size_max = 0;
+	size_t size = 0;
+
+	// sequences shorter than this are cheaper to evaluate again than to save
+	size_t n_tokens_min = 64;
+
+	// serialized bytes the writer may lag behind, a store beyond that is skipped unless nothing is pending
+	size_t pending_max = 1024ull * 1024 * 1024;
+
+	// sequences per KV cell, the system prompt and one per slot
+	int32_t n_seq_max = 1;
+
+	// keyed by the hash of the system tokens followed by the slot tokens
+	std::map<uint64_t, entry> entries;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::deque<std::shared_ptr<write_job>> queue;
+	size_t n_bytes_pending = 0;
+	bool stop = false;
+
+	~server_kv_disk_cache()
+	{
+		if (writer.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stop = true;
+			}
+			condition.notify_one();
+			writer.join();
+		}
+	}
+
+	bool enabled() const
+	{
+		return !path.empty();
+	}
+
+	bool init(const std::string &path_, size_t size_max_, int32_t n_seq_max_)
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(path_, ec);
+		if (ec) {
+			LOG_ERROR("unable to create the KV disk cache directory", {
+				{"path",  path_},
+				{"error", ec.message()}
+			});
+			return false;
+		}
+
+		// the saved states depend on the model and context parameters, do not reuse the ones of a previous run
+		for (const auto &file : std::filesystem::directory_iterator(path_, ec)) {
+			if (file.path().extension() == ".kvc" || file.path().extension() == ".part") {
+				std::filesystem::remove(file.path(), ec);
+			}
+		}
+
+		// every store would fail in the writer thread, check that the directory can be written to
+		const std::string probe = (std::filesystem::path(path_) / "probe.part").string();
+		FILE *fp = fopen(probe.c_str(), "wb");
+		if (fp == nullptr) {
+			LOG_ERROR("unable to write to the KV disk cache directory", {
+				{"path", path_}
+			});
+			return false;
+		}
+		fclose(fp);
+		std::filesystem::remove(probe, ec);
+
+		path = path_;
+		size_max = size_max_;
+		n_seq_max = n_seq_max_;
+
+		writer = std::thread([this]() { write_loop(); });
+
+		LOG_INFO("KV disk cache enabled", {
+			{"path",     path},
+			{"size_max", size_max}
+		});
+
+		return true;
+	}
+
+	void write_loop()
+	{
+		while (true) {
+			std::shared_ptr<write_job> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [this]() { return stop || !queue.empty(); });
+				if (stop) {
+					return;
+				}
+				job = queue.front();
+				queue.pop_front();
+			}
+
+			if (!job->dropped) {
+				job->failed = !write_file(*job);
+			}
+
+			{
+				// a load reads the file from now on, the serialized state is not needed until the entry is reaped
+				std::lock_guard<std::mutex> lock(mutex);
+				n_bytes_pending -= job->state.size();
+				std::vector<uint8_t>().swap(job->state);
+				job->done = true;
+			}
+
+			// dropped is set before the file is removed, whichever side comes last removes it
+			if (job->dropped) {
+				std::error_code ec;
+				std::filesystem::remove(job->filepath, ec);
+			}
+		}
+	}
+
+	// same layout as llama_state_seq_save_file, written next to the target and renamed so a load never sees half a file
+	static bool write_file(const write_job &job)
+	{
+		const std::string filepath_part = job.filepath + ".part";
+
+		FILE *fp = fopen(filepath_part.c_str(), "wb");
+		if (fp == nullptr) {
+			return false;
+		}
+
+		const uint32_t header[3] = { LLAMA_STATE_SEQ_MAGIC, LLAMA_STATE_SEQ_VERSION, (uint32_t)job.tokens.size() };
+
+		bool ok = fwrite(header, sizeof(header), 1, fp) == 1;
+		ok = ok && fwrite(job.tokens.data(), sizeof(llama_token), job.tokens.size(), fp) == job.tokens.size();
+		ok = ok && fwrite(job.state.data(), 1, job.state.size(), fp) == job.state.size();
+		ok = (fclose(fp) == 0) && ok;
+
+		std::error_code ec;
+		if (ok) {
+			std::filesystem::rename(filepath_part, job.filepath, ec);
+			ok = !ec;
+		}
+		if (!ok) {
+			std::filesystem::remove(filepath_part, ec);
+		}
+
+		return ok;
+	}
+
+	// number of cells holding seq_id, and the longest run of cells that would be free once seq_id is removed
+	void count_cells(const llama_context *ctx, llama_seq_id seq_id, size_t &n_cells, size_t &n_room) const
+	{
+		llama_kv_cache_view view = llama_kv_cache_view_init(ctx, n_seq_max);
+		llama_kv_cache_view_update(ctx, &view);
+
+		n_cells = 0;
+		n_room = 0;
+
+		size_t n_run = 0;
+		for (int32_t i = 0; i < view.n_cells; ++i) {
+			const llama_seq_id *seqs = view.cells_sequences + (size_t)i * view.n_seq_max;
+
+			bool has_seq = false;
+			bool has_other = false;
+			for (int32_t s = 0; s < view.n_seq_max && seqs[s] >= 0; ++s) {
+				has_seq = has_seq || seqs[s] == seq_id;
+				has_other = has_other || seqs[s] != seq_id;
+			}
+
+			n_cells += has_seq;
+			n_run = has_other ? 0 : n_run + 1;
+			n_room = std::max(n_room, n_run);
+		}
+
+		llama_kv_cache_view_free(&view);
+	}
+
+	// drop the entries whose file has been written, or failed to be
+	void reap()
+	{
+		for (auto it = entries.begin(); it != entries.end();) {
+			const auto &job = it->second.pending;
+			if (job && job->done) {
+				if (job->failed) {
+					LOG_WARNING("failed to save sequence to the KV disk cache", {
+						{"filepath", it->second.filepath}
+					});
+
+					size -= it->second.n_bytes;
+					it = entries.erase(it);
+					continue;
+				}
+				it->second.pending.reset();
+			}
+			++it;
+		}
+	}
+
+	void erase(std::map<uint64_t, entry>::iterator it)
+	{
+		if (it->second.pending) {
+			it->second.pending->dropped = true;
+		}
+
+		std::error_code ec;
+		std::filesystem::remove(it->second.filepath, ec);
+
+		size -= it->second.n_bytes;
+		entries.erase(it);
+	}
+
+	// FNV-1a, hashes[i] is the hash of the system tokens followed by the first i tokens
+	static std::vector<uint64_t> prefix_hashes(const std::vector<llama_token> &system_tokens, const std::vector<llama_token> &tokens)
+	{
+		uint64_t h = 0xcbf29ce484222325ULL;
+
+		const auto add = [&h](llama_token token) {
+			for (size_t i = 0; i < sizeof(token); ++i) {
+				h ^= (uint64_t)(((uint32_t)token >> (8 * i)) & 0xff);
+				h *= 0x100000001b3ULL;
+			}
+		};
+
+		for (llama_token token : system_tokens) {
+			add(token);
+		}
+
+		std::vector<uint64_t> hashes(tokens.size() + 1);
+		hashes[0] = h;
+		for (size_t i = 0; i < tokens.size(); ++i) {
+			add(tokens[i]);
+			hashes[i + 1] = h;
+		}
+
+		return hashes;
+	}
+
+	// serialize the sequence holding the given tokens and queue it for writing,
+	// evicting the least recently used entries to stay within size_max
+	void store(llama_context *ctx, llama_seq_id seq_id, const std::vector<llama_token> &system_tokens, const std::vector<llama_token> &tokens)
+	{
+		if (tokens.size() < n_tokens_min) {
+			return;
+		}
+
+		reap();
+
+		const uint64_t key = prefix_hashes(system_tokens, tokens).back();
+
+		auto it = entries.find(key);
+		if (it != entries.end()) {
+			it->second.t_last_used = ggml_time_us();
+			return;
+		}
+
+		const size_t n_state = llama_state_seq_get_size(ctx, seq_id);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (n_bytes_pending > 0 && n_bytes_pending + n_state > pending_max) {
+				LOG_VERBOSE("KV disk cache writer is behind, not saving sequence", {
+					{"seq_id",          seq_id},
+					{"n_bytes_pending", n_bytes_pending}
+				});
+				return;
+			}
+		}
+
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.kvc", (unsigned long long)key);
+
+		const int64_t t_start = ggml_time_us();
+
+		auto job = std::make_shared<write_job>();
+		job->filepath = (std::filesystem::path(path) / name).string();
+		job->tokens = tokens;
+		job->state.resize(n_state);
+		job->state.resize(llama_state_seq_get_data(ctx, job->state.data(), seq_id));
+
+		size_t n_cells = 0;
+		size_t n_room = 0;
+		count_cells(ctx, seq_id, n_cells, n_room);
+
+		const size_t n_bytes = 3 * sizeof(uint32_t) + tokens.size() * sizeof(llama_token) + job->state.size();
+
+		entries[key] = { job->filepath, tokens.size(), n_cells, n_bytes, ggml_time_us(), job };
+		size += n_bytes;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			n_bytes_pending += job->state.size();
+			queue.push_back(job);
+		}
+		condition.notify_one();
+
+		LOG_VERBOSE("KV disk cache store", {
+			{"seq_id",   seq_id},
+			{"n_tokens", tokens.size()},
+			{"n_bytes",  n_bytes},
+			{"t_ms",     (ggml_time_us() - t_start) / 1e3}
+		});
+
+		while (size > size_max && !entries.empty()) {
+			auto lru = entries.begin();
+			for (auto e = entries.begin(); e != entries.end(); ++e) {
+				if (e->second.t_last_used < lru->second.t_last_used) {
+					lru = e;
+				}
+			}
+
+			erase(lru);
+		}
+	}
+
+	// restore the longest cached prefix of tokens longer than n_min into seq_id
+	// returns the number of restored tokens, 0 if there is no such entry or no room for it in the KV cache
+	// or -1 if the entry could not be loaded, in which case the sequence has been wiped
+	int32_t load(llama_context *ctx, llama_seq_id seq_id, const std::vector<llama_token> &system_tokens, const std::vector<llama_token> &tokens, size_t n_min, std::vector<llama_token> &tokens_out)
+	{
+		reap();
+
+		const std::vector<uint64_t> hashes = prefix_hashes(system_tokens, tokens);
+
+		auto best = entries.end();
+		for (auto it = entries.begin(); it != entries.end(); ++it) {
+			const size_t n = it->second.n_tokens;
+			if (n > n_min && n <= tokens.size() && hashes[n] == it->first && (best == entries.end() || n > best->second.n_tokens)) {
+				best = it;
+			}
+		}
+
+		if (best == entries.end()) {
+			return 0;
+		}
+
+		// restoring wipes the sequence and needs its cells in one contiguous run, a fragmented cache is not the
+		// entry's fault, keep it and let the prompt be evaluated
+		size_t n_cells = 0;
+		size_t n_room = 0;
+		count_cells(ctx, seq_id, n_cells, n_room);
+		if (n_room < best->second.n_cells) {
+			LOG_VERBOSE("no room in the KV cache to restore sequence from disk", {
+				{"seq_id",  seq_id},
+				{"n_cells", best->second.n_cells},
+				{"n_room",  n_room}
+			});
+			return 0;
+		}
+
+		const int64_t t_start = ggml_time_us();
+
+		size_t n_read = 0;
+		size_t n_bytes = 0;
+
+		bool from_memory = false;
+
+		const auto job = best->second.pending;
+		if (job) {
+			// still being written, the serialized state is in memory until the writer is done with it
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!job->done) {
+				tokens_out = job->tokens;
+				n_read = tokens_out.size();
+				n_bytes = llama_state_seq_set_data(ctx, job->state.data(), seq_id);
+				from_memory = true;
+			}
+		}
+
+		if (!from_memory) {
+			tokens_out.resize(best->second.n_tokens);
+			n_bytes = llama_state_seq_load_file(ctx, best->second.filepath.c_str(), seq_id, tokens_out.data(), tokens_out.size(), &n_read);
+		}
+
+		// guard against hash collisions and files removed behind our back
+		if (n_bytes == 0 || n_read != best->second.n_tokens || !std::equal(tokens_out.begin(), tokens_out.end(), tokens.begin())) {
+			LOG_WARNING("failed to load sequence from the KV disk cache", {
+				{"seq_id",   seq_id},
+				{"filepath", best->second.filepath}
+			});
+
+			erase(best);
+
+			llama_kv_cache_seq_rm(ctx, seq_id, -1, -1);
+			tokens_out.clear();
+
+			return -1;
+		}
+
+		best->second.t_last_used = ggml_time_us();
+
+		LOG_VERBOSE("KV disk cache load", {
+			{"seq_id",   seq_id},
+			{"n_tokens", n_read},
+			{"n_bytes",  n_bytes},
+			{"pending",  from_memory},
+			{"t_ms",     (ggml_time_us() - t_start) / 1e3}
+		});
+
+		return (int32_t)n_read;
+	}
+};
+
 struct server_context {
 	llama_model *model = nullptr;
 	llama_context *ctx = nullptr;
@@ -686,13 +1451,54 @@ struct server_context {
 	std::vector<server_slot> slots;
 	json default_generation_settings_for_props;
 
+	// prefixes of the prompts cached by the slots, see slot_tokens_changed()
+	server_prefix_cache prefix_cache;
+
+	// share of a prompt a slot must already hold for the prompt to be routed to it, 0 routes by LRU only
+	float slot_prompt_similarity = 0.5f;
+
+	// evicted slots, enabled with --kv-disk-cache
+	server_kv_disk_cache kv_disk_cache;
+
+	server_grammar_cache grammar_cache;
+
 	server_queue    queue_tasks;
 	server_response queue_results;
 
 	server_metrics metrics;
 
+	// samples the slots of a batch in parallel, only created with more than one slot
+	std::unique_ptr<httplib::ThreadPool> sampling_pool;
+
+	// draft model for speculative decoding, loaded with --model-draft
+	// each slot uses the same sequence in the draft context as in the target one
+	llama_model *model_dft = nullptr;
+	llama_context *ctx_dft = nullptr;
+	llama_batch batch_dft = {};
+	bool loading_draft = false;
+
+	// prompt lookup decoding, enabled with --lookup: each slot drafts from the n-grams of its own tokens
+	bool lookup = false;
+	llama_ngram_cache ngram_cache_static;	// from --lookup-cache-static, never updated
+	llama_ngram_cache ngram_cache_dynamic;	// not kept by the server, always empty
+
 	~server_context()
 	{
+		if (sampling_pool) {
+			sampling_pool->shutdown();
+		}
+
+		if (ctx_dft) {
+			llama_batch_free(batch_dft);
+			llama_free(ctx_dft);
+			ctx_dft = nullptr;
+		}
+
+		if (model_dft) {
+			llama_free_model(model_dft);
+			model_dft = nullptr;
+		}
+
 		if (ctx) {
 			llama_free(ctx);
 			ctx = nullptr;
@@ -723,6 +1529,115 @@ struct server_context {
 		add_bos_token = llama_should_add_bos_token(model);
 		GGML_ASSERT(llama_add_eos_token(model) != 1);
 
+		if (!params.model_draft.empty() && !load_draft_model()) {
+			return false;
+		}
+
+		if (lookup && !params.lookup_cache_static.empty() && !load_lookup_cache_static()) {
+			return false;
+		}
+
+		return true;
+	}
+
+	bool load_draft_model()
+	{
+		gpt_params params_dft = params;
+		params_dft.model = params.model_draft;
+		params_dft.model_url = "";
+		params_dft.hf_repo = "";
+		params_dft.hf_file = "";
+		params_dft.n_gpu_layers = params.n_gpu_layers_draft;
+		params_dft.lora_adapter.clear();
+		params_dft.control_vectors.clear();
+		params_dft.n_parallel += 1;
+
+		loading_draft = true;
+		std::tie(model_dft, ctx_dft) = llama_init_from_gpt_params(params_dft);
+		loading_draft = false;
+
+		if (model_dft == nullptr) {
+			LOG_ERROR("unable to load draft model", { {"model", params.model_draft} });
+			return false;
+		}
+
+		if (!draft_vocab_matches()) {
+			llama_free(ctx_dft);
+			llama_free_model(model_dft);
+			ctx_dft = nullptr;
+			model_dft = nullptr;
+			return false;
+		}
+
+		batch_dft = llama_batch_init(llama_n_batch(ctx_dft), 0, 1);
+
+		LOG_INFO("loaded draft model", {
+			{"model",   params.model_draft},
+			{"n_draft", params.n_draft}
+		});
+
+		return true;
+	}
+
+	bool load_lookup_cache_static()
+	{
+		try {
+			ngram_cache_static = llama_ngram_cache_load(params.lookup_cache_static);
+		} catch (const std::ifstream::failure &) {
+			LOG_ERROR("unable to load static lookup cache", { {"path", params.lookup_cache_static} });
+			return false;
+		}
+
+		LOG_INFO("loaded static lookup cache", {
+			{"path",     params.lookup_cache_static},
+			{"n_ngrams", ngram_cache_static.size()}
+		});
+
+		return true;
+	}
+
+	// drafted tokens are only useful when both models give the same ids to the same text
+	bool draft_vocab_matches() const
+	{
+		if (llama_vocab_type(model) != llama_vocab_type(model_dft)) {
+			LOG_ERROR("draft model vocab type does not match the model", {
+				{"vocab_type",     llama_vocab_type(model)},
+				{"vocab_type_dft", llama_vocab_type(model_dft)}
+			});
+			return false;
+		}
+
+		if (llama_add_bos_token(model) != llama_add_bos_token(model_dft) ||
+			llama_add_eos_token(model) != llama_add_eos_token(model_dft) ||
+			llama_token_bos(model) != llama_token_bos(model_dft) ||
+			llama_token_eos(model) != llama_token_eos(model_dft)) {
+			LOG_ERROR("draft model special tokens do not match the model", {});
+			return false;
+		}
+
+		const int n_vocab = llama_n_vocab(model);
+		const int n_vocab_dft = llama_n_vocab(model_dft);
+
+		// same limits as examples/speculative
+		if (std::abs(n_vocab - n_vocab_dft) > 100) {
+			LOG_ERROR("draft model vocab size is too different from the model", {
+				{"n_vocab",     n_vocab},
+				{"n_vocab_dft", n_vocab_dft}
+			});
+			return false;
+		}
+
+		for (int i = 5; i < std::min(n_vocab, n_vocab_dft); ++i) {
+			if (std::strcmp(llama_token_get_text(model, i), llama_token_get_text(model_dft, i)) != 0) {
+				LOG_ERROR("draft model vocab does not match the model", {
+					{"token",    i},
+					{"text",     llama_token_get_text(model, i)},
+					{"text_dft", llama_token_get_text(model_dft, i)}
+				});
+				return false;
+			}
+		}
+
 		return true;
 	}
 
@@ -790,6 +1705,14 @@ struct server_context {
 			batch = llama_batch_init(n_batch, 0, 1);
 		}
 
+		// the main loop samples one slot itself, the workers take the others
+		{
+			const int32_t n_workers = std::min(params.n_parallel, (int32_t)std::thread::hardware_concurrency()) - 1;
+			if (n_workers > 0) {
+				sampling_pool = std::make_unique<httplib::ThreadPool>(n_workers);
+			}
+		}
+
 		metrics.init();
 	}
 
@@ -835,7 +1758,7 @@ struct server_context {
 		return prompt_tokens;
 	}
 
-	server_slot *get_slot(int id)
+	server_slot *get_slot(int id, const std::vector<llama_token> &prompt_tokens = {})
 	{
 		int64_t t_last = ggml_time_us();
 
@@ -845,7 +1768,36 @@ struct server_context {
 			if (slot.id == id && slot.available()) {
 				return &slot;
 			}
+		}
 
+		// prefer the available slot that already holds the longest prefix of the prompt, when that prefix is more than
+		// what every slot holds (a BOS or the start of a chat template) and at least slot_prompt_similarity of the prompt
+		if (!prompt_tokens.empty() && slot_prompt_similarity > 0.0f) {
+			const auto match = prefix_cache.find_all(prompt_tokens, [this](int id_slot) {
+				return slots[id_slot].available();
+			}, slots.size());
+
+			if (!match.slots.empty() && match.n > match.n_shared &&
+				match.n >= slot_prompt_similarity * prompt_tokens.size()) {
+				// the least recently used of the slots holding it, equal prefixes are spread over them
+				server_slot *best = nullptr;
+				for (int id_slot : match.slots) {
+					if (best == nullptr || slots[id_slot].t_last_used < best->t_last_used) {
+						best = &slots[id_slot];
+					}
+				}
+
+				LOG_VERBOSE("selected slot by prefix", {
+					{"id_slot",  best->id},
+					{"n_prefix", match.n},
+					{"n_shared", match.n_shared}
+				});
+
+				return best;
+			}
+		}
+
+		for (server_slot &slot : slots) {
 			// among all available slots, find the one that has been least recently used
 			if (slot.available() && slot.t_last_used < t_last) {
 				last_used = &slot;
@@ -896,19 +1848,30 @@ struct server_context {
 		slot.sparams.min_keep = json_value(data, "min_keep", default_sparams.min_keep);
 
 		// process "json_schema" and "grammar"
+		const grammar_parser::parse_state *parsed_grammar = nullptr;
 		if (data.contains("json_schema") && !data["json_schema"].is_null() && data.contains("grammar") && !data["grammar"].is_null()) {
 			send_error(task, "Either \"json_schema\" or \"grammar\" can be specified, but not both", ERROR_TYPE_INVALID_REQUEST);
 			return false;
 		} else if (data.contains("json_schema") && !data.contains("grammar")) {
 			try {
 				auto schema = json_value(data, "json_schema", json::object());
-				slot.sparams.grammar = json_schema_to_grammar(schema);
+				const auto &cached = grammar_cache.get("json_schema:" + schema.dump(), [&schema]() {
+					return json_schema_to_grammar(schema);
+				});
+				slot.sparams.grammar = cached.grammar;
+				parsed_grammar = &cached.parsed_grammar;
 			} catch (const std::exception &e) {
 				send_error(task, std::string("\"json_schema\": ") + e.what(), ERROR_TYPE_INVALID_REQUEST);
 				return false;
 			}
 		} else {
 			slot.sparams.grammar = json_value(data, "grammar", default_sparams.grammar);
+			if (!slot.sparams.grammar.empty()) {
+				const auto &cached = grammar_cache.get("grammar:" + slot.sparams.grammar, [&slot]() {
+					return slot.sparams.grammar;
+				});
+				parsed_grammar = &cached.parsed_grammar;
+			}
 		}
 
 		if (slot.params.cache_prompt && slot.ga_n != 1) {
@@ -1058,7 +2021,7 @@ struct server_context {
 			if (slot.ctx_sampling != nullptr) {
 				llama_sampling_free(slot.ctx_sampling);
 			}
-			slot.ctx_sampling = llama_sampling_init(slot.sparams);
+			slot.ctx_sampling = parsed_grammar ? llama_sampling_init(slot.sparams, *parsed_grammar) : llama_sampling_init(slot.sparams);
 			if (slot.ctx_sampling == nullptr) {
 				// for now, the only error that may happen here is invalid grammar
 				send_error(task, "Failed to parse grammar", ERROR_TYPE_INVALID_REQUEST);
@@ -1068,6 +2031,7 @@ struct server_context {
 
 		slot.command = SLOT_COMMAND_LOAD_PROMPT;
 		slot.prompt_tokens.clear();
+		slot.prompt_tokens_task.clear();
 
 		LOG_INFO("slot is processing task", {
 			{"id_slot", slot.id},
@@ -1084,6 +2048,106 @@ struct server_context {
 		// clear the entire KV cache
 		llama_kv_cache_clear(ctx);
 		clean_kv_cache = false;
+
+		// nothing the slots evaluated is left in the cache; the system prompt of what the draft context holds is about
+		// to change too
+		for (server_slot &slot : slots) {
+			slot.cache_tokens.clear();
+			slot.tokens_dft.clear();
+			slot.n_past_dft = 0;
+			slot.tokens_ngram.clear();
+			slot.ngram_context.clear();
+		}
+		prefix_cache.clear();
+	}
+
+	bool speculative() const
+	{
+		return ctx_dft != nullptr || lookup;
+	}
+
+	// whether slot.cache_tokens follows the tokens of the slot: always needed to draft for it
+	bool slot_keeps_tokens(const server_slot &slot) const
+	{
+		return slot.params.cache_prompt || (speculative() && slot.ga_n == 1);
+	}
+
+	// token `i` of the slot, counting the system prompt
+	llama_token slot_token(const server_slot &slot, size_t i) const
+	{
+		return i < system_tokens.size() ? system_tokens[i] : slot.cache_tokens[i - system_tokens.size()];
+	}
+
+	// how many leading tokens of the slot, counting the system prompt, are the same as those of `tokens`
+	size_t slot_common_part(const server_slot &slot, const std::vector<llama_token> &tokens) const
+	{
+		const size_t n_tokens = system_tokens.size() + slot.cache_tokens.size();
+		size_t n = 0;
+		while (n < tokens.size() && n < n_tokens && tokens[n] == slot_token(slot, n)) {
+			n++;
+		}
+		return n;
+	}
+
+	// make the prefix cache, the draft context and the n-grams reflect the tokens of the slot, after a change other
+	// than appending; what they have in common with the tokens before the change is kept
+	// must only be called when all of slot.cache_tokens have been evaluated
+	void slot_tokens_changed(server_slot &slot)
+	{
+		prefix_cache.update(slot.id, slot.cache_tokens);
+
+		slot.n_past_dft = slot_common_part(slot, slot.tokens_dft);
+		slot.tokens_dft.resize(slot.n_past_dft);
+
+		if (lookup) {
+			ngram_truncate(slot, slot_common_part(slot, slot.tokens_ngram));
+			for (size_t i = slot.tokens_ngram.size(); i < system_tokens.size() + slot.cache_tokens.size(); i++) {
+				ngram_append(slot, slot_token(slot, i));
+			}
+			// the sampled token of a generating slot is still to be decoded
+			if (slot.state == SLOT_STATE_PROCESSING) {
+				ngram_append(slot, slot.sampled);
+			}
+		}
+	}
+
+	// add the n-grams `id` ends to the n-grams of the slot, in the order the slot takes in its tokens
+	void ngram_append(server_slot &slot, llama_token id)
+	{
+		// as for drafting, self-extend keeps no tokens to draft from
+		if (!lookup || slot.ga_n != 1) {
+			return;
+		}
+		slot.tokens_ngram.push_back(id);
+		llama_ngram_cache_update(slot.ngram_context, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX, slot.tokens_ngram, 1, false);
+	}
+
+	// take the n-grams the tokens past the first n end out of the n-grams of the slot
+	void ngram_truncate(server_slot &slot, size_t n)
+	{
+		std::vector<llama_token> &tokens = slot.tokens_ngram;
+		for (size_t i = n; i < tokens.size(); i++) {
+			for (int ngram_size = LLAMA_NGRAM_MIN; ngram_size <= LLAMA_NGRAM_MAX && (size_t)ngram_size <= i; ngram_size++) {
+				const auto part = slot.ngram_context.find(llama_ngram(&tokens[i - ngram_size], ngram_size));
+				if (part == slot.ngram_context.end()) {
+					continue;
+				}
+				const auto count = part->second.find(tokens[i]);
+				if (count != part->second.end() && --count->second == 0) {
+					part->second.erase(count);
+				}
+				if (part->second.empty()) {
+					slot.ngram_context.erase(part);
+				}
+			}
+		}
+		tokens.resize(std::min(n, tokens.size()));
+	}
+
+	// same, for a slot that only appended to slot.cache_tokens since the last update
+	void prefix_cache_append(const server_slot &slot)
+	{
+		prefix_cache.append(slot.id, slot.cache_tokens);
 	}
 
 	void system_prompt_update()
@@ -1568,16 +2632,30 @@ struct server_context {
 		}
 	}
 
-	void process_single_task(const server_task &task)
+	void process_single_task(server_task &task)
 	{
 		switch (task.type) {
 			case SERVER_TASK_TYPE_COMPLETION:
 			{
-				server_slot *slot = get_slot(json_value(task.data, "id_slot", -1));
+				// tokenize the prompt once, a deferred task comes back here until a slot is available
+				if (!task.prompt_tokenized && !task.infill && task.data.contains("prompt")) {
+					const json &prompt = task.data.at("prompt");
+					if (prompt.is_string() || prompt.is_array()) {
+						task.prompt_add_bos = system_prompt.empty();
+						task.prompt_tokens = tokenize(prompt, task.prompt_add_bos);
+					}
+					task.prompt_tokenized = true;
+				}
+
+				// route prompts that can reuse the cache to the slot holding the longest prefix of them
+				static const std::vector<llama_token> no_tokens;
+				const bool route = json_value(task.data, "cache_prompt", false) && !task.embedding;
+
+				server_slot *slot = get_slot(json_value(task.data, "id_slot", -1), route ? task.prompt_tokens : no_tokens);
 				if (slot == nullptr) {
 					// if no slot is available, we defer this task for processing later
 					LOG_VERBOSE("no slot is available", { {"id_task", task.id} });
-					queue_tasks.defer(task);
+					queue_tasks.defer(std::move(task));
 					break;
 				}
 
@@ -1601,6 +2679,11 @@ struct server_context {
 					LOG_ERROR("error while launching slot", task.data);
 					break;
 				}
+
+				// unless the system prompt changed the BOS since
+				if (task.prompt_add_bos == system_prompt.empty()) {
+					slot->prompt_tokens_task = std::move(task.prompt_tokens);
+				}
 			} break;
 			case SERVER_TASK_TYPE_CANCEL:
 			{
@@ -1638,6 +2721,18 @@ struct server_context {
 						{"stopped_limit",  slot.stopped_limit},
 						{"stopping_word",  slot.stopping_word},
 					};
+					slot_data["sampling"] = {
+						{"t_sampling_ms",           slot.t_sampling},
+						{"t_sampling_per_token_ms", slot.n_decoded > 0 ? slot.t_sampling / slot.n_decoded : 0.0},
+					};
+					if (speculative()) {
+						slot_data["speculative"] = {
+							{"n_draft",          slot.n_draft},
+							{"n_drafted",        slot.n_drafted},
+							{"n_draft_accepted", slot.n_draft_accepted},
+							{"acceptance_rate",  slot.n_drafted > 0 ? (double)slot.n_draft_accepted / slot.n_drafted : 0.0},
+						};
+					}
 
 					if (slot_data["state"] == SLOT_STATE_IDLE) {
 						n_idle_slots++;
@@ -1681,6 +2776,16 @@ struct server_context {
 					{ "n_tokens_predicted",              metrics.n_tokens_predicted},
 					{ "t_tokens_generation",             metrics.t_tokens_generation},
 
+					{ "t_sampling_total",                metrics.t_sampling_total},
+					{ "t_sampling",                      metrics.t_sampling},
+
+					{ "n_drafted_total",                 metrics.n_drafted_total},
+					{ "n_draft_accepted_total",          metrics.n_draft_accepted_total},
+
+					{ "grammar_cache_hits",              grammar_cache.n_hit},
+					{ "grammar_cache_misses",            grammar_cache.n_miss},
+					{ "grammar_cache_size",              grammar_cache.entries.size()},
+
 					{ "kv_cache_tokens_count",           llama_get_kv_cache_token_count(ctx)},
 					{ "kv_cache_used_cells",             llama_get_kv_cache_used_cells(ctx)},
 
@@ -1746,10 +2851,12 @@ struct server_context {
 				size_t nread = llama_state_seq_load_file(ctx, filepath.c_str(), slot->id + 1, slot->cache_tokens.data(), slot->cache_tokens.size(), &token_count);
 				if (nread == 0) {
 					slot->cache_tokens.resize(0);
+					slot_tokens_changed(*slot);
 					send_error(task, "Unable to restore slot, no available space in KV cache or invalid slot save file", ERROR_TYPE_INVALID_REQUEST);
 					break;
 				}
 				slot->cache_tokens.resize(token_count);
+				slot_tokens_changed(*slot);
 
 				const int64_t t_end = ggml_time_us();
 				const double t_restore_ms = (t_end - t_start) / 1000.0;
@@ -1782,6 +2889,7 @@ struct server_context {
 				const size_t n_erased = slot->cache_tokens.size();
 				llama_kv_cache_seq_rm(ctx, slot->id + 1, -1, -1);
 				slot->cache_tokens.clear();
+				slot_tokens_changed(*slot);
 
 				server_task_result result;
 				result.id = task.id;
@@ -1817,6 +2925,303 @@ struct server_context {
 		queue_results.send(result);
 	}
 
+	// most likely token of the draft model at row i of the last draft batch, -1 when it cannot be drafted
+	llama_token draft_token(int32_t i) const
+	{
+		const float *logits = llama_get_logits_ith(ctx_dft, i);
+		const int n_vocab = std::min(llama_n_vocab(model), llama_n_vocab(model_dft));
+
+		const llama_token id = (llama_token)(std::max_element(logits, logits + n_vocab) - logits);
+
+		return llama_token_is_eog(model, id) ? -1 : id;
+	}
+
+	// greedily draft up to n_draft[k] tokens after the sampled token of each slot in slots_draft, into slot.drafted
+	// the draft context of a slot first catches up with the tokens the slot added since the last step, all slots in
+	// the same batches; what it has in common with tokens that changed otherwise is kept by slot_tokens_changed()
+	void draft_slots(const std::vector<server_slot *> &slots_draft, const std::vector<int32_t> &n_draft)
+	{
+		const int32_t n_batch = llama_n_batch(ctx_dft);
+
+		// the tokens each slot evaluates start at n_eval[k], the last being the sampled token, whose logits draft
+		std::vector<size_t> n_eval(slots_draft.size());
+
+		for (size_t k = 0; k < slots_draft.size(); k++) {
+			server_slot &slot = *slots_draft[k];
+			slot.drafted.clear();
+
+			// past the known tokens are the last sampled token and the drafts, some of which may have been accepted
+			const size_t n_tokens = system_tokens.size() + slot.cache_tokens.size();
+			size_t n_past = std::min(slot.n_past_dft, n_tokens);
+			while (n_past < slot.tokens_dft.size() && n_past < n_tokens && slot.tokens_dft[n_past] == slot_token(slot, n_past)) {
+				n_past++;
+			}
+
+			llama_kv_cache_seq_rm(ctx_dft, slot.id + 1, (llama_pos)n_past, -1);
+			slot.tokens_dft.resize(n_past);
+			for (size_t i = n_past; i < n_tokens; i++) {
+				slot.tokens_dft.push_back(slot_token(slot, i));
+			}
+			slot.tokens_dft.push_back(slot.sampled);
+			slot.n_past_dft = n_tokens;
+
+			n_eval[k] = n_past;
+		}
+
+		std::vector<size_t> active;
+		std::vector<size_t> in_batch;						// slots with tokens in batch_dft
+		std::vector<int32_t> i_last(slots_draft.size(), -1);	// row of the sampled token of the slot in batch_dft
+
+		const auto decode = [&]() {
+			if (llama_decode(ctx_dft, batch_dft) != 0) {
+				for (const size_t k : in_batch) {
+					server_slot &slot = *slots_draft[k];
+					LOG_WARNING("failed to decode the draft context of the slot", {
+						{"id_slot",  slot.id},
+						{"n_tokens", slot.tokens_dft.size()}
+					});
+					llama_kv_cache_seq_rm(ctx_dft, slot.id + 1, -1, -1);
+					slot.tokens_dft.clear();
+					slot.n_past_dft = 0;
+					i_last[k] = -1;
+				}
+			}
+
+			for (const size_t k : in_batch) {
+				if (i_last[k] < 0) {
+					continue;
+				}
+
+				const llama_token id = draft_token(i_last[k]);
+				if (id < 0) {
+					continue;
+				}
+
+				server_slot &slot = *slots_draft[k];
+				slot.drafted.push_back(id);
+				if ((int32_t)slot.drafted.size() < n_draft[k]) {
+					active.push_back(k);
+				}
+			}
+
+			llama_batch_clear(batch_dft);
+			in_batch.clear();
+		};
+
+		llama_batch_clear(batch_dft);
+		for (size_t k = 0; k < slots_draft.size(); k++) {
+			server_slot &slot = *slots_draft[k];
+
+			for (size_t j = n_eval[k]; j < slot.tokens_dft.size(); j++) {
+				if (batch_dft.n_tokens == n_batch) {
+					decode();
+				}
+				// a failed decode dropped the tokens of the slot
+				if (j >= slot.tokens_dft.size()) {
+					break;
+				}
+
+				const bool last = j == slot.tokens_dft.size() - 1;
+				llama_batch_add(batch_dft, slot.tokens_dft[j], (llama_pos)j, { slot.id + 1 }, last);
+				if (in_batch.empty() || in_batch.back() != k) {
+					in_batch.push_back(k);
+				}
+				if (last) {
+					i_last[k] = batch_dft.n_tokens - 1;
+				}
+			}
+		}
+		if (batch_dft.n_tokens > 0) {
+			decode();
+		}
+
+		// one token more for every slot still drafting, all in one batch
+		while (!active.empty()) {
+			llama_batch_clear(batch_dft);
+			for (const size_t k : active) {
+				server_slot &slot = *slots_draft[k];
+				llama_batch_add(batch_dft, slot.drafted.back(), (llama_pos)slot.tokens_dft.size(), { slot.id + 1 }, true);
+				slot.tokens_dft.push_back(slot.drafted.back());
+			}
+
+			if (llama_decode(ctx_dft, batch_dft) != 0) {
+				// what was drafted so far is still good to verify
+				for (const size_t k : active) {
+					slots_draft[k]->tokens_dft.pop_back();
+				}
+				break;
+			}
+
+			std::vector<size_t> next;
+			for (size_t b = 0; b < active.size(); b++) {
+				server_slot &slot = *slots_draft[active[b]];
+
+				const llama_token id = draft_token((int32_t)b);
+				if (id < 0) {
+					continue;
+				}
+
+				slot.drafted.push_back(id);
+				if ((int32_t)slot.drafted.size() < n_draft[active[b]]) {
+					next.push_back(active[b]);
+				}
+			}
+			active = std::move(next);
+		}
+	}
+
+	// drafts up to n_draft tokens after the sampled token of the slot from the n-grams of its tokens, into slot.drafted
+	// the static n-grams only weigh the candidates, or draft on their own when the tokens of the slot have no match
+	// the n-grams of the slot are kept up to date as it takes in tokens, see ngram_append()
+	void lookup_draft(server_slot &slot, int32_t n_draft)
+	{
+		// the longest n-gram drafted from has to be within the tokens
+		if (slot.tokens_ngram.size() < LLAMA_NGRAM_MAX) {
+			return;
+		}
+
+		std::vector<llama_token> draft = { slot.sampled };
+		llama_ngram_cache_draft(slot.tokens_ngram, draft, n_draft, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX,
+			slot.ngram_context, ngram_cache_dynamic, ngram_cache_static);
+
+		// a static cache made for another vocab can hold ids this model does not have
+		const int32_t n_vocab = llama_n_vocab(model);
+		for (size_t i = 1; i < draft.size() && draft[i] >= 0 && draft[i] < n_vocab; i++) {
+			slot.drafted.push_back(draft[i]);
+		}
+	}
+
+	// picks the generating slots to draft for at this step and how many tokens each, then drafts them
+	// prompt lookup goes first as it costs no decode, the draft model only drafts for the slots it found nothing for
+	void draft_update(int32_t n_batch)
+	{
+		std::vector<server_slot *> slots_draft;
+		std::vector<int32_t> n_draft;
+
+		// the sampled token of every slot goes in the batch first, the drafts have to fit in what is left
+		int32_t n_room = n_batch;
+		for (const server_slot &slot : slots) {
+			if (slot.state != SLOT_STATE_IDLE) {
+				n_room--;
+			}
+		}
+
+		for (server_slot &slot : slots) {
+			slot.drafted.clear();
+
+			// the probabilities of a sampled token are only at hand until the next one is sampled
+			if (slot.state != SLOT_STATE_PROCESSING || slot.embedding || slot.ga_n != 1 || slot.sparams.n_probs > 0) {
+				continue;
+			}
+
+			int32_t n = std::min(params.n_draft, n_room);
+
+			// within the context of the slot, before a context shift is needed
+			n = std::min(n, slot.n_ctx - 2 - (int32_t)system_tokens.size() - slot.n_past);
+
+			// and within the tokens left to predict, one of which is sampled after the last accepted draft
+			const int32_t n_predict = slot.params.n_predict != -1 ? slot.params.n_predict : params.n_predict;
+			if (n_predict != -1) {
+				n = std::min(n, n_predict - slot.n_decoded - 1);
+			}
+
+			if (n <= 0) {
+				continue;
+			}
+
+			if (lookup) {
+				lookup_draft(slot, n);
+				if (!slot.drafted.empty()) {
+					n_room -= (int32_t)slot.drafted.size();
+					continue;
+				}
+			}
+
+			// the draft model drafts one token more than were accepted of the last drafts
+			n = std::min(n, slot.n_draft);
+			if (ctx_dft == nullptr || n <= 0) {
+				continue;
+			}
+
+			n_room -= n;
+			slots_draft.push_back(&slot);
+			n_draft.push_back(n);
+		}
+
+		if (!slots_draft.empty()) {
+			draft_slots(slots_draft, n_draft);
+		}
+	}
+
+	// sample and accept the next tokens of every slot in slots_sample, using the logits of the batch view starting at i_batch
+	// a slot with drafted tokens keeps sampling at the rows of its drafts as long as the sampled token is the drafted
+	// one, so ids[k] holds one token more than the drafts that were accepted, each sampled as without drafting
+	// each slot has its own sampling context and logits rows, so they can be sampled in parallel
+	void sample_slots(const std::vector<server_slot *> &slots_sample, int32_t i_batch, std::vector<std::vector<llama_token>> &ids)
+	{
+		ids.resize(slots_sample.size());
+
+		const auto sample = [&](size_t k) {
+			server_slot &slot = *slots_sample[k];
+
+			const int64_t t_start_sampling = ggml_time_us();
+
+			ids[k].clear();
+			for (size_t j = 0; ; j++) {
+				const llama_token id = llama_sampling_sample(slot.ctx_sampling, ctx, NULL, slot.i_batch - i_batch + (int32_t)j);
+				llama_sampling_accept(slot.ctx_sampling, ctx, id, true);
+				ids[k].push_back(id);
+
+				if (j == slot.drafted.size() || id != slot.drafted[j]) {
+					break;
+				}
+			}
+
+			slot.t_sampling += (ggml_time_us() - t_start_sampling) / 1e3;
+		};
+
+		if (!sampling_pool || slots_sample.size() < 2) {
+			for (size_t k = 0; k < slots_sample.size(); k++) {
+				sample(k);
+			}
+			return;
+		}
+
+		// llama_get_logits_ith() synchronizes and updates the eval statistics of the context on the first call after a
+		// decode, make that call here so the workers only read them
+		llama_synchronize(ctx);
+
+		// mirostat draws from the rng of the context instead of the one of the slot, those slots stay on this thread
+		std::vector<size_t> k_pool;
+		std::vector<size_t> k_main;
+		for (size_t k = 0; k < slots_sample.size(); k++) {
+			(slots_sample[k]->sparams.mirostat == 0 && k_main.size() > 0 ? k_pool : k_main).push_back(k);
+		}
+
+		std::mutex mutex_pending;
+		std::condition_variable condition_pending;
+		size_t n_pending = k_pool.size();
+
+		for (size_t k : k_pool) {
+			sampling_pool->enqueue([&, k]() {
+				sample(k);
+
+				std::unique_lock<std::mutex> lock(mutex_pending);
+				if (--n_pending == 0) {
+					condition_pending.notify_one();
+				}
+			});
+		}
+
+		for (size_t k : k_main) {
+			sample(k);
+		}
+
+		// the next llama_decode() overwrites the logits, so all slots must be done before returning
+		std::unique_lock<std::mutex> lock(mutex_pending);
+		condition_pending.wait(lock, [&] { return n_pending == 0; });
+	}
+
 	void update_slots()
 	{
 		if (system_need_update) {
@@ -1900,7 +3305,7 @@ struct server_context {
 					llama_kv_cache_seq_rm(ctx, slot.id + 1, n_keep, n_keep + n_discard);
 					llama_kv_cache_seq_add(ctx, slot.id + 1, n_keep + n_discard, system_tokens.size() + slot.n_past, -n_discard);
 
-					if (slot.params.cache_prompt) {
+					if (slot_keeps_tokens(slot)) {
 						for (size_t i = n_keep + n_discard; i < slot.cache_tokens.size(); i++) {
 							slot.cache_tokens[i - n_discard] = slot.cache_tokens[i];
 						}
@@ -1908,6 +3313,8 @@ struct server_context {
 						slot.cache_tokens.resize(slot.cache_tokens.size() - n_discard);
 					}
 
+					slot_tokens_changed(slot);
+
 					slot.n_past -= n_discard;
 
 					slot.truncated = true;
@@ -1915,9 +3322,19 @@ struct server_context {
 			}
 		}
 
+		// process in chunks of params.n_batch
+		int32_t n_batch = llama_n_batch(ctx);
+		int32_t n_ubatch = llama_n_ubatch(ctx);
+
+		if (speculative()) {
+			draft_update(n_batch);
+		}
+
 		// start populating the batch for this iteration
 		llama_batch_clear(batch);
 
+		std::vector<server_slot *> slots_drafted;
+
 		// frist, add sampled tokens from any ongoing sequences
 		for (auto &slot : slots) {
 			if (slot.state == SLOT_STATE_IDLE) {
@@ -1932,9 +3349,17 @@ struct server_context {
 			//       this is not great and needs to be improved somehow
 			llama_batch_add(batch, slot.sampled, system_tokens.size() + slot_npast, { slot.id + 1 }, true);
 
+			// followed by the drafts, verified by sampling at each of them
+			for (size_t j = 0; j < slot.drafted.size(); j++) {
+				llama_batch_add(batch, slot.drafted[j], system_tokens.size() + slot_npast + 1 + j, { slot.id + 1 }, true);
+			}
+			if (!slot.drafted.empty()) {
+				slots_drafted.push_back(&slot);
+			}
+
 			slot.n_past += 1;
 
-			if (slot.params.cache_prompt) {
+			if (slot_keeps_tokens(slot)) {
 				slot.cache_tokens.push_back(slot.sampled);
 			}
 
@@ -1949,10 +3374,6 @@ struct server_context {
 			});
 		}
 
-		// process in chunks of params.n_batch
-		int32_t n_batch = llama_n_batch(ctx);
-		int32_t n_ubatch = llama_n_ubatch(ctx);
-
 		// next, batch any pending prompts without exceeding n_batch
 		if (params.cont_batching || batch.n_tokens == 0) {
 			for (auto &slot : slots) {
@@ -1991,10 +3412,18 @@ struct server_context {
 							prefix_tokens.insert(prefix_tokens.end(), suffix_tokens.begin(), suffix_tokens.end());
 							prefix_tokens.push_back(llama_token_middle(model));
 							prompt_tokens = prefix_tokens;
+						} else if (!slot.prompt_tokens_task.empty()) {
+							prompt_tokens = std::move(slot.prompt_tokens_task);
+							slot.prompt_tokens_task.clear();
 						} else {
 							prompt_tokens = tokenize(slot.prompt, system_prompt.empty()); // add BOS if there isn't system prompt
 						}
 
+						// the tokens not shared with the new prompt are about to be dropped, keep them on disk
+						if (kv_disk_cache.enabled() && !slot.embedding && common_part(slot.cache_tokens, prompt_tokens) < slot.cache_tokens.size()) {
+							kv_disk_cache.store(ctx, slot.id + 1, system_tokens, slot.cache_tokens);
+						}
+
 						slot.n_past = 0;
 						slot.n_prompt_tokens = prompt_tokens.size();
 
@@ -2083,6 +3512,52 @@ struct server_context {
 								// reuse any previously computed tokens that are common with the new prompt
 								slot.n_past = common_part(slot.cache_tokens, prompt_tokens);
 
+								// another slot may hold a longer prefix - share its cells instead of evaluating them again
+								const auto [id_src, n_src] = prefix_cache.find(prompt_tokens, [&slot](int id_slot) {
+									return id_slot != slot.id;
+								});
+
+								if (id_src >= 0 && (int)n_src > slot.n_past) {
+									LOG_INFO("kv cache copy prefix from slot", {
+										{ "id_slot",  slot.id },
+										{ "id_task",  slot.id_task },
+										{ "id_src",   id_src },
+										{ "n_prefix", n_src }
+									});
+
+									const int p0 = (int)system_tokens.size();
+									llama_kv_cache_seq_rm(ctx, slot.id + 1, p0, -1);
+									llama_kv_cache_seq_cp(ctx, id_src + 1, slot.id + 1, p0, p0 + (int)n_src);
+
+									slot.cache_tokens.assign(prompt_tokens.begin(), prompt_tokens.begin() + n_src);
+									slot.n_past = (int)n_src;
+								}
+
+								// a longer prefix may have been evicted to disk
+								if (kv_disk_cache.enabled()) {
+									std::vector<llama_token> tokens_disk;
+									const int32_t n_disk = kv_disk_cache.load(ctx, slot.id + 1, system_tokens, prompt_tokens, slot.n_past, tokens_disk);
+
+									if (n_disk > 0) {
+										LOG_INFO("kv cache restored prefix from disk", {
+											{ "id_slot",  slot.id },
+											{ "id_task",  slot.id_task },
+											{ "n_prefix", n_disk }
+										});
+
+										slot.cache_tokens = std::move(tokens_disk);
+										slot.n_past = (int)n_disk;
+									} else if (n_disk < 0) {
+										// the sequence was wiped, start over from the system prompt
+										slot.cache_tokens.clear();
+										slot.n_past = 0;
+
+										if (!system_tokens.empty()) {
+											llama_kv_cache_seq_cp(ctx, 0, slot.id + 1, -1, -1);
+										}
+									}
+								}
+
 								// push the prompt into the sampling context (do not apply grammar)
 								for (int i = 0; i < slot.n_past; ++i) {
 									llama_sampling_accept(slot.ctx_sampling, ctx, slot.cache_tokens[i], false);
@@ -2133,8 +3608,11 @@ struct server_context {
 						llama_sampling_reset(slot.ctx_sampling);
 					}
 
-					// remove the non-common part from the cache
-					slot.cache_tokens.resize(slot.n_past);
+					// remove the non-common part from the cache, only ever there before the first tokens of the prompt
+					if (slot.n_prompt_tokens_processed == 0) {
+						slot.cache_tokens.resize(slot.n_past);
+						slot_tokens_changed(slot);
+					}
 
 					LOG_INFO("kv cache rm [p0, end)", {
 						{ "id_slot", slot.id },
@@ -2161,8 +3639,9 @@ struct server_context {
 
 						llama_batch_add(batch, prompt_tokens[slot.n_past], system_tokens.size() + slot_npast, { slot.id + 1 }, false);
 
-						if (slot.params.cache_prompt) {
+						if (slot_keeps_tokens(slot)) {
 							slot.cache_tokens.push_back(prompt_tokens[slot.n_past]);
+							ngram_append(slot, prompt_tokens[slot.n_past]);
 						}
 
 						slot.n_prompt_tokens_processed++;
@@ -2188,6 +3667,8 @@ struct server_context {
 						batch.logits[batch.n_tokens - 1] = true;
 
 						slot.n_decoded = 0;
+						slot.t_sampling = 0.0;
+						slot.n_draft = params.n_draft;
 						slot.i_batch = batch.n_tokens - 1;
 
 						LOG_VERBOSE("prompt done", {
@@ -2214,6 +3695,8 @@ struct server_context {
 			{"n_tokens", batch.n_tokens},
 		});
 
+		bool decoded = true;
+
 		// process the created batch of tokens
 		for (int32_t i = 0; i < batch.n_tokens; i += n_batch) {
 			const int32_t n_tokens = std::min(n_batch, batch.n_tokens - i);
@@ -2274,6 +3757,7 @@ struct server_context {
 						slot.release();
 						send_error(slot, "Input prompt is too big compared to KV size. Please try increasing KV size.");
 					}
+					decoded = false;
 					break; // break loop of n_batch
 				}
 
@@ -2290,6 +3774,8 @@ struct server_context {
 				continue; // continue loop of n_batch
 			}
 
+			std::vector<server_slot *> slots_sample;
+
 			for (auto &slot : slots) {
 				if (slot.state != SLOT_STATE_PROCESSING || slot.i_batch < (int)i || slot.i_batch >= (int)(i + n_tokens)) {
 					continue; // continue loop of slots
@@ -2303,45 +3789,88 @@ struct server_context {
 					continue; // continue loop of slots
 				}
 
-				completion_token_output result;
-				const llama_token id = llama_sampling_sample(slot.ctx_sampling, ctx, NULL, slot.i_batch - i);
+				// drafts that ended up in the next view of the batch cannot be verified
+				slot.drafted.resize(std::min(slot.drafted.size(), (size_t)(i + n_tokens - 1 - slot.i_batch)));
 
-				llama_sampling_accept(slot.ctx_sampling, ctx, id, true);
+				slots_sample.push_back(&slot);
+			}
 
-				slot.n_decoded += 1;
-				if (slot.n_decoded == 1) {
-					slot.t_start_generation = ggml_time_us();
-					slot.t_prompt_processing = (slot.t_start_generation - slot.t_start_process_prompt) / 1e3;
-					metrics.on_prompt_eval(slot);
-				}
+			std::vector<std::vector<llama_token>> ids;
+			sample_slots(slots_sample, i, ids);
 
-				llama_token_data_array cur_p = { slot.ctx_sampling->cur.data(), slot.ctx_sampling->cur.size(), false };
-				result.tok = id;
+			for (size_t k = 0; k < slots_sample.size(); k++) {
+				server_slot &slot = *slots_sample[k];
 
-				const int32_t n_probs = slot.sparams.n_probs;
-				if (slot.sparams.temp <= 0 && n_probs > 0) {
-					// for llama_sample_token_greedy we need to sort candidates
-					llama_sample_softmax(ctx, &cur_p);
+				for (const llama_token id : ids[k]) {
+					ngram_append(slot, id);
 				}
 
-				for (size_t i = 0; i < std::min(cur_p.size, (size_t)n_probs); ++i) {
-					result.probs.push_back({
-						cur_p.data[i].id,
-						cur_p.data[i].p
-					});
+				// the accepted drafts stay in the KV cache, the token sampled after them is decoded at the next step
+				const int32_t n_accepted = (int32_t)ids[k].size() - 1;
+				if (!slot.drafted.empty()) {
+					slot.n_drafted += (int32_t)slot.drafted.size();
+					slot.n_draft_accepted += n_accepted;
+					slot.n_draft = std::min(params.n_draft, n_accepted + 1);
+
+					slot.n_past += n_accepted;
+					if (slot_keeps_tokens(slot)) {
+						slot.cache_tokens.insert(slot.cache_tokens.end(), slot.drafted.begin(), slot.drafted.begin() + n_accepted);
+					}
 				}
 
-				if (!process_token(result, slot)) {
-					slot.release();
-					slot.print_timings();
-					send_final_response(slot);
-					metrics.on_prediction(slot);
+				for (const llama_token id : ids[k]) {
+					completion_token_output result;
+
+					slot.n_decoded += 1;
+					if (slot.n_decoded == 1) {
+						slot.t_start_generation = ggml_time_us();
+						slot.t_prompt_processing = (slot.t_start_generation - slot.t_start_process_prompt) / 1e3;
+						metrics.on_prompt_eval(slot);
+					}
+
+					llama_token_data_array cur_p = { slot.ctx_sampling->cur.data(), slot.ctx_sampling->cur.size(), false };
+					result.tok = id;
+
+					const int32_t n_probs = slot.sparams.n_probs;
+					if (slot.sparams.temp <= 0 && n_probs > 0) {
+						// for llama_sample_token_greedy we need to sort candidates
+						llama_sample_softmax(ctx, &cur_p);
+					}
+
+					for (size_t i = 0; i < std::min(cur_p.size, (size_t)n_probs); ++i) {
+						result.probs.push_back({
+							cur_p.data[i].id,
+							cur_p.data[i].p
+						});
+					}
+
+					if (!process_token(result, slot)) {
+						slot.release();
+						slot.print_timings();
+						send_final_response(slot);
+						metrics.on_prediction(slot);
+						break;
+					}
 				}
 
 				slot.i_batch = -1;
 			}
 		}
 
+		// the drafts that were not accepted are dropped from the KV cache, wherever they were decoded
+		for (server_slot *slot : slots_drafted) {
+			llama_kv_cache_seq_rm(ctx, slot->id + 1, (llama_pos)(system_tokens.size() + slot->n_past), -1);
+			slot->drafted.clear();
+		}
+
+		// the tokens added to the slots in this iteration are now in the KV cache
+		// anything else that changes slot.cache_tokens updates the prefix cache right away
+		if (decoded) {
+			for (const server_slot &slot : slots) {
+				prefix_cache_append(slot);
+			}
+		}
+
 		LOG_VERBOSE("run slots completed", {});
 	}
 
@@ -2419,6 +3948,16 @@ static void server_print_usage(const char *argv0, const gpt_params &params, cons
 	printf("                            Hugging Face model repository (default: unused)\n");
 	printf("  -hff FILE, --hf-file FILE\n");
 	printf("                            Hugging Face model file (default: unused)\n");
+	printf("  -md FNAME, --model-draft FNAME\n");
+	printf("                            draft model for speculative decoding, with the same vocab as the model (default: unused)\n");
+	printf("  --draft N                 maximum number of tokens to draft per slot and step (default: %d)\n", params.n_draft);
+	if (llama_supports_gpu_offload()) {
+		printf("  -ngld N, --n-gpu-layers-draft N\n");
+		printf("                            number of layers of the draft model to store in VRAM\n");
+	}
+	printf("  --lookup                  draft from the n-grams of the prompt and output of each slot for speculative decoding\n");
+	printf("  -lcs FNAME, --lookup-cache-static FNAME\n");
+	printf("                            static n-gram cache from lookup-create with the same vocab, implies --lookup (default: unused)\n");
 	printf("  -a ALIAS, --alias ALIAS\n");
 	printf("                            set an alias for the model, will be added as `model` field in completion response\n");
 	printf("  --lora FNAME              apply LoRA adapter (implies --no-mmap)\n");
@@ -2448,6 +3987,10 @@ static void server_print_usage(const char *argv0, const gpt_params &params, cons
 	printf("  --slots-endpoint-disable  disables slots monitoring endpoint.\n");
 	printf("  --metrics                 enable prometheus compatible metrics endpoint (default: %s).\n", sparams.metrics_endpoint ? "enabled" : "disabled");
 	printf("  --slot-save-path PATH     path to save slot kv cache (default: disabled)\n");
+	printf("  --kv-disk-cache PATH      directory where the kv cache of evicted slots is kept to be restored by later prompts (default: disabled)\n");
+	printf("  --kv-disk-cache-size N    maximum size of the kv disk cache in MiB (default: %zu)\n", sparams.kv_disk_cache_size);
+	printf("  -sps F, --slot-prompt-similarity F\n");
+	printf("                            share of a prompt a slot must already hold to be picked for it, 0.0 always picks the least recently used slot (default: %.1f)\n", sparams.slot_prompt_similarity);
 	printf("\n");
 	printf("  -n, --n-predict           maximum tokens to predict (default: %d)\n", params.n_predict);
 	printf("  --override-kv KEY=TYPE:VALUE\n");
@@ -2544,6 +4087,27 @@ static void server_params_parse(int argc, char **argv, server_params &sparams, g
 				break;
 			}
 			params.model = argv[i];
+		} else if (arg == "-md" || arg == "--model-draft") {
+			if (++i >= argc) {
+				invalid_param = true;
+				break;
+			}
+			params.model_draft = argv[i];
+		} else if (arg == "--draft") {
+			if (++i >= argc) {
+				invalid_param = true;
+				break;
+			}
+			params.n_draft = std::stoi(argv[i]);
+		} else if (arg == "--lookup") {
+			sparams.lookup = true;
+		} else if (arg == "-lcs" || arg == "--lookup-cache-static") {
+			if (++i >= argc) {
+				invalid_param = true;
+				break;
+			}
+			params.lookup_cache_static = argv[i];
+			sparams.lookup = true;
 		} else if (arg == "-mu" || arg == "--model-url") {
 			if (++i >= argc) {
 				invalid_param = true;
@@ -2706,6 +4270,19 @@ static void server_params_parse(int argc, char **argv, server_params &sparams, g
 					"See main README.md for information on enabling GPU BLAS support",
 					{ {"n_gpu_layers", params.n_gpu_layers} });
 			}
+		} else if (arg == "--gpu-layers-draft" || arg == "-ngld" || arg == "--n-gpu-layers-draft") {
+			if (++i >= argc) {
+				invalid_param = true;
+				break;
+			}
+			if (llama_supports_gpu_offload()) {
+				params.n_gpu_layers_draft = std::stoi(argv[i]);
+			} else {
+				LOG_WARNING(
+					"Not compiled with GPU offload support, --n-gpu-layers-draft option will be ignored. "
+					"See main README.md for information on enabling GPU BLAS support",
+					{ {"n_gpu_layers_draft", params.n_gpu_layers_draft} });
+			}
 		} else if (arg == "-nkvo" || arg == "--no-kv-offload") {
 			params.no_kv_offload = true;
 		} else if (arg == "--split-mode" || arg == "-sm") {
@@ -2882,6 +4459,24 @@ static void server_params_parse(int argc, char **argv, server_params &sparams, g
 			if (!sparams.slot_save_path.empty() && sparams.slot_save_path[sparams.slot_save_path.size() - 1] != DIRECTORY_SEPARATOR) {
 				sparams.slot_save_path += DIRECTORY_SEPARATOR;
 			}
+		} else if (arg == "--kv-disk-cache") {
+			if (++i >= argc) {
+				invalid_param = true;
+				break;
+			}
+			sparams.kv_disk_cache_path = argv[i];
+		} else if (arg == "--kv-disk-cache-size") {
+			if (++i >= argc) {
+				invalid_param = true;
+				break;
+			}
+			sparams.kv_disk_cache_size = std::stoull(argv[i]);
+		} else if (arg == "-sps" || arg == "--slot-prompt-similarity") {
+			if (++i >= argc) {
+				invalid_param = true;
+				break;
+			}
+			sparams.slot_prompt_similarity = std::stof(argv[i]);
 		} else if (arg == "--chat-template") {
 			if (++i >= argc) {
 				invalid_param = true;
@@ -2967,136 +4562,64 @@ int main(int argc, char **argv)
 {
 #else
 
-static void llama_log_callback_wingman(ggml_log_level level, const char *text, void *user_data)
+static void llama_event_callback_wingman(const llama_event *event, void *user_data)
 {
-	// let's write code to extract relevant information from `text` using
-	// std::regex
-	std::string str(text);
 	server_context *ctx = static_cast<server_context *>(user_data);
 
-	if (ctx == nullptr) {
-		std::cout << "ctx is nullptr" << std::endl;
+	// the info describes the served model, not the draft one
+	if (ctx == nullptr || ctx->loading_draft) {
 		return;
 	}
 
-	// llm_load_tensors: ggml ctx size =    0.09 MB
-	std::regex ctx_size_regex("llm_load_tensors: ggml ctx size =\\s+(\\d+\\.\\d+) MB");
-	std::smatch ctx_size_match;
-	static float ctx_size = -1.0;
-	if (std::regex_search(str, ctx_size_match, ctx_size_regex)) {
-		std::string ctx_size_str = ctx_size_match[1];
-		ctx_size = std::stof(ctx_size_str);
-		ctx->extra.ctx_size = ctx_size;
-		std::cout << "ctx_size: " << ctx_size << std::endl;
-	}
-
-	// llm_load_tensors: using CUDA for GPU acceleration
-	std::regex using_cuda_regex("llm_load_tensors: using (\\w+) for GPU acceleration");
-	std::smatch using_cuda_match;
-	static std::string cuda_str;
-	if (std::regex_search(str, using_cuda_match, using_cuda_regex)) {
-		cuda_str = using_cuda_match[1];
-		ctx->extra.cuda_str = cuda_str;
-		std::cout << "cuda_str: " << cuda_str << std::endl;
-	}
-
-	// llm_load_tensors: mem required  =   70.44 MB
-	std::regex mem_required_regex("llm_load_tensors: mem required  =\\s+(\\d+\\.\\d+)\\s+(\\w+)");
-	std::smatch mem_required_match;
-	static float mem_required = -1.0;
-	if (std::regex_search(str, mem_required_match, mem_required_regex)) {
-		std::string mem_required_str = mem_required_match[1];
-		std::string mem_required_unit = mem_required_match[2];
-		mem_required = std::stof(mem_required_str);
-		ctx->extra.mem_required = mem_required;
-		ctx->extra.mem_required_unit = mem_required_unit;
-		std::cout << "mem_required: " << mem_required << " " << mem_required_unit << std::endl;
-	}
-
-	// llm_load_tensors: offloading 32 repeating layers to GPU
-	std::regex offloading_repeating_regex("llm_load_tensors: offloading (\\d+) repeating layers to GPU");
-	std::smatch offloading_repeating_match;
-	static int offloading_repeating = -1;
-	if (std::regex_search(str, offloading_repeating_match, offloading_repeating_regex)) {
-		std::string offloading_repeating_str = offloading_repeating_match[1];
-		offloading_repeating = std::stoi(offloading_repeating_str);
-		ctx->extra.offloading_repeating = offloading_repeating;
-		std::cout << "repeating layers offloaded: " << offloading_repeating << std::endl;
-	}
-
-	// llm_load_tensors: offloading non-repeating layers to GPU
-	std::regex offloading_nonrepeating_regex("llm_load_tensors: offloading (\\d+) non-repeating layers to GPU");
-	std::smatch offloading_nonrepeating_match;
-	static int offloading = -1;
-	if (std::regex_search(str, offloading_nonrepeating_match, offloading_nonrepeating_regex)) {
-		std::string offloading_str = offloading_nonrepeating_match[1];
-		offloading = std::stoi(offloading_str);
-		ctx->extra.offloading_nonrepeating = offloading;
-		std::cout << "non-repeating layers offloaded: " << offloading << std::endl;
-	}
-
-	// llm_load_tensors: offloaded 35/35 layers to GPU
-	std::regex offloaded_regex("llm_load_tensors: offloaded (\\d+)/(\\d+) layers to GPU");
-	std::smatch offloaded_match;
-	static int offloaded = -1;
-	static int offloaded_total = -1;
-	if (std::regex_search(str, offloaded_match, offloaded_regex)) {
-		std::string offloaded_str = offloaded_match[1];
-		std::string offloaded_total_str = offloaded_match[2];
-		offloaded = std::stoi(offloaded_str);
-		ctx->extra.offloaded = offloaded;
-		offloaded_total = std::stoi(offloaded_total_str);
-		ctx->extra.offloaded_total = offloaded_total;
-		std::cout << "offloaded: " << offloaded << "/" << offloaded_total << std::endl;
-	}
-
-	// llm_load_tensors: VRAM used: 4849 MB
-	std::regex vram_used_regex("llm_load_tensors: VRAM used: (\\d+.\\d+) MB");
-	std::smatch vram_used_match;
-	static float vram_used = -1.0;
-	static float vram_per_layer_avg = -1.0;
-	if (std::regex_search(str, vram_used_match, vram_used_regex)) {
-		std::string vram_used_str = vram_used_match[1];
-		vram_used = std::stof(vram_used_str);
-		ctx->extra.vram_used = vram_used;
-		vram_per_layer_avg = vram_used / static_cast<float>(offloaded_total);
-		ctx->extra.vram_per_layer_avg = vram_per_layer_avg;
-		std::cout << "vram_used: " << vram_used << std::endl;
-		std::cout << "vram_per_layer_avg: " << vram_per_layer_avg << std::endl;
-	}
-
-	// llama_model_loader: - type  f32:   65 tensors
-	// llama_model_loader: - type  f16:    1 tensors
-	// llama_model_loader: - type q4_0:    1 tensors
-	// llama_model_loader: - type q2_K:   64 tensors
-	// llama_model_loader: - type q3_K:  160 tensors
-	std::regex type_regex("llama_model_loader: - type\\s+(\\w+):\\s+(\\d+) tensors");
-	std::smatch tensor_type_match;
-	static std::map<std::string, int> tensor_type_map;
-	if (std::regex_search(str, tensor_type_match, type_regex)) {
-		std::string tensor_type_str = tensor_type_match[1];
-		std::string tensor_count_str = tensor_type_match[2];
-		int tensor_count = std::stoi(tensor_count_str);
-		tensor_type_map[tensor_type_str] = tensor_count;
-		ctx->extra.tensor_type_map[tensor_type_str] = tensor_count;
-		std::cout << "tensor_type: " << tensor_type_str << " " << tensor_count << std::endl;
-	}
+	auto &extra = ctx->extra;
 
-	// llm_load_print_meta: format         = GGUF V1 (support until nov 2023)
-	// llm_load_print_meta: arch           = llama
-	std::regex meta_regex("llm_load_print_meta: (\\w+)\\s+=\\s+(.+)");
-	std::smatch meta_match;
-	static std::map<std::string, std::string> meta_map;
-	if (std::regex_search(str, meta_match, meta_regex)) {
-		std::string meta_key_str = meta_match[1];
-		std::string meta_value_str = meta_match[2];
-		meta_map[meta_key_str] = meta_value_str;
-		ctx->extra.meta_map[meta_key_str] = meta_value_str;
-		std::cout << "meta_key: " << meta_key_str << " " << meta_value_str << std::endl;
+	switch (event->type) {
+		case LLAMA_EVENT_TYPE_MODEL_META:
+			switch (event->meta.type) {
+				case LLAMA_META_TYPE_INT:
+					extra.meta_map[event->meta.key] = event->meta.value_int;
+					break;
+				case LLAMA_META_TYPE_FLOAT:
+					extra.meta_map[event->meta.key] = event->meta.value_float;
+					break;
+				default:
+					extra.meta_map[event->meta.key] = event->meta.value;
+					break;
+			}
+			break;
+		case LLAMA_EVENT_TYPE_TENSOR_CTX:
+			extra.ctx_size = static_cast<float>(event->tensor_ctx.size) / 1024.0f / 1024.0f;
+			break;
+		case LLAMA_EVENT_TYPE_TENSOR_TYPE:
+			extra.tensor_type_map[event->tensor_type.name] = event->tensor_type.n_tensors;
+			break;
+		case LLAMA_EVENT_TYPE_OFFLOAD:
+			extra.offloading_repeating = event->offload.n_repeating;
+			extra.offloading_nonrepeating = event->offload.non_repeating ? 1 : 0;
+			extra.offloaded = event->offload.n_offloaded;
+			extra.offloaded_total = event->offload.n_layers;
+			break;
+		case LLAMA_EVENT_TYPE_BUFFER:
+		{
+			if (event->buffer.usage != LLAMA_BUFFER_USAGE_MODEL) {
+				break;
+			}
+			const float size_mib = static_cast<float>(event->buffer.size) / 1024.0f / 1024.0f;
+			extra.mem_required = std::max(extra.mem_required, 0.0f) + size_mib;
+			extra.mem_required_unit = "MiB";
+			if (!event->buffer.is_host) {
+				extra.cuda_str = event->buffer.name;
+				extra.vram_used = std::max(extra.vram_used, 0.0f) + size_mib;
+				// per layer that can be offloaded, as it was when read from the "offloaded X/Y layers" log line
+				if (extra.offloaded_total > 0) {
+					extra.vram_per_layer_avg = extra.vram_used / static_cast<float>(extra.offloaded_total);
+				}
+			}
+			break;
+		}
+		default:
+			break;
 	}
-
-	(void)level;
-	(void)user_data;
 }
 
 json format_timing_report(server_context & llama)
@@ -3187,7 +4710,7 @@ int run_inference(int argc, char **argv,
 	server_context ctx_server;
 
 #ifdef WINGMAN_LIB
-	(llama_log_callback_wingman, &ctx_server);
+	llama_event_set(llama_event_callback_wingman, &ctx_server);
 	shutdownInference = [&]() {
 		keepRunning = false;
 		shutdown_handler(0);
@@ -3305,6 +4828,8 @@ int run_inference(int argc, char **argv,
 	}
 
 	// load the model
+	ctx_server.lookup = sparams.lookup;
+	ctx_server.slot_prompt_similarity = sparams.slot_prompt_similarity;
 	if (!ctx_server.load_model(params)) {
 		state.store(SERVER_STATE_ERROR);
 #ifdef WINGMAN_LIB
@@ -3316,6 +4841,14 @@ int run_inference(int argc, char **argv,
 #endif
 	} else {
 		ctx_server.init();
+
+		if (!sparams.kv_disk_cache_path.empty() &&
+			!ctx_server.kv_disk_cache.init(sparams.kv_disk_cache_path, sparams.kv_disk_cache_size * 1024 * 1024, ctx_server.params.n_parallel + 1)) {
+			LOG_WARNING("KV disk cache disabled", {
+				{"path", sparams.kv_disk_cache_path}
+			});
+		}
+
 		state.store(SERVER_STATE_READY);
 	}
 
@@ -3520,6 +5053,7 @@ int run_inference(int argc, char **argv,
 
 		const uint64_t n_tokens_predicted = data["n_tokens_predicted"];
 		const uint64_t t_tokens_generation = data["t_tokens_generation"];
+		const double t_sampling = data["t_sampling"];
 
 		const int32_t kv_cache_used_cells = data["kv_cache_used_cells"];
 
@@ -3541,6 +5075,26 @@ int run_inference(int argc, char **argv,
 					{"name",  "tokens_predicted_seconds_total"},
 					{"help",  "Predict process time"},
 					{"value",  (uint64_t)data["t_tokens_generation_total"] / 1.e3}
+			}, {
+					{"name",  "sampling_seconds_total"},
+					{"help",  "Time spent sampling the predicted tokens, summed over slots."},
+					{"value",  (double)data["t_sampling_total"] / 1.e3}
+			}, {
+					{"name",  "draft_tokens_total"},
+					{"help",  "Number of tokens drafted for speculative decoding, by the draft model or by prompt lookup."},
+					{"value",  (uint64_t)data["n_drafted_total"]}
+			}, {
+					{"name",  "draft_tokens_accepted_total"},
+					{"help",  "Number of drafted tokens the model sampled as well."},
+					{"value",  (uint64_t)data["n_draft_accepted_total"]}
+			}, {
+					{"name",  "grammar_cache_hits_total"},
+					{"help",  "Number of requests whose grammar or JSON schema was already parsed."},
+					{"value",  (uint64_t)data["grammar_cache_hits"]}
+			}, {
+					{"name",  "grammar_cache_misses_total"},
+					{"help",  "Number of requests whose grammar or JSON schema had to be parsed."},
+					{"value",  (uint64_t)data["grammar_cache_misses"]}
 			}}},
 			{"gauge", {{
 					{"name",  "prompt_tokens_seconds"},
@@ -3550,6 +5104,10 @@ int run_inference(int argc, char **argv,
 					{"name",  "predicted_tokens_seconds"},
 					{"help",  "Average generation throughput in tokens/s."},
 					{"value",  n_tokens_predicted ? 1.e3 / t_tokens_generation * n_tokens_predicted : 0.}
+			},{
+					{"name",  "sampling_seconds_per_token"},
+					{"help",  "Average sampling time per predicted token in seconds."},
+					{"value",  n_tokens_predicted ? t_sampling / 1.e3 / n_tokens_predicted : 0.}
 			},{
 					{"name",  "kv_cache_usage_ratio"},
 					{"help",  "KV-cache usage. 1 means 100 percent usage."},
@@ -3558,6 +5116,10 @@ int run_inference(int argc, char **argv,
 					{"name",  "kv_cache_tokens"},
 					{"help",  "KV-cache tokens."},
 					{"value",  (uint64_t)data["kv_cache_tokens_count"]}
+			},{
+					{"name",  "grammar_cache_entries"},
+					{"help",  "Number of parsed grammars in the cache."},
+					{"value",  (uint64_t)data["grammar_cache_size"]}
 			},{
 					{"name",  "requests_processing"},
 					{"help",  "Number of request processing."},
@@ -4148,6 +5710,10 @@ int run_inference(int argc, char **argv,
 #endif
 	t.join();
 
+#ifdef WINGMAN_LIB
+	// ctx_server goes out of scope below
+	llama_event_set(nullptr, nullptr);
+#endif
 	llama_backend_free();
 
 #ifdef WINGMAN_LIB